@@ -0,0 +1,468 @@
+#!/usr/bin/env python3
+#
+# mockctrl.py -- stand-in controller and traffic generator for the EmPOWER
+# data-plane benchmark (see empower-bench)
+#
+# Copyright (c) 2017 CREATE-NET
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, subject to the conditions
+# listed in the Click LICENSE file. These conditions include: you must
+# preserve this copyright notice, and you cannot mention the copyright
+# holders in advertising related to the Software without their permission.
+# The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+# notice is a summary of the Click LICENSE file; the license in that file is
+# legally binding.
+
+"""Stand-in EmPOWER controller and traffic generator.
+
+  mockctrl.py traffic DIR --lvaps N [--packets P] [--size S]
+      write down.pcap (Ethernet to the stations), down80211.pcap (802.11
+      from the LVAPs) and up80211.pcap (802.11 from the stations) to DIR
+
+  mockctrl.py serve --port PORT --lvaps N [--radios R] [--epoch E] [--storm R]
+      accept one WTP, send SET_PORT/ADD_LVAP for N stations spread over R
+      interfaces and SET_SLICE for an EF slice on each, then ADD_VAP for
+      the "bench-ready" SSID as a marker. With --epoch, first answer the
+      WTP's hello with controller epoch E, and skip all of the above if
+      the hello says the WTP already holds the state of epoch E. With
+      --storm, then send R rounds of AUTH_RESPONSE and ASSOC_RESPONSE for
+      every station
+
+  mockctrl.py report --lvaps N RESULTS DIR
+      turn the "bench" lines printed by bench.click and the latency dumps
+      in DIR into one table row per element
+
+  mockctrl.py report-radio --lvaps N --size S RESULTS
+      turn the medium and station counters printed by radio.click into
+      one table row
+
+  mockctrl.py report-threads --lvaps N RESULTS
+      turn the "threads" line printed by threads.click into one table row
+
+  mockctrl.py report-restart --lvaps N RESULTS
+      turn the "restart" line and snapshot status printed by restart.click
+      into one table row
+
+  mockctrl.py report-storm --lvaps N RESULTS
+      turn the "storm" line printed by storm.click into one table row
+"""
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import threading
+
+SSID = b"bench"
+READY_SSID = b"bench-ready"
+WIRED = bytes.fromhex("0200000fff01")
+IFACE_ID = 0
+
+# protocol types, see empowerpacket.hh
+PT_HELLO_REQUEST = 0x01
+PT_HELLO_RESPONSE = 0x02
+PT_AUTH_RESPONSE = 0x08
+PT_ASSOC_RESPONSE = 0x0A
+PT_ADD_LVAP = 0x0B
+PT_ADD_LVAP_RESPONSE = 0x0C
+PT_ADD_VAP = 0x11
+PT_SET_PORT = 0x15
+PT_SET_SLICE = 0x19
+
+LVAP_AUTHENTICATED = 1 << 0
+LVAP_ASSOCIATED = 1 << 1
+LVAP_SET_MASK = 1 << 2
+
+MCS = [2, 4, 11, 22, 12, 18, 24, 36, 48, 72, 96, 108]
+HT_MCS = list(range(16))
+
+HEADER = struct.Struct("!BBIII6s")
+
+
+def sta_addr(i):
+    return bytes([0x02, 0x00, 0x00, 0x00, i >> 8, i & 0xff])
+
+
+def bssid_addr(i):
+    return bytes([0x02, 0x00, 0x00, 0x01, i >> 8, i & 0xff])
+
+
+def ssid_field(ssid):
+    return ssid.ljust(33, b"\0")
+
+
+def message(ptype, body, seq):
+    return HEADER.pack(0, ptype, HEADER.size + len(body), seq, 0, bytes(6)) + body
+
+
+def set_port(i, iface=IFACE_ID):
+    body = struct.pack("!IB6sHHBBBB", iface, 0, sta_addr(i), 2436, 3839,
+                       0, 0, len(MCS), len(HT_MCS))
+    return body + bytes(MCS) + bytes(HT_MCS)
+
+
+def add_lvap(i, iface=IFACE_ID):
+    flags = LVAP_AUTHENTICATED | LVAP_ASSOCIATED | LVAP_SET_MASK
+    body = struct.pack("!IBHH6s6s6s", iface, flags, i + 1, 0,
+                       sta_addr(i), bytes(6), bssid_addr(i))
+    body += ssid_field(SSID)
+    return body + bssid_addr(i) + ssid_field(SSID)
+
+
+def set_slice(dscp, quantum, iface=IFACE_ID):
+    return struct.pack("!IBBBI", iface, dscp, 1, 0, quantum) + ssid_field(SSID)
+
+
+def add_vap(bssid, ssid):
+    return struct.pack("!I6s", IFACE_ID, bssid) + ssid_field(ssid)
+
+
+class Wtp(object):
+
+    def __init__(self, conn):
+        self.conn = conn
+        self.buf = b""
+        self.seq = 0
+
+    def send(self, ptype, body):
+        self.seq += 1
+        return message(ptype, body, self.seq)
+
+    def recv(self):
+        while True:
+            if len(self.buf) >= HEADER.size:
+                length = HEADER.unpack_from(self.buf)[2]
+                if len(self.buf) >= length:
+                    msg, self.buf = self.buf[:length], self.buf[length:]
+                    return msg
+            data = self.conn.recv(65536)
+            if not data:
+                return None
+            self.buf += data
+
+    def wait_hello(self):
+        while True:
+            msg = self.recv()
+            if msg is None:
+                raise IOError("WTP closed the connection")
+            if msg[1] == PT_HELLO_REQUEST:
+                return msg
+
+    def hello_response(self, hello, epoch):
+        period = struct.unpack_from("!I", hello, HEADER.size)[0]
+        return self.send(PT_HELLO_RESPONSE, struct.pack("!II", period, epoch))
+
+    def wait_add_lvap_responses(self, count):
+        while count > 0:
+            msg = self.recv()
+            if msg is None:
+                raise IOError("WTP closed the connection")
+            if msg[1] == PT_ADD_LVAP_RESPONSE:
+                count -= 1
+
+
+def serve(args):
+    srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind(("127.0.0.1", args.port))
+    srv.listen(1)
+    srv.settimeout(args.timeout)
+    conn, _ = srv.accept()
+    conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    conn.settimeout(args.timeout)
+    wtp = Wtp(conn)
+
+    if args.epoch:
+        # a WTP that kept the state of this epoch across a restart only
+        # needs the hello response to confirm it
+        hello = wtp.wait_hello()
+        conn.sendall(wtp.hello_response(hello, args.epoch))
+        if len(hello) >= HEADER.size + 8 and \
+                struct.unpack_from("!I", hello, HEADER.size + 4)[0] == args.epoch:
+            answer_hellos(wtp, args.epoch)
+            return
+
+    # the WTP reads at most one socket buffer per push, never split a message
+    batch, pending = b"", 0
+    for i in range(args.lvaps):
+        batch += wtp.send(PT_SET_PORT, set_port(i, i % args.radios))
+        batch += wtp.send(PT_ADD_LVAP, add_lvap(i, i % args.radios))
+        pending += 1
+        if len(batch) > 16384 or i == args.lvaps - 1:
+            conn.sendall(batch)
+            wtp.wait_add_lvap_responses(pending)
+            batch, pending = b"", 0
+
+    for iface in range(args.radios):
+        conn.sendall(wtp.send(PT_SET_SLICE, set_slice(46, 6000, iface)))
+    conn.sendall(wtp.send(PT_ADD_VAP, add_vap(bssid_addr(0xffff), READY_SSID)))
+
+    if args.storm:
+        storm(wtp, args.lvaps, args.storm)
+        return
+
+    answer_hellos(wtp, args.epoch)
+
+
+def storm(wtp, lvaps, rounds):
+    # build the whole burst up front so that the WTP, not this script, sets
+    # the pace. Every response makes the WTP send an LVAP status back: drain
+    # those on another thread so that neither side blocks on a full socket
+    # buffer
+    burst = []
+    for r in range(rounds):
+        for i in range(lvaps):
+            burst.append(wtp.send(PT_AUTH_RESPONSE, sta_addr(i)))
+            burst.append(wtp.send(PT_ASSOC_RESPONSE, sta_addr(i)))
+    burst = b"".join(burst)
+    drain = threading.Thread(target=discard, args=(wtp.conn,))
+    drain.start()
+    wtp.conn.sendall(burst)
+    drain.join()
+
+
+def discard(conn):
+    while conn.recv(1 << 20):
+        pass
+
+
+def answer_hellos(wtp, epoch):
+    # keep draining hellos until the WTP goes away, answering them if the
+    # controller has an epoch
+    while True:
+        msg = wtp.recv()
+        if msg is None:
+            return
+        if epoch and msg[1] == PT_HELLO_REQUEST:
+            wtp.conn.sendall(wtp.hello_response(msg, epoch))
+
+
+class PcapWriter(object):
+
+    def __init__(self, path, linktype):
+        self.f = open(path, "wb")
+        self.f.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, linktype))
+
+    def write(self, frame):
+        self.f.write(struct.pack("<IIII", 0, 0, len(frame), len(frame)))
+        self.f.write(frame)
+
+    def close(self):
+        self.f.close()
+
+
+def checksum(data):
+    s = sum(struct.unpack("!%dH" % (len(data) // 2), data))
+    s = (s >> 16) + (s & 0xffff)
+    s += s >> 16
+    return ~s & 0xffff
+
+
+def ip_udp(i, n, size):
+    # every fourth packet is EF (DSCP 46) to exercise a second slice
+    tos = 0xb8 if n % 4 == 3 else 0
+    payload = bytes(max(size - 28, 0))
+    udp = struct.pack("!HHHH", 1024, 5001, 8 + len(payload), 0) + payload
+    ip = struct.pack("!BBHHHBBH4s4s", 0x45, tos, 20 + len(udp), n & 0xffff, 0,
+                     64, 17, 0, bytes([10, 0, 0, 1]),
+                     bytes([10, 1, i >> 8, i & 0xff]))
+    ip = ip[:10] + struct.pack("!H", checksum(ip)) + ip[12:]
+    return ip + udp
+
+
+LLC_IP = bytes([0xaa, 0xaa, 0x03, 0, 0, 0, 0x08, 0x00])
+
+
+def traffic(args):
+    down = PcapWriter(os.path.join(args.dir, "down.pcap"), 1)
+    down80211 = PcapWriter(os.path.join(args.dir, "down80211.pcap"), 105)
+    up80211 = PcapWriter(os.path.join(args.dir, "up80211.pcap"), 105)
+    for n in range(args.packets):
+        i = n % args.lvaps
+        ip = ip_udp(i, n, args.size)
+        sta, bssid = sta_addr(i), bssid_addr(i)
+        down.write(sta + WIRED + b"\x08\x00" + ip)
+        # data, from ds: addr1 sta, addr2 bssid, addr3 source
+        down80211.write(b"\x08\x02\x00\x00" + sta + bssid + WIRED + b"\x00\x00" + LLC_IP + ip)
+        # data, to ds: addr1 bssid, addr2 sta, addr3 destination
+        up80211.write(b"\x08\x01\x00\x00" + bssid + sta + WIRED + b"\x00\x00" + LLC_IP + ip)
+    down.close()
+    down80211.close()
+    up80211.close()
+
+
+def read_deltas(path):
+    """Packet timestamps in a ToDump file, in microseconds."""
+    deltas = []
+    with open(path, "rb") as f:
+        hdr = f.read(24)
+        if len(hdr) < 24:
+            return deltas
+        magic = struct.unpack("<I", hdr[:4])[0]
+        endian = "<" if magic in (0xa1b2c3d4, 0xa1b23c4d) else ">"
+        nsec = struct.unpack(endian + "I", hdr[:4])[0] == 0xa1b23c4d
+        rec = struct.Struct(endian + "IIII")
+        while True:
+            r = f.read(rec.size)
+            if len(r) < rec.size:
+                break
+            sec, frac, caplen, _ = rec.unpack(r)
+            f.seek(caplen, 1)
+            deltas.append(sec * 1e6 + (frac / 1e3 if nsec else frac))
+    return deltas
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    k = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[k]
+
+
+def report(args):
+    rates = {}
+    with open(args.results) as f:
+        for line in f:
+            words = line.split()
+            if len(words) == 4 and words[0] == "bench":
+                rates[words[1]] = (int(words[2]), float(words[3]))
+    base = rates.get("base", (0, 0.0))[1]
+    base_ns = 1e9 / base if base else 0.0
+    for name in ("eqm", "minstrel", "rxstats", "rxewma", "rxwsma",
+                 "rxkalman", "wifidecap", "upsplit", "upfused"):
+        if name not in rates:
+            continue
+        count, rate = rates[name]
+        ns = (1e9 / rate - base_ns) if rate else 0.0
+        lat = sorted(read_deltas(os.path.join(args.dir, "lat-%s.pcap" % name)))
+        print("%6d %-10s %8d %12.0f %10.1f %9.1f %9.1f %9.1f" % (
+            args.lvaps, name, count, rate, ns,
+            percentile(lat, 50), percentile(lat, 99), percentile(lat, 99.9)))
+
+
+def report_radio(args):
+    busy, frames, attempts, successes = 0, 0, 0, []
+    with open(args.results) as f:
+        for line in f:
+            words = line.split()
+            if len(words) >= 3 and words[0] == "radio" and words[1] == "busy":
+                busy = int(words[2])
+            elif len(words) == 11 and words[1] == "snr":
+                frames += int(words[4])
+                attempts += int(words[6])
+                successes.append(int(words[8]))
+    delivered = sum(successes)
+    # Jain's fairness index over the frames each station received
+    squares = sum(s * s for s in successes)
+    jain = delivered * delivered / (len(successes) * squares) if squares else 0.0
+    goodput = delivered * args.size * 8 / busy if busy else 0.0
+    print("%6d %8d %8d %10.2f %10.1f %8.3f" % (
+        args.lvaps, frames, delivered,
+        attempts / frames if frames else 0.0, goodput, jain))
+
+
+def report_threads(args):
+    with open(args.results) as f:
+        for line in f:
+            words = line.split()
+            if len(words) == 6 and words[0] == "threads":
+                radios, mode, count, secs = words[1], words[2], int(words[4]), float(words[5])
+                print("%6d %6s %-8s %8d %12.0f %8s" % (
+                    args.lvaps, radios, mode, count, count / secs if secs else 0.0,
+                    words[3]))
+
+
+def report_restart(args):
+    restart, restored, load_usec = None, "0", "0"
+    with open(args.results) as f:
+        for line in f:
+            words = line.split()
+            if len(words) == 4 and words[0] == "restart":
+                restart = words
+            elif len(words) == 11 and words[0] == "restored":
+                restored = words[1]
+            elif len(words) == 2 and words[0] == "load_usec":
+                load_usec = words[1]
+    if restart:
+        print("%6d %-6s %-10s %8s %10s %10.1f" % (
+            args.lvaps, restart[1], restart[2], restored, load_usec,
+            float(restart[3]) * 1000))
+
+
+def report_storm(args):
+    with open(args.results) as f:
+        for line in f:
+            words = line.split()
+            if len(words) == 4 and words[0] == "storm":
+                auths, assocs, rate = int(words[1]), int(words[2]), float(words[3])
+                print("%6d %8d %8d %12.0f %10.2f" % (
+                    args.lvaps, auths, assocs, rate, 1e6 / rate if rate else 0.0))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd")
+
+    p = sub.add_parser("traffic")
+    p.add_argument("dir")
+    p.add_argument("--lvaps", type=int, required=True)
+    p.add_argument("--packets", type=int, default=200000)
+    p.add_argument("--size", type=int, default=512)
+
+    p = sub.add_parser("serve")
+    p.add_argument("--port", type=int, required=True)
+    p.add_argument("--lvaps", type=int, required=True)
+    p.add_argument("--radios", type=int, default=1)
+    p.add_argument("--epoch", type=int, default=0)
+    p.add_argument("--storm", type=int, default=0)
+    p.add_argument("--timeout", type=float, default=30)
+
+    p = sub.add_parser("report")
+    p.add_argument("results")
+    p.add_argument("dir")
+    p.add_argument("--lvaps", type=int, required=True)
+
+    p = sub.add_parser("report-radio")
+    p.add_argument("results")
+    p.add_argument("--lvaps", type=int, required=True)
+    p.add_argument("--size", type=int, default=512)
+
+    p = sub.add_parser("report-threads")
+    p.add_argument("results")
+    p.add_argument("--lvaps", type=int, required=True)
+
+    p = sub.add_parser("report-restart")
+    p.add_argument("results")
+    p.add_argument("--lvaps", type=int, required=True)
+
+    p = sub.add_parser("report-storm")
+    p.add_argument("results")
+    p.add_argument("--lvaps", type=int, required=True)
+
+    args = parser.parse_args()
+    if args.cmd == "traffic":
+        traffic(args)
+    elif args.cmd == "serve":
+        serve(args)
+    elif args.cmd == "report":
+        report(args)
+    elif args.cmd == "report-radio":
+        report_radio(args)
+    elif args.cmd == "report-threads":
+        report_threads(args)
+    elif args.cmd == "report-restart":
+        report_restart(args)
+    elif args.cmd == "report-storm":
+        report_storm(args)
+    else:
+        parser.print_help()
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,21 +1,42 @@
 #ifndef CLICK_EMPOWER_DSTINFO_HH
 #define CLICK_EMPOWER_DSTINFO_HH
+#include <click/atomic.hh>
 #include <click/straccum.hh>
+#include <click/sync.hh>
 #include <click/etheraddress.hh>
 #include <click/hashcode.hh>
 #include <click/timer.hh>
 #include <click/vector.hh>
+#include <clicknet/wifi.h>
 #include "frame.hh"
 #include "sma.hh"
+#include "rssiestimator.hh"
 CLICK_DECLS
 
+/*
+ * RSSI samples go into one of two windows. The data path only ever adds
+ * to the active window; the housekeeping task of EmpowerRXStats flips the
+ * windows, drains the retired one with drain() and publishes the result
+ * with update(). A sample registers as a writer of the window it adds to
+ * and drain() waits for the writers of the retired window, so a sample
+ * is never split across two periods. The per frame RSSI estimators and
+ * the sequence number of the last frame are only written when enabled,
+ * under a per neighbor spinlock.
+ */
 class DstInfo {
 public:
+	struct Window {
+		atomic_uint32_t writers;
+		atomic_uint32_t packets;
+		atomic_uint32_t accum_rssi;
+		atomic_uint32_t squares_rssi;
+	};
 	EtherAddress _eth;
     int _sender_type;
-	int _accum_rssi;
-	int _squares_rssi;
-	int _packets;
+	Window _windows[2];
+	atomic_uint32_t _active;
+	// serializes the estimators and the duplicate check of this neighbor
+	mutable SimpleSpinlock _lock;
 	int _last_rssi;
 	int _last_std;
 	int _last_packets;
@@ -23,54 +44,175 @@ public:
 	unsigned _silent_window_count;
 	int _hist_packets;
 	int _iface_id;
-	Timestamp _last_received;
+	atomic_uint32_t _last_received;	// jiffies
+	// computed by drain() outside of the write lock, published by update()
+	bool _drained;
+	int _next_rssi;
+	int _next_std;
+	int _next_packets;
+	// per frame estimators, only those in use are updated
+	EwmaEstimator _ewma_rssi;
+	WsmaEstimator _wsma_rssi;
+	KalmanEstimator _kalman_rssi;
+	// sequence control of the last frame, only written by the data path
+	bool _seq_valid;
+	uint16_t _seq;
+	uint8_t _frag;
+	uint32_t _dupes;
 
 	DstInfo() {
 		_eth = EtherAddress();
 		_sender_type = 0;
 		_sma_rssi = 0;
-		_accum_rssi = 0;
-		_squares_rssi = 0;
+		for (int i = 0; i < 2; i++) {
+			_windows[i].writers = 0;
+			_windows[i].packets = 0;
+			_windows[i].accum_rssi = 0;
+			_windows[i].squares_rssi = 0;
+		}
+		_active = 0;
+		_last_received = click_jiffies();
 		_silent_window_count = 0;
-		_packets = 0;
 		_last_rssi = 0;
 		_last_std= 0;
 		_last_packets= 0;
 		_hist_packets = 0;
 		_iface_id = -1;
+		_drained = false;
+		_next_rssi = 0;
+		_next_std = 0;
+		_next_packets = 0;
+		_seq_valid = false;
+		_seq = 0;
+		_frag = 0;
+		_dupes = 0;
 	}
 
 	~DstInfo() {
 		delete _sma_rssi;
 	}
 
+	void drain() {
+		uint32_t retired = _active;
+		_active = retired ^ 1;
+		click_fence();
+		Window &w = _windows[retired];
+		while (w.writers)
+			click_relax_fence();
+		uint32_t packets = w.packets.swap(0);
+		uint32_t accum_rssi = w.accum_rssi.swap(0);
+		uint32_t squares_rssi = w.squares_rssi.swap(0);
+		_next_packets = packets;
+		_next_rssi = (packets > 0) ? accum_rssi / (double) packets : 0;
+		_next_std = (packets > 0) ? sqrt( (squares_rssi / (double) packets) - (_next_rssi * _next_rssi) ) : 0;
+		_drained = true;
+	}
+
 	void update() {
-		_hist_packets += _packets;
-		_last_rssi = (_packets > 0) ? _accum_rssi / (double) _packets : 0;
-		_last_std = (_packets > 0) ? sqrt( (_squares_rssi / (double) _packets) - (_last_rssi * _last_rssi) ) : 0;
-		_last_packets = _packets;
-		if (_packets == 0) {
+		// added after the last drain, nothing to publish yet
+		if (!_drained) {
+			return;
+		}
+		_hist_packets += _next_packets;
+		_last_rssi = _next_rssi;
+		_last_std = _next_std;
+		_last_packets = _next_packets;
+		if (_next_packets == 0) {
 			_silent_window_count++;
 		} else {
 			_silent_window_count = 0;
 			_sma_rssi->add(_last_rssi);
 		}
-		_packets = 0;
-		_accum_rssi = 0;
-		_squares_rssi = 0;
+		_drained = false;
+	}
+
+	// false, and nothing is accounted, if w is given and is a duplicate
+	bool add_sample(uint8_t rssi, const RssiEstimators &estimators, const struct click_wifi *w = 0) {
+		if (w || estimators.mask) {
+			_lock.acquire();
+			if (w && check_duplicate(w)) {
+				_lock.release();
+				return false;
+			}
+			if (estimators.mask & (1 << EMPOWER_RSSI_EWMA))
+				_ewma_rssi.add(rssi, estimators.alpha);
+			if (estimators.mask & (1 << EMPOWER_RSSI_WSMA))
+				_wsma_rssi.add(rssi, estimators.window);
+			if (estimators.mask & (1 << EMPOWER_RSSI_KALMAN))
+				_kalman_rssi.add(rssi, estimators.q, estimators.r);
+			_lock.release();
+		}
+		// register as a writer of the active window, and retry if drain()
+		// retired it in the meantime
+		Window *win;
+		while (1) {
+			uint32_t active = _active;
+			win = &_windows[active];
+			win->writers++;
+			if (_active == active)
+				break;
+			win->writers--;
+		}
+		win->packets++;
+		win->accum_rssi += rssi;
+		win->squares_rssi += rssi * rssi;
+		win->writers--;
+		_last_received = click_jiffies();
+		return true;
+	}
+
+	bool duplicate(const struct click_wifi *w) {
+		_lock.acquire();
+		bool dupe = check_duplicate(w);
+		_lock.release();
+		return dupe;
+	}
+
+	// same test as WifiDupeFilter: a retry carrying the sequence number
+	// of the last frame, and not a later fragment of it, is a duplicate.
+	// Called with _lock held.
+	bool check_duplicate(const struct click_wifi *w) {
+		uint16_t seq = le16_to_cpu(w->i_seq) >> WIFI_SEQ_SEQ_SHIFT;
+		uint8_t frag = le16_to_cpu(w->i_seq) & WIFI_SEQ_FRAG_MASK;
+		bool is_frag = frag || (w->i_fc[1] & WIFI_FC1_MORE_FRAG);
+		if ((w->i_fc[1] & WIFI_FC1_RETRY) && _seq_valid && seq == _seq
+				&& (!is_frag || frag <= _frag)) {
+			_dupes++;
+			return true;
+		}
+		_seq_valid = true;
+		_seq = seq;
+		_frag = frag;
+		return false;
+	}
+
+	int estimate(int estimator) const {
+		int rssi;
+		_lock.acquire();
+		switch (estimator) {
+		case EMPOWER_RSSI_EWMA:
+			rssi = _ewma_rssi.estimate();
+			break;
+		case EMPOWER_RSSI_WSMA:
+			rssi = _wsma_rssi.estimate();
+			break;
+		case EMPOWER_RSSI_KALMAN:
+			rssi = _kalman_rssi.estimate();
+			break;
+		default:
+			rssi = _sma_rssi->avg();
+			break;
+		}
+		_lock.release();
+		return rssi;
 	}
 
-	void add_sample(uint8_t rssi) {
-		_packets++;
-		_accum_rssi += rssi;
-		_squares_rssi += rssi * rssi;
-		_last_received.assign_now();
+	Timestamp age() const {
+		return Timestamp::make_jiffies((click_jiffies_difference_t) (click_jiffies() - _last_received));
 	}
 
 	String unparse() {
-		Timestamp now = Timestamp::now();
 		StringAccum sa;
-		Timestamp age = now - _last_received;
 		sa << _eth.unparse();
 		sa << (_sender_type == 0 ? " STA" : " AP");
 		sa << " sma_rssi " << _sma_rssi->avg();
@@ -78,7 +220,7 @@ public:
 		sa << " last_rssi_std " << _last_std;
 		sa << " last_packets " << _last_packets;
 		sa << " hist_packets " << _hist_packets;
-		sa << " last_received " << age;
+		sa << " last_received " << age();
 		sa << " silent_window_count " << _silent_window_count;
 		sa << " iface_id " << _iface_id << "\n";
 		return sa.take_string();
@@ -151,6 +151,7 @@ void EmpowerAssociationResponder::push(int, Packet *p) {
 	uint8_t *rates_l = NULL;
 	uint8_t *rates_x = NULL;
 	uint8_t *htcaps = NULL;
+	uint8_t *wmm_info = NULL;
 
 	while (ptr < end) {
 		switch (*ptr) {
@@ -166,6 +167,14 @@ void EmpowerAssociationResponder::push(int, Packet *p) {
 		case WIFI_ELEMID_HTCAPS:
 			htcaps = ptr;
 			break;
+		case WIFI_ELEMID_VENDOR:
+			// WMM information element: OUI, type, subtype, version, QoS Info
+			if (ptr[1] >= 7 && ptr + 9 <= end
+					&& !memcmp(ptr + 2, WIFI_WME_OUI, WIFI_WME_OUI_LEN)
+					&& ptr[5] == WIFI_WME_TYPE && ptr[6] == WIFI_WME_INFO_SUBTYPE) {
+				wmm_info = ptr;
+			}
+			break;
 		default:
 			if (_debug) {
 				click_chatter("%{element} :: %s :: Ignored element id %u %u",
@@ -388,6 +397,30 @@ void EmpowerAssociationResponder::push(int, Packet *p) {
 		sa << " ]";
 	}
 
+	uint8_t uapsd_acs = 0;
+
+	if (wmm_info) {
+		uint8_t qos_info = wmm_info[8];
+		sa << " U-APSD {";
+		if (qos_info & WIFI_WME_QOSINFO_UAPSD_BE) {
+			uapsd_acs |= 1 << AC_BE;
+			sa << " BE";
+		}
+		if (qos_info & WIFI_WME_QOSINFO_UAPSD_BK) {
+			uapsd_acs |= 1 << AC_BK;
+			sa << " BK";
+		}
+		if (qos_info & WIFI_WME_QOSINFO_UAPSD_VI) {
+			uapsd_acs |= 1 << AC_VI;
+			sa << " VI";
+		}
+		if (qos_info & WIFI_WME_QOSINFO_UAPSD_VO) {
+			uapsd_acs |= 1 << AC_VO;
+			sa << " VO";
+		}
+		sa << " }";
+	}
+
 	if (_debug) {
 		click_chatter("%{element} :: %s :: %s",
 				      this,
@@ -401,6 +434,10 @@ void EmpowerAssociationResponder::push(int, Packet *p) {
 		return;
 	}
 
+	// these ACs are both trigger- and delivery-enabled, see
+	// EmpowerPowerSaveBuffer
+	ess->_uapsd_acs = uapsd_acs;
+
 	// always ask to the controller because we may want to reject this request
 	int band = _el->ifaces()->get(ess->_iface_id)->_band;
 	if (htcaps && (band == EMPOWER_BT_HT20)) {
@@ -419,9 +456,7 @@ void EmpowerAssociationResponder::send_association_response(EtherAddress dst) {
     EmpowerStationState *ess = _el->get_ess(dst);
 
     String ssid = ess->_ssid;
-    uint16_t status = WIFI_STATUS_SUCCESS;
     int iface_id = ess->_iface_id;
-    int channel = _el->ifaces()->get(ess->_iface_id)->_channel;
 
 	if (_debug) {
 		click_chatter("%{element} :: %s :: dst %s assoc_id %d ssid %s channel %u",
@@ -430,9 +465,92 @@ void EmpowerAssociationResponder::send_association_response(EtherAddress dst) {
 				      dst.unparse().c_str(),
 				      ess->_assoc_id,
 					  ssid.c_str(),
-					  channel);
+					  _el->ifaces()->get(iface_id)->_channel);
+	}
+
+	TransmissionPolicies * tx_table = _el->get_tx_policies(iface_id);
+	AssocTemplate *t = get_template(iface_id, tx_table->lookup(ess->_sta)->_mcs);
+
+	if (!t) {
+		return;
 	}
 
+	WritablePacket *p = Packet::make(t->_p->data(), t->_p->length());
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+				      this,
+				      __func__);
+		return;
+	}
+
+	t->_hits++;
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+
+	memcpy(w->i_addr1, dst.data(), 6);
+	memcpy(w->i_addr2, ess->_bssid.data(), 6);
+	memcpy(w->i_addr3, ess->_bssid.data(), 6);
+
+	/* cap_info and status come first */
+	uint8_t *ptr = (uint8_t *) p->data() + sizeof(struct click_wifi) + 2 + 2;
+	*(uint16_t *) ptr = cpu_to_le16(0xc000 | ess->_assoc_id);
+
+	_el->send_status_lvap(dst);
+	SET_PAINT_ANNO(p, iface_id);
+	output(0).push(p);
+
+}
+
+AssocTemplate *EmpowerAssociationResponder::get_template(int iface_id, const Vector<int> &rates) {
+
+	AssocTemplate *t = _templates.get_pointer(AssocKey(iface_id, &rates));
+	ResourceElement *elm = _el->ifaces()->get(iface_id);
+
+	if (t && t->_channel == elm->_channel && t->_band == elm->_band) {
+		return t;
+	}
+
+	// first response for these rates, or the interface changed
+	Packet *p = make_template(iface_id, rates);
+
+	if (!p) {
+		return 0;
+	}
+
+	if (t) {
+		t->_p->kill();
+	} else {
+		// the stored key refers to a copy of the rates, made only here
+		Vector<int> *copy = new Vector<int>(rates);
+		AssocKey key = AssocKey(iface_id, copy);
+		_templates.set(key, AssocTemplate());
+		t = _templates.get_pointer(key);
+		t->_rates = copy;
+	}
+
+	t->_p = p;
+	t->_channel = elm->_channel;
+	t->_band = elm->_band;
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: iface_id %d channel %d band %d rates %d",
+				      this,
+				      __func__,
+				      iface_id,
+				      t->_channel,
+				      t->_band,
+				      rates.size());
+	}
+
+	return t;
+
+}
+
+Packet *EmpowerAssociationResponder::make_template(int iface_id, const Vector<int> &rates) {
+
+    uint16_t status = WIFI_STATUS_SUCCESS;
+
 	int max_len = sizeof(struct click_wifi) + 2 + /* cap_info */
 											  2 + /* status  */
 											  2 + /* assoc_id */
@@ -449,17 +567,17 @@ void EmpowerAssociationResponder::send_association_response(EtherAddress dst) {
 		click_chatter("%{element} :: %s :: cannot make packet!",
 				      this,
 				      __func__);
-		return;
+		return 0;
 	}
 
+	memset(p->data(), 0, p->length());
+
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
 	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT | WIFI_FC0_SUBTYPE_ASSOC_RESP;
 	w->i_fc[1] = WIFI_FC1_DIR_NODS;
 
-	memcpy(w->i_addr1, dst.data(), 6);
-	memcpy(w->i_addr2, ess->_bssid.data(), 6);
-	memcpy(w->i_addr3, ess->_bssid.data(), 6);
+	/* addresses are set for each response */
 
 	w->i_dur = 0;
 	w->i_seq = 0;
@@ -477,13 +595,11 @@ void EmpowerAssociationResponder::send_association_response(EtherAddress dst) {
 	ptr += 2;
 	actual_length += 2;
 
-	*(uint16_t *) ptr = cpu_to_le16(0xc000 | ess->_assoc_id);
+	/* assoc_id is set for each response */
 	ptr += 2;
 	actual_length += 2;
 
 	/* rates */
-	TransmissionPolicies * tx_table = _el->get_tx_policies(iface_id);
-	Vector<int> rates = tx_table->lookup(ess->_sta)->_mcs;
 	ptr[0] = WIFI_ELEMID_RATES;
 	ptr[1] = WIFI_MIN(WIFI_RATE_SIZE, rates.size());
 	for (int x = 0; x < WIFI_MIN(WIFI_RATE_SIZE, rates.size()); x++) {
@@ -513,6 +629,7 @@ void EmpowerAssociationResponder::send_association_response(EtherAddress dst) {
 
 	/* 802.11n fields */
 	ResourceElement *elm = _el->ifaces()->get(iface_id);
+	int channel = elm->_channel;
 	if (elm->_band == EMPOWER_BT_HT20) {
 
 		/* ht capabilities */
@@ -593,14 +710,22 @@ void EmpowerAssociationResponder::send_association_response(EtherAddress dst) {
 	}
 
 	p->take(max_len - actual_length);
-	_el->send_status_lvap(dst);
-	SET_PAINT_ANNO(p, iface_id);
-	output(0).push(p);
 
+	return p;
+
+}
+
+void EmpowerAssociationResponder::cleanup(CleanupStage) {
+	for (ATIter it = _templates.begin(); it.live(); it++) {
+		it.value()._p->kill();
+		delete it.value()._rates;
+	}
+	_templates.clear();
 }
 
 enum {
-	H_DEBUG
+	H_DEBUG,
+	H_TEMPLATES,
 };
 
 String EmpowerAssociationResponder::read_handler(Element *e, void *thunk) {
@@ -608,6 +733,21 @@ String EmpowerAssociationResponder::read_handler(Element *e, void *thunk) {
 	switch ((uintptr_t) thunk) {
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
+	case H_TEMPLATES: {
+		StringAccum sa;
+		for (ATIter it = td->_templates.begin(); it.live(); it++) {
+			AssocTemplate &t = it.value();
+			sa << "iface_id " << it.key()._iface_id
+			   << " channel " << t._channel
+			   << " band " << t._band
+			   << " rates";
+			for (int i = 0; i < t._rates->size(); i++) {
+				sa << " " << (*t._rates)[i];
+			}
+			sa << " hits " << t._hits << "\n";
+		}
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -633,6 +773,7 @@ int EmpowerAssociationResponder::write_handler(const String &in_s, Element *e,
 
 void EmpowerAssociationResponder::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
+	add_read_handler("templates", read_handler, (void *) H_TEMPLATES);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
@@ -3,6 +3,8 @@
 #define CLICK_EMPOWERASSOCIATIONRESPONDER_HH
 #include <click/element.hh>
 #include <click/config.h>
+#include <click/hashtable.hh>
+#include <click/vector.hh>
 CLICK_DECLS
 
 /*
@@ -16,6 +18,12 @@ Respond to 802.11 association requests.
 
 =d
 
+Association responses only differ in the station address, the BSSID and
+the association id, so they are copied from templates built once per
+interface and set of rates. A template is rebuilt when the TX policy of
+the station has other rates, or the channel or band of the interface
+changed since it was built.
+
 Keyword arguments are:
 
 =over 8
@@ -31,9 +39,65 @@ Turn debug on/off
 
 =back 8
 
+=h templates read-only
+
+Response templates, with their interface, channel, band, rates and the
+responses copied from each.
+
 =a EmpowerLVAPManager
 */
 
+// Association response templates are keyed by the interface and the
+// rates of the TX policy. A lookup key refers to the caller's rates, a
+// stored key to a copy owned by its template.
+class AssocKey {
+public:
+
+	int _iface_id;
+	const Vector<int> *_rates;
+
+	AssocKey() : _iface_id(0), _rates(0) {
+	}
+
+	AssocKey(int iface_id, const Vector<int> *rates) : _iface_id(iface_id), _rates(rates) {
+	}
+
+	inline hashcode_t hashcode() const {
+		hashcode_t hash = _iface_id;
+		for (int i = 0; i < _rates->size(); i++) {
+			hash = hash * 31 + (*_rates)[i];
+		}
+		return hash;
+	}
+
+	inline bool operator==(const AssocKey &other) const {
+		if (other._iface_id != _iface_id || other._rates->size() != _rates->size()) {
+			return false;
+		}
+		for (int i = 0; i < _rates->size(); i++) {
+			if ((*other._rates)[i] != (*_rates)[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+};
+
+class AssocTemplate {
+public:
+	Packet *_p;
+	Vector<int> *_rates;	// the rates the key of this template refers to
+	int _channel;
+	int _band;
+	uint32_t _hits;
+	AssocTemplate() : _p(0), _rates(0), _channel(0), _band(0), _hits(0) {
+	}
+};
+
+typedef HashTable<AssocKey, AssocTemplate> AssocTemplates;
+typedef AssocTemplates::iterator ATIter;
+
 class EmpowerAssociationResponder: public Element {
 public:
 
@@ -45,6 +109,7 @@ public:
 	const char *processing() const { return PUSH; }
 
 	int configure(Vector<String> &, ErrorHandler *);
+	void cleanup(CleanupStage);
 	void add_handlers();
 	void send_association_response(EtherAddress);
 	void push(int, Packet *);
@@ -55,6 +120,11 @@ private:
 
 	bool _debug;
 
+	AssocTemplates _templates;
+
+	AssocTemplate *get_template(int, const Vector<int> &);
+	Packet *make_template(int, const Vector<int> &);
+
 	// Read/Write handlers
 	static String read_handler(Element *e, void *user_data);
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
@@ -26,22 +26,40 @@
 #include "minstrel.hh"
 #include "empowerpacket.hh"
 #include "empowerlvapmanager.hh"
+#include "empowerpowersavebuffer.hh"
 CLICK_DECLS
 
 EmpowerBeaconSource::EmpowerBeaconSource() :
-		_el(0), _period(500), _timer(this), _debug(false) {
+		_el(0), _period(500), _timer(this), _local_probes(true), _probe_window(1000),
+		_probes_local(0), _probes_forwarded(0), _probes_suppressed(0), _debug(false) {
 }
 
 EmpowerBeaconSource::~EmpowerBeaconSource() {
+	for (PTIter it = _templates.begin(); it.live(); it++) {
+		it.value()._p->kill();
+	}
+	_templates.clear();
 }
 
 int EmpowerBeaconSource::configure(Vector<String> &conf, ErrorHandler *errh) {
 
+	unsigned int probe_rate = 100;
+
 	int ret = Args(conf, this, errh)
               .read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
 			  .read("PERIOD", _period)
+			  .read("LOCAL_PROBES", _local_probes)
+			  .read("PROBE_WINDOW", _probe_window)
+			  .read("PROBE_RATE", probe_rate)
 			  .read("DEBUG", _debug).complete();
 
+	if (probe_rate) {
+		_probe_bucket.assign(probe_rate, probe_rate);
+	} else {
+		_probe_bucket.assign(true);
+	}
+	_probe_bucket.set_full();
+
 	return ret;
 
 }
@@ -76,6 +94,18 @@ void EmpowerBeaconSource::run_timer(Timer *) {
 				false, false, 0, 0, 0);
 	}
 
+	// forget forwarded probe requests older than the window
+	Timestamp now = Timestamp::now();
+	Vector<ProbeKey> expired;
+	for (PRIter it = _requests.begin(); it.live(); it++) {
+		if ((now - it.value()).msecval() >= _probe_window) {
+			expired.push_back(it.key());
+		}
+	}
+	for (int i = 0; i < expired.size(); i++) {
+		_requests.erase(expired[i]);
+	}
+
 	// re-schedule the timer with some jitter
 	_timer.schedule_after_msec(_period);
 
@@ -122,6 +152,19 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 		String ssid, int channel, int iface_id, bool probe, bool csa_active,
 		int csa_mode, int csa_count, int csa_channel) {
 
+	WritablePacket *p = make_beacon(dst, bssid, ssid, channel, iface_id, probe,
+			csa_active, csa_mode, csa_count, csa_channel);
+
+	if (p) {
+		output(0).push(p);
+	}
+
+}
+
+WritablePacket *EmpowerBeaconSource::make_beacon(EtherAddress dst, EtherAddress bssid,
+		String ssid, int channel, int iface_id, bool probe, bool csa_active,
+		int csa_mode, int csa_count, int csa_channel) {
+
 	if (_debug) {
 		click_chatter("%{element} :: %s :: dst %s bssid %s ssid %s channel %u iface_id %u",
 					  this,
@@ -145,7 +188,7 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 		2 + WIFI_RATES_MAXSIZE + /* rates */
 		2 + 1 + /* ds param */
 		2 + WIFI_RATES_MAXSIZE + /* xrates */
-		2 + 4 + /* tim */
+		2 + 254 + /* tim */
 		2 + 26 + /* ht capabilities */
 		2 + 22 + /* ht information */
 		2 + 24 + /* wmm parameter element */
@@ -158,15 +201,16 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 	}
 
 	WritablePacket *p = Packet::make(max_len);
-	memset(p->data(), 0, p->length());
 
 	if (!p) {
 		click_chatter("%{element} :: %s :: cannot make packet!",
 				      this,
 				      __func__);
-		return;
+		return 0;
 	}
 
+	memset(p->data(), 0, p->length());
+
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
 	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT;
@@ -241,14 +285,21 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 
 	/* tim */
 	if (!probe) {
-		ptr[0] = WIFI_ELEMID_TIM;
-		ptr[1] = 4;
-		ptr[2] = 0; //count
-		ptr[3] = 1; //period
-		ptr[4] = 0; //bitmap control
-		ptr[5] = 0; //partial virtual bitmap
-		ptr += 2 + 4;
-		actual_length += 2 + 4;
+		EmpowerPowerSaveBuffer *epsb = _el->get_epsb(iface_id);
+		if (epsb) {
+			int tim_len = epsb->tim(bssid, ptr);
+			ptr += tim_len;
+			actual_length += tim_len;
+		} else {
+			ptr[0] = WIFI_ELEMID_TIM;
+			ptr[1] = 4;
+			ptr[2] = 0; //count
+			ptr[3] = 1; //period
+			ptr[4] = 0; //bitmap control
+			ptr[5] = 0; //partial virtual bitmap
+			ptr += 2 + 4;
+			actual_length += 2 + 4;
+		}
 	}
 
 	/* Channel switch */
@@ -364,7 +415,8 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 
 	p->take(max_len - actual_length);
 	SET_PAINT_ANNO(p, iface_id);
-	output(0).push(p);
+
+	return p;
 
 }
 
@@ -444,7 +496,47 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 		ssid = String((char *) ssid_l + 2, WIFI_MIN((int)ssid_l[1], WIFI_NWID_MAXSIZE));
 	}
 
-    StringAccum sa;
+	if (_debug) {
+		click_chatter("%{element} :: %s :: %s",
+				      this,
+				      __func__,
+				      unparse_probe_request(src, ssid, rates_l, rates_x, htcaps).c_str());
+	}
+
+	// known station asking for a network it is already served, answer locally
+	if (_local_probes && answer_locally(src, ssid, iface_id)) {
+		_probes_local++;
+		p->kill();
+		return;
+	}
+
+	// new or unknown station, forward once per window and within the rate limit
+	if (!forward_probe(src, ssid)) {
+		_probes_suppressed++;
+		p->kill();
+		return;
+	}
+
+	_probes_forwarded++;
+
+	// ask to the controller because we may want to reject this request
+	ResourceElement *el = _el->ifaces()->get(iface_id);
+	if (htcaps && (el->_band == EMPOWER_BT_HT20)) {
+		struct click_wifi_ht_caps *ht = (struct click_wifi_ht_caps *) htcaps;
+		_el->send_probe_request(el->_iface_id, src, ssid, true, ht->ht_caps_info);
+	} else {
+		_el->send_probe_request(el->_iface_id, src, ssid, false, 0);
+	}
+
+	/* probe processed */
+	p->kill();
+
+}
+
+String EmpowerBeaconSource::unparse_probe_request(EtherAddress src, String ssid,
+		uint8_t *rates_l, uint8_t *rates_x, uint8_t *htcaps) {
+
+	StringAccum sa;
 	Vector<int> rates;
 	Vector<int> ht_rates;
 
@@ -486,11 +578,9 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 		}
 	}
 
-	struct click_wifi_ht_caps *ht;
-
 	if (htcaps) {
 
-		ht = (struct click_wifi_ht_caps *) htcaps;
+		struct click_wifi_ht_caps *ht = (struct click_wifi_ht_caps *) htcaps;
 
 		sa << " HT_CAPS [";
 
@@ -624,24 +714,56 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 		sa << " ]";
 	}
 
-	/* print rates information */
-	if (_debug) {
-		click_chatter("%{element} :: %s :: %s",
-				      this,
-				      __func__,
-				      sa.take_string().c_str());
+	return sa.take_string();
+
+}
+
+bool EmpowerBeaconSource::answer_locally(EtherAddress src, String ssid, int iface_id) {
+
+	EmpowerStationState *ess = _el->lvaps()->get_pointer(src);
+
+	if (!ess || ess->_iface_id != iface_id) {
+		return false;
 	}
 
-	// always ask to the controller because we may want to reject this request
-	ResourceElement *el = _el->ifaces()->get(iface_id);
-	if (htcaps && (el->_band == EMPOWER_BT_HT20)) {
-		_el->send_probe_request(el->_iface_id, src, ssid, true, ht->ht_caps_info);
-	} else {
-		_el->send_probe_request(el->_iface_id, src, ssid, false, 0);
+	// the controller may want to add this network to the lvap
+	if (ssid != "") {
+		bool served = false;
+		for (int i = 0; i < ess->_networks.size() && !served; i++) {
+			served = (ess->_networks[i]._ssid == ssid);
+		}
+		for (VAPIter it = _el->vaps()->begin(); it.live() && !served; it++) {
+			served = (it.value()._ssid == ssid);
+		}
+		if (!served) {
+			return false;
+		}
 	}
 
-	/* probe processed */
-	p->kill();
+	send_probe_response(ess, ssid);
+
+	return true;
+
+}
+
+bool EmpowerBeaconSource::forward_probe(EtherAddress src, String ssid) {
+
+	Timestamp now = Timestamp::now();
+	ProbeKey key = ProbeKey(src, ssid);
+
+	PRIter it = _requests.find(key);
+	if (it != _requests.end() && (now - it.value()).msecval() < _probe_window) {
+		return false;
+	}
+
+	_probe_bucket.refill();
+	if (!_probe_bucket.remove_if(1)) {
+		return false;
+	}
+
+	_requests.set(key, now);
+
+	return true;
 
 }
 
@@ -651,6 +773,7 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 		click_chatter("%{element} :: %s :: invalid ess",
 				      this,
 				      __func__);
+		return;
 	}
 
 	int current_channel = _el->ifaces()->get(ess->_iface_id)->_channel;
@@ -659,15 +782,14 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 
 		// reply with all ssids
 		for (int i = 0; i < ess->_networks.size(); i++) {
-			send_beacon(ess->_sta, ess->_networks[i]._bssid, ess->_networks[i]._ssid,
-					current_channel, ess->_iface_id, true, false, 0, 0, 0);
+			send_probe_response(ess->_sta, ess->_networks[i]._bssid, ess->_networks[i]._ssid,
+					current_channel, ess->_iface_id);
 		}
 
 		// reply also with all vaps
 		for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-			send_beacon(ess->_sta, it.value()._bssid, it.value()._ssid,
-					current_channel, it.value()._iface_id, true, false, 0,
-					0, 0);
+			send_probe_response(ess->_sta, it.value()._bssid, it.value()._ssid,
+					current_channel, it.value()._iface_id);
 		}
 
 	} else {
@@ -675,8 +797,8 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 		// reply with lvap's ssid
 		for (int i = 0; i < ess->_networks.size(); i++) {
 			if (ess->_networks[i]._ssid == ssid) {
-				send_beacon(ess->_sta, ess->_networks[i]._bssid, ess->_networks[i]._ssid,
-						current_channel, ess->_iface_id, true, false, 0, 0, 0);
+				send_probe_response(ess->_sta, ess->_networks[i]._bssid, ess->_networks[i]._ssid,
+						current_channel, ess->_iface_id);
 				break;
 			}
 		}
@@ -684,9 +806,8 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 		// reply also with all vaps
 		for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
 			if (it.value()._ssid == ssid) {
-				send_beacon(ess->_sta, it.value()._bssid, it.value()._ssid,
-						current_channel, it.value()._iface_id, true, false,
-						0, 0, 0);
+				send_probe_response(ess->_sta, it.value()._bssid, it.value()._ssid,
+						current_channel, it.value()._iface_id);
 			}
 		}
 
@@ -694,8 +815,50 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 
 }
 
+void EmpowerBeaconSource::send_probe_response(EtherAddress dst, EtherAddress bssid,
+		String ssid, int channel, int iface_id) {
+
+	// templates are rebuilt at most once per beacon period
+	Timestamp now = Timestamp::now();
+	ProbeTemplate *t = _templates.get_pointer(ProbeKey(bssid, ssid));
+
+	if (!t || t->_iface_id != iface_id || t->_channel != channel || (now - t->_built).msecval() >= _period) {
+		WritablePacket *q = make_beacon(EtherAddress(), bssid, ssid, channel, iface_id, true, false, 0, 0, 0);
+		if (!q) {
+			return;
+		}
+		if (t) {
+			t->_p->kill();
+		} else {
+			_templates.set(ProbeKey(bssid, ssid), ProbeTemplate());
+			t = _templates.get_pointer(ProbeKey(bssid, ssid));
+		}
+		t->_p = q;
+		t->_iface_id = iface_id;
+		t->_channel = channel;
+		t->_built = now;
+	}
+
+	WritablePacket *p = Packet::make(t->_p->data(), t->_p->length());
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+				      this,
+				      __func__);
+		return;
+	}
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	memcpy(w->i_addr1, dst.data(), 6);
+
+	SET_PAINT_ANNO(p, iface_id);
+	output(0).push(p);
+
+}
+
 enum {
 	H_DEBUG,
+	H_PROBES,
 };
 
 String EmpowerBeaconSource::read_handler(Element *e, void *thunk) {
@@ -703,6 +866,13 @@ String EmpowerBeaconSource::read_handler(Element *e, void *thunk) {
 	switch ((uintptr_t) thunk) {
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
+	case H_PROBES: {
+		StringAccum sa;
+		sa << "local " << td->_probes_local
+		   << " forwarded " << td->_probes_forwarded
+		   << " suppressed " << td->_probes_suppressed << "\n";
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -728,6 +898,7 @@ int EmpowerBeaconSource::write_handler(const String &in_s, Element *e,
 
 void EmpowerBeaconSource::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
+	add_read_handler("probes", read_handler, (void *) H_PROBES);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
@@ -4,6 +4,7 @@
 #include <click/element.hh>
 #include <click/config.h>
 #include <click/timer.hh>
+#include <click/tokenbucket.hh>
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
 
@@ -23,6 +24,13 @@ Point (WTP). Subsequent probe request are directly handled by the WTP.
 
 =d
 
+Probe requests from stations with an LVAP on this interface, for the
+broadcast SSID or for an SSID the LVAP or a VAP already serves, are
+answered locally. Probe responses are built from per (BSSID, SSID)
+templates that are refreshed every beacon period. All other probe
+requests are forwarded to the controller, at most once per station and
+SSID every PROBE_WINDOW and at most PROBE_RATE per second overall.
+
 Keyword arguments are:
 
 =over 8
@@ -39,14 +47,66 @@ The wireless channel it is operating on.
 =item PERIOD
 How often beacon packets are sent, in milliseconds.
 
+=item LOCAL_PROBES
+Boolean. Answer probe requests from known stations locally. Default true.
+
+=item PROBE_WINDOW
+Forward at most one probe request per station and SSID in this
+interval, in milliseconds. Default 1000.
+
+=item PROBE_RATE
+Maximum number of probe requests forwarded to the controller per
+second. Default 100.
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+=h probes read-only
+Probe requests answered locally, forwarded, and suppressed.
+
 =a EmpowerLVAPManager
 */
 
+// A (BSSID or STA, SSID) tuple, used to index probe response
+// templates and forwarded probe requests.
+class ProbeKey {
+public:
+
+	EtherAddress _addr;
+	String _ssid;
+
+	ProbeKey() {
+	}
+
+	ProbeKey(EtherAddress addr, String ssid) : _addr(addr), _ssid(ssid) {
+	}
+
+	inline hashcode_t hashcode() const {
+		return CLICK_NAME(hashcode)(_addr) + CLICK_NAME(hashcode)(_ssid);
+	}
+
+	inline bool operator==(ProbeKey other) const {
+		return (other._addr == _addr && other._ssid == _ssid);
+	}
+
+};
+
+class ProbeTemplate {
+public:
+	Packet *_p;
+	int _iface_id;
+	int _channel;
+	Timestamp _built;
+};
+
+typedef HashTable<ProbeKey, ProbeTemplate> ProbeTemplates;
+typedef ProbeTemplates::iterator PTIter;
+
+typedef HashTable<ProbeKey, Timestamp> ProbeRequests;
+typedef ProbeRequests::iterator PRIter;
+
 class EmpowerBeaconSource: public Element {
 public:
 
@@ -66,6 +126,7 @@ public:
 	void send_lvap_csa_beacon(EmpowerStationState *);
 
 	void send_probe_response(EmpowerStationState *, String);
+	void send_probe_response(EtherAddress, EtherAddress, String, int, int);
 
 	void push(int, Packet *);
 
@@ -76,8 +137,24 @@ private:
 	unsigned int _period; // msecs
 	Timer _timer;
 
+	bool _local_probes;
+	unsigned int _probe_window; // msecs
+	TokenBucket _probe_bucket;
+
+	ProbeTemplates _templates;
+	ProbeRequests _requests;
+
+	uint32_t _probes_local;
+	uint32_t _probes_forwarded;
+	uint32_t _probes_suppressed;
+
 	bool _debug;
 
+	WritablePacket *make_beacon(EtherAddress, EtherAddress, String, int, int, bool, bool, int, int, int);
+	bool answer_locally(EtherAddress, String, int);
+	bool forward_probe(EtherAddress, String);
+	String unparse_probe_request(EtherAddress, String, uint8_t *, uint8_t *, uint8_t *);
+
 	// Read/Write handlers
 	static String read_handler(Element *e, void *user_data);
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
@@ -0,0 +1,119 @@
+#ifndef CLICK_EMPOWERLOCK_HH
+#define CLICK_EMPOWERLOCK_HH
+#include <click/config.h>
+#include <click/glue.hh>
+#include <click/sync.hh>
+CLICK_DECLS
+
+/*
+ * A ReadWriteLock that, when Click is configured with --enable-stats=2,
+ * counts acquisitions and the cycles spent waiting for and holding the
+ * lock. Counters are kept per CPU so that concurrent readers do not race
+ * on them. Without statistics EmpowerRWLock is a plain ReadWriteLock.
+ */
+
+#if CLICK_STATS >= 2
+
+class EmpowerRWLock : public ReadWriteLock { public:
+
+	struct Stats {
+		uint64_t reads;
+		uint64_t writes;
+		click_cycles_t wait;
+		click_cycles_t hold;
+	};
+
+	EmpowerRWLock() {
+		memset(_cpu, 0, sizeof(_cpu));
+	}
+
+	inline void acquire_read() {
+		click_cycles_t start = click_get_cycles();
+		ReadWriteLock::acquire_read();
+		acquired(start, false);
+	}
+
+	inline bool attempt_read() {
+		click_cycles_t start = click_get_cycles();
+		if (!ReadWriteLock::attempt_read())
+			return false;
+		acquired(start, false);
+		return true;
+	}
+
+	inline void release_read() {
+		released();
+		ReadWriteLock::release_read();
+	}
+
+	inline void acquire_write() {
+		click_cycles_t start = click_get_cycles();
+		ReadWriteLock::acquire_write();
+		acquired(start, true);
+	}
+
+	inline bool attempt_write() {
+		click_cycles_t start = click_get_cycles();
+		if (!ReadWriteLock::attempt_write())
+			return false;
+		acquired(start, true);
+		return true;
+	}
+
+	inline void release_write() {
+		released();
+		ReadWriteLock::release_write();
+	}
+
+	Stats stats() const {
+		Stats s;
+		memset(&s, 0, sizeof(s));
+		for (unsigned i = 0; i < click_max_cpu_ids() && i < CLICK_CPU_MAX; i++) {
+			s.reads += _cpu[i].reads;
+			s.writes += _cpu[i].writes;
+			s.wait += _cpu[i].wait;
+			s.hold += _cpu[i].hold;
+		}
+		return s;
+	}
+
+  private:
+
+	struct {
+		uint64_t reads;
+		uint64_t writes;
+		click_cycles_t wait;
+		click_cycles_t hold;
+		click_cycles_t since;
+		unsigned depth;
+	} _cpu[CLICK_CPU_MAX];
+
+	inline void acquired(click_cycles_t start, bool write) {
+		click_cycles_t now = click_get_cycles();
+		unsigned cpu = click_current_cpu_id();
+		if (write)
+			_cpu[cpu].writes++;
+		else
+			_cpu[cpu].reads++;
+		_cpu[cpu].wait += now - start;
+		// the lock is reentrant, only the outermost hold counts
+		if (_cpu[cpu].depth++ == 0)
+			_cpu[cpu].since = now;
+	}
+
+	inline void released() {
+		unsigned cpu = click_current_cpu_id();
+		if (--_cpu[cpu].depth == 0)
+			_cpu[cpu].hold += click_get_cycles() - _cpu[cpu].since;
+	}
+
+};
+
+#else
+
+typedef ReadWriteLock EmpowerRWLock;
+
+#endif
+
+CLICK_ENDDECLS
+#endif
@@ -17,6 +17,9 @@
 #include <click/config.h>
 #include "empowerlvapmanager.hh"
 #include <click/straccum.hh>
+#include <click/router.hh>
+#include <click/handlercall.hh>
+#include <click/packet_anno.hh>
 #include <click/args.hh>
 #include <click/error.hh>
 #include <clicknet/wifi.h>
@@ -34,23 +37,57 @@
 #include "empowerrxstats.hh"
 #include "empowerqosmanager.hh"
 #include "empowerregmon.hh"
+#include "empowersnapshot.hh"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 CLICK_DECLS
 
 EmpowerLVAPManager::EmpowerLVAPManager() :
 		_period(2000), _timer(this), _e11k(0), _ebs(0), _eauthr(0), _eassor(0),
-		_edeauthr(0), _ers(0), _mtbl(0), _seq(0), _debug(false) {
+		_edeauthr(0), _ers(0), _mtbl(0), _seq(0), _debug(false),
+		_hold_bytes(65536), _hold_time(200), _hold_timer(this), _held_frames(0),
+		_released_frames(0), _exported_frames(0), _expired_frames(0), _hold_drops(0),
+		_snapshot_period(10000), _snapshot_timer(this), _restart(EMPOWER_RESTART_COLD),
+		_epoch(0), _restoring(false), _snapshot_saves(0), _snapshot_unchanged(0),
+		_snapshot_length(0), _snapshot_crc(0), _snapshot_epoch(0), _restored_lvaps(0),
+		_restored_vaps(0), _restored_slices(0), _restored_ports(0), _restored_rates(0) {
+	_held_stas = 0;
 }
 
 EmpowerLVAPManager::~EmpowerLVAPManager() {
 }
 
-int EmpowerLVAPManager::initialize(ErrorHandler *) {
+int EmpowerLVAPManager::initialize(ErrorHandler *errh) {
+	if (_snapshot_file) {
+		load_snapshot(errh);
+		_snapshot_timer.initialize(this);
+		if (_snapshot_period) {
+			_snapshot_timer.schedule_after_msec(_snapshot_period);
+		}
+	}
 	compute_bssid_mask();
+	_hold_timer.initialize(this);
 	_timer.initialize(this);
 	_timer.schedule_now();
 	return 0;
 }
 
+void EmpowerLVAPManager::cleanup(CleanupStage stage) {
+	// the elements holding the rest of the state are not destroyed yet
+	if (_snapshot_file && stage >= CLEANUP_ROUTER_INITIALIZED) {
+		save_snapshot(ErrorHandler::default_handler());
+	}
+	for (HFIter it = _held.begin(); it.live(); it++) {
+		for (int i = 0; i < it.value()._frames.size(); i++) {
+			it.value()._frames[i]->kill();
+		}
+	}
+	_held.clear();
+	_held_stas = 0;
+}
+
 void cp_slashvec(const String &str, Vector<String> &conf) {
 	int start = 0;
 	int pos = str.find_left('/');
@@ -71,6 +108,7 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 	String res_strings;
 	String eqms_strings;
 	String regmon_strings;
+	String epsbs_strings;
 
 	res = Args(conf, this, errh).read_m("WTP", _wtp)
 						    .read_m("E11K", ElementCastArg("Empower11k"), _e11k)
@@ -84,6 +122,11 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 			          .read_m("RES", res_strings)
 			          .read_m("ERS", ElementCastArg("EmpowerRXStats"), _ers)
 			          .read("REGMONS", regmon_strings)
+			          .read("EPSBS", epsbs_strings)
+			          .read("SNAPSHOT", FilenameArg(), _snapshot_file)
+			          .read("SNAPSHOT_PERIOD", _snapshot_period)
+			          .read("HOLD_BYTES", _hold_bytes)
+			          .read("HOLD_TIME", _hold_time)
 								.read("MTBL", ElementCastArg("EmpowerMulticastTable"), _mtbl)
 				  			.read("PERIOD", _period)
 			          .read("DEBUG", _debug)
@@ -172,11 +215,36 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 		return errh->error("regmons has %u values, while masks has %u values", _regmons.size(), _masks.size());
 	}
 
+	tokens.clear();
+	cp_spacevec(epsbs_strings, tokens);
+	for (int i = 0; i < tokens.size(); i++) {
+		EmpowerPowerSaveBuffer *epsb;
+		if (!ElementCastArg("EmpowerPowerSaveBuffer").parse(tokens[i], epsb, Args(conf, this, errh))) {
+			return errh->error("error param %s: must be a EmpowerPowerSaveBuffer element", tokens[i].c_str());
+		}
+		_epsbs.push_back(epsb);
+	}
+
+	if (_epsbs.size() && _epsbs.size() != _masks.size()) {
+		return errh->error("epsbs has %u values, while masks has %u values", _epsbs.size(), _masks.size());
+	}
+
 	return res;
 
 }
 
-void EmpowerLVAPManager::run_timer(Timer *) {
+void EmpowerLVAPManager::run_timer(Timer *timer) {
+
+	if (timer == &_snapshot_timer) {
+		save_snapshot(ErrorHandler::default_handler());
+		_snapshot_timer.reschedule_after_msec(_snapshot_period);
+		return;
+	}
+
+	if (timer == &_hold_timer) {
+		expire_held();
+		return;
+	}
 
 	// send hello request
 	send_hello_request();
@@ -304,6 +372,11 @@ void EmpowerLVAPManager::send_probe_request(uint32_t iface_id, EtherAddress src,
 }
 
 void EmpowerLVAPManager::send_message(Packet *p) {
+	// the controller hears about restored state once it answers the hello
+	if (_restoring) {
+		p->kill();
+		return;
+	}
 	output(0).push(p);
 }
 
@@ -328,6 +401,7 @@ void EmpowerLVAPManager::send_hello_request() {
 	hello->set_seq(get_next_seq());
 	hello->set_wtp(_wtp);
 	hello->set_period(_period);
+	hello->set_epoch(_epoch);
 
 	send_message(p);
 
@@ -362,6 +436,11 @@ void EmpowerLVAPManager::send_status_slice(uint32_t iface_id, String ssid, int d
 	status->set_quantum(queue->_quantum);
     status->set_iface_id(iface_id);
     status->set_scheduler(queue->_scheduler);
+    status->set_max_rate(queue->_max_rate);
+    status->set_max_burst(queue->_max_burst);
+    status->set_max_airtime(queue->_max_airtime);
+    status->set_max_airtime_burst(queue->_max_airtime_burst);
+    status->set_throttled(queue->_throttled);
 
 	if (queue->_amsdu_aggregation) {
 		status->set_flag(EMPOWER_AMSDU_AGGREGATION);
@@ -379,6 +458,12 @@ int EmpowerLVAPManager::handle_slice_stats_request(Packet *p, uint32_t offset) {
     return 0;
 }
 
+int EmpowerLVAPManager::handle_perf_stats_request(Packet *p, uint32_t offset) {
+	empower_perf_stats_request *q = (empower_perf_stats_request *) (p->data() + offset);
+	send_perf_stats_response(q->xid());
+	return 0;
+}
+
 int EmpowerLVAPManager::handle_slice_status_request(Packet *, uint32_t) {
 
 	for (REIter it_re = _ifaces.begin(); it_re.live(); it_re++) {
@@ -408,6 +493,7 @@ int EmpowerLVAPManager::handle_port_status_request(Packet *, uint32_t) {
 void EmpowerLVAPManager::send_slice_stats_response(String ssid, uint8_t dscp, uint32_t xid) {
 
 	int len = sizeof(empower_slice_stats_response) + _eqms.size() * sizeof(empower_slice_stats_entry);
+	len += _eqms.size() * sizeof(empower_slice_stats_airtime);
 
     WritablePacket *p = Packet::make(len);
 
@@ -454,10 +540,156 @@ void EmpowerLVAPManager::send_slice_stats_response(String ssid, uint8_t dscp, ui
 
 	}
 
+	for (int i = 0; i < _eqms.size(); i++) {
+
+		assert (ptr <= end);
+
+		empower_slice_stats_airtime *airtime = (empower_slice_stats_airtime *) ptr;
+
+		SIter itr = _eqms[i]->slices()->find(slice);
+
+		airtime->set_tx_airtime(itr.value()->_tx_airtime);
+
+		ptr += sizeof(empower_slice_stats_airtime);
+
+	}
+
     send_message(p);
 
 }
 
+void EmpowerLVAPManager::perf_elements(Vector<PerfElement> &elements) {
+#if CLICK_STATS >= 2
+	for (int i = 0; i < router()->nelements(); i++) {
+		Element *e = router()->element(i);
+		String klass = e->class_name();
+		if (!klass.starts_with("Empower") && klass != "Minstrel")
+			continue;
+		PerfElement pe;
+		pe._name = e->name();
+		pe._class = klass;
+		pe._packets = 0;
+		for (int j = 0; j < e->ninputs(); j++)
+			pe._packets += e->input(j).npackets();
+		pe._xfer_calls = e->xfer_calls();
+		pe._task_calls = e->task_calls();
+		pe._cycles = e->xfer_own_cycles() + e->task_own_cycles() + e->timer_own_cycles();
+		elements.push_back(pe);
+	}
+#else
+	(void) elements;
+#endif
+}
+
+void EmpowerLVAPManager::perf_locks(Vector<String> &names, Vector<EmpowerRWLock *> &locks) {
+	names.push_back(name());
+	locks.push_back(&_lock);
+	if (_ers) {
+		names.push_back(_ers->name());
+		locks.push_back(&_ers->lock);
+	}
+	for (int i = 0; i < _eqms.size(); i++) {
+		names.push_back(_eqms[i]->name());
+		locks.push_back(_eqms[i]->lock());
+	}
+}
+
+String EmpowerLVAPManager::unparse_perf() {
+#if CLICK_STATS >= 2
+	StringAccum sa;
+	Vector<PerfElement> elements;
+	perf_elements(elements);
+	sa << "element class packets xfer_calls task_calls cycles cycles/packet packets/batch\n";
+	for (int i = 0; i < elements.size(); i++) {
+		PerfElement &pe = elements[i];
+		uint64_t batches = pe._task_calls ? pe._task_calls : pe._xfer_calls;
+		sa << pe._name << ' ' << pe._class << ' ' << pe._packets << ' '
+		   << pe._xfer_calls << ' ' << pe._task_calls << ' ' << pe._cycles << ' '
+		   << (pe._packets ? pe._cycles / pe._packets : 0) << ' '
+		   << (batches ? (double) pe._packets / batches : 0.0) << "\n";
+	}
+	Vector<String> names;
+	Vector<EmpowerRWLock *> locks;
+	perf_locks(names, locks);
+	sa << "lock reads writes wait_cycles hold_cycles\n";
+	for (int i = 0; i < locks.size(); i++) {
+		EmpowerRWLock::Stats st = locks[i]->stats();
+		sa << names[i] << ' ' << st.reads << ' ' << st.writes << ' '
+		   << st.wait << ' ' << st.hold << "\n";
+	}
+	return sa.take_string();
+#else
+	return "disabled, configure Click with --enable-stats=2\n";
+#endif
+}
+
+void EmpowerLVAPManager::send_perf_stats_response(uint32_t xid) {
+
+	Vector<PerfElement> elements;
+	Vector<String> names;
+	Vector<EmpowerRWLock *> locks;
+
+#if CLICK_STATS >= 2
+	perf_elements(elements);
+	perf_locks(names, locks);
+#endif
+
+	int len = sizeof(empower_perf_stats_response)
+			+ elements.size() * sizeof(perf_element_entry)
+			+ locks.size() * sizeof(perf_lock_entry);
+
+	WritablePacket *p = Packet::make(len);
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	empower_perf_stats_response *stats = (empower_perf_stats_response *) (p->data());
+	stats->set_version(_empower_version);
+	stats->set_length(len);
+	stats->set_type(EMPOWER_PT_PERF_STATS_RESPONSE);
+	stats->set_seq(get_next_seq());
+	stats->set_xid(xid);
+	stats->set_wtp(_wtp);
+	stats->set_enabled(CLICK_STATS >= 2);
+	stats->set_nb_elements(elements.size());
+	stats->set_nb_locks(locks.size());
+
+	uint8_t *ptr = (uint8_t *) stats;
+	ptr += sizeof(empower_perf_stats_response);
+
+	for (int i = 0; i < elements.size(); i++) {
+		perf_element_entry *entry = (perf_element_entry *) ptr;
+		entry->set_name(elements[i]._name);
+		entry->set_packets(elements[i]._packets);
+		entry->set_xfer_calls(elements[i]._xfer_calls);
+		entry->set_task_calls(elements[i]._task_calls);
+		entry->set_cycles(elements[i]._cycles);
+		ptr += sizeof(perf_element_entry);
+	}
+
+#if CLICK_STATS >= 2
+	for (int i = 0; i < locks.size(); i++) {
+		EmpowerRWLock::Stats st = locks[i]->stats();
+		perf_lock_entry *entry = (perf_lock_entry *) ptr;
+		entry->set_name(names[i]);
+		entry->set_reads(st.reads);
+		entry->set_writes(st.writes);
+		entry->set_wait_cycles(st.wait);
+		entry->set_hold_cycles(st.hold);
+		ptr += sizeof(perf_lock_entry);
+	}
+#endif
+
+	send_message(p);
+
+}
+
 void EmpowerLVAPManager::send_status_lvap(EtherAddress sta) {
 
 	EmpowerStationState *ess = _lvaps.get_pointer(sta);
@@ -688,9 +920,25 @@ void EmpowerLVAPManager::send_img_response(uint32_t iface_id, int type, uint32_t
 
 }
 
-void EmpowerLVAPManager::send_wifi_stats_response(uint32_t iface_id, uint32_t xid) {
+/*
+ * nb_entries is 16 bits wide, each register gets a third of it. Only the
+ * oldest entries are sent, the rest goes in the reply to the next request
+ * as its since moves past them.
+ */
+#define EMPOWER_REGMON_MAX_ENTRIES (0xFFFF / 3)
+
+void EmpowerLVAPManager::send_wifi_stats_response(uint32_t iface_id, uint32_t xid, uint64_t since) {
+
+	empower_regmon_types types[3] = { EMPOWER_REGMON_TX, EMPOWER_REGMON_RX, EMPOWER_REGMON_ED };
+	Vector<RegmonSample> samples[3];
+	int nb_entries = 0;
+
+	for (int i = 0; i < 3; i++) {
+		_regmons[iface_id]->registers(types[i])->raw(since, samples[i], EMPOWER_REGMON_MAX_ENTRIES);
+		nb_entries += samples[i].size();
+	}
 
-	int len = sizeof(empower_wifi_stats_response) + sizeof(wifi_stats_entry) * _regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size * 3;
+	int len = sizeof(empower_wifi_stats_response) + sizeof(wifi_stats_entry) * nb_entries;
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
@@ -710,38 +958,90 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t iface_id, uint32_t xi
 	stats->set_xid(xid);
 	stats->set_wtp(_wtp);
 	stats->set_iface_id(iface_id);
-	stats->set_nb_entries(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size * 3);
+	stats->set_nb_entries(nb_entries);
 
 	uint8_t *ptr = (uint8_t *) stats;
 	ptr += sizeof(empower_wifi_stats_response);
 
 	uint8_t *end = ptr + (len - sizeof(empower_wifi_stats_response));
 
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size; i++) {
-		assert (ptr <= end);
-		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_samples[i]);
-		ptr += sizeof(wifi_stats_entry);
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < samples[i].size(); j++) {
+			assert (ptr <= end);
+			wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
+			entry->set_type(types[i]);
+			entry->set_timestamp(samples[i][j]._timestamp);
+			entry->set_sample(samples[i][j]._value);
+			ptr += sizeof(wifi_stats_entry);
+		}
 	}
 
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_size; i++) {
-		assert (ptr <= end);
-		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_samples[i]);
-		ptr += sizeof(wifi_stats_entry);
+	send_message(p);
+
+}
+
+void EmpowerLVAPManager::send_wifi_stats_rollup_response(uint32_t iface_id, uint32_t xid, uint64_t since, uint32_t resolution) {
+
+	empower_regmon_types types[3] = { EMPOWER_REGMON_TX, EMPOWER_REGMON_RX, EMPOWER_REGMON_ED };
+	Vector<RegmonRollup> rollups[3];
+	int nb_entries = 0;
+
+	const RegmonLevel *level = _regmons[iface_id]->registers(EMPOWER_REGMON_TX)->level(resolution);
+
+	if (!level) {
+		click_chatter("%{element} :: %s :: no rollups configured on iface %u",
+					  this,
+					  __func__,
+					  iface_id);
+		return;
 	}
 
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_size; i++) {
-		assert (ptr <= end);
-		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_samples[i]);
-		ptr += sizeof(wifi_stats_entry);
+	for (int i = 0; i < 3; i++) {
+		RegmonRegister *reg = _regmons[iface_id]->registers(types[i]);
+		reg->rollups(reg->level(resolution), since, rollups[i], EMPOWER_REGMON_MAX_ENTRIES);
+		nb_entries += rollups[i].size();
+	}
+
+	int len = sizeof(empower_wifi_stats_rollup_response) + sizeof(wifi_stats_rollup_entry) * nb_entries;
+	WritablePacket *p = Packet::make(len);
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	empower_wifi_stats_rollup_response *stats = (empower_wifi_stats_rollup_response *) (p->data());
+	stats->set_version(_empower_version);
+	stats->set_length(len);
+	stats->set_type(EMPOWER_PT_WIFI_STATS_ROLLUP_RESPONSE);
+	stats->set_seq(get_next_seq());
+	stats->set_xid(xid);
+	stats->set_wtp(_wtp);
+	stats->set_iface_id(iface_id);
+	stats->set_resolution(level->_resolution);
+	stats->set_nb_entries(nb_entries);
+
+	uint8_t *ptr = (uint8_t *) stats;
+	ptr += sizeof(empower_wifi_stats_rollup_response);
+
+	uint8_t *end = ptr + (len - sizeof(empower_wifi_stats_rollup_response));
+
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < rollups[i].size(); j++) {
+			assert (ptr <= end);
+			wifi_stats_rollup_entry *entry = (wifi_stats_rollup_entry *) ptr;
+			entry->set_type(types[i]);
+			entry->set_timestamp(rollups[i][j]._timestamp);
+			entry->set_count(rollups[i][j]._count);
+			entry->set_min(rollups[i][j]._count ? rollups[i][j]._min : 0);
+			entry->set_avg(rollups[i][j].avg());
+			entry->set_max(rollups[i][j]._max);
+			ptr += sizeof(wifi_stats_rollup_entry);
+		}
 	}
 
 	send_message(p);
@@ -1044,6 +1344,8 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t iface_id, uint32_t
         counters->set_seq(get_next_seq());
         counters->set_xid(xid);
         counters->set_wtp(_wtp);
+        counters->set_iface_id(iface_id);
+        counters->set_mcast(mcast);
         counters->set_nb_tx(0);
 
         send_message(p);
@@ -1054,6 +1356,8 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t iface_id, uint32_t
 
 	int len = sizeof(empower_txp_counters_response);
 	len += txp->_tx.size() * 6; // the tx samples
+	len += sizeof(empower_txp_counters_ur);
+	len += txp->_ur.size() * 6; // the unsolicited retries samples
 
 	WritablePacket *p = Packet::make(len);
 
@@ -1073,6 +1377,8 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t iface_id, uint32_t
 	counters->set_seq(get_next_seq());
 	counters->set_xid(xid);
 	counters->set_wtp(_wtp);
+	counters->set_iface_id(iface_id);
+	counters->set_mcast(mcast);
 	counters->set_nb_tx(txp->_tx.size());
 
 	uint8_t *ptr = (uint8_t *) counters;
@@ -1088,6 +1394,18 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t iface_id, uint32_t
 		ptr += sizeof(counters_entry);
 	}
 
+	empower_txp_counters_ur *ur = (empower_txp_counters_ur *) ptr;
+	ur->set_nb_ur(txp->_ur.size());
+	ptr += sizeof(empower_txp_counters_ur);
+
+	for (CBytesIter iter = txp->_ur.begin(); iter.live(); iter++) {
+		assert (ptr <= end);
+		counters_entry *entry = (counters_entry *) ptr;
+		entry->set_size(iter.key());
+		entry->set_count(iter.value());
+		ptr += sizeof(counters_entry);
+	}
+
 	send_message(p);
 
 }
@@ -1139,6 +1457,31 @@ int EmpowerLVAPManager::handle_hello_response(Packet *p, uint32_t offset) {
 	// Process hello response and update period
 	empower_hello_response *q = (empower_hello_response *) (p->data() + offset);
 	_period = q->period();
+	// the epoch is optional, older controllers send the message without it
+	uint32_t epoch = 0;
+	if (q->length() >= sizeof(empower_hello_response)) {
+		epoch = q->epoch();
+	}
+	// keep the restored state only if the controller still knows it
+	if (_restart == EMPOWER_RESTART_PENDING) {
+		if (epoch && epoch == _epoch) {
+			click_chatter("%{element} :: %s :: controller epoch %u, keeping restored state",
+						  this,
+						  __func__,
+						  epoch);
+			_restart = EMPOWER_RESTART_CONFIRMED;
+			_restored.clear();
+		} else {
+			click_chatter("%{element} :: %s :: controller epoch %u, snapshot epoch %u, dropping restored state",
+						  this,
+						  __func__,
+						  epoch,
+						  _epoch);
+			_restart = EMPOWER_RESTART_DISCARDED;
+			discard_snapshot();
+		}
+	}
+	_epoch = epoch;
 	return 0;
 }
 
@@ -1261,6 +1604,12 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 	EtherAddress encap = add_lvap->encap();
 	uint32_t xid = add_lvap->xid();
 
+	/* create default slice, so that the held frames can be queued in it */
+	if (ssid != "" && !_lvaps.get_pointer(sta)) {
+		// TODO: for the moment assume that at worst a 1500 bytes frame can be sent in 12000 usec
+		_eqms[iface_id]->set_default_slice(ssid);
+	}
+
 	_lock.acquire_write();
 
 	// if no lvap can be found, then create it
@@ -1290,8 +1639,23 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 		// set the add/del lvap response ids to zero
 		state._xid = 0;
 
+		state._tx_airtime = 0;
+		state._uapsd_acs = 0;
+		state._export_frames = false;
+
 		_lvaps.set(sta, state);
 
+		EmpowerStationState *ess = _lvaps.get_pointer(sta);
+
+		/* resolve slice queues */
+		_eqms[iface_id]->update_slice_queues(ess);
+
+		/* queue the frames held while the lvap was in transition, still under
+		 * the lock so that they go ahead of the frames the lvap gets next */
+		if (ess->is_valid(iface_id)) {
+			release_held(ess);
+		}
+
 		/* Regenerate the BSSID mask */
 		compute_bssid_mask();
 
@@ -1300,12 +1664,6 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 
 		_lock.release_write();
 
-		/* create default slice */
-		if (ssid != "") {
-			// TODO: for the moment assume that at worst a 1500 bytes frame can be sent in 12000 usec
-			_eqms[iface_id]->set_default_slice(ssid);
-		}
-
 		return 0;
 
 	}
@@ -1323,6 +1681,14 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 	ess->_set_mask = set_mask;
 	ess->_ht_caps_info = ht_caps_info;
 
+	/* the tenant may have changed */
+	_eqms[ess->_iface_id]->update_slice_queues(ess);
+
+	/* queue the frames held while the lvap was in transition */
+	if (ess->is_valid(ess->_iface_id)) {
+		release_held(ess);
+	}
+
 	/* send add lvap response message */
 	send_add_del_lvap_response(EMPOWER_PT_ADD_LVAP_RESPONSE, ess->_sta, xid, 0);
 
@@ -1427,7 +1793,12 @@ int EmpowerLVAPManager::handle_del_port(Packet *p, uint32_t offset) {
 
 int EmpowerLVAPManager::handle_add_rssi_trigger(Packet *p, uint32_t offset) {
 	empower_add_rssi_trigger *q = (empower_add_rssi_trigger *) (p->data() + offset);
-	_ers->add_rssi_trigger(q->sta(), q->xid(), static_cast<empower_trigger_relation>(q->relation()), q->value(), q->period());
+	// the estimator is optional, older controllers send the message without it
+	int estimator = EMPOWER_RSSI_SMA;
+	if (q->length() >= sizeof(empower_add_rssi_trigger) && q->estimator() < EMPOWER_RSSI_MAX) {
+		estimator = q->estimator();
+	}
+	_ers->add_rssi_trigger(q->sta(), q->xid(), static_cast<empower_trigger_relation>(q->relation()), q->value(), q->period(), estimator);
 	return 0;
 }
 
@@ -1463,12 +1834,15 @@ int EmpowerLVAPManager::handle_del_lvap(Packet *p, uint32_t offset) {
 
 	EmpowerStationState *ess = _lvaps.get_pointer(sta);
 
+	// hand the frames of the station over to the controller once it is gone
+	ess->_export_frames = q->flag(EMPOWER_DEL_LVAP_EXPORT_FRAMES);
+
 	// if this is an uplink only LVAP the CSA is not needed
 	if (!ess->_set_mask) {
 		// remove lvap
-		remove_lvap(ess->_sta);
+		remove_lvap(sta);
 		// send del lvap response message
-		send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, ess->_sta, xid, 0);
+		send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, sta, xid, 0);
 		return 0;
 	}
 
@@ -1493,15 +1867,324 @@ int EmpowerLVAPManager::handle_del_lvap(Packet *p, uint32_t offset) {
 	}
 
 	// remove lvap
-	remove_lvap(ess->_sta);
+	remove_lvap(sta);
 
 	// send del lvap response message
-	send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, ess->_sta, xid, 0);
+	send_add_del_lvap_response(EMPOWER_PT_DEL_LVAP_RESPONSE, sta, xid, 0);
+
+	return 0;
+
+}
+
+void EmpowerLVAPManager::hold_frame(EtherAddress sta, Packet *p, bool start) {
+
+	// no station in transition, nothing to add the frame to
+	if (!_hold_bytes || (!start && !_held_stas)) {
+		p->kill();
+		return;
+	}
+
+	bool schedule = false;
+	Timestamp expiry;
+
+	_hold_lock.acquire();
+
+	// checked again under the lock, stations may start or end a transition
+	HeldFrames *hf = _held.get_pointer(sta);
+
+	if (!hf && start) {
+		hf = &_held.find_insert(sta).value();
+		hf->_expiry = expiry = Timestamp::now_steady() + Timestamp::make_msec(_hold_time);
+		_held_stas++;
+		schedule = true;
+	}
+
+	if (!hf || hf->_bytes + p->length() > _hold_bytes) {
+		if (hf) {
+			_hold_drops++;
+		}
+		_hold_lock.release();
+		p->kill();
+		return;
+	}
+
+	hf->_frames.push_back(p);
+	hf->_bytes += p->length();
+	_held_frames++;
+
+	_hold_lock.release();
+
+	// every entry is held for HOLD_TIME, so a new one never expires first
+	if (schedule && !_hold_timer.scheduled()) {
+		_hold_timer.schedule_at_steady(expiry);
+	}
+
+}
+
+// Called with _lock held for writing. The frames to hand over to the
+// controller are moved to frames, to be sent once the lock is released.
+void EmpowerLVAPManager::hold_lvap(EmpowerStationState *ess, Vector<Packet *> &frames) {
+
+	if (!_hold_bytes) {
+		return;
+	}
+
+	Vector<Packet *> queued;
+	_eqms[ess->_iface_id]->reclaim(ess->_sta, queued);
+
+	Timestamp expiry = Timestamp::now_steady() + Timestamp::make_msec(_hold_time);
+
+	_hold_lock.acquire();
+
+	if (!_held.get_pointer(ess->_sta)) {
+		_held_stas++;
+	}
+
+	HeldFrames &hf = _held.find_insert(ess->_sta).value();
+
+	// the frames still queued are older than those held so far
+	for (int i = 0; i < hf._frames.size(); i++) {
+		queued.push_back(hf._frames[i]);
+	}
+	_held_frames += queued.size() - hf._frames.size();
+
+	hf._frames.clear();
+	hf._bytes = 0;
+	hf._expiry = expiry;
+	hf._export = ess->_export_frames;
+
+	for (int i = 0; i < queued.size(); i++) {
+		if (hf._bytes + queued[i]->length() > _hold_bytes) {
+			queued[i]->kill();
+			_hold_drops++;
+			continue;
+		}
+		hf._frames.push_back(queued[i]);
+		hf._bytes += queued[i]->length();
+	}
+
+	if (hf._export) {
+		frames.swap(hf._frames);
+		hf._bytes = 0;
+	}
+
+	_hold_lock.release();
+
+	if (!_hold_timer.scheduled()) {
+		_hold_timer.schedule_at_steady(expiry);
+	}
+
+}
+
+// Called with _lock held for writing, in the same critical section that
+// makes the lvap valid, so no newer frame is queued for it in between.
+void EmpowerLVAPManager::release_held(EmpowerStationState *ess) {
+
+	Vector<Packet *> frames;
+
+	_hold_lock.acquire();
+	HFIter it = _held.find(ess->_sta);
+	if (it.live()) {
+		frames.swap(it.value()._frames);
+		_held.erase(it);
+		_held_stas--;
+	}
+	_hold_lock.release();
+
+	if (!frames.size()) {
+		return;
+	}
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: releasing %u frames held for %s",
+				      this,
+				      __func__,
+				      frames.size(),
+				      ess->_sta.unparse().c_str());
+	}
+
+	_eqms[ess->_iface_id]->requeue(ess, frames);
+
+	_released_frames += frames.size();
+
+}
+
+void EmpowerLVAPManager::expire_held() {
+
+	Timestamp now = Timestamp::now_steady();
+	Timestamp next;
+	Vector<EtherAddress> stas;
+	Vector<HeldFrames> expired;
+
+	_hold_lock.acquire();
+
+	HFIter it = _held.begin();
+	while (it.live()) {
+		if (it.value()._expiry <= now) {
+			stas.push_back(it.key());
+			expired.push_back(it.value());
+			it = _held.erase(it);
+			_held_stas--;
+			continue;
+		}
+		if (!next || it.value()._expiry < next) {
+			next = it.value()._expiry;
+		}
+		it++;
+	}
+
+	_hold_lock.release();
+
+	for (int i = 0; i < expired.size(); i++) {
+		if (expired[i]._export) {
+			send_held_frames(stas[i], expired[i]._frames);
+			continue;
+		}
+		for (int j = 0; j < expired[i]._frames.size(); j++) {
+			expired[i]._frames[j]->kill();
+		}
+		_expired_frames += expired[i]._frames.size();
+	}
+
+	if (next) {
+		_hold_timer.schedule_at_steady(next);
+	}
+
+}
+
+/*
+ * Longest HELD_FRAMES message. The controller relays it to the WTP that
+ * takes the LVAP over, whose control Socket reads messages of up to its
+ * SNAPLEN (65536 in the samples) and, with FRAMING LENGTH, grows its
+ * buffer for longer ones.
+ */
+#define EMPOWER_HELD_FRAMES_MAX 65535
+
+void EmpowerLVAPManager::send_held_frames(EtherAddress sta, Vector<Packet *> &frames) {
+
+	int i = 0;
+
+	while (i < frames.size()) {
+
+		uint32_t len = sizeof(empower_held_frames);
+		int n = 0;
+		while (i + n < frames.size() && len + 2 + frames[i + n]->length() <= EMPOWER_HELD_FRAMES_MAX) {
+			len += 2 + frames[i + n]->length();
+			n++;
+		}
+
+		if (!n) {
+			frames[i++]->kill();
+			_hold_drops++;
+			continue;
+		}
+
+		WritablePacket *p = Packet::make(len);
+
+		if (!p) {
+			click_chatter("%{element} :: %s :: cannot make packet!",
+						  this,
+						  __func__);
+			for (; i < frames.size(); i++) {
+				frames[i]->kill();
+				_hold_drops++;
+			}
+			break;
+		}
+
+		memset(p->data(), 0, sizeof(empower_held_frames));
+
+		empower_held_frames *msg = (empower_held_frames *) (p->data());
+		msg->set_version(_empower_version);
+		msg->set_length(len);
+		msg->set_type(EMPOWER_PT_HELD_FRAMES);
+		msg->set_seq(get_next_seq());
+		msg->set_wtp(_wtp);
+		msg->set_sta(sta);
+		msg->set_nb_frames(n);
+
+		uint8_t *ptr = p->data() + sizeof(empower_held_frames);
+
+		for (int j = 0; j < n; j++, i++) {
+			uint16_t flen = htons(frames[i]->length());
+			memcpy(ptr, &flen, 2);
+			memcpy(ptr + 2, frames[i]->data(), frames[i]->length());
+			ptr += 2 + frames[i]->length();
+			frames[i]->kill();
+		}
+
+		_exported_frames += n;
+
+		send_message(p);
+
+	}
+
+	frames.clear();
+
+}
+
+int EmpowerLVAPManager::handle_held_frames(Packet *p, uint32_t offset) {
+
+	empower_held_frames *q = (empower_held_frames *) (p->data() + offset);
+	EtherAddress sta = q->sta();
+
+	uint8_t *ptr = (uint8_t *) q + sizeof(empower_held_frames);
+	uint8_t *end = (uint8_t *) q + q->length();
+
+	for (int i = 0; i < q->nb_frames() && ptr + 2 <= end; i++) {
+		uint16_t len;
+		memcpy(&len, ptr, 2);
+		len = ntohs(len);
+		ptr += 2;
+		if (len < sizeof(click_ether) || ptr + len > end) {
+			click_chatter("%{element} :: %s :: invalid frame length %u",
+					      this,
+					      __func__,
+					      len);
+			break;
+		}
+		if (Packet *f = Packet::make(ptr, len)) {
+			hold_frame(sta, f, true);
+		}
+		ptr += len;
+	}
+
+	// the lvap may be here already
+	_lock.acquire_write();
+	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+	if (ess && ess->is_valid(ess->_iface_id)) {
+		release_held(ess);
+	}
+	_lock.release_write();
 
 	return 0;
 
 }
 
+String EmpowerLVAPManager::unparse_held() {
+
+	StringAccum sa;
+	Timestamp now = Timestamp::now_steady();
+
+	_hold_lock.acquire();
+
+	for (HFIter it = _held.begin(); it.live(); it++) {
+		HeldFrames &hf = it.value();
+		Timestamp left = hf._expiry > now ? hf._expiry - now : Timestamp();
+		sa << it.key().unparse() << " frames " << hf._frames.size() << " bytes " << hf._bytes
+		   << " left " << left.msecval() << (hf._export ? " export" : "") << "\n";
+	}
+
+	sa << "held " << _held_frames << " released " << _released_frames
+	   << " exported " << _exported_frames << " expired " << _expired_frames
+	   << " drops " << _hold_drops << "\n";
+
+	_hold_lock.release();
+
+	return sa.take_string();
+
+}
+
 int EmpowerLVAPManager::handle_probe_response(Packet *p, uint32_t offset) {
 	empower_probe_response *q = (empower_probe_response *) (p->data() + offset);
 	EtherAddress sta = q->sta();
@@ -1538,7 +2221,14 @@ int EmpowerLVAPManager::handle_counters_request(Packet *p, uint32_t offset) {
 
 int EmpowerLVAPManager::handle_wifi_stats_request(Packet *p, uint32_t offset) {
 	empower_wifi_stats_request *q = (empower_wifi_stats_request *) (p->data() + offset);
-	send_wifi_stats_response(q->iface_id(), q->xid());
+	// since and resolution are optional, older controllers get every raw sample
+	if (q->length() < sizeof(empower_wifi_stats_request)) {
+		send_wifi_stats_response(q->iface_id(), q->xid());
+	} else if (!q->resolution()) {
+		send_wifi_stats_response(q->iface_id(), q->xid(), q->since());
+	} else {
+		send_wifi_stats_rollup_response(q->iface_id(), q->xid(), q->since(), q->resolution());
+	}
 	return 0;
 }
 
@@ -1572,7 +2262,18 @@ int EmpowerLVAPManager::handle_set_slice(Packet *p, uint32_t offset) {
 	bool amsdu_aggregation = add_slice->flags(EMPOWER_AMSDU_AGGREGATION);
 	uint8_t scheduler = add_slice->scheduler();
 
-	_eqms[iface_id]->set_slice(ssid, dscp, quantum, amsdu_aggregation, scheduler);
+	// limits are optional, older controllers send the message without them
+	uint32_t max_rate = 0, max_burst = 0, max_airtime = 0, max_airtime_burst = 0;
+
+	if (add_slice->length() >= sizeof(empower_set_slice)) {
+		max_rate = add_slice->max_rate();
+		max_burst = add_slice->max_burst();
+		max_airtime = add_slice->max_airtime();
+		max_airtime_burst = add_slice->max_airtime_burst();
+	}
+
+	_eqms[iface_id]->set_slice(ssid, dscp, quantum, amsdu_aggregation, scheduler,
+							   max_rate, max_burst, max_airtime, max_airtime_burst);
 
 	return 0;
 
@@ -1692,12 +2393,18 @@ void EmpowerLVAPManager::push(int, Packet *p) {
 		case EMPOWER_PT_SLICE_STATS_REQUEST:
 			handle_slice_stats_request(p, offset);
 			break;
+		case EMPOWER_PT_PERF_STATS_REQUEST:
+			handle_perf_stats_request(p, offset);
+			break;
 		case EMPOWER_PT_SLICE_STATUS_REQ:
 			handle_slice_status_request(p, offset);
 			break;
 		case EMPOWER_PT_PORT_STATUS_REQ:
 			handle_port_status_request(p, offset);
 			break;
+		case EMPOWER_PT_HELD_FRAMES:
+			handle_held_frames(p, offset);
+			break;
 		default:
 			click_chatter("%{element} :: %s :: Unknown packet type: %d",
 					      this,
@@ -1812,6 +2519,528 @@ void EmpowerLVAPManager::compute_bssid_mask() {
 
 }
 
+String EmpowerLVAPManager::snapshot_lvaps(uint32_t first, uint32_t count) {
+
+	_lock.acquire_read();
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_LVAPS, sizeof(snapshot_lvap_record), _lvaps.size(), first, count);
+
+	for (LVAPIter it = _lvaps.begin(); it.live() && !sb.done(); it++) {
+		snapshot_lvap_record *r = (snapshot_lvap_record *) sb.record();
+		if (!r) {
+			continue;
+		}
+		EmpowerStationState *ess = &it.value();
+		uint8_t flags = 0;
+		if (ess->_authentication_status)
+			flags |= EMPOWER_STATUS_LVAP_AUTHENTICATED;
+		if (ess->_association_status)
+			flags |= EMPOWER_STATUS_LVAP_ASSOCIATED;
+		if (ess->_set_mask)
+			flags |= EMPOWER_STATUS_LVAP_SET_MASK;
+		if (ess->_ht_caps)
+			flags |= EMPOWER_STATUS_LVAP_HT_CAPS;
+		r->set_sta(ess->_sta);
+		r->set_bssid(ess->_bssid);
+		r->set_encap(ess->_encap);
+		r->set_iface_id(ess->_iface_id);
+		r->set_assoc_id(ess->_assoc_id);
+		r->set_flags(flags);
+		r->set_ssid(ess->_ssid);
+		r->set_ht_caps_info(ess->_ht_caps_info);
+	}
+
+	_lock.release_read();
+
+	return sb.take();
+
+}
+
+int EmpowerLVAPManager::snapshot_handler(int, String &s, Element *e, const Handler *, ErrorHandler *errh) {
+	EmpowerLVAPManager *td = (EmpowerLVAPManager *) e;
+	uint32_t first, count;
+	if (SnapshotBuilder::parse_range(s, first, count, e, errh) < 0)
+		return -1;
+	s = td->snapshot_lvaps(first, count);
+	return 0;
+}
+
+String EmpowerLVAPManager::snapshot_vaps() {
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_VAPS, sizeof(snapshot_vap_record), _vaps.size(), 0, _vaps.size());
+
+	for (VAPIter it = _vaps.begin(); it.live(); it++) {
+		snapshot_vap_record *r = (snapshot_vap_record *) sb.record();
+		if (!r) {
+			continue;
+		}
+		r->set_bssid(it.value()._bssid);
+		r->set_iface_id(it.value()._iface_id);
+		r->set_ssid(it.value()._ssid);
+	}
+
+	return sb.take();
+
+}
+
+String EmpowerLVAPManager::snapshot_networks() {
+
+	_lock.acquire_read();
+
+	uint32_t total = 0;
+	for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
+		total += it.value()._networks.size();
+	}
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_NETWORKS, sizeof(snapshot_network_record), total, 0, total);
+
+	for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
+		EmpowerStationState *ess = &it.value();
+		for (int i = 0; i < ess->_networks.size(); i++) {
+			snapshot_network_record *r = (snapshot_network_record *) sb.record();
+			if (!r) {
+				continue;
+			}
+			r->set_sta(ess->_sta);
+			r->set_bssid(ess->_networks[i]._bssid);
+			r->set_ssid(ess->_networks[i]._ssid);
+		}
+	}
+
+	_lock.release_read();
+
+	return sb.take();
+
+}
+
+String EmpowerLVAPManager::snapshot_ports(int iface_id) {
+
+	TxTable *table = _rcs[iface_id]->tx_policies()->tx_table();
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_PORTS, sizeof(snapshot_port_record), table->size(), 0, table->size());
+
+	for (TxTableIter it = table->begin(); it.live(); it++) {
+		snapshot_port_record *r = (snapshot_port_record *) sb.record();
+		if (!r) {
+			continue;
+		}
+		TxPolicyInfo *txp = it.value();
+		r->set_addr(it.key());
+		r->set_flags(txp->_no_ack ? EMPOWER_STATUS_PORT_NOACK : 0);
+		r->set_tx_mcast(txp->_tx_mcast);
+		r->set_ur_mcast_count(txp->_ur_mcast_count);
+		r->set_rts_cts(txp->_rts_cts);
+		r->set_max_amsdu_len(txp->_max_amsdu_len);
+	}
+
+	return sb.take();
+
+}
+
+String EmpowerLVAPManager::snapshot_port_rates(int iface_id) {
+
+	TxTable *table = _rcs[iface_id]->tx_policies()->tx_table();
+
+	uint32_t total = 0;
+	for (TxTableIter it = table->begin(); it.live(); it++) {
+		total += it.value()->_mcs.size() + it.value()->_ht_mcs.size();
+	}
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_PORT_RATES, sizeof(snapshot_port_rate_record), total, 0, total);
+
+	for (TxTableIter it = table->begin(); it.live(); it++) {
+		TxPolicyInfo *txp = it.value();
+		for (int i = 0; i < txp->_mcs.size() + txp->_ht_mcs.size(); i++) {
+			snapshot_port_rate_record *r = (snapshot_port_rate_record *) sb.record();
+			if (!r) {
+				continue;
+			}
+			r->set_addr(it.key());
+			if (i < txp->_mcs.size()) {
+				r->set_rate(txp->_mcs[i]);
+			} else {
+				r->set_flags(SNAPSHOT_RATE_HT);
+				r->set_rate(txp->_ht_mcs[i - txp->_mcs.size()]);
+			}
+		}
+	}
+
+	return sb.take();
+
+}
+
+String EmpowerLVAPManager::state_image() {
+
+	StateBuilder st;
+
+	st.add(EMPOWER_STATE_ALL_IFACES, snapshot_vaps());
+	st.add(EMPOWER_STATE_ALL_IFACES, snapshot_lvaps(0, _lvaps.size()));
+	st.add(EMPOWER_STATE_ALL_IFACES, snapshot_networks());
+
+	for (int i = 0; i < _rcs.size(); i++) {
+		st.add(i, _eqms[i]->snapshot_slices(0, 0xFFFFFFFFU));
+		st.add(i, snapshot_ports(i));
+		st.add(i, snapshot_port_rates(i));
+		st.add(i, _rcs[i]->snapshot_rates(0, 0xFFFFFFFFU));
+	}
+
+	return st.take(_wtp, _epoch, Timestamp::now().sec());
+
+}
+
+int EmpowerLVAPManager::save_snapshot(ErrorHandler *errh) {
+
+	String image = state_image();
+
+	if (!image) {
+		return errh->error("%s: out of memory", _snapshot_file.c_str());
+	}
+
+	// Minstrel statistics aside, the state rarely changes
+	uint32_t crc = ((empower_state_header *) image.data())->crc();
+	if (_snapshot_saves && crc == _snapshot_crc && _epoch == _snapshot_epoch) {
+		_snapshot_unchanged++;
+		return 0;
+	}
+
+	// write a new file and rename it over the old one, so that the
+	// snapshot on disk is always complete
+	String tmp = _snapshot_file + ".tmp";
+	int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		return errh->error("%s: %s", tmp.c_str(), strerror(errno));
+	}
+
+	if (ftruncate(fd, image.length()) < 0) {
+		int err = errno;
+		close(fd);
+		unlink(tmp.c_str());
+		return errh->error("%s: %s", tmp.c_str(), strerror(err));
+	}
+
+	void *m = mmap(0, image.length(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (m == MAP_FAILED) {
+		int err = errno;
+		close(fd);
+		unlink(tmp.c_str());
+		return errh->error("%s: %s", tmp.c_str(), strerror(err));
+	}
+
+	memcpy(m, image.data(), image.length());
+	munmap(m, image.length());
+	close(fd);
+
+	if (rename(tmp.c_str(), _snapshot_file.c_str()) < 0) {
+		int err = errno;
+		unlink(tmp.c_str());
+		return errh->error("%s: %s", _snapshot_file.c_str(), strerror(err));
+	}
+
+	_snapshot_saves++;
+	_snapshot_length = image.length();
+	_snapshot_crc = crc;
+	_snapshot_epoch = _epoch;
+
+	return 0;
+
+}
+
+int EmpowerLVAPManager::load_snapshot(ErrorHandler *errh) {
+
+	int fd = open(_snapshot_file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			errh->warning("%s: %s, starting cold", _snapshot_file.c_str(), strerror(errno));
+		}
+		return 0;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	Timestamp start = Timestamp::now_steady();
+
+	void *m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		errh->warning("%s: %s, starting cold", _snapshot_file.c_str(), strerror(errno));
+		return 0;
+	}
+
+	StateReader sr((const char *) m, st.st_size);
+
+	if (!sr.valid()) {
+		errh->warning("%s: not a valid snapshot, starting cold", _snapshot_file.c_str());
+	} else if (sr.header()->wtp() != _wtp) {
+		errh->warning("%s: snapshot of WTP %s, starting cold",
+					  _snapshot_file.c_str(),
+					  sr.header()->wtp().unparse().c_str());
+	} else {
+		_epoch = sr.header()->epoch();
+		_restart = EMPOWER_RESTART_PENDING;
+		_restoring = true;
+		restore_snapshot(sr);
+		_restoring = false;
+	}
+
+	munmap(m, st.st_size);
+
+	_snapshot_load_time = Timestamp::now_steady() - start;
+
+	if (_restart == EMPOWER_RESTART_PENDING) {
+		click_chatter("%{element} :: %s :: restored %u lvaps %u vaps %u slices %u ports %u rates in %s s, epoch %u",
+					  this,
+					  __func__,
+					  _restored_lvaps,
+					  _restored_vaps,
+					  _restored_slices,
+					  _restored_ports,
+					  _restored_rates,
+					  _snapshot_load_time.unparse().c_str(),
+					  _epoch);
+	}
+
+	return 0;
+
+}
+
+void EmpowerLVAPManager::restore_snapshot(StateReader &sr) {
+
+	// sections may come in any order, apply them so that slices exist
+	// before the lvaps that use them and ports before their rate tables
+	Vector<uint32_t> ifaces;
+	Vector<const char *> datas;
+	Vector<uint32_t> lengths;
+	Vector<uint8_t> types;
+
+	uint32_t iface_id, length;
+	const char *data;
+
+	while (sr.next(iface_id, data, length)) {
+		if (length < sizeof(empower_snapshot_header)) {
+			continue;
+		}
+		if (iface_id != EMPOWER_STATE_ALL_IFACES && iface_id >= (uint32_t) _rcs.size()) {
+			continue;
+		}
+		ifaces.push_back(iface_id);
+		datas.push_back(data);
+		lengths.push_back(length);
+		types.push_back(((empower_snapshot_header *) data)->type());
+	}
+
+	static const uint8_t order[] = {
+		EMPOWER_SNAPSHOT_VAPS, EMPOWER_SNAPSHOT_SLICES, EMPOWER_SNAPSHOT_LVAPS,
+		EMPOWER_SNAPSHOT_NETWORKS, EMPOWER_SNAPSHOT_PORTS, EMPOWER_SNAPSHOT_RATES
+	};
+
+	for (unsigned o = 0; o < sizeof(order) / sizeof(order[0]); o++) {
+		for (int s = 0; s < types.size(); s++) {
+
+			if (types[s] != order[o]) {
+				continue;
+			}
+
+			switch (types[s]) {
+			case EMPOWER_SNAPSHOT_VAPS: {
+				SnapshotReader rd(datas[s], lengths[s], EMPOWER_SNAPSHOT_VAPS, sizeof(snapshot_vap_record));
+				for (uint32_t i = 0; i < rd.count(); i++) {
+					snapshot_vap_record *r = (snapshot_vap_record *) rd.record(i);
+					if (r->iface_id() >= (uint32_t) _rcs.size() || _vaps.find(r->bssid()) != _vaps.end()) {
+						continue;
+					}
+					EmpowerVAPState state;
+					state._bssid = r->bssid();
+					state._ssid = r->ssid();
+					state._iface_id = r->iface_id();
+					_vaps.set(state._bssid, state);
+					_restored.push_back(RestoredEntry(EMPOWER_SNAPSHOT_VAPS, state._iface_id, state._bssid));
+					_restored_vaps++;
+				}
+				break;
+			}
+			case EMPOWER_SNAPSHOT_SLICES: {
+				SnapshotReader rd(datas[s], lengths[s], EMPOWER_SNAPSHOT_SLICES, sizeof(snapshot_slice_record));
+				if (ifaces[s] == EMPOWER_STATE_ALL_IFACES) {
+					break;
+				}
+				for (uint32_t i = 0; i < rd.count(); i++) {
+					snapshot_slice_record *r = (snapshot_slice_record *) rd.record(i);
+					_eqms[ifaces[s]]->set_slice(r->ssid(), r->dscp(), r->quantum(),
+												r->flag(EMPOWER_AMSDU_AGGREGATION), r->scheduler(),
+												r->max_rate(), r->max_burst(), r->max_airtime(), r->max_airtime_burst());
+					_restored.push_back(RestoredEntry(EMPOWER_SNAPSHOT_SLICES, ifaces[s], EtherAddress(), r->ssid(), r->dscp()));
+					_restored_slices++;
+				}
+				break;
+			}
+			case EMPOWER_SNAPSHOT_LVAPS: {
+				SnapshotReader rd(datas[s], lengths[s], EMPOWER_SNAPSHOT_LVAPS, sizeof(snapshot_lvap_record));
+				_lock.acquire_write();
+				for (uint32_t i = 0; i < rd.count(); i++) {
+					snapshot_lvap_record *r = (snapshot_lvap_record *) rd.record(i);
+					if (r->iface_id() >= (uint32_t) _rcs.size() || _lvaps.find(r->sta()) != _lvaps.end()) {
+						continue;
+					}
+					EmpowerStationState state;
+					state._sta = r->sta();
+					state._bssid = r->bssid();
+					state._ssid = r->ssid();
+					state._encap = r->encap();
+					state._assoc_id = r->assoc_id();
+					state._iface_id = r->iface_id();
+					state._ht_caps = r->flag(EMPOWER_STATUS_LVAP_HT_CAPS);
+					state._ht_caps_info = r->ht_caps_info();
+					state._set_mask = r->flag(EMPOWER_STATUS_LVAP_SET_MASK);
+					state._authentication_status = r->flag(EMPOWER_STATUS_LVAP_AUTHENTICATED);
+					state._association_status = r->flag(EMPOWER_STATUS_LVAP_ASSOCIATED);
+					state._csa_active = false;
+					state._csa_switch_count = 0;
+					state._csa_switch_mode = 1;
+					state._csa_switch_channel = 0;
+					state._xid = 0;
+					state._tx_airtime = 0;
+					state._uapsd_acs = 0;
+					state._export_frames = false;
+					_lvaps.set(state._sta, state);
+					_eqms[state._iface_id]->update_slice_queues(_lvaps.get_pointer(state._sta));
+					_restored.push_back(RestoredEntry(EMPOWER_SNAPSHOT_LVAPS, state._iface_id, state._sta));
+				}
+				_lock.release_write();
+				break;
+			}
+			case EMPOWER_SNAPSHOT_NETWORKS: {
+				SnapshotReader rd(datas[s], lengths[s], EMPOWER_SNAPSHOT_NETWORKS, sizeof(snapshot_network_record));
+				_lock.acquire_write();
+				for (uint32_t i = 0; i < rd.count(); i++) {
+					snapshot_network_record *r = (snapshot_network_record *) rd.record(i);
+					EmpowerStationState *ess = _lvaps.get_pointer(r->sta());
+					if (ess) {
+						ess->_networks.push_back(EmpowerNetwork(r->bssid(), r->ssid()));
+					}
+				}
+				_lock.release_write();
+				break;
+			}
+			case EMPOWER_SNAPSHOT_PORTS: {
+				SnapshotReader rd(datas[s], lengths[s], EMPOWER_SNAPSHOT_PORTS, sizeof(snapshot_port_record));
+				if (ifaces[s] == EMPOWER_STATE_ALL_IFACES) {
+					break;
+				}
+				// the rates of the ports are in their own section
+				HashTable<EtherAddress, Vector<int> > mcs, ht_mcs;
+				for (int t = 0; t < types.size(); t++) {
+					if (types[t] != EMPOWER_SNAPSHOT_PORT_RATES || ifaces[t] != ifaces[s]) {
+						continue;
+					}
+					SnapshotReader rr(datas[t], lengths[t], EMPOWER_SNAPSHOT_PORT_RATES, sizeof(snapshot_port_rate_record));
+					for (uint32_t i = 0; i < rr.count(); i++) {
+						snapshot_port_rate_record *r = (snapshot_port_rate_record *) rr.record(i);
+						if (r->flag(SNAPSHOT_RATE_HT)) {
+							ht_mcs[r->addr()].push_back(r->rate());
+						} else {
+							mcs[r->addr()].push_back(r->rate());
+						}
+					}
+				}
+				Minstrel *rc = _rcs[ifaces[s]];
+				for (uint32_t i = 0; i < rd.count(); i++) {
+					snapshot_port_record *r = (snapshot_port_record *) rd.record(i);
+					EtherAddress addr = r->addr();
+					rc->tx_policies()->insert(addr, mcs[addr], ht_mcs[addr], r->flag(EMPOWER_STATUS_PORT_NOACK),
+											  (empower_tx_mcast_type) r->tx_mcast(), r->ur_mcast_count(),
+											  r->rts_cts(), r->max_amsdu_len());
+					rc->forget_station(addr);
+					TxPolicyInfo *txp = rc->tx_policies()->tx_table()->find(addr);
+					if (txp && (txp->_mcs.size() || txp->_ht_mcs.size())) {
+						rc->insert_neighbor(addr, txp);
+					}
+					_restored.push_back(RestoredEntry(EMPOWER_SNAPSHOT_PORTS, ifaces[s], addr));
+					_restored_ports++;
+				}
+				break;
+			}
+			case EMPOWER_SNAPSHOT_RATES: {
+				SnapshotReader rd(datas[s], lengths[s], EMPOWER_SNAPSHOT_RATES, sizeof(snapshot_rate_record));
+				if (ifaces[s] == EMPOWER_STATE_ALL_IFACES) {
+					break;
+				}
+				for (uint32_t i = 0; i < rd.count(); i++) {
+					_rcs[ifaces[s]]->restore_rate((snapshot_rate_record *) rd.record(i));
+					_restored_rates++;
+				}
+				break;
+			}
+			}
+
+		}
+	}
+
+	// an lvap needs at least one network, as for ADD_LVAP
+	Vector<EtherAddress> incomplete;
+	for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
+		if (!it.value()._networks.size()) {
+			incomplete.push_back(it.key());
+		}
+	}
+	for (int i = 0; i < incomplete.size(); i++) {
+		_lvaps.erase(incomplete[i]);
+	}
+	_restored_lvaps = _lvaps.size();
+
+	compute_bssid_mask();
+
+}
+
+void EmpowerLVAPManager::discard_snapshot() {
+
+	for (int i = 0; i < _restored.size(); i++) {
+		RestoredEntry &e = _restored[i];
+		switch (e._type) {
+		case EMPOWER_SNAPSHOT_VAPS:
+			_vaps.erase(e._addr);
+			break;
+		case EMPOWER_SNAPSHOT_LVAPS:
+			if (_lvaps.get_pointer(e._addr)) {
+				remove_lvap(e._addr);
+			}
+			break;
+		case EMPOWER_SNAPSHOT_SLICES:
+			_eqms[e._iface_id]->del_slice(e._ssid, e._dscp);
+			break;
+		case EMPOWER_SNAPSHOT_PORTS:
+			_rcs[e._iface_id]->tx_policies()->remove(e._addr);
+			_rcs[e._iface_id]->forget_station(e._addr);
+			break;
+		}
+	}
+
+	_restored.clear();
+
+	compute_bssid_mask();
+
+}
+
+static const char * const restart_names[] = { "cold", "pending", "confirmed", "discarded" };
+
+String EmpowerLVAPManager::unparse_snapshot() {
+	StringAccum sa;
+	sa << "file " << _snapshot_file << "\n";
+	sa << "restart " << restart_names[_restart] << "\n";
+	sa << "epoch " << _epoch << "\n";
+	sa << "saves " << _snapshot_saves << "\n";
+	sa << "unchanged " << _snapshot_unchanged << "\n";
+	sa << "bytes " << _snapshot_length << "\n";
+	sa << "restored " << _restored_lvaps << " lvaps " << _restored_vaps << " vaps "
+	   << _restored_slices << " slices " << _restored_ports << " ports "
+	   << _restored_rates << " rates\n";
+	sa << "load_usec " << _snapshot_load_time.usecval() << "\n";
+	return sa.take_string();
+}
+
 enum {
 	H_BYTES,
 	H_DEBUG,
@@ -1822,6 +3051,11 @@ enum {
 	H_DEL_LVAP,
 	H_RECONNECT,
 	H_INTERFACES,
+	H_PERF,
+	H_SNAPSHOT,
+	H_RESTART,
+	H_SAVE_SNAPSHOT,
+	H_HOLDS,
 };
 
 String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
@@ -1829,6 +3063,14 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 	switch ((uintptr_t) thunk) {
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
+	case H_PERF:
+		return td->unparse_perf();
+	case H_SNAPSHOT:
+		return td->unparse_snapshot();
+	case H_HOLDS:
+		return td->unparse_held();
+	case H_RESTART:
+		return String(restart_names[td->_restart]) + "\n";
 	case H_MASKS: {
 	    StringAccum sa;
 	    for (int i = 0; i < td->_masks.size(); i++) {
@@ -1881,6 +3123,8 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 			} else {
 				sa << "False";
 			}
+			sa << " airtime ";
+			sa << it.value()._tx_airtime;
 			sa << "\n";
 		}
 		return sa.take_string();
@@ -1963,6 +3207,14 @@ int EmpowerLVAPManager::write_handler(const String &in_s, Element *e,
 		case H_RECONNECT: {
 			// clear triggers
 			f->_ers->clear_triggers();
+			break;
+		}
+		case H_SAVE_SNAPSHOT: {
+			if (!f->_snapshot_file)
+				return errh->error("no SNAPSHOT file");
+			// write even if nothing changed
+			f->_snapshot_saves = 0;
+			return f->save_snapshot(errh);
 		}
 	}
 	return 0;
@@ -1975,6 +3227,12 @@ void EmpowerLVAPManager::add_handlers() {
 	add_read_handler("masks", read_handler, (void *) H_MASKS);
 	add_read_handler("bytes", read_handler, (void *) H_BYTES);
 	add_read_handler("interfaces", read_handler, (void *) H_INTERFACES);
+	add_read_handler("perf", read_handler, (void *) H_PERF);
+	add_read_handler("snapshot", read_handler, (void *) H_SNAPSHOT);
+	add_read_handler("restart", read_handler, (void *) H_RESTART);
+	add_write_handler("save_snapshot", write_handler, (void *) H_SAVE_SNAPSHOT);
+	add_read_handler("holds", read_handler, (void *) H_HOLDS);
+	set_handler("lvaps_bin", Handler::f_read | Handler::f_read_param, snapshot_handler);
 	add_write_handler("reconnect", write_handler, (void *) H_RECONNECT);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
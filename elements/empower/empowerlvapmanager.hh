@@ -6,8 +6,10 @@
 #include <click/etheraddress.hh>
 #include <click/ipaddress.hh>
 #include <click/hashtable.hh>
-#include <clicknet/wifi.h>
 #include <click/sync.hh>
+#include <click/atomic.hh>
+#include <clicknet/wifi.h>
+#include "empowerlock.hh"
 #include "minstrel.hh"
 #include "empowerrxstats.hh"
 #include "empowerpacket.hh"
@@ -45,8 +47,10 @@ An EmpowerAssociationResponder element
 =item DEBUGFS
 The path to the bssid_extra file
 
-=item EPSB
-An EmpowerPowerSaveBuffer element
+=item EPSBS
+Space separated list of EmpowerPowerSaveBuffer elements, one per
+interface, whose buffered frames are announced in the TIM of the
+beacons. Optional.
 
 =item PERIOD
 Interval between hello messages to the Access Controller (in msec), default is 5000
@@ -57,11 +61,79 @@ An EmpowerDeAuthResponder element
 =item EDISASSOR
 An EmpowerDisassocResponder element
 
+=item SNAPSHOT
+File the LVAPs, VAPs, slices, transmission policies and Minstrel tables
+are saved to, every SNAPSHOT_PERIOD and when the router stops, so that a
+restarted agent can pick up where it left off. The file is written
+through a memory mapping to a temporary file that is then renamed over
+it, so it should live on a RAM backed filesystem: it is meant to survive
+agent restarts, not reboots. It is loaded by initialize(), and the state
+it holds is used right away but stays pending until the first hello
+response: it is kept if the controller epoch in the response is the one
+the state was saved under, and dropped otherwise, in which case the
+controller replays the state it wants. Default is no snapshot.
+
+=item SNAPSHOT_PERIOD
+Interval between snapshots (in msec), 0 for only on shutdown. Default is
+10000.
+
+=item HOLD_BYTES
+Downlink bytes held for each station in transition, 0 to disable. A
+station is in transition from the moment its LVAP is removed (DEL_LVAP or
+the end of a CSA) until HOLD_TIME later, while its LVAP is not yet valid
+on the interface its frames arrive on, and when the controller hands over
+frames for it before its ADD_LVAP. Frames arriving in the meantime, and
+those still queued for the station when its LVAP is removed, are held
+instead of dropped, and are queued again as soon as an ADD_LVAP makes the
+LVAP valid. Frames past HOLD_BYTES are dropped. Default is 65536.
+
+=item HOLD_TIME
+How long frames are held for a station (in msec). Default is 200.
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+When a DEL_LVAP has the EMPOWER_DEL_LVAP_EXPORT_FRAMES flag set, the
+frames held for the station are sent to the controller in HELD_FRAMES
+messages when the LVAP is removed and when HOLD_TIME expires, so that
+they can be handed over to the WTP the station moves to.
+
+=h holds read-only
+
+Stations frames are held for, with the frames, bytes and time left, and
+the frames held, released, exported, expired and dropped so far.
+
+=h snapshot read-only
+
+File, restart state, controller epoch, number of snapshots written and
+skipped because nothing had changed, size of the last one, and what was
+restored at startup and how long loading it took.
+
+=h restart read-only
+
+How the agent started: "cold" (no snapshot), "pending" (state restored,
+waiting for the controller), "confirmed" or "discarded".
+
+=h save_snapshot write-only
+
+Write the snapshot now.
+
+=h lvaps_bin read-only
+
+Binary snapshot of the LVAP table, see empowersnapshot.hh. Takes an
+optional "FIRST COUNT" parameter to read it in chunks.
+
+=h perf read-only
+
+When Click is configured with --enable-stats=2, the packets, push/pull
+calls, task runs and own cycles of every EmPOWER element (and Minstrel),
+with cycles/packet and packets/batch, followed by the acquisitions and
+the wait and hold cycles of the LVAP manager, RX stats and QoS manager
+locks. The same figures are sent to the controller in reply to a
+PERF_STATS_REQUEST.
+
 =a EmpowerLVAPManager
 */
 
@@ -80,6 +152,10 @@ enum empower_lvap_flags {
     EMPOWER_STATUS_LVAP_HT_CAPS = (1<<3),
 };
 
+enum empower_del_lvap_flags {
+    EMPOWER_DEL_LVAP_EXPORT_FRAMES = (1<<0),
+};
+
 enum empower_bands_types {
     EMPOWER_BT_L20 = 0x0,
     EMPOWER_BT_HT20 = 0x1,
@@ -106,7 +182,9 @@ typedef CBytes::iterator CBytesIter;
 
 class Minstrel;
 class EmpowerQOSManager;
+class SliceQueue;
 class EmpowerRegmon;
+class EmpowerPowerSaveBuffer;
 
 // An EmPOWER Virtual Access Point or VAP. This is an AP than
 // can be used by multiple clients (unlike the LVAP that is
@@ -157,6 +235,15 @@ public:
 	int _csa_switch_channel;
 	// ADD/DEL LVAP response entries
 	uint32_t _xid;
+	// Slice queue for each DSCP, maintained by EmpowerQOSManager
+	SliceQueue *_slice_queues[64];
+	// Airtime used in usec, from TX feedback
+	uint64_t _tx_airtime;
+	// Send the frames held once the LVAP is removed to the controller
+	bool _export_frames;
+	// ACs the station uses U-APSD for (bit i for AC i), from the WMM
+	// QoS Info of its last association request on this WTP
+	uint8_t _uapsd_acs;
 	bool is_valid(int iface_id) {
 		if (_iface_id != iface_id) {
 			return false;
@@ -238,8 +325,54 @@ inline bool operator==(const ResourceElement &a, const ResourceElement &b) {
 }
 
 typedef HashTable<int, ResourceElement *> RETable;
+
+enum empower_restart_state {
+	EMPOWER_RESTART_COLD = 0x0,
+	EMPOWER_RESTART_PENDING = 0x1,
+	EMPOWER_RESTART_CONFIRMED = 0x2,
+	EMPOWER_RESTART_DISCARDED = 0x3,
+};
+
+// An entry restored from the warm restart snapshot, dropped again if the
+// controller does not confirm the snapshot
+class RestoredEntry {
+public:
+	uint8_t _type; // see empower_snapshot_types
+	int _iface_id;
+	EtherAddress _addr;
+	String _ssid;
+	int _dscp;
+	RestoredEntry(uint8_t type, int iface_id, EtherAddress addr, String ssid = String(), int dscp = 0) :
+			_type(type), _iface_id(iface_id), _addr(addr), _ssid(ssid), _dscp(dscp) {
+	}
+};
 typedef RETable::const_iterator REIter;
 
+// Downlink frames held for a station in transition
+class HeldFrames {
+public:
+	Vector<Packet *> _frames;
+	uint32_t _bytes;
+	Timestamp _expiry;
+	bool _export;
+	HeldFrames() : _bytes(0), _export(false) {
+	}
+};
+
+typedef HashTable<EtherAddress, HeldFrames> HeldFramesTable;
+typedef HeldFramesTable::iterator HFIter;
+
+// Data-path cost of an element as accounted by Click with --enable-stats=2
+class PerfElement {
+public:
+	String _name;
+	String _class;
+	uint64_t _packets;
+	uint64_t _xfer_calls;
+	uint64_t _task_calls;
+	uint64_t _cycles;
+};
+
 class EmpowerLVAPManager: public Element {
 public:
 
@@ -252,6 +385,7 @@ public:
 
 	int initialize(ErrorHandler *);
 	int configure(Vector<String> &, ErrorHandler *);
+	void cleanup(CleanupStage);
 	void add_handlers();
 	void run_timer(Timer *);
 	void reset();
@@ -287,6 +421,8 @@ public:
 	int handle_slice_stats_request(Packet *, uint32_t);
 	int handle_slice_status_request(Packet *, uint32_t);
 	int handle_port_status_request(Packet *, uint32_t);
+	int handle_perf_stats_request(Packet *, uint32_t);
+	int handle_held_frames(Packet *, uint32_t);
 
 	void send_hello_request();
 	void send_probe_request(uint32_t iface_id, EtherAddress src, String ssid, bool ht_caps, uint16_t ht_caps_info);
@@ -299,7 +435,8 @@ public:
 	void send_counters_response(EtherAddress sta, uint32_t xid);
 	void send_txp_counters_response(uint32_t iface_id, uint32_t xid, EtherAddress mcast);
 	void send_img_response(uint32_t iface_id, int type, uint32_t xid);
-	void send_wifi_stats_response(uint32_t iface_id, uint32_t xid);
+	void send_wifi_stats_response(uint32_t iface_id, uint32_t xid, uint64_t since = 0);
+	void send_wifi_stats_rollup_response(uint32_t iface_id, uint32_t xid, uint64_t since, uint32_t resolution);
 	void send_caps_response();
 	void send_rssi_trigger(uint32_t iface_id, uint32_t xid, uint8_t current);
 	void send_summary_trigger(SummaryTrigger * summary);
@@ -308,8 +445,13 @@ public:
 	void send_igmp_report(EtherAddress, Vector<IPAddress>*, Vector<enum empower_igmp_record_type>*);
 	void send_add_del_lvap_response(uint8_t type, EtherAddress sta, uint32_t xid, uint32_t status);
 	void send_slice_stats_response(String ssid, uint8_t dscp, uint32_t xid);
+	void send_perf_stats_response(uint32_t xid);
+	void send_held_frames(EtherAddress sta, Vector<Packet *> &frames);
+
+	void hold_frame(EtherAddress sta, Packet *p, bool start = false);
+	void release_held(EmpowerStationState *);
 
-	ReadWriteLock* lock() { return &_lock; }
+	EmpowerRWLock* lock() { return &_lock; }
 	LVAP* lvaps() { return &_lvaps; }
 	VAP* vaps() { return &_vaps; }
 	EtherAddress wtp() { return _wtp; }
@@ -318,18 +460,37 @@ public:
 
 	int remove_lvap(EtherAddress sta) {
 
+		Vector<Packet *> frames;
+
+		_lock.acquire_write();
+
 		EmpowerStationState *ess = _lvaps.get_pointer(sta);
 
+		if (!ess) {
+			_lock.release_write();
+			return -1;
+		}
+
+		// Hold the frames still queued for it, and those yet to come
+		hold_lvap(ess, frames);
+
 		// Forget station
-		_rcs[ess->_iface_id]->tx_policies()->tx_table()->erase(ess->_sta);
-		_rcs[ess->_iface_id]->forget_station(ess->_sta);
+		_rcs[ess->_iface_id]->tx_policies()->tx_table()->erase(sta);
+		_rcs[ess->_iface_id]->forget_station(sta);
 
 		// Erase lvap
-		_lvaps.erase(_lvaps.find(ess->_sta));
+		_lvaps.erase(sta);
 
 		// Remove this VAP's BSSID from the mask
 		compute_bssid_mask();
 
+		_lock.release_write();
+
+		// Hand the frames over to the controller
+		if (frames.size()) {
+			send_held_frames(sta, frames);
+		}
+
 		return 0;
 
 	}
@@ -342,6 +503,10 @@ public:
 		return _lvaps.get_pointer(sta);
 	}
 
+	EmpowerPowerSaveBuffer * get_epsb(int iface_id) {
+		return iface_id < _epsbs.size() ? _epsbs[iface_id] : 0;
+	}
+
 	TxPolicyInfo * get_txp(EtherAddress sta) {
 		EmpowerStationState *ess = _lvaps.get_pointer(sta);
 		if (!ess) {
@@ -374,7 +539,7 @@ public:
 
 private:
 
-	ReadWriteLock _lock;
+	EmpowerRWLock _lock;
 
 	RETable _ifaces;
 
@@ -384,6 +549,10 @@ private:
 	void compute_bssid_mask();
 	void send_message(Packet *);
 
+	void perf_elements(Vector<PerfElement> &);
+	void perf_locks(Vector<String> &, Vector<EmpowerRWLock *> &);
+	String unparse_perf();
+
 	class Empower11k *_e11k;
 	class EmpowerBeaconSource *_ebs;
 	class EmpowerOpenAuthResponder *_eauthr;
@@ -398,13 +567,65 @@ private:
 	Vector<Minstrel *> _rcs;
 	Vector<EmpowerRegmon *> _regmons;
 	Vector<EmpowerQOSManager *> _eqms;
+	Vector<EmpowerPowerSaveBuffer *> _epsbs;
 	Vector<String> _debugfs_strings;
 	uint32_t _seq;
 	EtherAddress _wtp;
 	bool _debug;
 
+	String snapshot_lvaps(uint32_t, uint32_t);
+	String snapshot_vaps();
+	String snapshot_networks();
+	String snapshot_ports(int);
+	String snapshot_port_rates(int);
+
+	// handover holding buffers
+	uint32_t _hold_bytes;
+	unsigned int _hold_time; // msecs
+	Timer _hold_timer;
+	SimpleSpinlock _hold_lock;
+	HeldFramesTable _held;
+	atomic_uint32_t _held_stas;	// entries in _held, read without _hold_lock
+	uint32_t _held_frames;
+	uint32_t _released_frames;
+	uint32_t _exported_frames;
+	uint32_t _expired_frames;
+	uint32_t _hold_drops;
+
+	void hold_lvap(EmpowerStationState *, Vector<Packet *> &);
+	void expire_held();
+	String unparse_held();
+
+	// warm restart
+	String _snapshot_file;
+	unsigned int _snapshot_period; // msecs
+	Timer _snapshot_timer;
+	empower_restart_state _restart;
+	uint32_t _epoch;
+	bool _restoring;
+	Vector<RestoredEntry> _restored;
+	uint32_t _snapshot_saves;
+	uint32_t _snapshot_unchanged;
+	uint32_t _snapshot_length;
+	uint32_t _snapshot_crc;
+	uint32_t _snapshot_epoch;
+	uint32_t _restored_lvaps;
+	uint32_t _restored_vaps;
+	uint32_t _restored_slices;
+	uint32_t _restored_ports;
+	uint32_t _restored_rates;
+	Timestamp _snapshot_load_time;
+
+	String state_image();
+	int save_snapshot(ErrorHandler *);
+	int load_snapshot(ErrorHandler *);
+	void restore_snapshot(class StateReader &);
+	void discard_snapshot();
+	String unparse_snapshot();
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
+	static int snapshot_handler(int, String &, Element *, const Handler *, ErrorHandler *);
 
 };
 
@@ -33,7 +33,7 @@
 CLICK_DECLS
 
 EmpowerOpenAuthResponder::EmpowerOpenAuthResponder() :
-		_el(0), _debug(false) {
+		_el(0), _debug(false), _template(0) {
 }
 
 EmpowerOpenAuthResponder::~EmpowerOpenAuthResponder() {
@@ -48,6 +48,56 @@ int EmpowerOpenAuthResponder::configure(Vector<String> &conf,
 
 }
 
+int EmpowerOpenAuthResponder::initialize(ErrorHandler *errh) {
+
+	int len = sizeof(struct click_wifi) + 2 + /* alg */
+		2 + /* seq */
+		2 + /* status */
+		0;
+
+	WritablePacket *p = Packet::make(len);
+
+	if (p == 0)
+		return errh->error("cannot make packet!");
+
+	memset(p->data(), 0, p->length());
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+
+	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT | WIFI_FC0_SUBTYPE_AUTH;
+	w->i_fc[1] = WIFI_FC1_DIR_NODS;
+
+	/* addresses are set for each response */
+
+	w->i_dur = 0;
+	w->i_seq = 0;
+
+	uint8_t *ptr;
+
+	ptr = (uint8_t *) p->data() + sizeof(struct click_wifi);
+
+	*(uint16_t *) ptr = cpu_to_le16(WIFI_AUTH_ALG_OPEN);
+	ptr += 2;
+
+	*(uint16_t *) ptr = cpu_to_le16(2); /* seq */
+	ptr += 2;
+
+	*(uint16_t *) ptr = cpu_to_le16(WIFI_STATUS_SUCCESS);
+	ptr += 2;
+
+	_template = p;
+
+	return 0;
+
+}
+
+void EmpowerOpenAuthResponder::cleanup(CleanupStage) {
+	if (_template) {
+		_template->kill();
+		_template = 0;
+	}
+}
+
 void EmpowerOpenAuthResponder::push(int, Packet *p) {
 
 	if (p->length() < sizeof(struct click_wifi)) {
@@ -177,55 +227,30 @@ void EmpowerOpenAuthResponder::send_auth_response(EtherAddress dst) {
     EmpowerStationState *ess = _el->get_ess(dst);
 	EtherAddress bssid = ess->_bssid;
 	int iface_id = ess->_iface_id;
-	uint16_t seq = 2;
-	uint16_t status = WIFI_STATUS_SUCCESS;
 
 	if (_debug) {
+		// the template always carries the second frame of the exchange
 		click_chatter("%{element} :: %s :: authentication %s bssid %s sequence number %u status %u",
 				      this,
 				      __func__,
 				      dst.unparse().c_str(),
 					  bssid.unparse().c_str(),
-				      seq,
-				      status);
+				      2,
+				      WIFI_STATUS_SUCCESS);
 
 	}
 
-	int len = sizeof(struct click_wifi) + 2 + /* alg */
-		2 + /* seq */
-		2 + /* status */
-		0;
-
-	WritablePacket *p = Packet::make(len);
+	WritablePacket *p = Packet::make(_template->data(), _template->length());
 
 	if (p == 0)
 		return;
 
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
-	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT | WIFI_FC0_SUBTYPE_AUTH;
-	w->i_fc[1] = WIFI_FC1_DIR_NODS;
-
 	memcpy(w->i_addr1, dst.data(), 6);
 	memcpy(w->i_addr2, bssid.data(), 6);
 	memcpy(w->i_addr3, bssid.data(), 6);
 
-	w->i_dur = 0;
-	w->i_seq = 0;
-
-	uint8_t *ptr;
-
-	ptr = (uint8_t *) p->data() + sizeof(struct click_wifi);
-
-	*(uint16_t *) ptr = cpu_to_le16(WIFI_AUTH_ALG_OPEN);
-	ptr += 2;
-
-	*(uint16_t *) ptr = cpu_to_le16(seq);
-	ptr += 2;
-
-	*(uint16_t *) ptr = cpu_to_le16(status);
-	ptr += 2;
-
 	_el->send_status_lvap(dst);
 	SET_PAINT_ANNO(p, iface_id);
 	output(0).push(p);
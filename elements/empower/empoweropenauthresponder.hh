@@ -16,6 +16,9 @@ Respond to 802.11 open authentication requests.
 
 =d
 
+All successful open authentication responses are the same but for the
+addresses, so they are copied from a template built at initialization.
+
 Keyword arguments are:
 
 =over 8
@@ -45,6 +48,8 @@ public:
 	const char *processing() const { return PUSH; }
 
 	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
+	void cleanup(CleanupStage);
 	void add_handlers();
 	void send_auth_response(EtherAddress);
 	void push(int, Packet *);
@@ -55,6 +60,8 @@ private:
 
 	bool _debug;
 
+	Packet *_template;
+
 	static String read_handler(Element *e, void *user_data);
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 
@@ -64,6 +64,7 @@ enum empower_packet_types {
     EMPOWER_PT_NCQM_RESPONSE = 0x43,                // wtp -> ac
 
     // wifi stats
+    EMPOWER_PT_WIFI_STATS_ROLLUP_RESPONSE = 0x49,   // wtp -> ac
     EMPOWER_PT_WIFI_STATS_REQUEST = 0x4A,           // ac -> wtp
     EMPOWER_PT_WIFI_STATS_RESPONSE = 0x4B,          // wtp -> ac
 
@@ -71,6 +72,10 @@ enum empower_packet_types {
     EMPOWER_PT_SLICE_STATS_REQUEST = 0x4C,   		// ac -> wtp
     EMPOWER_PT_SLICE_STATS_RESPONSE = 0x4D,  		// wtp -> ac
 
+    // Data-path cycle and lock accounting
+    EMPOWER_PT_PERF_STATS_REQUEST = 0x4E,   		// ac -> wtp
+    EMPOWER_PT_PERF_STATS_RESPONSE = 0x4F,  		// wtp -> ac
+
 	/* Primitives 0x80 - 0xCF*/
 
     // Link Stats
@@ -100,6 +105,9 @@ enum empower_packet_types {
     // IGMP messages
     EMPOWER_PT_IGMP_REPORT = 0xE0,                  // wtp -> ac
     EMPOWER_PT_INCOMING_MCAST_ADDRESS = 0xE1,       // wtp -> ac
+
+    // Handover messages
+    EMPOWER_PT_HELD_FRAMES = 0xE2,                  // wtp <-> ac
 };
 
 /* header format, common to all messages */
@@ -130,16 +138,20 @@ struct empower_header {
 struct empower_hello_request : public empower_header {
   private:
     uint32_t _period;         /* Hello period in ms (int) */
+    uint32_t _epoch;          /* Controller epoch of the WTP state, 0 if none (int) */
   public:
     void set_period(uint32_t period) { _period = htonl(period); }
+    void set_epoch(uint32_t epoch)   { _epoch = htonl(epoch); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
-/* hello response packet format */
+/* hello response packet format, older controllers send it without the epoch */
 struct empower_hello_response : public empower_header {
   private:
     uint32_t _period;         /* Hello period in ms (int) */
+    uint32_t _epoch;          /* Controller epoch (int) */
   public:
     uint32_t period()  { return ntohl(_period); }
+    uint32_t epoch()   { return ntohl(_epoch); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* probe request packet format */
@@ -280,9 +292,13 @@ struct lvap_stats_entry {
 /* wifi stats request packet format */
 struct empower_wifi_stats_request : public empower_header {
   private:
-    uint32_t _iface_id; /* sequence number */
+    uint32_t _iface_id;   /* sequence number */
+    uint64_t _since;      /* Only samples newer than this, in microseconds (int) */
+    uint32_t _resolution; /* Rollup resolution in ms, 0 for raw samples (int) */
   public:
-    uint32_t iface_id() { return ntohl(_iface_id); }
+    uint32_t iface_id()   { return ntohl(_iface_id); }
+    uint64_t since()      { return be64toh(_since); }
+    uint32_t resolution() { return ntohl(_resolution); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* wifi stats entry format */
@@ -307,6 +323,36 @@ struct empower_wifi_stats_response : public empower_header {
     void set_nb_entries(uint16_t nb_entries) { _nb_entries = htons(nb_entries); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* wifi stats rollup entry format */
+struct wifi_stats_rollup_entry {
+  private:
+      uint8_t  _type;       /* Register (empower_regmon_types) */
+      uint64_t _timestamp;  /* Start of the window in microseconds (int) */
+      uint32_t _count;      /* Valid samples in the window (int) */
+      uint32_t _min;        /* Minimum sample (int) */
+      uint32_t _avg;        /* Average sample (int) */
+      uint32_t _max;        /* Maximum sample (int) */
+  public:
+    void set_type(uint8_t type)                         { _type = type; }
+    void set_timestamp(uint64_t timestamp)              { _timestamp = htobe64(timestamp); }
+    void set_count(uint32_t count)                      { _count = htonl(count); }
+    void set_min(uint32_t min)                          { _min = htonl(min); }
+    void set_avg(uint32_t avg)                          { _avg = htonl(avg); }
+    void set_max(uint32_t max)                          { _max = htonl(max); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* wifi stats rollup response packet format */
+struct empower_wifi_stats_rollup_response : public empower_header {
+  private:
+    uint32_t _iface_id;       /* sequence number */
+    uint32_t _resolution;     /* Window of each entry in ms (int) */
+    uint16_t _nb_entries;     /* Int */
+  public:
+    void set_iface_id(uint32_t iface_id)     { _iface_id = htonl(iface_id); }
+    void set_resolution(uint32_t resolution) { _resolution = htonl(resolution); }
+    void set_nb_entries(uint16_t nb_entries) { _nb_entries = htons(nb_entries); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* channel quality map request packet format */
 struct empower_cqm_request : public empower_header {
   private:
@@ -385,6 +431,15 @@ struct empower_txp_counters_response : public empower_header {
     void set_nb_tx(uint16_t nb_tx) { _nb_tx = htons(nb_tx); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* txp counters unsolicited retries, optional, follows the tx entries
+ * when length() extends past them */
+struct empower_txp_counters_ur {
+  private:
+    uint16_t _nb_ur;          /* Int */
+  public:
+    void set_nb_ur(uint16_t nb_ur) { _nb_ur = htons(nb_ur); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* counters entry format */
 struct counters_entry {
   private:
@@ -436,11 +491,13 @@ struct empower_del_lvap : public empower_header {
     uint8_t _csa_switch_mode;
     uint8_t _csa_switch_count;
     uint8_t _csa_switch_channel;  /* WiFi channel (int) */
+    uint8_t _flags;               /* Flags (empower_del_lvap_flags), optional */
   public:
     EtherAddress sta()              { return EtherAddress(_sta); }
     uint8_t csa_switch_mode()       { return _csa_switch_mode; }
     uint8_t csa_switch_count()      { return _csa_switch_count; }
     uint8_t csa_switch_channel()    { return _csa_switch_channel; }
+    bool    flag(int f)             { return length() >= sizeof(empower_del_lvap) && (_flags & f); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* lvap add/del response packet format */
@@ -540,11 +597,13 @@ struct empower_add_rssi_trigger: public empower_header {
     uint8_t  _relation; /* Relation (relation_t) */
     int8_t   _value;        /* RSSI value in dBm (int) */
     uint16_t _period;       /* Reporting period in ms (int) */
+    uint8_t  _estimator;    /* RSSI estimator (empower_rssi_estimator) */
   public:
     EtherAddress sta()    { return EtherAddress(_sta); }
     uint8_t relation()    { return _relation; }
     int8_t value()        { return _value; }
     uint16_t period()     { return ntohs(_period); }
+    uint8_t estimator()   { return _estimator; }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* del rssi trigger packet format */
@@ -678,6 +737,10 @@ struct empower_set_slice : public empower_header {
     uint8_t     _flags;         			/* Flags (empower_slice_flags) */
     uint32_t    _quantum;       			/* Priority of the slice (int) */
     char        _ssid[WIFI_NWID_MAXSIZE+1];	/* Null terminated SSID */
+    uint32_t    _max_rate;      			/* Rate limit in bytes/s, 0 if unlimited (int) */
+    uint32_t    _max_burst;     			/* Rate burst in bytes (int) */
+    uint32_t    _max_airtime;   			/* Airtime limit in usec/s, 0 if unlimited (int) */
+    uint32_t    _max_airtime_burst;			/* Airtime burst in usec (int) */
   public:
     uint32_t     iface_id()             { return ntohl(_iface_id); }
     uint8_t      dscp()          		{ return _dscp; }
@@ -685,6 +748,10 @@ struct empower_set_slice : public empower_header {
     bool         flags(int f)    		{ return _flags & f; }
     uint32_t     quantum()       		{ return ntohl(_quantum); }
     String       ssid()          		{ return String((char *) _ssid); }
+    uint32_t     max_rate()      		{ return ntohl(_max_rate); }
+    uint32_t     max_burst()     		{ return ntohl(_max_burst); }
+    uint32_t     max_airtime()   		{ return ntohl(_max_airtime); }
+    uint32_t     max_airtime_burst()	{ return ntohl(_max_airtime_burst); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 struct empower_del_slice : public empower_header {
@@ -707,6 +774,11 @@ struct empower_status_slice : public empower_header {
     uint8_t     _flags;         			/* Flags (empower_slice_flags) */
     uint32_t    _quantum;       			/* Priority of the slice (int) */
     char        _ssid[WIFI_NWID_MAXSIZE+1];	/* Null terminated SSID */
+    uint32_t    _max_rate;      			/* Rate limit in bytes/s, 0 if unlimited (int) */
+    uint32_t    _max_burst;     			/* Rate burst in bytes (int) */
+    uint32_t    _max_airtime;   			/* Airtime limit in usec/s, 0 if unlimited (int) */
+    uint32_t    _max_airtime_burst;			/* Airtime burst in usec (int) */
+    uint32_t    _throttled;     			/* Times the slice ran out of tokens (int) */
   public:
     void set_iface_id(uint32_t iface_id)        				{ _iface_id = htonl(iface_id); }
     void set_dscp(uint8_t dscp)                 				{ _dscp = dscp; }
@@ -714,6 +786,11 @@ struct empower_status_slice : public empower_header {
     void set_flag(uint16_t f)                  					{ _flags = _flags | f; }
     void set_quantum(uint32_t quantum)          				{ _quantum = htonl(quantum); }
     void set_ssid(String ssid)                  				{ memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length()); }
+    void set_max_rate(uint32_t max_rate)        				{ _max_rate = htonl(max_rate); }
+    void set_max_burst(uint32_t max_burst)      				{ _max_burst = htonl(max_burst); }
+    void set_max_airtime(uint32_t max_airtime)  				{ _max_airtime = htonl(max_airtime); }
+    void set_max_airtime_burst(uint32_t max_airtime_burst)		{ _max_airtime_burst = htonl(max_airtime_burst); }
+    void set_throttled(uint32_t throttled)      				{ _throttled = htonl(throttled); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* slice stats request packet format */
@@ -742,6 +819,15 @@ struct empower_slice_stats_entry {
     void set_tx_bytes(uint32_t tx_bytes)                    { _tx_bytes = htonl(tx_bytes); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* slice queue airtime, optional, one per entry in the same order, follows
+ * the entries when length() extends past them */
+struct empower_slice_stats_airtime {
+  private:
+    uint64_t    _tx_airtime;        			/* Airtime used from TX feedback in usec (int) */
+  public:
+    void set_tx_airtime(uint64_t tx_airtime)                { _tx_airtime = htobe64(tx_airtime); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* slice stats response packet format */
 struct empower_slice_stats_response : public empower_header {
   private:
@@ -754,5 +840,69 @@ struct empower_slice_stats_response : public empower_header {
     void set_nb_entries(uint16_t nb_entries)       	{ _nb_entries = htons(nb_entries); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* perf stats request packet format */
+struct empower_perf_stats_request : public empower_header {
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+#define EMPOWER_PERF_NAME_SIZE 32
+
+/* perf stats element entry format */
+struct perf_element_entry {
+  private:
+    char        _name[EMPOWER_PERF_NAME_SIZE];  /* Null terminated element name */
+    uint64_t    _packets;                       /* Packets received (int) */
+    uint64_t    _xfer_calls;                    /* Push and pull calls (int) */
+    uint64_t    _task_calls;                    /* Task runs (int) */
+    uint64_t    _cycles;                        /* Cycles spent in the element (int) */
+  public:
+    void set_name(String name)                  { memset(_name, 0, EMPOWER_PERF_NAME_SIZE); memcpy(_name, name.data(), name.length() < EMPOWER_PERF_NAME_SIZE ? name.length() : EMPOWER_PERF_NAME_SIZE - 1); }
+    void set_packets(uint64_t packets)          { _packets = htobe64(packets); }
+    void set_xfer_calls(uint64_t xfer_calls)    { _xfer_calls = htobe64(xfer_calls); }
+    void set_task_calls(uint64_t task_calls)    { _task_calls = htobe64(task_calls); }
+    void set_cycles(uint64_t cycles)            { _cycles = htobe64(cycles); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* perf stats lock entry format */
+struct perf_lock_entry {
+  private:
+    char        _name[EMPOWER_PERF_NAME_SIZE];  /* Null terminated name of the owning element */
+    uint64_t    _reads;                         /* Read acquisitions (int) */
+    uint64_t    _writes;                        /* Write acquisitions (int) */
+    uint64_t    _wait_cycles;                   /* Cycles spent acquiring (int) */
+    uint64_t    _hold_cycles;                   /* Cycles spent holding (int) */
+  public:
+    void set_name(String name)                  { memset(_name, 0, EMPOWER_PERF_NAME_SIZE); memcpy(_name, name.data(), name.length() < EMPOWER_PERF_NAME_SIZE ? name.length() : EMPOWER_PERF_NAME_SIZE - 1); }
+    void set_reads(uint64_t reads)              { _reads = htobe64(reads); }
+    void set_writes(uint64_t writes)            { _writes = htobe64(writes); }
+    void set_wait_cycles(uint64_t wait_cycles)  { _wait_cycles = htobe64(wait_cycles); }
+    void set_hold_cycles(uint64_t hold_cycles)  { _hold_cycles = htobe64(hold_cycles); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* perf stats response packet format, followed by the element entries and
+ * then by the lock entries */
+struct empower_perf_stats_response : public empower_header {
+  private:
+    uint8_t     _enabled;       /* 1 if the WTP was built with --enable-stats=2 (bool) */
+    uint16_t    _nb_elements;   /* Int */
+    uint16_t    _nb_locks;      /* Int */
+  public:
+    void set_enabled(uint8_t enabled)           { _enabled = enabled; }
+    void set_nb_elements(uint16_t nb_elements)  { _nb_elements = htons(nb_elements); }
+    void set_nb_locks(uint16_t nb_locks)        { _nb_locks = htons(nb_locks); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* held frames packet format, followed by nb_frames entries each made of a
+ * 16 bit length and an Ethernet frame */
+struct empower_held_frames : public empower_header {
+  private:
+    uint8_t     _sta[6];        /* EtherAddress */
+    uint16_t    _nb_frames;     /* Int */
+  public:
+    EtherAddress sta()                      { return EtherAddress(_sta); }
+    uint16_t nb_frames()                    { return ntohs(_nb_frames); }
+    void set_sta(EtherAddress sta)          { memcpy(_sta, sta.data(), 6); }
+    void set_nb_frames(uint16_t nb_frames)  { _nb_frames = htons(nb_frames); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 CLICK_ENDDECLS
 #endif /* CLICK_EMPOWERPACKET_HH */
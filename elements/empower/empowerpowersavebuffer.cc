@@ -0,0 +1,432 @@
+/*
+ * empowerpowersavebuffer.{cc,hh} -- buffers frames for stations in power save mode
+ * Roberto Riggio
+ *
+ * Copyright (c) 2017 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerpowersavebuffer.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <clicknet/wifi.h>
+#include "empowerlvapmanager.hh"
+CLICK_DECLS
+
+// frames of dozing stations pulled and buffered at most in one pull
+#define EMPOWER_PS_PULL_BURST 8
+
+// AIDs range from 1 to 2007, one bit each in the virtual bitmap
+#define EMPOWER_PS_MAX_AID 2007
+
+// all four ACs, bit i for AC i
+#define EMPOWER_PS_ALL_ACS 0x0F
+
+// access category of a frame, from the TID of QoS data frames
+static int frame_ac(Packet *p) {
+	static const int tid_ac[8] = { AC_BE, AC_BK, AC_BK, AC_BE, AC_VI, AC_VI, AC_VO, AC_VO };
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	if ((w->i_fc[0] & WIFI_FC0_TYPE_MASK) != WIFI_FC0_TYPE_DATA
+			|| !(w->i_fc[0] & WIFI_FC0_SUBTYPE_QOS)
+			|| p->length() < sizeof(struct click_wifi) + sizeof(struct click_qos_control)) {
+		return AC_BE;
+	}
+	struct click_qos_control *qos = (struct click_qos_control *) (p->data() + sizeof(struct click_wifi));
+	// TIDs 8-15 belong to TSPECs, which are not set up
+	return tid_ac[(le16_to_cpu(qos->qos_control) & WIFI_QOS_CONTROL_QOS_TID_MASK) % 8];
+}
+
+EmpowerPowerSaveBuffer::EmpowerPowerSaveBuffer() :
+		_el(0), _iface_id(0), _capacity(64), _lifetime(1000), _debug(false),
+		_dozing(0), _notifier(Notifier::SEARCH_CONTINUE_WAKE), _timer(this),
+		_buffered(0), _released_frames(0), _expired(0), _drops(0) {
+}
+
+EmpowerPowerSaveBuffer::~EmpowerPowerSaveBuffer() {
+}
+
+void *EmpowerPowerSaveBuffer::cast(const char *n) {
+	if (strcmp(n, Notifier::EMPTY_NOTIFIER) == 0) {
+		return &_notifier;
+	}
+	return Element::cast(n);
+}
+
+int EmpowerPowerSaveBuffer::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	_notifier.initialize(Notifier::EMPTY_NOTIFIER, router());
+
+	int res = Args(conf, this, errh)
+			.read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
+			.read_m("IFACE_ID", _iface_id)
+			.read("CAPACITY", _capacity)
+			.read("LIFETIME", _lifetime)
+			.read("DEBUG", _debug)
+			.complete();
+
+	if (res >= 0 && !_capacity) {
+		return errh->error("CAPACITY must be positive");
+	}
+
+	return res;
+
+}
+
+int EmpowerPowerSaveBuffer::initialize(ErrorHandler *) {
+	_upstream_signal = Notifier::upstream_empty_signal(this, 0, &_notifier);
+	_timer.initialize(this);
+	_timer.schedule_after_msec(_lifetime / 2 + 1);
+	return 0;
+}
+
+void EmpowerPowerSaveBuffer::cleanup(CleanupStage) {
+	for (PSSIter it = _stations.begin(); it.live(); it++) {
+		for (int i = 0; i < it.value()._frames.size(); i++) {
+			it.value()._frames[i]._p->kill();
+		}
+	}
+	_stations.clear();
+	for (int i = 0; i < _released.size(); i++) {
+		_released[i]->kill();
+	}
+	_released.clear();
+}
+
+bool EmpowerPowerSaveBuffer::buffer(Packet *p) {
+
+	// no station is dozing, the common case
+	if (!_dozing || p->length() < sizeof(struct click_wifi)) {
+		return false;
+	}
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	EtherAddress ra = EtherAddress(w->i_addr1);
+
+	if (ra.is_group()) {
+		return false;
+	}
+
+	_lock.acquire();
+
+	PowerSaveStation *st = _stations.get_pointer(ra);
+
+	if (!st || !st->_dozing) {
+		_lock.release();
+		return false;
+	}
+
+	if ((uint32_t) st->_frames.size() >= _capacity) {
+		_drops++;
+		_lock.release();
+		p->kill();
+		return true;
+	}
+
+	st->_frames.push_back(PowerSaveFrame(p, Timestamp::now_steady()));
+	_buffered++;
+
+	_lock.release();
+
+	return true;
+
+}
+
+void EmpowerPowerSaveBuffer::release(PowerSaveStation *st, uint32_t count, bool service_period, uint8_t acs) {
+
+	// called with _lock held, only the frames of acs are released
+	Vector<Packet *> out;
+	Vector<PowerSaveFrame> kept;
+	bool left = false;
+
+	for (int i = 0; i < st->_frames.size(); i++) {
+		bool match = acs & (1 << frame_ac(st->_frames[i]._p));
+		if (match && (uint32_t) out.size() < count) {
+			out.push_back(st->_frames[i]._p);
+		} else {
+			kept.push_back(st->_frames[i]);
+			left = left || match;
+		}
+	}
+
+	st->_frames.swap(kept);
+
+	for (int n = 1; n <= out.size(); n++) {
+
+		Packet *p = out[n - 1];
+
+		bool more = (n == out.size() && left);
+		bool eosp = (service_period && n == out.size());
+
+		if (more || eosp) {
+			WritablePacket *q = p->uniqueify();
+			if (!q) {
+				_drops++;
+				continue;
+			}
+			struct click_wifi *w = (struct click_wifi *) q->data();
+			if (more) {
+				w->i_fc[1] |= WIFI_FC1_MORE_DATA;
+			}
+			if (eosp && WIFI_QOS_HAS_SEQ(w) && q->length() >= sizeof(struct click_wifi) + sizeof(struct click_qos_control)) {
+				struct click_qos_control *qos = (struct click_qos_control *) (q->data() + sizeof(struct click_wifi));
+				qos->qos_control |= WIFI_QOS_CONTROL_QOS_EOSP_MASK;
+			}
+			p = q;
+		}
+
+		_released.push_back(p);
+		_released_frames++;
+
+	}
+
+	if (out.size()) {
+		_notifier.wake();
+	}
+
+}
+
+Packet *EmpowerPowerSaveBuffer::pull(int) {
+
+	if (_released.size()) {
+		Packet *p = 0;
+		_lock.acquire();
+		if (_released.size()) {
+			p = _released[0];
+			_released.pop_front();
+		}
+		_lock.release();
+		if (p) {
+			return p;
+		}
+	}
+
+	for (int i = 0; i < EMPOWER_PS_PULL_BURST; i++) {
+		Packet *p = input(0).pull();
+		if (!p) {
+			break;
+		}
+		if (!buffer(p)) {
+			return p;
+		}
+	}
+
+	// release() wakes the notifier up again under the same lock
+	_lock.acquire();
+	if (!_released.size() && !_upstream_signal) {
+		_notifier.sleep();
+	}
+	_lock.release();
+
+	return 0;
+
+}
+
+void EmpowerPowerSaveBuffer::push(int, Packet *p) {
+	uplink(p);
+	output(1).push(p);
+}
+
+void EmpowerPowerSaveBuffer::uplink(Packet *p) {
+
+	// a PS-Poll is 16 bytes long, up to the transmitter address
+	if (p->length() < 16) {
+		return;
+	}
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+
+	uint8_t type = w->i_fc[0] & WIFI_FC0_TYPE_MASK;
+	uint8_t subtype = w->i_fc[0] & WIFI_FC0_SUBTYPE_MASK;
+	bool pspoll = (type == WIFI_FC0_TYPE_CTL && subtype == WIFI_FC0_SUBTYPE_PS_POLL);
+
+	if (!pspoll && (p->length() < sizeof(struct click_wifi)
+			|| (type != WIFI_FC0_TYPE_DATA && type != WIFI_FC0_TYPE_MGT))) {
+		return;
+	}
+
+	EtherAddress ta = EtherAddress(w->i_addr2);
+	bool pm = w->i_fc[1] & WIFI_FC1_PWR_MGT;
+
+	// only frames from stations with an lvap on this interface count
+	EmpowerStationState *ess = _el->get_ess(ta);
+	if (!ess || ess->_iface_id != _iface_id) {
+		return;
+	}
+
+	// PS-Poll serves the other ACs, or all of them if every one is
+	// delivery-enabled
+	uint8_t uapsd_acs = ess->_uapsd_acs & EMPOWER_PS_ALL_ACS;
+	uint8_t pspoll_acs = (uapsd_acs == EMPOWER_PS_ALL_ACS) ? EMPOWER_PS_ALL_ACS : EMPOWER_PS_ALL_ACS & ~uapsd_acs;
+
+	_lock.acquire();
+
+	PowerSaveStation *st = _stations.get_pointer(ta);
+
+	if (pspoll) {
+		if (st && st->_dozing) {
+			st->_pspolls++;
+			release(st, 1, false, pspoll_acs);
+		}
+	} else if (pm) {
+		if (!st) {
+			st = &_stations.find_insert(ta).value();
+		}
+		if (!st->_dozing) {
+			st->_dozing = true;
+			_dozing++;
+			if (_debug) {
+				click_chatter("%{element} :: %s :: %s is dozing",
+						      this,
+						      __func__,
+						      ta.unparse().c_str());
+			}
+		} else if (type == WIFI_FC0_TYPE_DATA && (subtype & WIFI_FC0_SUBTYPE_QOS)
+				&& (uapsd_acs & (1 << frame_ac(p)))) {
+			// a U-APSD trigger, only from trigger-enabled ACs
+			st->_triggers++;
+			release(st, st->_frames.size(), true, uapsd_acs);
+		}
+	} else if (st && st->_dozing) {
+		st->_dozing = false;
+		_dozing--;
+		release(st, st->_frames.size(), false, EMPOWER_PS_ALL_ACS);
+		if (_debug) {
+			click_chatter("%{element} :: %s :: %s is awake",
+					      this,
+					      __func__,
+					      ta.unparse().c_str());
+		}
+	}
+
+	_lock.release();
+
+}
+
+void EmpowerPowerSaveBuffer::run_timer(Timer *) {
+
+	Timestamp now = Timestamp::now_steady();
+	Timestamp lifetime = Timestamp::make_msec(_lifetime);
+	Vector<EtherAddress> gone;
+
+	_lock.acquire();
+
+	for (PSSIter it = _stations.begin(); it.live(); it++) {
+		PowerSaveStation &st = it.value();
+		EmpowerStationState *ess = _el->get_ess(it.key());
+		bool here = (ess && ess->_iface_id == _iface_id);
+		// the station left, or its frames waited too long
+		while (st._frames.size() && (!here || now - st._frames[0]._since >= lifetime)) {
+			st._frames[0]._p->kill();
+			st._frames.pop_front();
+			_expired++;
+		}
+		if (!here) {
+			gone.push_back(it.key());
+		}
+	}
+
+	for (int i = 0; i < gone.size(); i++) {
+		if (_stations.get(gone[i])._dozing) {
+			_dozing--;
+		}
+		_stations.erase(gone[i]);
+	}
+
+	_lock.release();
+
+	_timer.reschedule_after_msec(_lifetime / 2 + 1);
+
+}
+
+int EmpowerPowerSaveBuffer::tim(EtherAddress bssid, uint8_t *ptr) {
+
+	uint8_t bitmap[EMPOWER_PS_MAX_AID / 8 + 1];
+	int first = sizeof(bitmap);
+	int last = -1;
+
+	memset(bitmap, 0, sizeof(bitmap));
+
+	_lock.acquire();
+
+	for (PSSIter it = _stations.begin(); it.live(); it++) {
+		if (!it.value()._frames.size()) {
+			continue;
+		}
+		EmpowerStationState *ess = _el->get_ess(it.key());
+		if (!ess || ess->_bssid != bssid || ess->_assoc_id < 1 || ess->_assoc_id > EMPOWER_PS_MAX_AID) {
+			continue;
+		}
+		int octet = ess->_assoc_id / 8;
+		bitmap[octet] |= 1 << (ess->_assoc_id % 8);
+		first = (octet < first) ? octet : first;
+		last = (octet > last) ? octet : last;
+	}
+
+	_lock.release();
+
+	ptr[0] = WIFI_ELEMID_TIM;
+	ptr[2] = 0; // dtim count
+	ptr[3] = 1; // dtim period
+
+	if (last < 0) {
+		ptr[1] = 4;
+		ptr[4] = 0; // bitmap control
+		ptr[5] = 0; // partial virtual bitmap
+		return 2 + 4;
+	}
+
+	// the partial virtual bitmap starts at an even octet, whose offset
+	// goes in bits 1-7 of the bitmap control, bit 0 is for group frames
+	first &= ~1;
+	ptr[1] = 3 + last - first + 1;
+	ptr[4] = first;
+	memcpy(ptr + 5, bitmap + first, last - first + 1);
+
+	return 2 + ptr[1];
+
+}
+
+enum {
+	H_STATIONS
+};
+
+String EmpowerPowerSaveBuffer::read_handler(Element *e, void *thunk) {
+	EmpowerPowerSaveBuffer *td = (EmpowerPowerSaveBuffer *) e;
+	switch ((uintptr_t) thunk) {
+	case H_STATIONS: {
+		StringAccum sa;
+		td->_lock.acquire();
+		for (PSSIter it = td->_stations.begin(); it.live(); it++) {
+			PowerSaveStation &st = it.value();
+			sa << it.key().unparse() << (st._dozing ? " dozing" : " awake")
+			   << " frames " << st._frames.size() << " pspolls " << st._pspolls
+			   << " triggers " << st._triggers << "\n";
+		}
+		sa << "buffered " << td->_buffered << " released " << td->_released_frames
+		   << " expired " << td->_expired << " drops " << td->_drops << "\n";
+		td->_lock.release();
+		return sa.take_string();
+	}
+	default:
+		return String();
+	}
+}
+
+void EmpowerPowerSaveBuffer::add_handlers() {
+	add_read_handler("stations", read_handler, (void *) H_STATIONS);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerPowerSaveBuffer)
+ELEMENT_REQUIRES(userlevel)
@@ -0,0 +1,171 @@
+#ifndef CLICK_EMPOWERPOWERSAVEBUFFER_HH
+#define CLICK_EMPOWERPOWERSAVEBUFFER_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/hashtable.hh>
+#include <click/notifier.hh>
+#include <click/sync.hh>
+#include <click/timer.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerPowerSaveBuffer(EL, IFACE_ID[, I<KEYWORDS>])
+
+=s EmPOWER
+
+Buffers the frames of stations in power save mode.
+
+=d
+
+Input and output 0 are pull: the 802.11 frames of one interface on their
+way from EmpowerQOSManager to the device. Input and output 1 are push:
+the frames received on that interface, which are passed through
+unchanged.
+
+A station dozes from the first data or management frame it sends with
+the power management bit set to the first one it sends with the bit
+clear. Unicast frames for a dozing station are taken out of the
+downlink and buffered, and the beacons sent by EmpowerBeaconSource carry
+a TIM with the station's association id set as long as frames are
+buffered for it. Buffered frames are released:
+
+=over 8
+
+=item *
+one at a time, on PS-Poll, with More Data set if more are left. PS-Poll
+serves the access categories the station does not use U-APSD for, or all
+of them if it uses U-APSD for every one.
+
+=item *
+all at once, on a QoS Data or QoS Null frame with the power management
+bit set whose access category the station uses U-APSD for (a U-APSD
+trigger), the last one with EOSP set. Only the frames of the U-APSD
+access categories are released. The access categories are those of the
+WMM QoS Info in the station's association request, both trigger- and
+delivery-enabled. Stations without U-APSD are served by PS-Poll only.
+Neither ADD_LVAP nor the EmpowerLVAPManager snapshot carries the access
+categories, so after a handover or a warm restart a station is served by
+PS-Poll only until it associates again.
+
+=item *
+all at once, when the station wakes up.
+
+=back
+
+Group frames are not buffered, every beacon is a DTIM.
+
+Keyword arguments are:
+
+=over 8
+
+=item EL
+An EmpowerLVAPManager element.
+
+=item IFACE_ID
+Integer. The interface the element buffers frames for.
+
+=item CAPACITY
+Frames buffered for each station, frames past it are dropped. Default is
+64.
+
+=item LIFETIME
+How long a frame may stay buffered (in msec). Default is 1000.
+
+=item DEBUG
+Turn debug on/off
+
+=back 8
+
+=h stations read-only
+
+Stations known to the element with their power management state and
+the frames buffered for them, followed by the frames buffered, released,
+expired and dropped and the PS-Polls and triggers received so far.
+
+=e
+
+  eqm_0 -> epsb_0 :: EmpowerPowerSaveBuffer(EL el, IFACE_ID 0) -> [1] sched_0;
+  FromDevice(moni0) -> RadiotapDecap() -> [1] epsb_0 [1] -> ers;
+
+=a EmpowerLVAPManager, EmpowerBeaconSource, EmpowerQOSManager
+*/
+
+class PowerSaveFrame {
+public:
+	Packet *_p;
+	Timestamp _since;
+	PowerSaveFrame() : _p(0) {
+	}
+	PowerSaveFrame(Packet *p, Timestamp since) : _p(p), _since(since) {
+	}
+};
+
+class PowerSaveStation {
+public:
+	bool _dozing;
+	Vector<PowerSaveFrame> _frames;
+	uint32_t _pspolls;
+	uint32_t _triggers;
+	PowerSaveStation() : _dozing(false), _pspolls(0), _triggers(0) {
+	}
+};
+
+typedef HashTable<EtherAddress, PowerSaveStation> PowerSaveStations;
+typedef PowerSaveStations::iterator PSSIter;
+
+class EmpowerPowerSaveBuffer : public Element {
+public:
+
+	EmpowerPowerSaveBuffer() CLICK_COLD;
+	~EmpowerPowerSaveBuffer() CLICK_COLD;
+
+	const char *class_name() const	{ return "EmpowerPowerSaveBuffer"; }
+	const char *port_count() const	{ return "2/2"; }
+	const char *processing() const	{ return "lh/lh"; }
+	void *cast(const char *);
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+	void cleanup(CleanupStage) CLICK_COLD;
+	void add_handlers() CLICK_COLD;
+	void run_timer(Timer *);
+
+	Packet *pull(int);
+	void push(int, Packet *);
+
+	int tim(EtherAddress bssid, uint8_t *ptr);
+
+private:
+
+	class EmpowerLVAPManager *_el;
+	int _iface_id;
+	uint32_t _capacity;
+	uint32_t _lifetime; // msecs
+	bool _debug;
+
+	SimpleSpinlock _lock;
+	PowerSaveStations _stations;
+	Vector<Packet *> _released;
+	uint32_t _dozing;
+
+	ActiveNotifier _notifier;
+	NotifierSignal _upstream_signal;
+	Timer _timer;
+
+	uint32_t _buffered;
+	uint32_t _released_frames;
+	uint32_t _expired;
+	uint32_t _drops;
+
+	bool buffer(Packet *);
+	void release(PowerSaveStation *, uint32_t, bool, uint8_t);
+	void uplink(Packet *);
+
+	static String read_handler(Element *, void *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
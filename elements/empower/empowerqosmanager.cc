@@ -31,10 +31,14 @@
 #include "transmissionpolicy.hh"
 #include "minstrel.hh"
 #include "empowerlvapmanager.hh"
+#include "empowersnapshot.hh"
 CLICK_DECLS
 
+// msecs TX feedback is batched for before it is charged to the slices
+#define EMPOWER_CHARGE_INTERVAL 10
+
 EmpowerQOSManager::EmpowerQOSManager() :
-		_el(0), _rc(0), _sleepiness(0), _capacity(500), _quantum(1470), _iface_id(0), _debug(false) {
+		_el(0), _rc(0), _starved_timer(this), _charge_timer(this), _sleepiness(0), _capacity(500), _quantum(1470), _iface_id(0), _debug(false) {
 }
 
 EmpowerQOSManager::~EmpowerQOSManager() {
@@ -48,11 +52,19 @@ int EmpowerQOSManager::configure(Vector<String> &conf,
 			.read_m("RC", ElementCastArg("Minstrel"), _rc)
 			.read_m("IFACE_ID", _iface_id)
 			.read("QUANTUM", _quantum)
+			.read("CAPACITY", _capacity)
 			.read("DEBUG", _debug)
 			.complete();
 
 }
 
+int EmpowerQOSManager::initialize(ErrorHandler *) {
+	_starved_timer.initialize(this);
+	_charge_timer.initialize(this);
+	_rc->set_eqm(this);
+	return 0;
+}
+
 void * EmpowerQOSManager::cast(const char *n) {
 	if (strcmp(n, "EmpowerQOSManager") == 0)
 		return (EmpowerQOSManager *) this;
@@ -78,31 +90,27 @@ EmpowerQOSManager::push(int, Packet *p) {
 	Timestamp now = Timestamp::now();
 	p->set_timestamp_anno(now);
 
-	int dscp = 0;
+	int dscp = classify(p);
 	uint8_t iface_id = PAINT_ANNO(p);
 
 	click_ether *eh = (click_ether *) p->data();
 
-	if (ntohs(eh->ether_type) == 0x0800) {
-		const click_ip *ip = p->ip_header();
-		dscp = ip->ip_tos >> 2;
-	}
-
 	EtherAddress dst = EtherAddress(eh->ether_dhost);
 
 	// If traffic is unicast we need to check if the lvap is active
 	if (!dst.is_broadcast() && !dst.is_group()) {
 		EmpowerStationState *ess = _el->get_ess(dst);
 		if (!ess) {
-			p->kill();
+			_el->hold_frame(dst, p);
 			return;
 		}
 		_el->lock()->acquire_read();
 		if (!ess->is_valid(iface_id)){
-			p->kill();
+			// the lvap is in transition, keep the frame for its ADD_LVAP
+			_el->hold_frame(dst, p, true);
 		} else {
 	        _el->get_txp(ess->_sta)->update_tx(p->length());
-	        store(ess->_ssid, dscp, p, dst, ess->_bssid);
+	        store(ess->_slice_queues[dscp], p, dst, ess->_bssid);
 		}
 		_el->lock()->release_read();
 		return;
@@ -122,25 +130,42 @@ EmpowerQOSManager::push(int, Packet *p) {
 			return;
 		}
 
+		/*
+		 * Queued frames share the payload buffer: every receiver but the
+		 * last gets a clone, the last one takes the original frame. Click
+		 * packets are contiguous, so AggregationQueue::wifi_encap still
+		 * copies the payload once for each receiver whose frame is shared
+		 * when it is dequeued. Only the last holder is encapsulated in place.
+		 */
+
+		EmpowerStationState *last = 0;
+
+		_el->lock()->acquire_read();
+
 		Vector<EtherAddress>::iterator itr;
 		for (itr = mcast_receivers->begin(); itr != mcast_receivers->end(); itr++) {
 			EmpowerStationState * ess = _el->lvaps()->get_pointer(*itr);
-			if (!ess) {
+			if (!ess || !ess->is_valid(iface_id)) {
 				continue;
 			}
-			_el->lock()->acquire_read();
-			if (!ess->is_valid(iface_id)){
-				continue;
-			} else {
-				Packet *q = p->clone();
-				if (!q) {
-					continue;
+			if (last) {
+				if (Packet *q = p->clone()) {
+					store(last->_slice_queues[dscp], q, last->_sta, last->_bssid);
 				}
-				store(ess->_ssid, dscp, q, *itr, ess->_bssid);
 			}
-			_el->lock()->release_read();
+			last = ess;
 		}
 
+		if (last) {
+			store(last->_slice_queues[dscp], p, last->_sta, last->_bssid);
+		} else {
+			p->kill();
+		}
+
+		_el->lock()->release_read();
+
+		return;
+
 	} else {
 
 		/*
@@ -192,6 +217,8 @@ EmpowerQOSManager::push(int, Packet *p) {
 				return;
 			}
 
+			mcast_tx_policy->update_tx(p->length());
+
 			Packet *q = p->clone();
 			store(first->_ssid, dscp, q, dst, first->_bssid);
 
@@ -214,7 +241,7 @@ EmpowerQOSManager::push(int, Packet *p) {
 				if (!q) {
 					continue;
 				}
-				store(it.value()._ssid, dscp, q, it.value()._sta, it.value()._bssid);
+				store(it.value()._slice_queues[dscp], q, it.value()._sta, it.value()._bssid);
 			}
 			_el->lock()->release_read();
 
@@ -234,42 +261,96 @@ EmpowerQOSManager::push(int, Packet *p) {
 
 }
 
+int EmpowerQOSManager::classify(Packet *p) {
+
+	/*
+	 * Parse the DSCP straight from the frame, no MarkIPHeader needed. For
+	 * 802.1Q frames the inner EtherType is used and, if the payload is not
+	 * IP, the PCP is mapped to the matching class selector (CS0-CS7).
+	 */
+
+	const uint8_t *data = p->data();
+	uint32_t offset = sizeof(click_ether);
+	uint16_t ether_type = ntohs(((const click_ether *) data)->ether_type);
+	int dscp = 0;
+
+	if (ether_type == ETHERTYPE_8021Q) {
+		if (p->length() < sizeof(click_ether_vlan)) {
+			return 0;
+		}
+		const click_ether_vlan *vlan = (const click_ether_vlan *) data;
+		dscp = (ntohs(vlan->ether_vlan_tci) >> 13) << 3;
+		ether_type = ntohs(vlan->ether_vlan_encap_proto);
+		offset = sizeof(click_ether_vlan);
+	}
+
+	if (ether_type == ETHERTYPE_IP && p->length() >= offset + 2) {
+		// type of service, second byte of the header
+		dscp = data[offset + 1] >> 2;
+	} else if (ether_type == ETHERTYPE_IP6 && p->length() >= offset + 2) {
+		// traffic class, bits 4-11 of the header
+		dscp = ((data[offset] & 0x0F) << 2) | (data[offset + 1] >> 6);
+	}
+
+	return dscp;
+
+}
+
 void EmpowerQOSManager::store(String ssid, int dscp, Packet *q, EtherAddress ra, EtherAddress ta) {
 
 	_lock.acquire_write();
 
-	Slice slice = Slice(ssid, dscp);
-	SliceQueue *sliceq = 0;
+	SliceQueue *sliceq = _slices.get(Slice(ssid, dscp));
 
-	if (_slices.find(slice) == _slices.end()) {
-		slice = Slice(ssid, 0);
-		assert(_slices.find(slice) != _slices.end());
+	if (!sliceq) {
+		sliceq = _slices.get(Slice(ssid, 0));
 	}
 
-	sliceq = _slices.get(slice);
+	enqueue(sliceq, q, ra, ta);
+
+	_lock.release_write();
+
+}
+
+void EmpowerQOSManager::store(SliceQueue *sliceq, Packet *q, EtherAddress ra, EtherAddress ta) {
+
+	_lock.acquire_write();
+	enqueue(sliceq, q, ra, ta);
+	_lock.release_write();
+
+}
+
+void EmpowerQOSManager::enqueue(SliceQueue *sliceq, Packet *q, EtherAddress ra, EtherAddress ta) {
+
+	// no slice for this tenant (yet), drop
+	if (!sliceq) {
+		q->kill();
+		return;
+	}
 
 	if (sliceq->enqueue(q, ra, ta)) {
 		// check if queue was empty and no packet in buffer
-		if (sliceq->_size == 1 && _head_table.find(slice).value() == 0) {
+		if (sliceq->_size == 1 && !sliceq->_head) {
 			sliceq->_deficit = 0;
-			_active_list.push_back(slice);
+			_active_list.push_back(sliceq);
+		}
+		// token-starved slices are woken up by _starved_timer
+		if (!sliceq->_starved) {
+			// wake up queue
+			_empty_note.wake();
+			// reset sleepiness
+			_sleepiness = 0;
 		}
-		// wake up queue
-		_empty_note.wake();
-		// reset sleepiness
-		_sleepiness = 0;
 	} else {
 		q->kill();
 	}
 
-	_lock.release_write();
-
 }
 
 Packet * EmpowerQOSManager::pull(int) {
 
 	if (_active_list.empty()) {
-		if (++_sleepiness == SLEEPINESS_TRIGGER) {
+		if (!_starved_list.empty() || ++_sleepiness == SLEEPINESS_TRIGGER) {
 			_empty_note.sleep();
 		}
 		return 0;
@@ -277,51 +358,215 @@ Packet * EmpowerQOSManager::pull(int) {
 
 	_lock.acquire_write();
 
-	Slice slice = _active_list[0];
+	SliceQueue* queue = _active_list[0];
 	_active_list.pop_front();
 
-	SIter active = _slices.find(slice);
-	HItr head = _head_table.find(slice);
-	SliceQueue* queue = active.value();
-
 	Packet *p = 0;
-	if (head.value()) {
-		p = head.value();
-		_head_table.set(slice, 0);
+	if (queue->_head) {
+		p = queue->_head;
+		queue->_head = 0;
 	} else {
 		p = queue->dequeue();
 	}
 
+	// for group frames the estimate includes unsolicited retries (TX_MCAST_UR)
+	uint32_t deficit = p ? _rc->estimate_usecs_wifi_packet(p) : 0;
+
 	if (!p) {
 		queue->_deficit = 0;
-	} else if (_rc->estimate_usecs_wifi_packet(p) <= queue->_deficit) {
-		uint32_t deficit = _rc->estimate_usecs_wifi_packet(p);
+		queue->_airtime_debt = 0;
+	} else if (deficit <= queue->_deficit && queue->limited() && !queue->has_tokens(p->length(), deficit)) {
+		queue->_head = p;
+		starve(queue, p->length(), deficit);
+	} else if (deficit <= queue->_deficit) {
+		queue->remove_tokens(p->length(), deficit);
 		queue->_deficit -= deficit;
 		queue->_deficit_used += deficit;
 		queue->_tx_bytes += p->length();
 		queue->_tx_packets++;
 		if (queue->_size > 0) {
-			_active_list.push_front(slice);
+			_active_list.push_front(queue);
 		}
 		_lock.release_write();
+		// what the feedback of this frame is checked against, see Minstrel
+		SET_AIRTIME_ANNO(p, deficit);
 		return p;
 	} else {
-		_head_table.set(slice, p);
-		_active_list.push_back(slice);
-		queue->_deficit += queue->_quantum;
+		queue->_head = p;
+		_active_list.push_back(queue);
+		queue->add_quantum();
+	}
+
+	_lock.release_write();
+
+	return 0;
+}
+
+void EmpowerQOSManager::starve(SliceQueue *queue, uint32_t bytes, uint32_t usecs) {
+
+	// park the slice until its buckets refill, see run_timer
+	queue->_starved = true;
+	queue->_throttled++;
+	_starved_list.push_back(queue);
+
+	uint32_t wait = queue->time_until_tokens(bytes, usecs);
+	Timestamp expiry = Timestamp::recent_steady() + Timestamp::make_jiffies((click_jiffies_t) (wait ? wait : 1));
+
+	if (!_starved_timer.scheduled() || expiry < _starved_timer.expiry_steady()) {
+		_starved_timer.schedule_at_steady(expiry);
+	}
+
+}
+
+void EmpowerQOSManager::run_timer(Timer *t) {
+
+	if (t == &_charge_timer) {
+		flush_charges();
+		return;
+	}
+
+	_lock.acquire_write();
+
+	uint32_t wait = 0;
+
+	Vector<SliceQueue *>::iterator it = _starved_list.begin();
+	while (it != _starved_list.end()) {
+		SliceQueue *queue = *it;
+		uint32_t bytes = queue->_head->length();
+		uint32_t usecs = _rc->estimate_usecs_wifi_packet(queue->_head);
+		if (queue->has_tokens(bytes, usecs)) {
+			queue->_starved = false;
+			_active_list.push_back(queue);
+			it = _starved_list.erase(it);
+			continue;
+		}
+		uint32_t t = queue->time_until_tokens(bytes, usecs);
+		if (!wait || t < wait) {
+			wait = t;
+		}
+		it++;
+	}
+
+	if (!_starved_list.empty()) {
+		_starved_timer.schedule_after(Timestamp::make_jiffies((click_jiffies_t) (wait ? wait : 1)));
+	}
+
+	if (!_active_list.empty()) {
+		_empty_note.wake();
+		_sleepiness = 0;
 	}
 
 	_lock.release_write();
 
+}
+
+int EmpowerQOSManager::classify_wifi(Packet *p) {
+
+	// DSCP of a frame built by AggregationQueue, from its first MSDU
+	const uint8_t *data = p->data();
+	uint32_t offset = sizeof(struct click_wifi) + sizeof(struct click_qos_control);
+
+	if (p->length() < offset) {
+		return 0;
+	}
+
+	const click_qos_control *qos = (const click_qos_control *) (data + sizeof(struct click_wifi));
+	if (qos->qos_control & WIFI_QOS_CONTROL_QOS_AMSDU_PRESENT_MASK) {
+		offset += sizeof(struct click_wifi_amsdu_subframe_header);
+	}
+
+	if (p->length() < offset + sizeof(struct click_llc) + 2) {
+		return 0;
+	}
+
+	const click_llc *llc = (const click_llc *) (data + offset);
+	uint16_t ether_type = ntohs(llc->llc_un.type_snap.ether_type);
+	offset += sizeof(struct click_llc);
+
+	if (ether_type == ETHERTYPE_IP) {
+		return data[offset + 1] >> 2;
+	} else if (ether_type == ETHERTYPE_IP6) {
+		return ((data[offset] & 0x0F) << 2) | (data[offset + 1] >> 6);
+	}
+
 	return 0;
+
+}
+
+void EmpowerQOSManager::charge_airtime(Packet *p, uint32_t usecs, uint32_t estimate) {
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+
+	if ((w->i_fc[0] & WIFI_FC0_TYPE_MASK) != WIFI_FC0_TYPE_DATA) {
+		return;
+	}
+
+	EtherAddress sta = EtherAddress(w->i_addr1);
+	int dscp = classify_wifi(p);
+
+	_charge_lock.acquire();
+
+	if (!_charges.size()) {
+		_charge_timer.schedule_after_msec(EMPOWER_CHARGE_INTERVAL);
+	}
+
+	AirtimeCharge *charge = 0;
+	for (int i = 0; i < _charges.size(); i++) {
+		if (_charges[i]._sta == sta && _charges[i]._dscp == dscp) {
+			charge = &_charges[i];
+			break;
+		}
+	}
+
+	if (!charge) {
+		_charges.push_back(AirtimeCharge(sta, dscp));
+		charge = &_charges.back();
+	}
+
+	charge->_usecs += usecs;
+	if (usecs > estimate) {
+		charge->_extra += usecs - estimate;
+	}
+
+	_charge_lock.release();
+
+}
+
+void EmpowerQOSManager::flush_charges() {
+
+	Vector<AirtimeCharge> charges;
+
+	_charge_lock.acquire();
+	charges.swap(_charges);
+	_charge_lock.release();
+
+	_el->lock()->acquire_read();
+	_lock.acquire_write();
+
+	for (int i = 0; i < charges.size(); i++) {
+		EmpowerStationState *ess = _el->lvaps()->get_pointer(charges[i]._sta);
+		if (!ess || ess->_iface_id != _iface_id) {
+			continue;
+		}
+		ess->_tx_airtime += charges[i]._usecs;
+		if (SliceQueue *sliceq = ess->_slice_queues[charges[i]._dscp]) {
+			sliceq->charge(charges[i]._usecs, charges[i]._extra);
+		}
+	}
+
+	_lock.release_write();
+	_el->lock()->release_read();
+
 }
 
 void EmpowerQOSManager::set_default_slice(String ssid) {
 	set_slice(ssid, 0, 12000, false, 0);
 }
 
-void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool amsdu_aggregation, uint8_t scheduler) {
+void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool amsdu_aggregation, uint8_t scheduler,
+		uint32_t max_rate, uint32_t max_burst, uint32_t max_airtime, uint32_t max_airtime_burst) {
 
+	_el->lock()->acquire_write();
 	_lock.acquire_write();
 
 	Slice slice = Slice(ssid, dscp);
@@ -341,8 +586,9 @@ void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool
 
 		uint32_t tr_quantum = (quantum == 0) ? _quantum : quantum;
 		SliceQueue *queue = new SliceQueue(this, slice, _capacity, tr_quantum, amsdu_aggregation, scheduler);
+		queue->set_limits(max_rate, max_burst, max_airtime, max_airtime_burst);
 		_slices.set(slice, queue);
-		_head_table.set(slice, 0);
+		refresh_slice_queues();
 	} else {
 		if (_debug) {
 			click_chatter("%{element} :: %s :: Updating slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u",
@@ -359,15 +605,18 @@ void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool
 		queue->_quantum = quantum;
 		queue->_amsdu_aggregation = amsdu_aggregation;
 		queue->_scheduler = scheduler;
+		queue->set_limits(max_rate, max_burst, max_airtime, max_airtime_burst);
 	}
 
 	_el->send_status_slice(_iface_id, ssid, dscp);
 
 	_lock.release_write();
+	_el->lock()->release_write();
 }
 
 void EmpowerQOSManager::del_slice(String ssid, int dscp) {
 
+	_el->lock()->acquire_write();
 	_lock.acquire_write();
 
 	if (_debug) {
@@ -378,39 +627,130 @@ void EmpowerQOSManager::del_slice(String ssid, int dscp) {
 					  dscp);
 	}
 
+	SIter itr = _slices.find(Slice(ssid, dscp));
+	if (itr == _slices.end()) {
+		_lock.release_write();
+		_el->lock()->release_write();
+		return;
+	}
+
+	SliceQueue *sliceq = itr.value();
+
 	// remove from active list
-	Vector<Slice>::iterator it = _active_list.begin();
+	Vector<SliceQueue *>::iterator it = _active_list.begin();
 	while (it != _active_list.end()) {
-		if (it->_ssid == ssid && it->_dscp == dscp) {
+		if (*it == sliceq) {
 			it = _active_list.erase(it);
 			break;
 		}
 		it++;
 	}
 
-	Slice slice = Slice(ssid, dscp);
-
-	// remove slice
-	SIter itr = _slices.find(slice);
-	if (itr == _slices.end()) {
-		return;
+	// remove from starved list
+	for (it = _starved_list.begin(); it != _starved_list.end(); it++) {
+		if (*it == sliceq) {
+			_starved_list.erase(it);
+			break;
+		}
 	}
-	SliceQueue *sliceq = itr.value();
-	delete sliceq;
+
+	// remove slice, this also drops the buffered head packet
 	_slices.erase(itr);
+	delete sliceq;
 
-	// remove from head table
-	HItr itr2 = _head_table.find(slice);
-	Packet *p = itr2.value();
-	if (p){
-		p->kill();
+	// no lvap may keep a handle to the deleted queue
+	refresh_slice_queues();
+
+	_lock.release_write();
+	_el->lock()->release_write();
+
+}
+
+void EmpowerQOSManager::update_slice_queues(EmpowerStationState *ess) {
+	_lock.acquire_read();
+	resolve_slice_queues(ess);
+	_lock.release_read();
+}
+
+void EmpowerQOSManager::reclaim(EtherAddress sta, Vector<Packet *> &frames) {
+
+	// take the Ethernet frames still queued for the station out of every
+	// slice, the frame a slice already dequeued (_head) is left alone
+	_lock.acquire_write();
+
+	for (SIter it = _slices.begin(); it.live(); it++) {
+		SliceQueue *sliceq = it.value();
+		Vector<EtherPair> pairs;
+		for (AQIter aq = sliceq->_queues.begin(); aq.live(); aq++) {
+			if (aq.key()._ra == sta) {
+				pairs.push_back(aq.key());
+			}
+		}
+		for (int i = 0; i < pairs.size(); i++) {
+			AggregationQueue *queue = sliceq->_queues.get(pairs[i]);
+			while (Packet *p = queue->pull(false)) {
+				frames.push_back(p);
+				sliceq->_size--;
+			}
+			sliceq->_queues.erase(pairs[i]);
+			delete queue;
+			Vector<EtherPair>::iterator ap = find(sliceq->_active_list.begin(), sliceq->_active_list.end(), pairs[i]);
+			if (ap != sliceq->_active_list.end()) {
+				sliceq->_active_list.erase(ap);
+			}
+		}
 	}
-	_head_table.erase(itr2);
 
 	_lock.release_write();
 
 }
 
+void EmpowerQOSManager::requeue(EmpowerStationState *ess, Vector<Packet *> &frames) {
+
+	// queue the frames held for a station in transition, called with the
+	// LVAP manager write lock held so that they go ahead of newer frames
+	Timestamp now = Timestamp::now();
+
+	_lock.acquire_write();
+
+	for (int i = 0; i < frames.size(); i++) {
+		Packet *p = frames[i];
+		p->set_timestamp_anno(now);
+		SET_PAINT_ANNO(p, _iface_id);
+		int dscp = classify(p);
+		_el->get_txp(ess->_sta)->update_tx(p->length());
+		enqueue(ess->_slice_queues[dscp], p, ess->_sta, ess->_bssid);
+	}
+
+	_lock.release_write();
+
+}
+
+void EmpowerQOSManager::resolve_slice_queues(EmpowerStationState *ess) {
+
+	// DSCPs without a dedicated slice fall back to the tenant's default slice
+	SliceQueue *fallback = _slices.get(Slice(ess->_ssid, 0));
+
+	for (int i = 0; i < 64; i++) {
+		ess->_slice_queues[i] = fallback;
+	}
+
+	for (SIter it = _slices.begin(); it.live(); it++) {
+		if (it.key()._ssid == ess->_ssid && it.key()._dscp >= 0 && it.key()._dscp < 64) {
+			ess->_slice_queues[it.key()._dscp] = it.value();
+		}
+	}
+
+}
+
+void EmpowerQOSManager::refresh_slice_queues() {
+	for (LVAPIter it = _el->lvaps()->begin(); it.live(); it++) {
+		if (it.value()._iface_id == _iface_id) {
+			resolve_slice_queues(&it.value());
+		}
+	}
+}
+
 String EmpowerQOSManager::list_slices() {
 	StringAccum result;
 	SIter itr = _slices.begin();
@@ -422,6 +762,53 @@ String EmpowerQOSManager::list_slices() {
 	return result.take_string();
 }
 
+String EmpowerQOSManager::snapshot_slices(uint32_t first, uint32_t count) {
+
+	_lock.acquire_read();
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_SLICES, sizeof(snapshot_slice_record), _slices.size(), first, count);
+
+	for (SIter itr = _slices.begin(); itr != _slices.end() && !sb.done(); itr++) {
+		snapshot_slice_record *r = (snapshot_slice_record *) sb.record();
+		if (!r) {
+			continue;
+		}
+		SliceQueue *sliceq = itr.value();
+		r->set_ssid(sliceq->_slice._ssid);
+		r->set_dscp(sliceq->_slice._dscp);
+		r->set_scheduler(sliceq->_scheduler);
+		r->set_flags(sliceq->_amsdu_aggregation ? EMPOWER_AMSDU_AGGREGATION : 0);
+		r->set_quantum(sliceq->_quantum);
+		r->set_capacity(sliceq->_capacity);
+		r->set_size(sliceq->_size);
+		r->set_drops(sliceq->_drops);
+		r->set_deficit(sliceq->_deficit);
+		r->set_deficit_used(sliceq->_deficit_used);
+		r->set_max_queue_length(sliceq->_max_queue_length);
+		r->set_tx_packets(sliceq->_tx_packets);
+		r->set_tx_bytes(sliceq->_tx_bytes);
+		r->set_throttled(sliceq->_throttled);
+		r->set_max_rate(sliceq->_max_rate);
+		r->set_max_burst(sliceq->_max_burst);
+		r->set_max_airtime(sliceq->_max_airtime);
+		r->set_max_airtime_burst(sliceq->_max_airtime_burst);
+	}
+
+	_lock.release_read();
+
+	return sb.take();
+
+}
+
+int EmpowerQOSManager::snapshot_handler(int, String &s, Element *e, const Handler *, ErrorHandler *errh) {
+	EmpowerQOSManager *td = (EmpowerQOSManager *) e;
+	uint32_t first, count;
+	if (SnapshotBuilder::parse_range(s, first, count, e, errh) < 0)
+		return -1;
+	s = td->snapshot_slices(first, count);
+	return 0;
+}
+
 enum {
 	H_DEBUG, H_SLICES
 };
@@ -456,6 +843,7 @@ int EmpowerQOSManager::write_handler(const String &in_s, Element *e, void *vpara
 void EmpowerQOSManager::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
 	add_read_handler("slices", read_handler, (void *) H_SLICES);
+	set_handler("slices_bin", Handler::f_read | Handler::f_read_param, snapshot_handler);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
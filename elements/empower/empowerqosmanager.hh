@@ -10,9 +10,13 @@
 #include <click/hashmap.hh>
 #include <click/hashtable.hh>
 #include <click/straccum.hh>
+#include <click/timer.hh>
+#include <click/sync.hh>
+#include <click/tokenbucket.hh>
 #include <clicknet/wifi.h>
 #include <clicknet/llc.h>
 #include <elements/standard/simplequeue.hh>
+#include "empowerlock.hh"
 CLICK_DECLS
 
 /*
@@ -32,16 +36,38 @@ Also maintains a dedicated queue for each pair tenant/dscp.
 Strips the Ethernet header off the front of the packet and pushes
 an 802.11 frame header and LLC header onto the packet.
 
+Frames are classified by the DSCP of IPv4 and IPv6 packets, also
+behind an 802.1Q tag. Tagged non-IP frames use the class selector
+matching their PCP. DSCPs without a slice go to the tenant's default
+slice.
+
+The deficit charged for a frame is an estimate at the current Minstrel
+rate without retries. When Minstrel (the RC element) processes the TX
+feedback of the frame, the airtime of its actual retry chain is added to
+the slice, and whatever the estimate missed is taken from the slice's
+deficit and airtime bucket, or from its next quantum.
+
+Slices may be capped in bytes/s and airtime usec/s through SET_SLICE.
+A slice out of tokens is parked until its buckets refill and does not
+wake the downstream pull task in the meantime.
+
 Arguments are:
 
 =item EL
 An EmpowerLVAPManager element
 
+=item CAPACITY
+Frames each slice queue holds. Default is 500.
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+=h slices_bin read-only
+Binary snapshot of the slice queues, see empowersnapshot.hh. Takes an
+optional "FIRST COUNT" parameter to read it in chunks.
+
 =a EmpowerWifiDecap
 */
 
@@ -126,35 +152,45 @@ public:
         click_ether *eh = (click_ether *) p->data();
         EtherAddress sa = EtherAddress(eh->ether_shost);
 
-        WritablePacket *q = p->uniqueify();
-
-        if (!q) {
-            return 0;
-        }
-
         uint8_t mode = WIFI_FC1_DIR_FROMDS;
         uint16_t ethtype;
 
-        memcpy(&ethtype, q->data() + 12, 2);
-
-        q->pull(sizeof(struct click_ether));
-        q = q->push(sizeof(struct click_llc));
-
-        if (!q) {
-            q->kill();
-            return 0;
-        }
+        memcpy(&ethtype, p->data() + 12, 2);
 
-        memcpy(q->data(), WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
-        memcpy(q->data() + 6, &ethtype, 2);
+        uint32_t hdr_len = sizeof(struct click_wifi) + sizeof(struct click_qos_control) + sizeof(struct click_llc);
+        uint32_t payload_len = p->length() - sizeof(struct click_ether);
 
-        q = q->push(sizeof(struct click_wifi) + sizeof(struct click_qos_control));
+        WritablePacket *q;
 
-        if (!q) {
-            q->kill();
-            return 0;
+        if (p->shared()) {
+            // DMS fan-out: the payload buffer is shared with the other
+            // receivers. Their headers would land in the same headroom, so
+            // this receiver gets its own buffer: build the headers there
+            // and copy only the payload, not the whole frame with its
+            // headroom and tailroom as uniqueify() would.
+            q = Packet::make(Packet::default_headroom, 0, hdr_len + payload_len, 0);
+            if (!q) {
+                p->kill();
+                return 0;
+            }
+            memcpy(q->data() + hdr_len, p->data() + sizeof(struct click_ether), payload_len);
+            q->copy_annotations(p);
+            p->kill();
+        } else {
+            q = p->uniqueify();
+            if (!q) {
+                return 0;
+            }
+            q->pull(sizeof(struct click_ether));
+            q = q->push(hdr_len);
+            if (!q) {
+                return 0;
+            }
         }
 
+        memcpy(q->data() + hdr_len - sizeof(struct click_llc), WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
+        memcpy(q->data() + hdr_len - sizeof(struct click_llc) + 6, &ethtype, 2);
+
         struct click_wifi *w = (struct click_wifi *) q->data();
 
         memset(q->data(), 0, sizeof(click_wifi) + sizeof(struct click_qos_control));
@@ -455,13 +491,33 @@ public:
     uint32_t _tx_packets;
     uint32_t _tx_bytes;
     uint8_t _scheduler;
+    Packet *_head;
+
+    // optional limits, 0 means unlimited
+    uint32_t _max_rate;             // bytes/s
+    uint32_t _max_burst;            // bytes
+    uint32_t _max_airtime;          // usec/s
+    uint32_t _max_airtime_burst;    // usec
+    TokenBucket _rate_bucket;
+    TokenBucket _airtime_bucket;
+    bool _starved;
+    uint32_t _throttled;
+
+    // airtime measured from TX feedback, see EmpowerQOSManager::charge_airtime
+    uint64_t _tx_airtime;           // usec
+    uint32_t _airtime_debt;         // usec not yet taken from the deficit
 
     SliceQueue(EmpowerQOSManager * eqm, Slice slice, uint32_t capacity, uint32_t quantum, bool amsdu_aggregation, uint8_t scheduler) :
 		_eqm(eqm), _slice(slice), _capacity(capacity), _size(0), _drops(0), _deficit(0), _quantum(quantum), _amsdu_aggregation(amsdu_aggregation),
-		_deficit_used(0), _max_queue_length(0), _tx_packets(0), _tx_bytes(0), _scheduler(scheduler) {
+		_deficit_used(0), _max_queue_length(0), _tx_packets(0), _tx_bytes(0), _scheduler(scheduler), _head(0),
+		_max_rate(0), _max_burst(0), _max_airtime(0), _max_airtime_burst(0), _starved(false), _throttled(0),
+		_tx_airtime(0), _airtime_debt(0) {
     }
 
     ~SliceQueue() {
+        if (_head) {
+            _head->kill();
+        }
         AQIter itr = _queues.begin();
         while (itr != _queues.end()) {
             AggregationQueue *aq = itr.value();
@@ -471,6 +527,94 @@ public:
         _queues.clear();
     }
 
+    void set_limits(uint32_t max_rate, uint32_t max_burst, uint32_t max_airtime, uint32_t max_airtime_burst) {
+        // bursts default to one second worth of tokens
+        _max_rate = max_rate;
+        _max_burst = (max_rate && !max_burst) ? max_rate : max_burst;
+        _max_airtime = max_airtime;
+        _max_airtime_burst = (max_airtime && !max_airtime_burst) ? max_airtime : max_airtime_burst;
+        if (_max_rate) {
+            _rate_bucket.assign(_max_rate, _max_burst);
+            _rate_bucket.set_full();
+        }
+        if (_max_airtime) {
+            _airtime_bucket.assign(_max_airtime, _max_airtime_burst);
+            _airtime_bucket.set_full();
+        }
+    }
+
+    // a new round: the quantum first pays for retries the estimate missed
+    void add_quantum() {
+        if (_airtime_debt >= _quantum) {
+            _airtime_debt -= _quantum;
+        } else {
+            _deficit += _quantum - _airtime_debt;
+            _airtime_debt = 0;
+        }
+    }
+
+    // usecs measured for frames that pull charged extra usecs less
+    void charge(uint64_t usecs, uint32_t extra) {
+        _tx_airtime += usecs;
+        if (!extra) {
+            return;
+        }
+        if (_deficit >= extra) {
+            _deficit -= extra;
+        } else {
+            _airtime_debt += extra - _deficit;
+            _deficit = 0;
+        }
+        _deficit_used += extra;
+        if (_max_airtime) {
+            _airtime_bucket.remove(extra);
+        }
+    }
+
+    bool limited() const {
+        return _max_rate || _max_airtime;
+    }
+
+    // frames larger than the burst only need a full bucket
+    bool has_tokens(uint32_t bytes, uint32_t usecs) {
+        if (_max_rate) {
+            _rate_bucket.refill();
+            if (!_rate_bucket.contains(bytes < _max_burst ? bytes : _max_burst)) {
+                return false;
+            }
+        }
+        if (_max_airtime) {
+            _airtime_bucket.refill();
+            if (!_airtime_bucket.contains(usecs < _max_airtime_burst ? usecs : _max_airtime_burst)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void remove_tokens(uint32_t bytes, uint32_t usecs) {
+        if (_max_rate) {
+            _rate_bucket.remove(bytes);
+        }
+        if (_max_airtime) {
+            _airtime_bucket.remove(usecs);
+        }
+    }
+
+    // jiffies until has_tokens() may succeed
+    uint32_t time_until_tokens(uint32_t bytes, uint32_t usecs) const {
+        uint32_t wait = 0;
+        if (_max_rate) {
+            uint32_t t = _rate_bucket.time_until_contains(bytes < _max_burst ? bytes : _max_burst);
+            wait = (t > wait) ? t : wait;
+        }
+        if (_max_airtime) {
+            uint32_t t = _airtime_bucket.time_until_contains(usecs < _max_airtime_burst ? usecs : _max_airtime_burst);
+            wait = (t > wait) ? t : wait;
+        }
+        return wait;
+    }
+
     bool enqueue(Packet *p, EtherAddress ra, EtherAddress ta) {
 
         EtherPair pair = EtherPair(ra, ta);
@@ -543,6 +687,16 @@ public:
         } else {
         	result << " aggregation off";
         }
+        if (_max_rate) {
+            result << ", rate: " << _max_rate << "/" << _max_burst;
+        }
+        if (_max_airtime) {
+            result << ", airtime: " << _max_airtime << "/" << _max_airtime_burst;
+        }
+        if (limited()) {
+            result << ", throttled: " << _throttled << (_starved ? " (starved)" : "");
+        }
+        result << ", airtime: " << _tx_airtime << " usec";
         result << "\n";
 
         AQIter itr = _queues.begin();
@@ -559,8 +713,15 @@ public:
 typedef HashTable<Slice, SliceQueue*> Slices;
 typedef Slices::iterator SIter;
 
-typedef HashTable<Slice, Packet*> HeadTable;
-typedef HeadTable::iterator HItr;
+// TX feedback of the frames of a LVAP in a slice, not yet charged
+struct AirtimeCharge {
+    EtherAddress _sta;
+    int _dscp;
+    uint64_t _usecs;
+    uint32_t _extra;
+    AirtimeCharge(EtherAddress sta, int dscp) : _sta(sta), _dscp(dscp), _usecs(0), _extra(0) {
+    }
+};
 
 class EmpowerQOSManager: public Element {
 
@@ -575,20 +736,28 @@ public:
     void *cast(const char *);
 
     int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *);
+    void run_timer(Timer *);
 
     void push(int, Packet *);
     Packet *pull(int);
 
     void add_handlers();
     void set_default_slice(String);
-    void set_slice(String, int, uint32_t, bool, uint8_t);
+    void set_slice(String, int, uint32_t, bool, uint8_t, uint32_t = 0, uint32_t = 0, uint32_t = 0, uint32_t = 0);
     void del_slice(String, int);
+    void update_slice_queues(class EmpowerStationState *);
+    void reclaim(EtherAddress, Vector<Packet *> &);
+    void requeue(class EmpowerStationState *, Vector<Packet *> &);
+    void charge_airtime(Packet *, uint32_t, uint32_t);
 
     Slices * slices() { return &_slices; }
+    String snapshot_slices(uint32_t, uint32_t);
+    EmpowerRWLock * lock() { return &_lock; }
 
 private:
 
-    ReadWriteLock _lock;
+    EmpowerRWLock _lock;
 
     enum { SLEEPINESS_TRIGGER = 9 };
 
@@ -597,8 +766,15 @@ private:
     class Minstrel * _rc;
 
     Slices _slices;
-    HeadTable _head_table;
-    Vector<Slice> _active_list;
+    Vector<SliceQueue *> _active_list;
+    Vector<SliceQueue *> _starved_list;
+    Timer _starved_timer;
+
+    // charges are batched and applied by _charge_timer, so that the TX
+    // feedback path does not take the LVAP and slice locks for each frame
+    SimpleSpinlock _charge_lock;
+    Vector<AirtimeCharge> _charges;
+    Timer _charge_timer;
 
     int _sleepiness;
     uint32_t _capacity;
@@ -608,11 +784,20 @@ private:
 
     bool _debug;
 
+    int classify(Packet *);
+    int classify_wifi(Packet *);
     void store(String, int, Packet *, EtherAddress, EtherAddress);
+    void store(SliceQueue *, Packet *, EtherAddress, EtherAddress);
+    void enqueue(SliceQueue *, Packet *, EtherAddress, EtherAddress);
+    void resolve_slice_queues(class EmpowerStationState *);
+    void refresh_slice_queues();
+    void starve(SliceQueue *, uint32_t, uint32_t);
+    void flush_charges();
     String list_slices();
 
     static int write_handler(const String &, Element *, void *, ErrorHandler *);
     static String read_handler(Element *, void *);
+    static int snapshot_handler(int, String &, Element *, const Handler *, ErrorHandler *);
 
 };
 
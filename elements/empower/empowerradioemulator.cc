@@ -0,0 +1,353 @@
+/*
+ * empowerradioemulator.{cc,hh} -- emulates a radio and its stations (EmPOWER Access Point)
+ * Roberto Riggio
+ *
+ * Copyright (c) 2017 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerradioemulator.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/packet_anno.hh>
+#include <clicknet/wifi.h>
+#include <clicknet/radiotap.h>
+#include <elements/wifi/bitrate.hh>
+CLICK_DECLS
+
+EmpowerRadioEmulator::EmpowerRadioEmulator() :
+		_task(this), _timer(this), _busy(0), _snr(30), _width(4), _seed(1),
+		_random(1), _realtime(true), _radiotap(true), _debug(false) {
+}
+
+EmpowerRadioEmulator::~EmpowerRadioEmulator() {
+}
+
+int EmpowerRadioEmulator::configure(Vector<String> &conf,
+		ErrorHandler *errh) {
+
+	int res = Args(conf, this, errh)
+			.read("SNR", _snr)
+			.read("WIDTH", _width)
+			.read("SEED", _seed)
+			.read("REALTIME", _realtime)
+			.read("RADIOTAP", _radiotap)
+			.read("DEBUG", _debug)
+			.complete();
+
+	if (res < 0)
+		return res;
+
+	if (_width < 1)
+		return errh->error("WIDTH must be at least 1 dB");
+
+	// xorshift32 gets stuck at zero
+	_random = _seed ? _seed : 1;
+
+	for (int m = -MARGIN_MAX; m <= MARGIN_MAX; m++) {
+		int64_t s = ((int64_t) (2 * m + _width) * 32768) / _width;
+		if (s < 0)
+			s = 0;
+		if (s > 65536)
+			s = 65536;
+		_success[m + MARGIN_MAX] = s;
+	}
+
+	return 0;
+
+}
+
+int EmpowerRadioEmulator::initialize(ErrorHandler *) {
+	_task.initialize(this, true);
+	_timer.initialize(this);
+	_signal = Notifier::upstream_empty_signal(this, 0, &_task);
+	_medium = Timestamp::now();
+	return 0;
+}
+
+/*
+ * SNR in dB needed to receive most frames at a rate: legacy rates are in
+ * units of 500 Kbps, HT rates are MCS indexes.
+ */
+int EmpowerRadioEmulator::threshold(int rate, bool ht) {
+	static const int ht_snr[16] = {
+		5, 8, 11, 14, 18, 22, 24, 26,
+		8, 11, 14, 17, 21, 25, 27, 29
+	};
+	if (ht)
+		return (rate >= 0 && rate < 16) ? ht_snr[rate] : 30;
+	switch (rate) {
+	case 2:   return 2;
+	case 4:   return 5;
+	case 11:  return 8;
+	case 22:  return 11;
+	case 12:  return 6;
+	case 18:  return 8;
+	case 24:  return 9;
+	case 36:  return 11;
+	case 48:  return 15;
+	case 72:  return 18;
+	case 96:  return 22;
+	case 108: return 24;
+	default:  return 30;
+	}
+}
+
+RadioEmulatorStation *EmpowerRadioEmulator::station(EtherAddress sta) {
+	RadioEmulatorStation *nfo = _stations.get_pointer(sta);
+	if (!nfo) {
+		_stations.set(sta, RadioEmulatorStation(sta, _snr));
+		nfo = _stations.get_pointer(sta);
+	}
+	return nfo;
+}
+
+bool EmpowerRadioEmulator::attempt(int snr, int rate, bool ht) {
+	int margin = snr - threshold(rate, ht);
+	if (margin < -MARGIN_MAX)
+		margin = -MARGIN_MAX;
+	if (margin > MARGIN_MAX)
+		margin = MARGIN_MAX;
+	_random ^= _random << 13;
+	_random ^= _random >> 17;
+	_random ^= _random << 5;
+	return (_random & 0xffff) < _success[margin + MARGIN_MAX];
+}
+
+/*
+ * Sends p along the retry chain in its annotation, rewrites the annotation
+ * as TX feedback and returns whether the station received the frame.
+ * airtime is set to the time the medium was busy in usec.
+ */
+bool EmpowerRadioEmulator::transmit(Packet *p, uint32_t &airtime) {
+
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	EtherAddress dst = EtherAddress(p->data() + 4);
+	RadioEmulatorStation *nfo = station(dst);
+
+	bool ht = ceh->flags & WIFI_EXTRA_MCS;
+	bool noack = dst.is_group() || (ceh->flags & WIFI_EXTRA_TX_NOACK);
+
+	int rates[4] = { ceh->rate, ceh->rate1, ceh->rate2, ceh->rate3 };
+	int tries[4] = { ceh->max_tries, ceh->max_tries1, ceh->max_tries2, ceh->max_tries3 };
+
+	if (noack || tries[0] < 1) {
+		tries[0] = 1;
+		tries[1] = tries[2] = tries[3] = 0;
+	}
+
+	bool success = false;
+	int last_rate = rates[0];
+	int last_tries = 0;
+	int stage = 0;
+	int t = 0;
+
+	airtime = 0;
+
+	for (int i = 0; i < 4 && !success; i++) {
+		if (rates[i] < 0 || tries[i] < 1 || (ht ? rates[i] > 15 : rates[i] == 0))
+			continue;
+		stage = i;
+		last_rate = rates[i];
+		last_tries = 0;
+		for (int j = 0; j < tries[i] && !success; j++, t++) {
+			if (ht)
+				airtime += calc_usecs_wifi_packet_tries_ht(p->length(), rates[i], t, t);
+			else
+				airtime += calc_usecs_wifi_packet_tries(p->length(), rates[i], t, t);
+			last_tries++;
+			success = attempt(nfo->_snr, rates[i], ht);
+		}
+	}
+
+	nfo->_frames++;
+	nfo->_attempts += t;
+	nfo->_successes += success;
+	nfo->_airtime += airtime;
+
+	ceh->magic = WIFI_EXTRA_MAGIC;
+	ceh->flags |= WIFI_EXTRA_TX;
+	if (!success && !noack)
+		ceh->flags |= WIFI_EXTRA_TX_FAIL;
+	if (stage > 0)
+		ceh->flags |= WIFI_EXTRA_TX_USED_ALT_RATE;
+	ceh->rate = last_rate;
+	ceh->max_tries = last_tries;
+	ceh->rssi = nfo->_snr > 0 ? nfo->_snr : 0;
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: %s rate %d tries %d airtime %u %s",
+				this,
+				__func__,
+				dst.unparse().c_str(),
+				last_rate,
+				t,
+				airtime,
+				success ? "ok" : "fail");
+	}
+
+	return success;
+
+}
+
+bool EmpowerRadioEmulator::run_task(Task *) {
+
+	Timestamp now = Timestamp::now();
+
+	if (_realtime) {
+		if (_medium > now) {
+			_timer.schedule_at(_medium);
+			return false;
+		}
+		_medium = now;
+	}
+
+	int worked = 0;
+
+	while (worked < 32 && (!_realtime || _medium <= now)) {
+
+		Packet *p = input(0).pull();
+
+		if (!p) {
+			if (!_signal)
+				return worked > 0;
+			break;
+		}
+
+		worked++;
+
+		if (_radiotap) {
+			struct ieee80211_radiotap_header *th = (struct ieee80211_radiotap_header *) p->data();
+			if (p->length() < sizeof(struct ieee80211_radiotap_header)
+					|| th->it_version
+					|| p->length() < le16_to_cpu(th->it_len)) {
+				click_chatter("%{element} :: %s :: malformed radiotap header",
+						this,
+						__func__);
+				p->kill();
+				continue;
+			}
+			p->pull(le16_to_cpu(th->it_len));
+		}
+
+		if (p->length() < sizeof(struct click_wifi)) {
+			click_chatter("%{element} :: %s :: packet too small: %d vs %d",
+					this,
+					__func__,
+					p->length(),
+					sizeof(struct click_wifi));
+			p->kill();
+			continue;
+		}
+
+		uint32_t airtime;
+		bool success = transmit(p, airtime);
+
+		_busy += airtime;
+		_medium += Timestamp::make_usec(airtime);
+		p->set_timestamp_anno(_medium);
+
+		if (success && noutputs() > 1)
+			if (Packet *q = p->clone())
+				output(1).push(q);
+
+		output(0).push(p);
+
+	}
+
+	if (_realtime && _medium > now)
+		_timer.schedule_at(_medium);
+	else
+		_task.fast_reschedule();
+
+	return worked > 0;
+
+}
+
+void EmpowerRadioEmulator::run_timer(Timer *) {
+	_task.reschedule();
+}
+
+String EmpowerRadioEmulator::list_stations() {
+	StringAccum sa;
+	for (RESIter it = _stations.begin(); it.live(); it++)
+		sa << it.value().unparse();
+	return sa.take_string();
+}
+
+enum {
+	H_DEBUG, H_STATIONS, H_MEDIUM, H_SNR, H_RESET
+};
+
+String EmpowerRadioEmulator::read_handler(Element *e, void *thunk) {
+	EmpowerRadioEmulator *td = (EmpowerRadioEmulator *) e;
+	switch ((uintptr_t) thunk) {
+	case H_STATIONS:
+		return td->list_stations();
+	case H_MEDIUM: {
+		StringAccum sa;
+		sa << "busy " << td->_busy << " time " << td->_medium << "\n";
+		return sa.take_string();
+	}
+	case H_DEBUG:
+		return String(td->_debug) + "\n";
+	default:
+		return String();
+	}
+}
+
+int EmpowerRadioEmulator::write_handler(const String &in_s, Element *e, void *vparam, ErrorHandler *errh) {
+	EmpowerRadioEmulator *f = (EmpowerRadioEmulator *) e;
+	String s = cp_uncomment(in_s);
+	switch ((intptr_t) vparam) {
+	case H_DEBUG: {    //debug
+		bool debug;
+		if (!BoolArg().parse(s, debug))
+			return errh->error("debug parameter must be boolean");
+		f->_debug = debug;
+		break;
+	}
+	case H_SNR: {
+		EtherAddress sta;
+		int snr;
+		if (Args(f, errh).push_back_words(s)
+				.read_mp("ADDR", sta)
+				.read_mp("SNR", snr)
+				.complete() < 0)
+			return -1;
+		f->station(sta)->_snr = snr;
+		break;
+	}
+	case H_RESET: {
+		for (RESIter it = f->_stations.begin(); it.live(); it++)
+			it.value().reset();
+		f->_busy = 0;
+		break;
+	}
+	}
+	return 0;
+}
+
+void EmpowerRadioEmulator::add_handlers() {
+	add_read_handler("debug", read_handler, (void *) H_DEBUG);
+	add_read_handler("stations", read_handler, (void *) H_STATIONS);
+	add_read_handler("medium", read_handler, (void *) H_MEDIUM);
+	add_write_handler("debug", write_handler, (void *) H_DEBUG);
+	add_write_handler("snr", write_handler, (void *) H_SNR);
+	add_write_handler("reset", write_handler, (void *) H_RESET);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerRadioEmulator)
+ELEMENT_REQUIRES(userlevel bitrate)
@@ -0,0 +1,199 @@
+#ifndef CLICK_EMPOWERRADIOEMULATOR_HH
+#define CLICK_EMPOWERRADIOEMULATOR_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/hashtable.hh>
+#include <click/notifier.hh>
+#include <click/straccum.hh>
+#include <click/task.hh>
+#include <click/timer.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerRadioEmulator([, I<KEYWORDS>])
+
+=s EmPOWER
+
+Emulates a radio and its stations, standing in for ToDevice/FromDevice.
+
+=d
+
+Pulls 802.11 frames, as produced by RadiotapEncap, from its input and
+transmits them on a virtual medium. Each frame is sent following the
+retry chain in its Wifi extra annotation (rate/max_tries through
+rate3/max_tries3). Every attempt takes the airtime given by
+calc_usecs_wifi_packet_tries (or its HT variant) and succeeds with a
+probability that depends on the SNR of the receiving station and on the
+SNR the rate needs. Frames sent to group addresses or with the no-ack
+flag set get a single attempt.
+
+The medium is busy until the last attempt of a frame is over and no
+frame is pulled before that. Once a frame is done, its radiotap header
+is removed and the frame is pushed to output 0 as TX feedback, in the
+form RadiotapDecap produces for FilterTX and Minstrel's input 1: the
+Wifi extra annotation has the TX flag set, the TX_FAIL flag set if no
+attempt of an acknowledged frame succeeded, the TX_USED_ALT_RATE flag set if the frame went past
+the first rate of the chain, and rate and max_tries set to the last rate
+tried and to the number of attempts made at that rate. The timestamp
+annotation is set to the time the medium became idle. If output 1 is
+connected, a clone of each frame received by its station is pushed
+there.
+
+Keyword arguments are:
+
+=over 8
+
+=item SNR
+
+Integer. SNR in dB of stations without a specific value. Default is 30.
+
+=item WIDTH
+
+Integer. Width in dB of the transition between losing and receiving
+every frame at a given rate. An attempt at a rate whose SNR threshold is
+T succeeds with probability 0 below T - WIDTH/2, 1 above T + WIDTH/2, and
+linearly in between. Default is 4.
+
+=item SEED
+
+Unsigned integer. Seed of the loss process. Runs with the same seed and
+the same input are identical. Default is 1.
+
+=item REALTIME
+
+Boolean. If true, the virtual medium follows the wall clock and a frame
+is not pulled before the previous one would have left the air. If false,
+frames are pulled as fast as possible and only the virtual clock
+advances. Default is true.
+
+=item RADIOTAP
+
+Boolean. If true, input frames carry a radiotap header that is stripped
+before transmission. Default is true.
+
+=item DEBUG
+
+Boolean. Turn debug on/off. Default is false.
+
+=back
+
+=h stations read-only
+
+Per station SNR, frames, attempts, successes, and airtime in usec.
+
+=h medium read-only
+
+Total airtime in usec and the current virtual time.
+
+=h snr write-only
+
+Takes "ADDR SNR" and sets the SNR of the station ADDR.
+
+=h reset write-only
+
+Clears the per station counters.
+
+=e
+
+  sched -> Minstrel(...) [1] -> RadiotapEncap() -> radio :: EmpowerRadioEmulator(SNR 25);
+  radio [0] -> FilterTX() [1] -> [1] Minstrel(...);
+  radio [1] -> Counter -> Discard;
+
+=a Minstrel, FilterTX, RadiotapEncap
+*/
+
+class RadioEmulatorStation {
+public:
+
+	EtherAddress _sta;
+	int _snr;
+	uint32_t _frames;
+	uint32_t _attempts;
+	uint32_t _successes;
+	uint64_t _airtime;
+
+	RadioEmulatorStation() :
+			_snr(0), _frames(0), _attempts(0), _successes(0), _airtime(0) {
+	}
+
+	RadioEmulatorStation(EtherAddress sta, int snr) :
+			_sta(sta), _snr(snr), _frames(0), _attempts(0), _successes(0), _airtime(0) {
+	}
+
+	void reset() {
+		_frames = 0;
+		_attempts = 0;
+		_successes = 0;
+		_airtime = 0;
+	}
+
+	String unparse() {
+		StringAccum sa;
+		sa << _sta.unparse() << " snr " << _snr << " frames " << _frames
+		   << " attempts " << _attempts << " successes " << _successes
+		   << " airtime " << _airtime << "\n";
+		return sa.take_string();
+	}
+
+};
+
+typedef HashTable<EtherAddress, RadioEmulatorStation> RadioEmulatorStations;
+typedef RadioEmulatorStations::iterator RESIter;
+
+class EmpowerRadioEmulator: public Element {
+public:
+
+	EmpowerRadioEmulator();
+	~EmpowerRadioEmulator();
+
+	const char *class_name() const { return "EmpowerRadioEmulator"; }
+	const char *port_count() const { return "1/1-2"; }
+	const char *processing() const { return PULL_TO_PUSH; }
+
+	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
+	void add_handlers();
+
+	bool run_task(Task *);
+	void run_timer(Timer *);
+
+private:
+
+	enum { MARGIN_MAX = 40 };
+
+	Task _task;
+	Timer _timer;
+	NotifierSignal _signal;
+
+	RadioEmulatorStations _stations;
+
+	Timestamp _medium;
+	uint64_t _busy;
+
+	// success probability in 1/65536 indexed by SNR margin in dB
+	uint32_t _success[2 * MARGIN_MAX + 1];
+
+	int _snr;
+	int _width;
+	uint32_t _seed;
+	uint32_t _random;
+	bool _realtime;
+	bool _radiotap;
+	bool _debug;
+
+	RadioEmulatorStation *station(EtherAddress);
+	bool attempt(int, int, bool);
+	bool transmit(Packet *, uint32_t &);
+
+	String list_stations();
+
+	static int threshold(int, bool);
+	static int write_handler(const String &, Element *, void *, ErrorHandler *);
+	static String read_handler(Element *, void *);
+
+};
+
+CLICK_ENDDECLS
+#endif
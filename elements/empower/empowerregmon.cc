@@ -27,7 +27,7 @@ CLICK_DECLS
 
 EmpowerRegmon::EmpowerRegmon() :
 		_el(0), _iface_id(0), _elem_period(4000), _reg_period(1000),
-		_timer(this), _debug(false), _register_log_file(0), _last_mac_ticks(0) {
+		_raw_size(100), _raw_window(0), _timer(this), _debug(false), _register_log_file(0), _last_mac_ticks(0) {
 }
 
 EmpowerRegmon::~EmpowerRegmon() {
@@ -36,13 +36,13 @@ EmpowerRegmon::~EmpowerRegmon() {
 
 int EmpowerRegmon::initialize(ErrorHandler *) {
 
-	RegmonRegister reg_tx = RegmonRegister(EMPOWER_REGMON_TX, _iface_id, 100);
+	RegmonRegister reg_tx = RegmonRegister(EMPOWER_REGMON_TX, _iface_id, _raw_size, _raw_window, _levels);
 	_registers.push_back(reg_tx);
 
-	RegmonRegister reg_rx = RegmonRegister(EMPOWER_REGMON_RX, _iface_id, 100);
+	RegmonRegister reg_rx = RegmonRegister(EMPOWER_REGMON_RX, _iface_id, _raw_size, _raw_window, _levels);
 	_registers.push_back(reg_rx);
 
-	RegmonRegister reg_ed = RegmonRegister(EMPOWER_REGMON_ED, _iface_id, 100);
+	RegmonRegister reg_ed = RegmonRegister(EMPOWER_REGMON_ED, _iface_id, _raw_size, _raw_window, _levels);
 	_registers.push_back(reg_ed);
 
 	_last_mac_ticks = 0;
@@ -88,15 +88,47 @@ int EmpowerRegmon::initialize(ErrorHandler *) {
 
 int EmpowerRegmon::configure(Vector<String> &conf, ErrorHandler *errh) {
 
+	String rollups = "1000/300 60000/60";
+
 	int ret = Args(conf, this, errh)
               .read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
 			  .read_m("IFACE_ID", _iface_id)
 			  .read("ELEM_PERIOD", _elem_period)
 			  .read("REG_PERIOD", _reg_period)
+			  .read("RAW_SIZE", _raw_size)
+			  .read("RAW_WINDOW", _raw_window)
+			  .read("ROLLUPS", rollups)
 			  .read_m("DEBUGFS", _debugfs)
 			  .read("DEBUG", _debug).complete();
 
-	return ret;
+	if (ret < 0)
+		return ret;
+
+	if (!_raw_size)
+		return errh->error("RAW_SIZE must be positive");
+
+	Vector<String> tokens;
+	cp_spacevec(rollups, tokens);
+
+	for (int i = 0; i < tokens.size(); i++) {
+		int slash = tokens[i].find_left('/');
+		uint32_t resolution, count;
+		if (slash < 0
+				|| !IntArg().parse(tokens[i].substring(0, slash), resolution)
+				|| !IntArg().parse(tokens[i].substring(slash + 1), count)
+				|| !resolution || !count)
+			return errh->error("ROLLUPS entries must be RESOLUTION/COUNT, not %s", tokens[i].c_str());
+		// keep the levels sorted by resolution
+		int j = _levels.size();
+		_levels.push_back(RegmonLevel(resolution, count));
+		for (; j > 0 && _levels[j - 1]._resolution > resolution; j--) {
+			RegmonLevel tmp = _levels[j - 1];
+			_levels[j - 1] = _levels[j];
+			_levels[j] = tmp;
+		}
+	}
+
+	return 0;
 
 }
 
@@ -190,8 +222,19 @@ String EmpowerRegmon::read_handler(Element *e, void *thunk) {
 	case H_FULL: {
 		for (RegistersIter iter = eg->_registers.begin(); iter != eg->_registers.end(); iter++) {
 			sa << iter->unparse() << "\n";
-			for (int i = 0; i < 100; i++) {
-				sa << iter->_timestamps[i] << " " << iter->_samples[i] << '\n';
+			Vector<RegmonSample> samples;
+			iter->raw(0, samples);
+			for (int i = 0; i < samples.size(); i++) {
+				sa << samples[i]._timestamp << " " << samples[i]._value << '\n';
+			}
+			for (int i = 0; i < iter->_levels.size(); i++) {
+				Vector<RegmonRollup> rollups;
+				iter->rollups(&iter->_levels[i], 0, rollups);
+				for (int j = 0; j < rollups.size(); j++) {
+					sa << rollups[j]._timestamp << "/" << iter->_levels[i]._resolution << " "
+					   << rollups[j]._count << " " << rollups[j]._min << " "
+					   << rollups[j].avg() << " " << rollups[j]._max << '\n';
+				}
 			}
 		}
 		return sa.take_string();
@@ -10,42 +10,125 @@
 CLICK_DECLS
 
 
+// A raw regmon sample, utilization in 1/18000, 36000 if invalid
+class RegmonSample {
+public:
+	uint64_t _timestamp; // usec
+	uint32_t _value;
+	RegmonSample() : _timestamp(0), _value(0) {
+	}
+	RegmonSample(uint64_t timestamp, uint32_t value) :
+			_timestamp(timestamp), _value(value) {
+	}
+};
+
+// Min/avg/max of the valid samples taken in [_timestamp, _timestamp + resolution)
+class RegmonRollup {
+public:
+	uint64_t _timestamp; // usec
+	uint32_t _count;
+	uint32_t _min;
+	uint32_t _max;
+	uint64_t _sum;
+	RegmonRollup() : _timestamp(0), _count(0), _min(0xffffffff), _max(0), _sum(0) {
+	}
+	RegmonRollup(uint64_t timestamp) : _timestamp(timestamp), _count(0), _min(0xffffffff), _max(0), _sum(0) {
+	}
+	void add(uint32_t value) {
+		_count++;
+		_sum += value;
+		if (value < _min)
+			_min = value;
+		if (value > _max)
+			_max = value;
+	}
+	uint32_t avg() const { return _count ? _sum / _count : 0; }
+};
+
+/*
+ * Fixed size ring, the oldest entry is overwritten once the ring is full.
+ */
+template <typename T> class RegmonRing {
+public:
+	RegmonRing(uint32_t capacity) : _ring(capacity, T()), _head(0), _size(0) {
+	}
+	void push(const T &x) {
+		_ring[_head] = x;
+		_head = (_head + 1) % _ring.size();
+		if (_size < (uint32_t) _ring.size())
+			_size++;
+	}
+	uint32_t size() const { return _size; }
+	uint32_t capacity() const { return _ring.size(); }
+	// i-th entry starting from the oldest one
+	const T &at(uint32_t i) const {
+		return _ring[(_head + _ring.size() - _size + i) % _ring.size()];
+	}
+private:
+	Vector<T> _ring;
+	uint32_t _head;
+	uint32_t _size;
+};
+
+// Rollups of a register at a given resolution
+class RegmonLevel {
+public:
+	uint32_t _resolution; // msecs
+	RegmonRing<RegmonRollup> _rollups;
+	RegmonRollup _current;
+	RegmonLevel(uint32_t resolution, uint32_t capacity) :
+			_resolution(resolution), _rollups(capacity) {
+	}
+	void add(uint64_t timestamp, uint32_t value, bool valid) {
+		uint64_t start = timestamp - timestamp % (_resolution * 1000ULL);
+		if (start != _current._timestamp) {
+			if (_current._timestamp)
+				_rollups.push(_current);
+			_current = RegmonRollup(start);
+		}
+		if (valid)
+			_current.add(value);
+	}
+};
+
+/*
+ * Samples of one register: the raw samples of the last window msecs, at
+ * most raw_size of them, and a ring of rollups for each level.
+ */
 class RegmonRegister {
 public:
 
-	RegmonRegister(empower_regmon_types type, int iface_id, uint32_t size) {
+	RegmonRegister(empower_regmon_types type, int iface_id, uint32_t raw_size, uint32_t window,
+				   const Vector<RegmonLevel> &levels) : _raw(raw_size), _levels(levels) {
 		_type = type;
 		_iface_id = iface_id;
-		_size = size;
-		_samples = new uint32_t[size]();
-		_timestamps = new uint64_t[size]();
-		_index = 0;
+		_window = window;
 		_last_value = 0;
 		_skipped = 0;
 		_min_value = 0xffffffff;
 		_max_value = 0;
 		_first_run = true;
-		memset(_samples, 0, _size);
 	}
 
 	void add_sample(uint64_t timestamp, uint32_t value, uint32_t mac_ticks_delta, bool valid) {
 
+		uint32_t sample;
+
 		if (_first_run) {
 			_first_run = false;
-			_samples[_index] = 0;
-			_timestamps[_index] = timestamp;
+			sample = 0;
+		} else if (!valid || !mac_ticks_delta) {
+			valid = false;
+			sample = 36000;
 		} else {
+			uint64_t value_delta = value - _last_value;
+			sample = (uint32_t)((value_delta * 18000) / mac_ticks_delta);
+		}
 
-			if (!valid)
-
-				_samples[_index] = 36000;
-			else {
-
-				uint64_t value_delta = value - _last_value;
-				_samples[_index] = (uint32_t)((value_delta * 18000) / mac_ticks_delta);
-			}
+		_raw.push(RegmonSample(timestamp, sample));
 
-			_timestamps[_index] = timestamp;
+		for (int i = 0; i < _levels.size(); i++) {
+			_levels[i].add(timestamp, sample, valid);
 		}
 
 		_last_value = value;
@@ -56,9 +139,41 @@ public:
 		if (value < _min_value)
 			_min_value = value;
 
-		_index++;
-		_index %= _size;
+	}
+
+	// the oldest max raw samples newer than since and within the window
+	void raw(uint64_t since, Vector<RegmonSample> &out, int max = INT_MAX) const {
+		if (!_raw.size())
+			return;
+		uint64_t latest = _raw.at(_raw.size() - 1)._timestamp;
+		uint64_t window = _window * 1000ULL;
+		uint64_t oldest = (window && latest > window) ? latest - window : 0;
+		for (uint32_t i = 0; i < _raw.size() && out.size() < max; i++) {
+			const RegmonSample &s = _raw.at(i);
+			if (s._timestamp > since && s._timestamp >= oldest)
+				out.push_back(s);
+		}
+	}
+
+	// the finest level at least as coarse as resolution, or the coarsest
+	// one, levels are sorted by resolution
+	const RegmonLevel *level(uint32_t resolution) const {
+		if (!_levels.size())
+			return 0;
+		for (int i = 0; i < _levels.size(); i++) {
+			if (_levels[i]._resolution >= resolution)
+				return &_levels[i];
+		}
+		return &_levels.back();
+	}
 
+	// the oldest max completed rollups starting after since
+	void rollups(const RegmonLevel *l, uint64_t since, Vector<RegmonRollup> &out, int max = INT_MAX) const {
+		for (uint32_t i = 0; i < l->_rollups.size() && out.size() < max; i++) {
+			const RegmonRollup &r = l->_rollups.at(i);
+			if (r._timestamp > since)
+				out.push_back(r);
+		}
 	}
 
 	String unparse() {
@@ -74,22 +189,26 @@ public:
 		}
 
 		sa << "Id=" << _iface_id << "\t";
-		sa << "Size=" << _size << "\t";
-		sa << "Index=" << _index << "\t";
+		sa << "Size=" << _raw.capacity() << "\t";
+		sa << "Samples=" << _raw.size() << "\t";
+		sa << "Window=" << _window << "\t";
 		sa << "Skipped=" << _skipped << "\t";
 		sa << "MinValue=" << _min_value << "\t\t";
 		sa << "MaxValue=" << _max_value;
 
+		for (int i = 0; i < _levels.size(); i++) {
+			sa << "\tRollups/" << _levels[i]._resolution << "=" << _levels[i]._rollups.size();
+		}
+
 		return sa.take_string();
 
 	}
 
 	empower_regmon_types _type;
 	int _iface_id;
-	int _size;
-	uint32_t *_samples;
-	uint64_t *_timestamps;
-	int _index;
+	uint32_t _window; // msecs
+	RegmonRing<RegmonSample> _raw;
+	Vector<RegmonLevel> _levels;
 	uint32_t _last_value;
 	int _skipped;
 	uint32_t _min_value;
@@ -101,6 +220,82 @@ public:
 typedef Vector<RegmonRegister> Registers;
 typedef Registers::iterator RegistersIter;
 
+/*
+=c
+
+EmpowerRegmon(EL, IFACE_ID, DEBUGFS [, I<KEYWORDS>])
+
+=s EmPOWER
+
+Samples the channel utilization registers exposed by the regmon driver.
+
+=d
+
+Every ELEM_PERIOD msecs reads the TX, RX and ED (busy) registers logged
+by the driver under DEBUGFS and keeps, for each of them, the last
+RAW_SIZE samples together with min/avg/max rollups at the resolutions
+listed in ROLLUPS. Memory use is fixed at configuration time. The
+controller can ask for the raw samples, or for the rollups of a given
+resolution, taken after a given time.
+
+Keyword arguments are:
+
+=over 8
+
+=item EL
+
+An EmpowerLVAPManager element.
+
+=item IFACE_ID
+
+Integer. The interface the registers refer to.
+
+=item DEBUGFS
+
+String. Path to the regmon debugfs directory.
+
+=item ELEM_PERIOD
+
+Unsigned integer. How often the register log is read, in msecs. Default
+is 4000.
+
+=item REG_PERIOD
+
+Unsigned integer. Sampling interval of the driver, in msecs. Default is
+1000.
+
+=item RAW_SIZE
+
+Unsigned integer. Raw samples kept per register. Default is 100.
+
+=item RAW_WINDOW
+
+Unsigned integer. Raw samples older than this, in msecs, are not
+reported. Zero means no limit. Default is 0.
+
+=item ROLLUPS
+
+String. Space separated list of RESOLUTION/COUNT pairs, each keeping the
+last COUNT rollups over windows of RESOLUTION msecs. Default is
+"1000/300 60000/60".
+
+=item DEBUG
+
+Boolean. Turn debug on/off. Default is false.
+
+=back
+
+=h status read-only
+
+Size, window and rollup occupancy of each register.
+
+=h full read-only
+
+Raw samples and rollups of each register.
+
+=a EmpowerLVAPManager
+*/
+
 class EmpowerRegmon: public Element {
 public:
 
@@ -122,6 +317,9 @@ private:
 
 	uint32_t _elem_period; // msecs
 	uint32_t _reg_period; // msecs
+	uint32_t _raw_size;
+	uint32_t _raw_window; // msecs
+	Vector<RegmonLevel> _levels;
 	Timer _timer;
 
 	bool _debug;
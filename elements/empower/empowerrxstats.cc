@@ -17,6 +17,7 @@
 #include <click/config.h>
 #include <click/args.hh>
 #include <click/error.hh>
+#include <click/master.hh>
 #include <click/glue.hh>
 #include <click/packet_anno.hh>
 #include <click/straccum.hh>
@@ -26,15 +27,18 @@
 #include <elements/wifi/bitrate.hh>
 #include "empowerlvapmanager.hh"
 #include "empowerrxstats.hh"
+#include "empowersnapshot.hh"
 CLICK_DECLS
 
 void send_summary_trigger_callback(Timer *timer, void *data) {
 	// send summary
 	SummaryTrigger *summary = (SummaryTrigger *) data;
-	summary->_ers->lock.acquire_write();
+	// take the frames collected by the data path, then send without locks
+	summary->_ers->summary_lock.acquire();
+	summary->_frames.swap(summary->_pending);
+	summary->_ers->summary_lock.release();
 	summary->_el->send_summary_trigger(summary);
 	summary->_sent++;
-	summary->_ers->lock.release_write();
 	if (summary->_limit > 0 && summary->_sent >= (unsigned) summary->_limit) {
 		summary->_ers->del_summary_trigger(summary->_trigger_id);
 		return;
@@ -46,36 +50,50 @@ void send_summary_trigger_callback(Timer *timer, void *data) {
 void send_rssi_trigger_callback(Timer *timer, void *data) {
 	// process triggers
 	RssiTrigger *rssi = (RssiTrigger *) data;
-	rssi->_ers->lock.acquire_write();
-	for (NTIter iter = rssi->_ers->stas.begin(); iter.live(); iter++) {
-		DstInfo *nfo = &iter.value();
-		// not matching the address
-		if (nfo->_eth != rssi->_eth) {
-			continue;
-		}
-		// check if condition matches
-		if (rssi->matches(nfo) && !rssi->_dispatched) {
-			rssi->_el->send_rssi_trigger(nfo->_iface_id, rssi->_trigger_id, nfo->_sma_rssi->avg());
-			rssi->_dispatched = true;
-		} else if (!rssi->matches(nfo) && rssi->_dispatched) {
-			rssi->_dispatched = false;
-		}
+	bool send = false;
+	int iface_id = -1;
+	int sma_rssi = 0;
+	rssi->_ers->lock.acquire_read();
+	DstInfo *nfo = rssi->_ers->stas.get_pointer(rssi->_eth);
+	// check if condition matches
+	if (nfo && rssi->matches(nfo) && !rssi->_dispatched) {
+		send = true;
+		iface_id = nfo->_iface_id;
+		sma_rssi = nfo->estimate(rssi->_estimator);
+		rssi->_dispatched = true;
+	} else if (nfo && !rssi->matches(nfo) && rssi->_dispatched) {
+		rssi->_dispatched = false;
+	}
+	rssi->_ers->lock.release_read();
+	if (send) {
+		rssi->_el->send_rssi_trigger(iface_id, rssi->_trigger_id, sma_rssi);
 	}
-	rssi->_ers->lock.release_write();
 	// re-schedule the timer
 	timer->schedule_after_msec(rssi->_period);
 }
 
 EmpowerRXStats::EmpowerRXStats() :
-		_el(0), _timer(this), _signal_offset(0), _period(500),
-		_sma_period(13), _max_silent_window_count(10), _debug(false) {
+		_el(0), _task(this), _timer(&_task), _thread(-1), _signal_offset(0),
+		_period(500), _sma_period(13), _max_silent_window_count(10),
+		_dupe_filter(false), _dupes(0), _debug(false) {
+	_estimators.mask = 0;
+	_estimators.alpha = 0.25;
+	_estimators.window = 8;
+	_estimators.q = 0.05;
+	_estimators.r = 4;
+	_estimators_always = 0;
 
 }
 
 EmpowerRXStats::~EmpowerRXStats() {
 }
 
-int EmpowerRXStats::initialize(ErrorHandler *) {
+int EmpowerRXStats::initialize(ErrorHandler *errh) {
+	if (_thread >= master()->nthreads())
+		return errh->error("THREAD must be less than %d", master()->nthreads());
+	_task.initialize(this, false);
+	if (_thread >= 0)
+		_task.move_thread(_thread);
 	_timer.initialize(this);
 	_timer.schedule_now();
 	return 0;
@@ -83,49 +101,90 @@ int EmpowerRXStats::initialize(ErrorHandler *) {
 
 int EmpowerRXStats::configure(Vector<String> &conf, ErrorHandler *errh) {
 
+	String estimators;
+	double alpha = _estimators.alpha, q = _estimators.q, r = _estimators.r;
+
 	int ret = Args(conf, this, errh)
 			.read("EL", ElementCastArg("EmpowerLVAPManager"), _el)
 			.read("SMA_PERIOD", _sma_period)
+			.read("ESTIMATORS", AnyArg(), estimators)
+			.read("EWMA_ALPHA", alpha)
+			.read("WSMA_WINDOW", _estimators.window)
+			.read("KALMAN_Q", q)
+			.read("KALMAN_R", r)
 			.read("SIGNAL_OFFSET", _signal_offset)
 			.read("PERIOD", _period)
+			.read("THREAD", _thread)
+			.read("DUPE_FILTER", _dupe_filter)
 			.read("DEBUG", _debug)
 			.complete();
 
-	return ret;
+	if (ret < 0)
+		return ret;
+
+	if (alpha <= 0 || alpha > 1)
+		return errh->error("EWMA_ALPHA must be in (0, 1]");
+
+	if (_estimators.window < 1 || _estimators.window > WsmaEstimator::WSMA_MAX)
+		return errh->error("WSMA_WINDOW must be between 1 and %d", WsmaEstimator::WSMA_MAX);
+
+	if (q < 0 || r <= 0)
+		return errh->error("KALMAN_Q must not be negative and KALMAN_R must be positive");
+
+	_estimators.alpha = alpha;
+	_estimators.q = q;
+	_estimators.r = r;
+
+	Vector<String> names;
+	cp_spacevec(estimators, names);
+	for (int i = 0; i < names.size(); i++) {
+		int estimator = rssi_estimator_parse(names[i]);
+		if (estimator < 0)
+			return errh->error("unknown estimator %s", names[i].c_str());
+		_estimators_always |= 1 << estimator;
+	}
+
+	_estimators.mask = _estimators_always;
+
+	return 0;
 
 }
 
-void EmpowerRXStats::run_timer(Timer *) {
-	// process stations
-	lock.acquire_write();
-	for (NTIter iter = stas.begin(); iter.live();) {
-		// Update stats
-		DstInfo *nfo = &iter.value();
-		nfo->update();
-		// Delete stale entries
-		if (nfo->_silent_window_count > _max_silent_window_count) {
-			iter = stas.erase(iter);
-		} else {
-			++iter;
-		}
+void EmpowerRXStats::drain(NeighborTable &table) {
+	for (NTIter iter = table.begin(); iter.live(); iter++) {
+		iter.value().drain();
 	}
-	// process access points
-	for (NTIter iter = aps.begin(); iter.live();) {
-		// Update aps
+}
+
+void EmpowerRXStats::update(NeighborTable &table) {
+	for (NTIter iter = table.begin(); iter.live();) {
+		// Update stats
 		DstInfo *nfo = &iter.value();
 		nfo->update();
 		// Delete stale entries
 		if (nfo->_silent_window_count > _max_silent_window_count) {
-			iter = aps.erase(iter);
+			iter = table.erase(iter);
 		} else {
 			++iter;
 		}
 	}
+}
+
+bool EmpowerRXStats::run_task(Task *) {
+	// flip the sample windows and compute the new averages, frames keep
+	// coming in since the data path only needs the read lock
+	lock.acquire_read();
+	drain(stas);
+	drain(aps);
+	lock.release_read();
+	// publish the averages and delete stale entries
+	lock.acquire_write();
+	update(stas);
+	update(aps);
 	lock.release_write();
-	// process reg mon info
-	/* read from debugfs and copy data in circular array */
 	// rescheduler
 	_timer.schedule_after_msec(_period);
+	return true;
 }
 
 Packet *
@@ -150,6 +209,8 @@ EmpowerRXStats::simple_action(Packet *p) {
 		return p;
 	}
 
+	set_empower_wifi_hdr_size(p, wifi_header_size);
+
 	int dir = w->i_fc[1] & WIFI_FC1_DIR_MASK;
 	int type = w->i_fc[0] & WIFI_FC0_TYPE_MASK;
 	int subtype = w->i_fc[0] & WIFI_FC0_SUBTYPE_MASK;
@@ -188,7 +249,12 @@ EmpowerRXStats::simple_action(Packet *p) {
 				break;
 			}
 		}
-		// no idea, ignore packet
+		// no idea, ignore packet unless it is a retry of a known neighbor
+		if (_dupe_filter && !EtherAddress(w->i_addr1).is_group()
+				&& known_duplicate(EtherAddress(w->i_addr2), w)) {
+			p->kill();
+			return 0;
+		}
 		return p;
 	case WIFI_FC1_DIR_FROMDS:
 		// FROMDS bit not set when TA is an station, but only when TA is an access point
@@ -208,9 +274,27 @@ EmpowerRXStats::simple_action(Packet *p) {
 
 	uint8_t iface_id = PAINT_ANNO(p);
 
-	lock.acquire_write();
+	// group addressed frames are not acknowledged, hence never retried
+	bool dupe_check = _dupe_filter && !ra.is_group();
+
+	if (!update_neighbor(ta, station, iface_id, rssi, dupe_check ? w : 0)) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: dup seq %d from %s",
+						  this,
+						  __func__,
+						  le16_to_cpu(w->i_seq) >> WIFI_SEQ_SEQ_SHIFT,
+						  ta.unparse().c_str());
+		}
+		_dupes++;
+		p->kill();
+		return 0;
+	}
+
+	if (!_summary_triggers.size()) {
+		return p;
+	}
 
-	update_neighbor(ta, station, iface_id, rssi);
+	summary_lock.acquire();
 
 	// check if frame meta-data should be saved
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
@@ -219,25 +303,39 @@ EmpowerRXStats::simple_action(Packet *p) {
 		}
 		if ((*qi)->_eth == ta || (*qi)->_eth.is_broadcast()) {
 			Frame frame = Frame(ra, ta, ceh->tsft, ceh->flags, w->i_seq, rssi, ceh->rate, type, subtype, p->length(), retry, station, iface_id);
-			(*qi)->_frames.push_back(frame);
+			(*qi)->_pending.push_back(frame);
 		}
 	}
 
-	lock.release_write();
+	summary_lock.release();
 
 	return p;
 
 }
 
-void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t iface_id, uint8_t rssi) {
+// Returns false if w is given and the frame is a duplicate, which is
+// then not accounted.
+bool EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t iface_id, uint8_t rssi, const struct click_wifi *w) {
 
-	DstInfo *nfo;
+	NeighborTable &table = station ? stas : aps;
 
-	if (station) {
-		nfo = stas.get_pointer(ta);
-	} else {
-		nfo = aps.get_pointer(ta);
+	// known neighbors only need the read lock, the sample goes in the
+	// active window of its DstInfo
+	lock.acquire_read();
+	DstInfo *nfo = table.get_pointer(ta);
+	bool accounted = false;
+	if (nfo) {
+		accounted = nfo->add_sample(rssi, _estimators, w);
 	}
+	lock.release_read();
+
+	if (nfo) {
+		return accounted;
+	}
+
+	lock.acquire_write();
+
+	nfo = table.get_pointer(ta);
 
 	if (!nfo) {
 		if (station) {
@@ -256,12 +354,43 @@ void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t ifac
 	}
 
 	// Add sample
-	nfo->add_sample(rssi);
+	accounted = nfo->add_sample(rssi, _estimators, w);
+
+	lock.release_write();
+
+	return accounted;
 
 }
 
-void EmpowerRXStats::add_rssi_trigger(EtherAddress eth, uint32_t trigger_id, empower_trigger_relation rel, int val, uint16_t period) {
-	RssiTrigger * rssi = new RssiTrigger(eth, trigger_id, rel, val, false, period, _el, this);
+// Duplicate check for frames from neighbors that are not accounted,
+// new addresses are not added.
+bool EmpowerRXStats::known_duplicate(EtherAddress ta, const struct click_wifi *w) {
+	bool dupe = false;
+	lock.acquire_read();
+	DstInfo *nfo = stas.get_pointer(ta);
+	if (!nfo) {
+		nfo = aps.get_pointer(ta);
+	}
+	if (nfo) {
+		dupe = nfo->duplicate(w);
+	}
+	lock.release_read();
+	if (dupe) {
+		_dupes++;
+	}
+	return dupe;
+}
+
+void EmpowerRXStats::update_estimators() {
+	uint32_t mask = _estimators_always;
+	for (RTIter qi = _rssi_triggers.begin(); qi != _rssi_triggers.end(); qi++) {
+		mask |= 1 << (*qi)->_estimator;
+	}
+	_estimators.mask = mask;
+}
+
+void EmpowerRXStats::add_rssi_trigger(EtherAddress eth, uint32_t trigger_id, empower_trigger_relation rel, int val, uint16_t period, int estimator) {
+	RssiTrigger * rssi = new RssiTrigger(eth, trigger_id, rel, val, estimator, false, period, _el, this);
 	for (RTIter qi = _rssi_triggers.begin(); qi != _rssi_triggers.end(); qi++) {
 		if (*rssi== **qi) {
 			click_chatter("%{element} :: %s :: trigger already defined (%s), setting sent to false",
@@ -269,6 +398,7 @@ void EmpowerRXStats::add_rssi_trigger(EtherAddress eth, uint32_t trigger_id, emp
 						  __func__,
 						  rssi->unparse().c_str());
 			(*qi)->_dispatched = false;
+			delete rssi;
 			return;
 		}
 	}
@@ -276,6 +406,7 @@ void EmpowerRXStats::add_rssi_trigger(EtherAddress eth, uint32_t trigger_id, emp
 	rssi->_trigger_timer->initialize(this);
 	rssi->_trigger_timer->schedule_now();
 	_rssi_triggers.push_back(rssi);
+	update_estimators();
 }
 
 void EmpowerRXStats::del_rssi_trigger(uint32_t trigger_id) {
@@ -283,6 +414,7 @@ void EmpowerRXStats::del_rssi_trigger(uint32_t trigger_id) {
 		if ((*qi)->_trigger_id == trigger_id) {
 			(*qi)->_trigger_timer->clear();
 			_rssi_triggers.erase(qi);
+			update_estimators();
 			break;
 		}
 	}
@@ -294,12 +426,16 @@ void EmpowerRXStats::clear_triggers() {
 		(*qi)->_trigger_timer->clear();
 	}
 	_rssi_triggers.clear();
+	update_estimators();
 	// clear summary triggers
-	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
+	summary_lock.acquire();
+	SummaryTriggersList summary_triggers;
+	summary_triggers.swap(_summary_triggers);
+	summary_lock.release();
+	for (DTIter qi = summary_triggers.begin(); qi != summary_triggers.end(); qi++) {
 		(*qi)->_trigger_timer->clear();
 		delete *qi;
 	}
-	_summary_triggers.clear();
 }
 
 void EmpowerRXStats::add_summary_trigger(int iface, EtherAddress addr, uint32_t summary_id, int16_t limit, uint16_t period) {
@@ -316,15 +452,20 @@ void EmpowerRXStats::add_summary_trigger(int iface, EtherAddress addr, uint32_t
 	summary->_trigger_timer->assign(&send_summary_trigger_callback, (void *) summary);
 	summary->_trigger_timer->initialize(this);
 	summary->_trigger_timer->schedule_now();
+	summary_lock.acquire();
 	_summary_triggers.push_back(summary);
+	summary_lock.release();
 }
 
 void EmpowerRXStats::del_summary_trigger(uint32_t summary_id) {
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		if ((*qi)->_trigger_id == summary_id) {
-			(*qi)->_trigger_timer->clear();
+			SummaryTrigger *summary = *qi;
+			summary->_trigger_timer->clear();
+			summary_lock.acquire();
 			_summary_triggers.erase(qi);
-			delete *qi;
+			summary_lock.release();
+			delete summary;
 			break;
 		}
 	}
@@ -337,9 +478,54 @@ enum {
 	H_SIGNAL_OFFSET,
 	H_RSSI_MATCHES,
 	H_RSSI_TRIGGERS,
-	H_SUMMARY_TRIGGERS
+	H_SUMMARY_TRIGGERS,
+	H_DUPES
 };
 
+String EmpowerRXStats::snapshot_neighbors(uint32_t first, uint32_t count) {
+
+	lock.acquire_read();
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_NEIGHBORS, sizeof(snapshot_neighbor_record), stas.size() + aps.size(), first, count);
+
+	// stations first, then access points, as in the neighbors handler
+	NeighborTable *tables[2] = { &stas, &aps };
+
+	for (int i = 0; i < 2 && !sb.done(); i++) {
+		for (NTIter iter = tables[i]->begin(); iter.live() && !sb.done(); iter++) {
+			snapshot_neighbor_record *r = (snapshot_neighbor_record *) sb.record();
+			if (!r) {
+				continue;
+			}
+			DstInfo *nfo = &iter.value();
+			r->set_addr(nfo->_eth);
+			r->set_sender_type(nfo->_sender_type);
+			r->set_sma_rssi(nfo->_sma_rssi ? nfo->_sma_rssi->avg() : 0);
+			r->set_last_rssi_avg(nfo->_last_rssi);
+			r->set_last_rssi_std(nfo->_last_std);
+			r->set_iface_id(nfo->_iface_id);
+			r->set_last_packets(nfo->_last_packets);
+			r->set_hist_packets(nfo->_hist_packets);
+			r->set_silent_window_count(nfo->_silent_window_count);
+			r->set_age(nfo->age().msecval());
+		}
+	}
+
+	lock.release_read();
+
+	return sb.take();
+
+}
+
+int EmpowerRXStats::snapshot_handler(int, String &s, Element *e, const Handler *, ErrorHandler *errh) {
+	EmpowerRXStats *td = (EmpowerRXStats *) e;
+	uint32_t first, count;
+	if (SnapshotBuilder::parse_range(s, first, count, e, errh) < 0)
+		return -1;
+	s = td->snapshot_neighbors(first, count);
+	return 0;
+}
+
 String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 
 	EmpowerRXStats *td = (EmpowerRXStats *) e;
@@ -354,7 +540,7 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 					continue;
 				if ((*qi)->matches(nfo)) {
 					sa << (*qi)->unparse();
-					sa << " current " << nfo->_sma_rssi->avg();
+					sa << " current " << nfo->estimate((*qi)->_estimator);
 					sa << "\n";
 				}
 			}
@@ -389,6 +575,8 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 	}
 	case H_SIGNAL_OFFSET:
 		return String(td->_signal_offset) + "\n";
+	case H_DUPES:
+		return String(td->_dupes) + "\n";
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
 	default:
@@ -428,9 +616,11 @@ int EmpowerRXStats::write_handler(const String &in_s, Element *e, void *vparam,
 
 void EmpowerRXStats::add_handlers() {
 	add_read_handler("neighbors", read_handler, (void *) H_NEIGHBORS);
+	set_handler("neighbors_bin", Handler::f_read | Handler::f_read_param, snapshot_handler);
 	add_read_handler("summary_triggers", read_handler, (void *) H_SUMMARY_TRIGGERS);
 	add_read_handler("rssi_matches", read_handler, (void *) H_RSSI_MATCHES);
 	add_read_handler("rssi_triggers", read_handler, (void *) H_RSSI_TRIGGERS);
+	add_read_handler("dupes", read_handler, (void *) H_DUPES);
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
 	add_read_handler("signal_offset", read_handler, (void *) H_SIGNAL_OFFSET);
 	add_write_handler("signal_offset", write_handler, (void *) H_SIGNAL_OFFSET);
@@ -5,10 +5,12 @@
 #include <click/etheraddress.hh>
 #include <click/hashtable.hh>
 #include <click/glue.hh>
+#include <click/task.hh>
 #include <click/timer.hh>
 #include <click/straccum.hh>
+#include <click/packet_anno.hh>
 #include <clicknet/wifi.h>
-#include <click/sync.hh>
+#include "empowerlock.hh"
 #include "summary_trigger.hh"
 #include "rssi_trigger.hh"
 #include "dstinfo.hh"
@@ -26,6 +28,16 @@ CLICK_DECLS
 
  =d
 
+ Per neighbor RSSI samples are added to a window that the data path
+ updates under the read lock. Every PERIOD msec a housekeeping task
+ flips the windows, computes the new averages and drops stale
+ neighbors; only the last step takes the write lock.
+
+ The 802.11 header is parsed once. Its size is left in the annotation
+ area for EmpowerWifiDecap, and with DUPE_FILTER the sequence number is
+ checked against the same neighbor entry, so that no WifiDupeFilter is
+ needed in front of this element.
+
  Keyword arguments are:
 
  =over 8
@@ -33,14 +45,78 @@ CLICK_DECLS
  =item EL
  An EmpowerLVAPManager element
 
+ =item ESTIMATORS
+ Space separated list of per frame RSSI estimators (EWMA, WSMA, KALMAN)
+ to update even if no RSSI trigger uses them. By default an estimator is
+ updated only while a trigger is evaluated against it.
+
+ =item EWMA_ALPHA
+ Weight of a new sample in the EWMA estimator. Default is 0.25.
+
+ =item WSMA_WINDOW
+ Number of frames averaged by the WSMA estimator, at most 32. Default
+ is 8.
+
+ =item KALMAN_Q
+ Process noise variance of the KALMAN estimator. Default is 0.05.
+
+ =item KALMAN_R
+ Measurement noise variance of the KALMAN estimator. Default is 4.
+
+ =item PERIOD
+ Housekeeping period in msec. Default is 500.
+
+ =item DUPE_FILTER
+ Drop retransmissions already received, as WifiDupeFilter does, before
+ they are accounted. Default is false.
+
+ =item THREAD
+ Thread the housekeeping task runs on. Default is the element's home
+ thread.
+
  =item DEBUG
  Turn debug on/off
 
  =back 8
 
- =a EmpowerLVAPManager
+ =h dupes read-only
+ Number of duplicate frames dropped.
+
+ =h neighbors_bin read-only
+ Binary snapshot of the neighbor tables, see empowersnapshot.hh. Takes
+ an optional "FIRST COUNT" parameter to read it in chunks.
+
+ =a EmpowerLVAPManager, EmpowerWifiDecap, WifiDupeFilter
  */
 
+/*
+ * Result of the 802.11 header parse, in EMPOWER_WIFI_HDR_ANNO (see
+ * packet_anno.hh). It is only valid while the packet keeps the length it
+ * had when it was parsed.
+ */
+#define EMPOWER_WIFI_HDR_MAGIC		0xE5
+
+struct empower_wifi_hdr_anno {
+	uint8_t magic;
+	uint8_t header_size;
+	uint16_t length;
+};
+
+static inline void set_empower_wifi_hdr_size(Packet *p, unsigned header_size) {
+	empower_wifi_hdr_anno *a = (empower_wifi_hdr_anno *) (p->anno_u8() + EMPOWER_WIFI_HDR_ANNO_OFFSET);
+	a->magic = EMPOWER_WIFI_HDR_MAGIC;
+	a->header_size = header_size;
+	a->length = p->length();
+}
+
+// header size parsed by EmpowerRXStats, 0 if unknown
+static inline unsigned empower_wifi_hdr_size(const Packet *p) {
+	const empower_wifi_hdr_anno *a = (const empower_wifi_hdr_anno *) (p->anno_u8() + EMPOWER_WIFI_HDR_ANNO_OFFSET);
+	if (a->magic != EMPOWER_WIFI_HDR_MAGIC || a->length != (uint16_t) p->length())
+		return 0;
+	return a->header_size;
+}
+
 typedef HashTable<EtherAddress, DstInfo> NeighborTable;
 typedef NeighborTable::iterator NTIter;
 
@@ -65,13 +141,13 @@ public:
 
 	int initialize(ErrorHandler *);
 	int configure(Vector<String> &, ErrorHandler *);
-	void run_timer(Timer *);
+	bool run_task(Task *);
 
 	Packet *simple_action(Packet *);
 
 	void add_handlers();
 
-	void add_rssi_trigger(EtherAddress, uint32_t, empower_trigger_relation, int, uint16_t);
+	void add_rssi_trigger(EtherAddress, uint32_t, empower_trigger_relation, int, uint16_t, int = EMPOWER_RSSI_SMA);
 	void del_rssi_trigger(uint32_t);
 
 	void add_summary_trigger(int, EtherAddress, uint32_t, int16_t, uint16_t);
@@ -79,7 +155,8 @@ public:
 
 	void clear_triggers();
 
-	ReadWriteLock lock;
+	EmpowerRWLock lock;
+	Spinlock summary_lock;
 
 	NeighborTable aps;
 	NeighborTable stas;
@@ -87,7 +164,9 @@ public:
 private:
 
 	EmpowerLVAPManager *_el;
+	Task _task;
 	Timer _timer;
+	int _thread;
 
 	RssiTriggersList _rssi_triggers;
 	SummaryTriggersList _summary_triggers;
@@ -97,12 +176,25 @@ private:
 	unsigned _sma_period;
 	unsigned _max_silent_window_count; // in number of windows
 
+	bool _dupe_filter;
+	uint32_t _dupes;
+
+	RssiEstimators _estimators;
+	uint32_t _estimators_always; // updated even if no trigger uses them
+
 	bool _debug;
 
+	String snapshot_neighbors(uint32_t, uint32_t);
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
+	static int snapshot_handler(int, String &, Element *, const Handler *, ErrorHandler *);
 
-	void update_neighbor(EtherAddress, bool, uint8_t, uint8_t);
+	bool update_neighbor(EtherAddress, bool, uint8_t, uint8_t, const struct click_wifi *);
+	bool known_duplicate(EtherAddress, const struct click_wifi *);
+	void drain(NeighborTable &);
+	void update(NeighborTable &);
+	void update_estimators();
 
 };
 
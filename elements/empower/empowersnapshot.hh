@@ -0,0 +1,548 @@
+#ifndef CLICK_EMPOWERSNAPSHOT_HH
+#define CLICK_EMPOWERSNAPSHOT_HH
+#include <click/config.h>
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/etheraddress.hh>
+#include <click/string.hh>
+#include <click/straccum.hh>
+#include <click/crc32.h>
+#include <clicknet/wifi.h>
+CLICK_DECLS
+
+/*
+ * Binary snapshots of EmPOWER tables, returned by the *_bin read handlers
+ * (EmpowerLVAPManager lvaps_bin, EmpowerRXStats neighbors_bin, Minstrel
+ * rates_bin, EmpowerQOSManager slices_bin).
+ *
+ * A snapshot is an empower_snapshot_header followed by count records of
+ * record_size bytes, all in network byte order. The handlers take an
+ * optional "FIRST COUNT" parameter so that large tables can be read in
+ * chunks through ControlSocket ("READ el.lvaps_bin 0 256", then 256 256,
+ * and so on until first + count reaches total). Fields are only ever
+ * appended to a record, so readers should step by record_size.
+ *
+ * The same snapshots make up the warm restart file written by
+ * EmpowerLVAPManager (SNAPSHOT keyword): an empower_state_header followed
+ * by sections, each an empower_state_section and a complete snapshot of
+ * one table. The VAPS, NETWORKS, PORTS and PORT_RATES tables only appear
+ * there.
+ */
+
+#define EMPOWER_SNAPSHOT_VERSION 0x01
+
+enum empower_snapshot_types {
+	EMPOWER_SNAPSHOT_LVAPS = 0x01,
+	EMPOWER_SNAPSHOT_NEIGHBORS = 0x02,
+	EMPOWER_SNAPSHOT_RATES = 0x03,
+	EMPOWER_SNAPSHOT_SLICES = 0x04,
+	EMPOWER_SNAPSHOT_VAPS = 0x05,
+	EMPOWER_SNAPSHOT_NETWORKS = 0x06,
+	EMPOWER_SNAPSHOT_PORTS = 0x07,
+	EMPOWER_SNAPSHOT_PORT_RATES = 0x08,
+};
+
+/* snapshot header format */
+struct empower_snapshot_header {
+  private:
+    uint8_t     _version;       /* see snapshot version */
+    uint8_t     _type;          /* see snapshot types */
+    uint16_t    _record_size;   /* bytes per record (int) */
+    uint32_t    _total;         /* records in the table (int) */
+    uint32_t    _first;         /* index of the first record returned (int) */
+    uint32_t    _count;         /* records returned (int) */
+  public:
+    void set_version(uint8_t version)           { _version = version; }
+    void set_type(uint8_t type)                 { _type = type; }
+    void set_record_size(uint16_t record_size)  { _record_size = htons(record_size); }
+    void set_total(uint32_t total)              { _total = htonl(total); }
+    void set_first(uint32_t first)              { _first = htonl(first); }
+    void set_count(uint32_t count)              { _count = htonl(count); }
+    uint8_t version()                           { return _version; }
+    uint8_t type()                              { return _type; }
+    uint16_t record_size()                      { return ntohs(_record_size); }
+    uint32_t total()                            { return ntohl(_total); }
+    uint32_t first()                            { return ntohl(_first); }
+    uint32_t count()                            { return ntohl(_count); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* lvap record format */
+struct snapshot_lvap_record {
+  private:
+    uint8_t     _sta[6];                        /* EtherAddress */
+    uint8_t     _bssid[6];                      /* EtherAddress */
+    uint8_t     _encap[6];                      /* EtherAddress */
+    uint32_t    _iface_id;                      /* Int */
+    uint16_t    _assoc_id;                      /* Int */
+    uint8_t     _flags;                         /* see empower_lvap_flags */
+    char        _ssid[WIFI_NWID_MAXSIZE+1];     /* Null terminated SSID */
+    uint16_t    _ht_caps_info;                  /* HT capabilities */
+  public:
+    void set_sta(EtherAddress sta)              { memcpy(_sta, sta.data(), 6); }
+    void set_bssid(EtherAddress bssid)          { memcpy(_bssid, bssid.data(), 6); }
+    void set_encap(EtherAddress encap)          { memcpy(_encap, encap.data(), 6); }
+    void set_iface_id(uint32_t iface_id)        { _iface_id = htonl(iface_id); }
+    void set_assoc_id(uint16_t assoc_id)        { _assoc_id = htons(assoc_id); }
+    void set_flags(uint8_t flags)               { _flags = flags; }
+    void set_ssid(String ssid)                  { memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length() < WIFI_NWID_MAXSIZE ? ssid.length() : WIFI_NWID_MAXSIZE); }
+    void set_ht_caps_info(uint16_t ht_caps_info){ _ht_caps_info = htons(ht_caps_info); }
+    EtherAddress sta()                          { return EtherAddress(_sta); }
+    EtherAddress bssid()                        { return EtherAddress(_bssid); }
+    EtherAddress encap()                        { return EtherAddress(_encap); }
+    uint32_t iface_id()                         { return ntohl(_iface_id); }
+    uint16_t assoc_id()                         { return ntohs(_assoc_id); }
+    bool flag(uint8_t f)                        { return _flags & f; }
+    String ssid()                               { return String(_ssid, strnlen(_ssid, WIFI_NWID_MAXSIZE)); }
+    uint16_t ht_caps_info()                     { return ntohs(_ht_caps_info); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* vap record format */
+struct snapshot_vap_record {
+  private:
+    uint8_t     _bssid[6];                      /* EtherAddress */
+    uint32_t    _iface_id;                      /* Int */
+    char        _ssid[WIFI_NWID_MAXSIZE+1];     /* Null terminated SSID */
+  public:
+    void set_bssid(EtherAddress bssid)          { memcpy(_bssid, bssid.data(), 6); }
+    void set_iface_id(uint32_t iface_id)        { _iface_id = htonl(iface_id); }
+    void set_ssid(String ssid)                  { memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length() < WIFI_NWID_MAXSIZE ? ssid.length() : WIFI_NWID_MAXSIZE); }
+    EtherAddress bssid()                        { return EtherAddress(_bssid); }
+    uint32_t iface_id()                         { return ntohl(_iface_id); }
+    String ssid()                               { return String(_ssid, strnlen(_ssid, WIFI_NWID_MAXSIZE)); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* network record format, one per network advertised by an lvap */
+struct snapshot_network_record {
+  private:
+    uint8_t     _sta[6];                        /* EtherAddress */
+    uint8_t     _bssid[6];                      /* EtherAddress */
+    char        _ssid[WIFI_NWID_MAXSIZE+1];     /* Null terminated SSID */
+  public:
+    void set_sta(EtherAddress sta)              { memcpy(_sta, sta.data(), 6); }
+    void set_bssid(EtherAddress bssid)          { memcpy(_bssid, bssid.data(), 6); }
+    void set_ssid(String ssid)                  { memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length() < WIFI_NWID_MAXSIZE ? ssid.length() : WIFI_NWID_MAXSIZE); }
+    EtherAddress sta()                          { return EtherAddress(_sta); }
+    EtherAddress bssid()                        { return EtherAddress(_bssid); }
+    String ssid()                               { return String(_ssid, strnlen(_ssid, WIFI_NWID_MAXSIZE)); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* port record format, the transmission policy of a station */
+struct snapshot_port_record {
+  private:
+    uint8_t     _addr[6];                       /* EtherAddress */
+    uint8_t     _flags;                         /* see empower_port_flags */
+    uint8_t     _tx_mcast;                      /* see empower_tx_mcast_type */
+    uint8_t     _ur_mcast_count;                /* Int */
+    uint16_t    _rts_cts;                       /* Int */
+    uint16_t    _max_amsdu_len;                 /* Int */
+  public:
+    void set_addr(EtherAddress addr)            { memcpy(_addr, addr.data(), 6); }
+    void set_flags(uint8_t flags)               { _flags = flags; }
+    void set_tx_mcast(uint8_t tx_mcast)         { _tx_mcast = tx_mcast; }
+    void set_ur_mcast_count(uint8_t count)      { _ur_mcast_count = count; }
+    void set_rts_cts(uint16_t rts_cts)          { _rts_cts = htons(rts_cts); }
+    void set_max_amsdu_len(uint16_t len)        { _max_amsdu_len = htons(len); }
+    EtherAddress addr()                         { return EtherAddress(_addr); }
+    bool flag(uint8_t f)                        { return _flags & f; }
+    uint8_t tx_mcast()                          { return _tx_mcast; }
+    uint8_t ur_mcast_count()                    { return _ur_mcast_count; }
+    uint16_t rts_cts()                          { return ntohs(_rts_cts); }
+    uint16_t max_amsdu_len()                    { return ntohs(_max_amsdu_len); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* port rate record format, one per rate of a port, in policy order */
+struct snapshot_port_rate_record {
+  private:
+    uint8_t     _addr[6];                       /* EtherAddress */
+    uint8_t     _flags;                         /* SNAPSHOT_RATE_HT for HT MCS */
+    uint8_t     _rate;                          /* Mbps*2 or MCS index (int) */
+  public:
+    void set_addr(EtherAddress addr)            { memcpy(_addr, addr.data(), 6); }
+    void set_flags(uint8_t flags)               { _flags = flags; }
+    void set_rate(uint8_t rate)                 { _rate = rate; }
+    EtherAddress addr()                         { return EtherAddress(_addr); }
+    bool flag(uint8_t f)                        { return _flags & f; }
+    uint8_t rate()                              { return _rate; }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* neighbor record format */
+struct snapshot_neighbor_record {
+  private:
+    uint8_t     _addr[6];       /* EtherAddress */
+    uint8_t     _sender_type;   /* 0 station, 1 access point */
+    int8_t      _sma_rssi;      /* Moving RSSI in dBm (int) */
+    int8_t      _last_rssi_avg; /* RSSI during last window in dBm (int) */
+    uint8_t     _last_rssi_std; /* Std RSSI during last window in dBm (int) */
+    uint32_t    _iface_id;      /* Int */
+    uint32_t    _last_packets;  /* Frames in last window (int) */
+    uint32_t    _hist_packets;  /* Total frames (int) */
+    uint32_t    _silent_window_count; /* Windows without frames (int) */
+    uint32_t    _age;           /* Msecs since last frame (int) */
+  public:
+    void set_addr(EtherAddress addr)            { memcpy(_addr, addr.data(), 6); }
+    void set_sender_type(uint8_t sender_type)   { _sender_type = sender_type; }
+    void set_sma_rssi(int8_t sma_rssi)          { _sma_rssi = sma_rssi; }
+    void set_last_rssi_avg(int8_t last_rssi_avg){ _last_rssi_avg = last_rssi_avg; }
+    void set_last_rssi_std(uint8_t last_rssi_std){ _last_rssi_std = last_rssi_std; }
+    void set_iface_id(uint32_t iface_id)        { _iface_id = htonl(iface_id); }
+    void set_last_packets(uint32_t last_packets){ _last_packets = htonl(last_packets); }
+    void set_hist_packets(uint32_t hist_packets){ _hist_packets = htonl(hist_packets); }
+    void set_silent_window_count(uint32_t count){ _silent_window_count = htonl(count); }
+    void set_age(uint32_t age)                  { _age = htonl(age); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+enum snapshot_rate_flags {
+    SNAPSHOT_RATE_HT = (1<<0),
+    SNAPSHOT_RATE_MAX_TP = (1<<1),
+    SNAPSHOT_RATE_MAX_TP2 = (1<<2),
+    SNAPSHOT_RATE_MAX_PROB = (1<<3),
+};
+
+/* rate record format, one per station and rate */
+struct snapshot_rate_record {
+  private:
+    uint8_t     _sta[6];            /* EtherAddress */
+    uint8_t     _rate;              /* Mbps*2 or MCS index (int) */
+    uint8_t     _flags;             /* see snapshot_rate_flags */
+    uint32_t    _cur_tp;            /* Throughput in Mbps*10 (int) */
+    uint32_t    _cur_prob;          /* Success probability in 1/1000 (int) */
+    uint32_t    _ewma_prob;         /* EWMA success probability in 1/1000 (int) */
+    uint32_t    _last_successes;    /* Int */
+    uint32_t    _last_attempts;     /* Int */
+    uint32_t    _hist_successes;    /* Int */
+    uint32_t    _hist_attempts;     /* Int */
+    uint32_t    _last_successes_bytes;  /* Int */
+    uint32_t    _last_attempts_bytes;   /* Int */
+    uint32_t    _hist_successes_bytes;  /* Int */
+    uint32_t    _hist_attempts_bytes;   /* Int */
+  public:
+    void set_sta(EtherAddress sta)              { memcpy(_sta, sta.data(), 6); }
+    void set_rate(uint8_t rate)                 { _rate = rate; }
+    void set_flags(uint8_t flags)               { _flags = flags; }
+    void set_cur_tp(uint32_t cur_tp)            { _cur_tp = htonl(cur_tp); }
+    void set_cur_prob(uint32_t cur_prob)        { _cur_prob = htonl(cur_prob); }
+    void set_ewma_prob(uint32_t ewma_prob)      { _ewma_prob = htonl(ewma_prob); }
+    void set_last_successes(uint32_t v)         { _last_successes = htonl(v); }
+    void set_last_attempts(uint32_t v)          { _last_attempts = htonl(v); }
+    void set_hist_successes(uint32_t v)         { _hist_successes = htonl(v); }
+    void set_hist_attempts(uint32_t v)          { _hist_attempts = htonl(v); }
+    void set_last_successes_bytes(uint32_t v)   { _last_successes_bytes = htonl(v); }
+    void set_last_attempts_bytes(uint32_t v)    { _last_attempts_bytes = htonl(v); }
+    void set_hist_successes_bytes(uint32_t v)   { _hist_successes_bytes = htonl(v); }
+    void set_hist_attempts_bytes(uint32_t v)    { _hist_attempts_bytes = htonl(v); }
+    EtherAddress sta()                          { return EtherAddress(_sta); }
+    uint8_t rate()                              { return _rate; }
+    bool flag(uint8_t f)                        { return _flags & f; }
+    uint32_t cur_prob()                         { return ntohl(_cur_prob); }
+    uint32_t ewma_prob()                        { return ntohl(_ewma_prob); }
+    uint32_t hist_successes()                   { return ntohl(_hist_successes); }
+    uint32_t hist_attempts()                    { return ntohl(_hist_attempts); }
+    uint32_t hist_successes_bytes()             { return ntohl(_hist_successes_bytes); }
+    uint32_t hist_attempts_bytes()              { return ntohl(_hist_attempts_bytes); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* slice record format */
+struct snapshot_slice_record {
+  private:
+    char        _ssid[WIFI_NWID_MAXSIZE+1]; /* Null terminated SSID */
+    uint8_t     _dscp;                      /* Traffic DSCP (int) */
+    uint8_t     _scheduler;                 /* see empower_slice_scheduleruler */
+    uint8_t     _flags;                     /* see empower_slice_flags */
+    uint32_t    _quantum;                   /* Int */
+    uint32_t    _capacity;                  /* Int */
+    uint32_t    _size;                      /* Frames queued (int) */
+    uint32_t    _drops;                     /* Int */
+    uint32_t    _deficit;                   /* Int */
+    uint32_t    _deficit_used;              /* Int */
+    uint32_t    _max_queue_length;          /* Int */
+    uint32_t    _tx_packets;                /* Int */
+    uint32_t    _tx_bytes;                  /* Int */
+    uint32_t    _throttled;                 /* Int */
+    uint32_t    _max_rate;                  /* Bytes/s, 0 unlimited (int) */
+    uint32_t    _max_burst;                 /* Bytes (int) */
+    uint32_t    _max_airtime;               /* Usec/s, 0 unlimited (int) */
+    uint32_t    _max_airtime_burst;         /* Usec (int) */
+  public:
+    void set_ssid(String ssid)                  { memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length() < WIFI_NWID_MAXSIZE ? ssid.length() : WIFI_NWID_MAXSIZE); }
+    void set_dscp(uint8_t dscp)                 { _dscp = dscp; }
+    void set_scheduler(uint8_t scheduler)       { _scheduler = scheduler; }
+    void set_flags(uint8_t flags)               { _flags = flags; }
+    void set_quantum(uint32_t quantum)          { _quantum = htonl(quantum); }
+    void set_capacity(uint32_t capacity)        { _capacity = htonl(capacity); }
+    void set_size(uint32_t size)                { _size = htonl(size); }
+    void set_drops(uint32_t drops)              { _drops = htonl(drops); }
+    void set_deficit(uint32_t deficit)          { _deficit = htonl(deficit); }
+    void set_deficit_used(uint32_t deficit_used){ _deficit_used = htonl(deficit_used); }
+    void set_max_queue_length(uint32_t v)       { _max_queue_length = htonl(v); }
+    void set_tx_packets(uint32_t tx_packets)    { _tx_packets = htonl(tx_packets); }
+    void set_tx_bytes(uint32_t tx_bytes)        { _tx_bytes = htonl(tx_bytes); }
+    void set_throttled(uint32_t throttled)      { _throttled = htonl(throttled); }
+    void set_max_rate(uint32_t v)               { _max_rate = htonl(v); }
+    void set_max_burst(uint32_t v)              { _max_burst = htonl(v); }
+    void set_max_airtime(uint32_t v)            { _max_airtime = htonl(v); }
+    void set_max_airtime_burst(uint32_t v)      { _max_airtime_burst = htonl(v); }
+    String ssid()                               { return String(_ssid, strnlen(_ssid, WIFI_NWID_MAXSIZE)); }
+    uint8_t dscp()                              { return _dscp; }
+    uint8_t scheduler()                         { return _scheduler; }
+    bool flag(uint8_t f)                        { return _flags & f; }
+    uint32_t quantum()                          { return ntohl(_quantum); }
+    uint32_t max_rate()                         { return ntohl(_max_rate); }
+    uint32_t max_burst()                        { return ntohl(_max_burst); }
+    uint32_t max_airtime()                      { return ntohl(_max_airtime); }
+    uint32_t max_airtime_burst()                { return ntohl(_max_airtime_burst); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+#define EMPOWER_STATE_MAGIC 0x454D5057  /* "EMPW" */
+#define EMPOWER_STATE_VERSION 0x01
+#define EMPOWER_STATE_ALL_IFACES 0xFFFFFFFFU
+
+/* warm restart file header */
+struct empower_state_header {
+  private:
+    uint32_t    _magic;         /* EMPOWER_STATE_MAGIC */
+    uint8_t     _version;       /* EMPOWER_STATE_VERSION */
+    uint8_t     _pad;
+    uint16_t    _sections;      /* sections that follow (int) */
+    uint32_t    _length;        /* bytes that follow (int) */
+    uint32_t    _crc;           /* crc32 of the bytes that follow */
+    uint8_t     _wtp[6];        /* EtherAddress */
+    uint32_t    _epoch;         /* controller epoch of the state (int) */
+    uint32_t    _saved;         /* seconds since the epoch (int) */
+  public:
+    void set_magic()                            { _magic = htonl(EMPOWER_STATE_MAGIC); }
+    void set_version(uint8_t version)           { _version = version; }
+    void set_sections(uint16_t sections)        { _sections = htons(sections); }
+    void set_length(uint32_t length)            { _length = htonl(length); }
+    void set_crc(uint32_t crc)                  { _crc = htonl(crc); }
+    void set_wtp(EtherAddress wtp)              { memcpy(_wtp, wtp.data(), 6); }
+    void set_epoch(uint32_t epoch)              { _epoch = htonl(epoch); }
+    void set_saved(uint32_t saved)              { _saved = htonl(saved); }
+    uint32_t magic()                            { return ntohl(_magic); }
+    uint8_t version()                           { return _version; }
+    uint16_t sections()                         { return ntohs(_sections); }
+    uint32_t length()                           { return ntohl(_length); }
+    uint32_t crc()                              { return ntohl(_crc); }
+    EtherAddress wtp()                          { return EtherAddress(_wtp); }
+    uint32_t epoch()                            { return ntohl(_epoch); }
+    uint32_t saved()                            { return ntohl(_saved); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* warm restart file section, followed by length bytes of snapshot */
+struct empower_state_section {
+  private:
+    uint32_t    _iface_id;      /* Int, EMPOWER_STATE_ALL_IFACES if none */
+    uint32_t    _length;        /* Int */
+  public:
+    void set_iface_id(uint32_t iface_id)        { _iface_id = htonl(iface_id); }
+    void set_length(uint32_t length)            { _length = htonl(length); }
+    uint32_t iface_id()                         { return ntohl(_iface_id); }
+    uint32_t length()                           { return ntohl(_length); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/*
+ * Builds a snapshot of records [first, first + count) of a table with
+ * total records in a single allocation. The caller walks the table in a
+ * stable order and calls record() once per entry; record() returns where
+ * to write that entry, or null if the entry is outside the range. Walking
+ * can stop as soon as done() is true.
+ */
+class SnapshotBuilder {
+public:
+
+	SnapshotBuilder(uint8_t type, uint16_t record_size, uint32_t total, uint32_t first, uint32_t count) :
+			_record_size(record_size), _index(0) {
+		_first = first < total ? first : total;
+		_count = count < total - _first ? count : total - _first;
+		_s = String::make_uninitialized(sizeof(empower_snapshot_header) + _count * record_size);
+		_data = _s.mutable_data();
+		if (!_data)
+			return;
+		memset(_data, 0, _s.length());
+		empower_snapshot_header *h = (empower_snapshot_header *) _data;
+		h->set_version(EMPOWER_SNAPSHOT_VERSION);
+		h->set_type(type);
+		h->set_record_size(record_size);
+		h->set_total(total);
+		h->set_first(_first);
+		h->set_count(_count);
+	}
+
+	void *record() {
+		uint32_t i = _index++;
+		if (!_data || i < _first || i >= _first + _count)
+			return 0;
+		return _data + sizeof(empower_snapshot_header) + (i - _first) * _record_size;
+	}
+
+	bool done() const {
+		return _index >= _first + _count;
+	}
+
+	String take() {
+		return _s;
+	}
+
+	/* Parses the optional "FIRST COUNT" handler parameter. */
+	static int parse_range(const String &s, uint32_t &first, uint32_t &count, const Element *e, ErrorHandler *errh) {
+		first = 0;
+		count = 0xFFFFFFFFU;
+		return Args(e, errh).push_back_words(s)
+				.read_p("FIRST", first)
+				.read_p("COUNT", count)
+				.complete();
+	}
+
+private:
+
+	String _s;
+	char *_data;
+	uint16_t _record_size;
+	uint32_t _first;
+	uint32_t _count;
+	uint32_t _index;
+
+};
+
+/*
+ * Walks the records of a snapshot read back from a warm restart file.
+ * The snapshot is rejected, and count() is zero, if it is truncated, of
+ * another type, or its records are shorter than the caller expects.
+ */
+class SnapshotReader {
+public:
+
+	SnapshotReader(const char *data, uint32_t length, uint8_t type, uint16_t record_size) :
+			_data(0), _record_size(0), _count(0) {
+		if (length < sizeof(empower_snapshot_header))
+			return;
+		empower_snapshot_header *h = (empower_snapshot_header *) data;
+		if (h->version() != EMPOWER_SNAPSHOT_VERSION || h->type() != type || h->record_size() < record_size)
+			return;
+		if ((uint64_t) h->count() * h->record_size() > length - sizeof(empower_snapshot_header))
+			return;
+		_data = data + sizeof(empower_snapshot_header);
+		_record_size = h->record_size();
+		_count = h->count();
+	}
+
+	bool valid() const {
+		return _data;
+	}
+
+	uint32_t count() const {
+		return _count;
+	}
+
+	void *record(uint32_t i) const {
+		return (void *) (_data + i * _record_size);
+	}
+
+private:
+
+	const char *_data;
+	uint16_t _record_size;
+	uint32_t _count;
+
+};
+
+/*
+ * Lays out a warm restart file: add() appends a complete snapshot of one
+ * table as a section, take() puts the header in front of the sections.
+ */
+class StateBuilder {
+public:
+
+	StateBuilder() : _sections(0) {
+		_sa.append_fill(0, sizeof(empower_state_header));
+	}
+
+	void add(uint32_t iface_id, const String &snapshot) {
+		empower_state_section section;
+		section.set_iface_id(iface_id);
+		section.set_length(snapshot.length());
+		_sa.append((const char *) &section, sizeof(section));
+		_sa << snapshot;
+		_sections++;
+	}
+
+	String take(EtherAddress wtp, uint32_t epoch, uint32_t saved) {
+		if (_sa.out_of_memory())
+			return String();
+		uint32_t length = _sa.length() - sizeof(empower_state_header);
+		empower_state_header *h = (empower_state_header *) _sa.data();
+		memset(h, 0, sizeof(empower_state_header));
+		h->set_magic();
+		h->set_version(EMPOWER_STATE_VERSION);
+		h->set_sections(_sections);
+		h->set_length(length);
+		h->set_crc(update_crc(0xffffffff, _sa.data() + sizeof(empower_state_header), length));
+		h->set_wtp(wtp);
+		h->set_epoch(epoch);
+		h->set_saved(saved);
+		return _sa.take_string();
+	}
+
+private:
+
+	StringAccum _sa;
+	uint16_t _sections;
+
+};
+
+/*
+ * Checks the header of a warm restart file and walks its sections;
+ * next() returns false at the end or at the first malformed section.
+ */
+class StateReader {
+public:
+
+	StateReader(const char *data, uint32_t length) : _h(0), _data(data), _end(data), _left(0), _valid(false) {
+		if (length < sizeof(empower_state_header))
+			return;
+		_h = (empower_state_header *) data;
+		if (_h->magic() != EMPOWER_STATE_MAGIC || _h->version() != EMPOWER_STATE_VERSION)
+			return;
+		if (_h->length() > length - sizeof(empower_state_header))
+			return;
+		if (_h->crc() != update_crc(0xffffffff, data + sizeof(empower_state_header), _h->length()))
+			return;
+		_data += sizeof(empower_state_header);
+		_end = _data + _h->length();
+		_left = _h->sections();
+		_valid = true;
+	}
+
+	bool valid() const {
+		return _valid;
+	}
+
+	empower_state_header *header() const {
+		return _h;
+	}
+
+	bool next(uint32_t &iface_id, const char *&data, uint32_t &length) {
+		if (!_left || (uint32_t) (_end - _data) < sizeof(empower_state_section))
+			return false;
+		empower_state_section *section = (empower_state_section *) _data;
+		if (section->length() > (uint32_t) (_end - _data) - sizeof(empower_state_section))
+			return false;
+		iface_id = section->iface_id();
+		data = _data + sizeof(empower_state_section);
+		length = section->length();
+		_data = data + length;
+		_left--;
+		return true;
+	}
+
+private:
+
+	empower_state_header *_h;
+	const char *_data;
+	const char *_end;
+	uint16_t _left;
+	bool _valid;
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -21,19 +21,72 @@
 #include <click/error.hh>
 #include <clicknet/ether.h>
 #include <click/etheraddress.hh>
+#include <click/straccum.hh>
+#include <click/master.hh>
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
 
-EmpowerTee::EmpowerTee() : _el(0) {
+EmpowerTeeRing::EmpowerTeeRing(EmpowerTee *tee, int port, uint32_t capacity) :
+		_tee(tee), _port(port), _thread(0), _task(EmpowerTee::run_ring, this),
+		_handoffs(0), _drops(0), _head(0), _tail(0) {
+	_sleeping = 1;
+	_mask = 1;
+	while (_mask < capacity)
+		_mask <<= 1;
+	_slots = new Packet *[_mask];
+	_mask--;
+}
+
+EmpowerTeeRing::~EmpowerTeeRing() {
+	while (Packet *p = dequeue())
+		p->kill();
+	delete[] _slots;
+}
+
+bool EmpowerTeeRing::enqueue(Packet *p) {
+	_lock.acquire();
+	uint32_t t = _tail;
+	if (t - _head > _mask) {
+		_drops++;
+		_lock.release();
+		return false;
+	}
+	_slots[t & _mask] = p;
+	// the slot must be visible before the task can see the new tail
+	click_fence();
+	_tail = t + 1;
+	_lock.release();
+	return true;
+}
+
+Packet *EmpowerTeeRing::dequeue() {
+	uint32_t h = _head;
+	if (h == _tail)
+		return 0;
+	click_fence();
+	Packet *p = _slots[h & _mask];
+	click_fence();
+	_head = h + 1;
+	return p;
+}
+
+EmpowerTee::EmpowerTee() : _el(0), _capacity(1024), _burst(32) {
+}
+
+EmpowerTee::~EmpowerTee() {
 }
 
 int EmpowerTee::configure(Vector<String> &conf, ErrorHandler *errh) {
 
 	unsigned n = noutputs();
+	String threads;
 
 	int res = Args(conf, this, errh)
 					.read_p("N", n)
 					.read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
+					.read("THREADS", AnyArg(), threads)
+					.read("CAPACITY", _capacity)
+					.read("BURST", _burst)
 					.complete();
 
 	if (res < 0)
@@ -42,10 +95,108 @@ int EmpowerTee::configure(Vector<String> &conf, ErrorHandler *errh) {
 	if (n != (unsigned) noutputs())
 		return errh->error("%d outputs implies %d arms", noutputs(), noutputs());
 
+	Vector<String> tokens;
+	cp_spacevec(cp_unquote(threads), tokens);
+
+	for (int i = 0; i < tokens.size(); i++) {
+		int thread;
+		if (!IntArg().parse(tokens[i], thread) || thread < 0)
+			return errh->error("error param %s: must be a thread id", tokens[i].c_str());
+		_threads.push_back(thread);
+	}
+
+	if (_threads.size() && _threads.size() != noutputs())
+		return errh->error("threads has %u values, while there are %u outputs", _threads.size(), noutputs());
+
+	if (_capacity < 1 || _capacity > 0x10000000)
+		return errh->error("CAPACITY must be between 1 and 2^28");
+
+	if (_burst < 1)
+		return errh->error("BURST must be positive");
+
 	return 0;
 
 }
 
+int EmpowerTee::initialize(ErrorHandler *errh) {
+
+	for (int i = 0; i < _threads.size(); i++) {
+		if (_threads[i] >= master()->nthreads())
+			return errh->error("THREADS must be less than %d", master()->nthreads());
+		EmpowerTeeRing *ring = new EmpowerTeeRing(this, i, _capacity);
+		_rings.push_back(ring);
+		ring->_thread = _threads[i];
+		ring->_task.initialize(this, false);
+		ring->_task.move_thread(_threads[i]);
+	}
+
+	return 0;
+
+}
+
+void EmpowerTee::cleanup(CleanupStage) {
+	for (int i = 0; i < _rings.size(); i++)
+		delete _rings[i];
+	_rings.clear();
+}
+
+bool EmpowerTee::run_ring(Task *, void *user_data) {
+	EmpowerTeeRing *ring = static_cast<EmpowerTeeRing *>(user_data);
+	return ring->_tee->drain(ring);
+}
+
+bool EmpowerTee::drain(EmpowerTeeRing *ring) {
+
+	int n = 0;
+
+	while (n < _burst) {
+		Packet *p = ring->dequeue();
+		if (!p)
+			break;
+		output(ring->_port).push(p);
+		n++;
+	}
+
+	ring->_handoffs += n;
+
+	if (!ring->empty()) {
+		ring->_task.fast_reschedule();
+		return n > 0;
+	}
+
+	// about to sleep: a frame enqueued before the producer could see the
+	// flag is caught by the check below, later ones wake the task
+	ring->_sleeping = 1;
+	click_fence();
+	if (!ring->empty() && ring->_sleeping.swap(0))
+		ring->_task.fast_reschedule();
+
+	return n > 0;
+
+}
+
+void EmpowerTee::output_push(int port, Packet *p) {
+
+	if (!_rings.size()) {
+		output(port).push(p);
+		return;
+	}
+
+	EmpowerTeeRing *ring = _rings[port];
+
+	if (!ring->enqueue(p)) {
+		p->kill();
+		return;
+	}
+
+	// pairs with the fence in drain(): either the task sees the frame or
+	// we see the task sleeping
+	click_fence();
+	if (ring->_sleeping && ring->_sleeping.swap(0))
+		ring->_task.reschedule();
+
+}
+
 void EmpowerTee::push(int, Packet *p) {
 
 	if (p->length() < sizeof(struct click_ether)) {
@@ -65,10 +216,10 @@ void EmpowerTee::push(int, Packet *p) {
 	if (!dst.is_broadcast() && !dst.is_group()) {
 		EmpowerStationState *ess = _el->get_ess(dst);
 		if (!ess) {
-			p->kill();
+			_el->hold_frame(dst, p);
 			return;
 		}
-		output(ess->_iface_id).push(p);
+		output_push(ess->_iface_id, p);
 		return;
 	}
 
@@ -76,11 +227,43 @@ void EmpowerTee::push(int, Packet *p) {
 	int n = noutputs();
 	for (int i = 0; i < n - 1; i++) {
 		if (Packet *q = p->clone()) {
-			output(i).push(q);
+			output_push(i, q);
 		}
 	}
-	output(n - 1).push(p);
+	output_push(n - 1, p);
+
+}
+
+enum {
+	H_RINGS, H_DROPS
+};
+
+String EmpowerTee::read_handler(Element *e, void *thunk) {
+	EmpowerTee *td = (EmpowerTee *) e;
+	switch ((uintptr_t) thunk) {
+	case H_RINGS: {
+		StringAccum sa;
+		for (int i = 0; i < td->_rings.size(); i++) {
+			EmpowerTeeRing *ring = td->_rings[i];
+			sa << i << " thread " << ring->_thread << " queued " << ring->size()
+			   << " handoffs " << ring->_handoffs << " drops " << ring->_drops << "\n";
+		}
+		return sa.take_string();
+	}
+	case H_DROPS: {
+		uint64_t drops = 0;
+		for (int i = 0; i < td->_rings.size(); i++)
+			drops += td->_rings[i]->_drops;
+		return String(drops);
+	}
+	default:
+		return String();
+	}
+}
 
+void EmpowerTee::add_handlers() {
+	add_read_handler("rings", read_handler, (void *) H_RINGS);
+	add_read_handler("drops", read_handler, (void *) H_DROPS);
 }
 
 CLICK_ENDDECLS
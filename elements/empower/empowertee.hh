@@ -1,28 +1,117 @@
 #ifndef CLICK_EMPOWERTEE_HH
 #define CLICK_EMPOWERTEE_HH
 #include <click/element.hh>
+#include <click/task.hh>
+#include <click/sync.hh>
+#include <click/atomic.hh>
 CLICK_DECLS
 
 /*
  * =c
- * EmpowerTee([N])
+ * EmpowerTee([N], EL[, I<KEYWORDS>])
  * =s basictransfer
  * duplicates packets
  * =d
  * EmpowerTee sends a copy of each incoming packet out each output.N.
+ * Unicast frames only go out the output of the interface their station
+ * is on. Those for stations without an LVAP go to the EL's holding
+ * buffers if a handover is under way, and are dropped otherwise.
+ *
+ * With THREADS, each output gets a ring and a task on its own thread:
+ * push only enqueues the frame, and the task pushes it out on that
+ * thread. Everything downstream of an output (EmpowerQOSManager,
+ * Minstrel, ToDevice) should then be scheduled on the same thread, e.g.
+ * with StaticThreadSched, so that each radio runs on its own core.
+ *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item EL
+ * An EmpowerLVAPManager element.
+ *
+ * =item THREADS
+ * Space separated list of thread ids, one per output. By default frames
+ * are pushed out synchronously on the calling thread.
+ *
+ * =item CAPACITY
+ * Frames each ring holds, rounded up to a power of two. Frames arriving
+ * at a full ring are dropped. Default is 1024.
+ *
+ * =item BURST
+ * Frames a task pushes out each time it runs. Default is 32.
+ *
+ * =back 8
+ *
+ * =h rings read-only
+ * Thread, queued frames, frames handed off and frames dropped for each
+ * output.
+ *
+ * =h drops read-only
+ * Frames dropped because a ring was full.
+ *
+ * =e
+ *   tee :: EmpowerTee(2, EL el, THREADS "1 2");
+ *   tee[0] -> eqm_0;
+ *   tee[1] -> eqm_1;
+ *   StaticThreadSched(td_0 1, td_1 2);
+ *
+ * =a EmpowerLVAPManager, StaticThreadSched
  */
 
+class EmpowerTee;
+
+/*
+ * Bounded ring handing frames from the threads pushing into EmpowerTee
+ * to the task of one output. Producers serialize on a spinlock, the task
+ * dequeues without locking. The task sleeps when the ring is empty and
+ * the producer that finds it sleeping reschedules it.
+ */
+class EmpowerTeeRing {
+public:
+
+	EmpowerTeeRing(EmpowerTee *tee, int port, uint32_t capacity);
+	~EmpowerTeeRing();
+
+	bool enqueue(Packet *p);
+	Packet *dequeue();
+
+	uint32_t size() const { return _tail - _head; }
+	bool empty() const { return _tail == _head; }
+
+	EmpowerTee *_tee;
+	int _port;
+	int _thread;
+	Task _task;
+	atomic_uint32_t _sleeping;
+	uint64_t _handoffs;
+	uint64_t _drops;
+
+private:
+
+	Packet **_slots;
+	uint32_t _mask;
+	volatile uint32_t _head;
+	volatile uint32_t _tail;
+	SimpleSpinlock _lock;
+
+};
+
 class EmpowerTee : public Element {
 
 public:
 
 	EmpowerTee() CLICK_COLD;
+	~EmpowerTee() CLICK_COLD;
 
 	const char *class_name() const		{ return "EmpowerTee"; }
 	const char *port_count() const		{ return "1/1-"; }
 	const char *processing() const		{ return PUSH; }
 
 	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+	void cleanup(CleanupStage) CLICK_COLD;
+	void add_handlers() CLICK_COLD;
 
 	void push(int, Packet *);
 
@@ -30,6 +119,19 @@ private:
 
 	class EmpowerLVAPManager *_el;
 
+	Vector<int> _threads;
+	Vector<EmpowerTeeRing *> _rings;
+	uint32_t _capacity;
+	int _burst;
+
+	void output_push(int port, Packet *p);
+	bool drain(EmpowerTeeRing *ring);
+
+	friend class EmpowerTeeRing;
+
+	static bool run_ring(Task *, void *);
+	static String read_handler(Element *, void *) CLICK_COLD;
+
 };
 
 CLICK_ENDDECLS
@@ -27,6 +27,7 @@
 #include <click/etheraddress.hh>
 #include "minstrel.hh"
 #include "empowerlvapmanager.hh"
+#include "empowerrxstats.hh"
 CLICK_DECLS
 
 EmpowerWifiDecap::EmpowerWifiDecap() :
@@ -61,18 +62,25 @@ EmpowerWifiDecap::push(int, Packet *p) {
 
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
-	unsigned wifi_header_size = sizeof(struct click_wifi);
+	// already parsed by EmpowerRXStats
+	unsigned wifi_header_size = empower_wifi_hdr_size(p);
 
-	if ((w->i_fc[1] & WIFI_FC1_DIR_MASK) == WIFI_FC1_DIR_DSTODS)
-		wifi_header_size += WIFI_ADDR_LEN;
+	if (!wifi_header_size) {
 
-	if (WIFI_QOS_HAS_SEQ(w))
-		wifi_header_size += sizeof(uint16_t);
+		wifi_header_size = sizeof(struct click_wifi);
 
-	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+		if ((w->i_fc[1] & WIFI_FC1_DIR_MASK) == WIFI_FC1_DIR_DSTODS)
+			wifi_header_size += WIFI_ADDR_LEN;
 
-	if ((ceh->magic == WIFI_EXTRA_MAGIC) && ceh->pad && (wifi_header_size & 3))
-		wifi_header_size += 4 - (wifi_header_size & 3);
+		if (WIFI_QOS_HAS_SEQ(w))
+			wifi_header_size += sizeof(uint16_t);
+
+		struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+
+		if ((ceh->magic == WIFI_EXTRA_MAGIC) && ceh->pad && (wifi_header_size & 3))
+			wifi_header_size += 4 - (wifi_header_size & 3);
+
+	}
 
 	if (p->length() < wifi_header_size) {
 		if (_debug) {
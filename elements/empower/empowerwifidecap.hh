@@ -21,7 +21,8 @@ Strips the 802.11 frame header and LLC header off the packet and pushes
 an Ethernet header onto the packet. Discards packets that are shorter
 than the length of the 802.11 frame header and LLC header and packets
 that do not have a LVAP or packets coming from station that have not
-completed the authentication and the association procedure.
+completed the authentication and the association procedure. The header
+size left in the annotations by EmpowerRXStats is used if present.
 
 =over 8
 
@@ -33,7 +34,7 @@ Turn debug on/off
 
 =back
 
-=a EmpowerWifiEncap
+=a EmpowerWifiEncap, EmpowerRXStats
 */
 
 class EmpowerWifiDecap: public Element {
@@ -24,15 +24,41 @@
 #include <clicknet/ether.h>
 #include <clicknet/wifi.h>
 #include "minstrel.hh"
+#include "empowersnapshot.hh"
+#include "empowerqosmanager.hh"
 
 CLICK_DECLS
 
 Minstrel::Minstrel() 
-  : _tx_policies(0), _timer(this), _lookaround_rate(20), _offset(0),
-	_active(true), _period(500), _ewma_level(75), _debug(false) {
+  : _eqm(0), _tx_policies(0), _timer(this), _ur_packet(0), _ur_left(0), _lookaround_rate(20),
+	_offset(0), _active(true), _period(500), _ewma_level(75), _debug(false) {
 }
 
 Minstrel::~Minstrel() {
+	if (_ur_packet) {
+		_ur_packet->kill();
+	}
+}
+
+uint32_t Minstrel::rate_usecs(MinstrelDstInfo *nfo, int i)
+{
+	uint32_t usecs;
+	if (_transm_time.find(nfo->rates[i]) == _transm_time.end()) {
+		if (nfo->ht)
+			usecs = calc_usecs_wifi_packet_ht(1500, nfo->rates[i], 0);
+		else
+			usecs = calc_usecs_wifi_packet(1500, nfo->rates[i], 0);
+
+		_transm_time.set(nfo->rates[i], usecs);
+	}
+	else
+	{
+		usecs = _transm_time.get(nfo->rates[i]);
+	}
+	if (!usecs) {
+		usecs = 1000000;
+	}
+	return usecs;
 }
 
 void Minstrel::run_timer(Timer *)
@@ -45,21 +71,7 @@ void Minstrel::run_timer(Timer *)
 		int i;
 		uint32_t p;
 		for (i = 0; i < nfo->rates.size(); i++) {
-			if (_transm_time.find(nfo->rates[i]) == _transm_time.end()) {
-				if (nfo->ht)
-					usecs = calc_usecs_wifi_packet_ht(1500, nfo->rates[i], 0);
-				else
-					usecs = calc_usecs_wifi_packet(1500, nfo->rates[i], 0);
-
-				_transm_time.set(nfo->rates[i], usecs);
-			}
-			else
-			{
-				usecs = _transm_time.get(nfo->rates[i]);
-			}
-			if (!usecs) {
-				usecs = 1000000;
-			}
+			usecs = rate_usecs(nfo, i);
 			/* To avoid rounding issues, probabilities scale from 0 (0%)
 			 * to 18000 (100%) */
 			if (nfo->attempts[i]) {
@@ -152,6 +164,8 @@ void Minstrel::process_feedback(Packet *p_in) {
 	}
 	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p_in);
 	int success = !(ceh->flags & WIFI_EXTRA_TX_FAIL);
+	struct click_wifi *w = (struct click_wifi *) p_in->data();
+	bool data = (w->i_fc[0] & WIFI_FC0_TYPE_MASK) == WIFI_FC0_TYPE_DATA;
 	MinstrelDstInfo *nfo = _neighbors.findp(dst);
 	/* rate wasn't set */
 	if (!nfo) {
@@ -163,6 +177,8 @@ void Minstrel::process_feedback(Packet *p_in) {
 		}
 		return;
 	}
+	/* pushed by assign_rate for data frames only */
+	uint32_t estimate = data ? nfo->pop_estimate() : 0;
 	/* rate is HT but feedback is legacy */
 	if (nfo->ht && !(ceh->flags & WIFI_EXTRA_MCS)) {
 		if (_debug) {
@@ -174,9 +190,46 @@ void Minstrel::process_feedback(Packet *p_in) {
 		return;
 	}
 	nfo->add_result(ceh->rate, ceh->max_tries, success, p_in->length());
+	uint32_t usecs = feedback_usecs_wifi_packet(nfo, p_in);
+	nfo->hist_airtime += usecs;
+	if (_eqm && data) {
+		_eqm->charge_airtime(p_in, usecs, estimate ? estimate : estimate_usecs_wifi_packet(p_in));
+	}
 	return;
 }
 
+/*
+ * Airtime taken by the retry chain of a frame. The feedback only carries
+ * the last rate and the tries made at it, so when an alternate rate was
+ * used the earlier stages are assumed to be those assign_rate() builds
+ * from the current statistics, each with all of its tries.
+ */
+uint32_t Minstrel::feedback_usecs_wifi_packet(MinstrelDstInfo *nfo, Packet *p) {
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	int length = p->length();
+	int tries = (ceh->max_tries > 0) ? ceh->max_tries : 1;
+	int t = 0;
+	uint32_t usecs = 0;
+	if (ceh->flags & WIFI_EXTRA_TX_USED_ALT_RATE) {
+		int chain[3] = {
+			nfo->rates[nfo->max_tp_rate],
+			nfo->rates[nfo->max_tp_rate2],
+			nfo->rates[nfo->max_prob_rate]
+		};
+		for (int i = 0; i < 3 && chain[i] != ceh->rate; i++, t += STAGE_TRIES) {
+			if (nfo->ht)
+				usecs += calc_usecs_wifi_packet_tries_ht(length, chain[i], t, t + STAGE_TRIES - 1);
+			else
+				usecs += calc_usecs_wifi_packet_tries(length, chain[i], t, t + STAGE_TRIES - 1);
+		}
+	}
+	if (nfo->ht)
+		usecs += calc_usecs_wifi_packet_tries_ht(length, ceh->rate, t, t + tries - 1);
+	else
+		usecs += calc_usecs_wifi_packet_tries(length, ceh->rate, t, t + tries - 1);
+	return usecs;
+}
+
 void Minstrel::assign_rate(Packet *p_in)
 {
 
@@ -270,6 +323,11 @@ void Minstrel::assign_rate(Packet *p_in)
 		}
 	}
 
+	/* set by EmpowerQOSManager::pull, read back from the TX feedback */
+	if (type == WIFI_FC0_TYPE_DATA) {
+		nfo->push_estimate(AIRTIME_ANNO(p_in));
+	}
+
 	int ndx;
 	bool sample = false;
 	int delta;
@@ -326,20 +384,88 @@ void Minstrel::assign_rate(Packet *p_in)
 	ceh->rate2 = nfo->rates[nfo->max_prob_rate];
 	ceh->rate3 = nfo->rates[0];
 
-	ceh->max_tries = 4;
-	ceh->max_tries1 = 4;
-	ceh->max_tries2 = 4;
-	ceh->max_tries3 = 4;
+	ceh->max_tries = STAGE_TRIES;
+	ceh->max_tries1 = STAGE_TRIES;
+	ceh->max_tries2 = STAGE_TRIES;
+	ceh->max_tries3 = STAGE_TRIES;
 
 	return;
 
 }
 
+void Minstrel::ur_schedule(Packet *p) {
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	EtherAddress dst = EtherAddress((uint8_t *) p->data() + _offset);
+
+	if (!dst.is_group() || (w->i_fc[0] & WIFI_FC0_TYPE_MASK) != WIFI_FC0_TYPE_DATA) {
+		return;
+	}
+
+	TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
+
+	if (!tx_policy || tx_policy->_tx_mcast != TX_MCAST_UR || tx_policy->_ur_mcast_count <= 1) {
+		return;
+	}
+
+	_ur_packet = p->clone();
+
+	if (_ur_packet) {
+		_ur_left = tx_policy->_ur_mcast_count - 1;
+	}
+
+}
+
+Packet * Minstrel::ur_repeat() {
+
+	// the last repetition takes the stored frame
+	Packet *p;
+	if (--_ur_left > 0) {
+		p = _ur_packet->clone();
+	} else {
+		p = _ur_packet;
+		_ur_packet = 0;
+	}
+
+	WritablePacket *q = p ? p->uniqueify() : 0;
+
+	// out of memory, give up the rest of the chain
+	if (!q) {
+		if (_ur_packet) {
+			_ur_packet->kill();
+			_ur_packet = 0;
+		}
+		_ur_left = 0;
+		return 0;
+	}
+
+	struct click_wifi *w = (struct click_wifi *) q->data();
+	w->i_fc[1] |= WIFI_FC1_RETRY;
+
+	EtherAddress dst = EtherAddress((uint8_t *) q->data() + _offset);
+	TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
+
+	if (tx_policy) {
+		tx_policy->update_ur(q->length());
+	}
+
+	return q;
+
+}
+
 Packet* Minstrel::pull(int port) {
+	if (_ur_packet) {
+		if (Packet *q = ur_repeat()) {
+			return q;
+		}
+	}
 	Packet *p = input(port).pull();
 	if (p && _active) {
 		assign_rate(p);
 	}
+	if (p) {
+		ur_schedule(p);
+	}
 	return p;
 }
 
@@ -350,10 +476,17 @@ void Minstrel::push(int port, Packet *p_in)
 	}
 	if (port != 0) {
 		process_feedback(p_in);
-	} else {
-		assign_rate(p_in);
+		checked_output_push(port, p_in);
+		return;
 	}
+	assign_rate(p_in);
+	ur_schedule(p_in);
 	checked_output_push(port, p_in);
+	while (_ur_packet) {
+		if (Packet *q = ur_repeat()) {
+			checked_output_push(port, q);
+		}
+	}
 }
 
 String Minstrel::print_rates()
@@ -366,6 +499,98 @@ String Minstrel::print_rates()
 	return sa.take_string();
 }
 
+String Minstrel::snapshot_rates(uint32_t first, uint32_t count) {
+
+	uint32_t total = 0;
+	for (MinstrelIter iter = _neighbors.begin(); iter.live(); iter++) {
+		total += iter.value().rates.size();
+	}
+
+	SnapshotBuilder sb(EMPOWER_SNAPSHOT_RATES, sizeof(snapshot_rate_record), total, first, count);
+
+	for (MinstrelIter iter = _neighbors.begin(); iter.live() && !sb.done(); iter++) {
+		MinstrelDstInfo *nfo = &iter.value();
+		for (int i = 0; i < nfo->rates.size() && !sb.done(); i++) {
+			snapshot_rate_record *r = (snapshot_rate_record *) sb.record();
+			if (!r) {
+				continue;
+			}
+			uint8_t flags = 0;
+			if (nfo->ht)
+				flags |= SNAPSHOT_RATE_HT;
+			if (i == nfo->max_tp_rate)
+				flags |= SNAPSHOT_RATE_MAX_TP;
+			if (i == nfo->max_tp_rate2)
+				flags |= SNAPSHOT_RATE_MAX_TP2;
+			if (i == nfo->max_prob_rate)
+				flags |= SNAPSHOT_RATE_MAX_PROB;
+			r->set_sta(nfo->eth);
+			r->set_rate(nfo->rates[i]);
+			r->set_flags(flags);
+			// same scaling as MinstrelDstInfo::unparse()
+			r->set_cur_tp(nfo->cur_tp[i] / ((18000 << 10) / 96));
+			r->set_cur_prob(nfo->cur_prob[i] / 18);
+			r->set_ewma_prob(nfo->probability[i] / 18);
+			r->set_last_successes(nfo->last_successes[i]);
+			r->set_last_attempts(nfo->last_attempts[i]);
+			r->set_hist_successes(nfo->hist_successes[i]);
+			r->set_hist_attempts(nfo->hist_attempts[i]);
+			r->set_last_successes_bytes(nfo->last_successes_bytes[i]);
+			r->set_last_attempts_bytes(nfo->last_attempts_bytes[i]);
+			r->set_hist_successes_bytes(nfo->hist_successes_bytes[i]);
+			r->set_hist_attempts_bytes(nfo->hist_attempts_bytes[i]);
+		}
+	}
+
+	return sb.take();
+
+}
+
+void Minstrel::restore_rate(snapshot_rate_record *r) {
+
+	// the neighbor is created with the rates of its transmission policy
+	MinstrelDstInfo *nfo = _neighbors.findp(r->sta());
+	if (!nfo || nfo->ht != r->flag(SNAPSHOT_RATE_HT)) {
+		return;
+	}
+
+	int i = nfo->rate_index(r->rate());
+	if (i < 0) {
+		return;
+	}
+
+	// probabilities were saved in 1/1000, throughput follows from them
+	nfo->probability[i] = WIFI_MIN(r->ewma_prob() * 18, 18000U);
+	nfo->cur_prob[i] = WIFI_MIN(r->cur_prob() * 18, 18000U);
+	nfo->cur_tp[i] = nfo->probability[i] * (1000000 / rate_usecs(nfo, i));
+	nfo->hist_successes[i] = r->hist_successes();
+	nfo->hist_attempts[i] = r->hist_attempts();
+	nfo->hist_successes_bytes[i] = r->hist_successes_bytes();
+	nfo->hist_attempts_bytes[i] = r->hist_attempts_bytes();
+	if ((nfo->probability[i] > 17100) || (nfo->probability[i] < 1800)) {
+		nfo->sample_limit[i] = 4;
+	} else {
+		nfo->sample_limit[i] = -1;
+	}
+
+	if (r->flag(SNAPSHOT_RATE_MAX_TP))
+		nfo->max_tp_rate = i;
+	if (r->flag(SNAPSHOT_RATE_MAX_TP2))
+		nfo->max_tp_rate2 = i;
+	if (r->flag(SNAPSHOT_RATE_MAX_PROB))
+		nfo->max_prob_rate = i;
+
+}
+
+int Minstrel::snapshot_handler(int, String &s, Element *e, const Handler *, ErrorHandler *errh) {
+	Minstrel *td = (Minstrel *) e;
+	uint32_t first, count;
+	if (SnapshotBuilder::parse_range(s, first, count, e, errh) < 0)
+		return -1;
+	s = td->snapshot_rates(first, count);
+	return 0;
+}
+
 enum {
 	H_RATES, H_DEBUG
 };
@@ -399,6 +624,7 @@ int Minstrel::write_handler(const String &in_s, Element *e, void *vparam, ErrorH
 
 void Minstrel::add_handlers() {
 	add_read_handler("rates", read_handler, H_RATES);
+	set_handler("rates_bin", Handler::f_read | Handler::f_read_param, snapshot_handler);
 	add_read_handler("debug", read_handler, H_DEBUG);
 	add_write_handler("debug", write_handler, H_DEBUG);
 }
@@ -10,14 +10,30 @@
 #include "transmissionpolicies.hh"
 CLICK_DECLS
 
+class EmpowerQOSManager;
+struct snapshot_rate_record;
+
 /*
  * =c
  * Minstrel([, I<KEYWORDS>])
  * =s Wifi
  * Minstrel wireless bit-rate selection algorithm
+ * =d
+ * Group data frames whose transmission policy is set to unsolicited
+ * retries (TX_MCAST_UR) are transmitted ur_mcast_count times. The
+ * repetitions keep the sequence number of the original frame, have the
+ * retry bit set, and are sent at the robust rate of the policy.
+ * TX feedback is converted into the airtime taken by the whole retry
+ * chain and, if an EmpowerQOSManager uses this element as its RC, charged
+ * to the slice the frame belongs to.
+ * =h rates_bin read-only
+ * Binary snapshot of the per rate statistics, see empowersnapshot.hh.
+ * Takes an optional "FIRST COUNT" parameter to read it in chunks.
  * =a SetTXRate, FilterTX
  */
 
+// dequeue time airtime estimates kept per neighbor, see push_estimate()
+#define MINSTREL_ESTIMATES 64
 
 struct MinstrelDstInfo {
 public:
@@ -45,6 +61,12 @@ public:
 	int max_tp_rate2;
 	int max_prob_rate;
 	bool ht;
+	uint64_t hist_airtime; // usec, from TX feedback
+	// airtime EmpowerQOSManager charged at dequeue for the data frames
+	// sent and not yet reported by TX feedback, oldest first
+	uint32_t estimates[MINSTREL_ESTIMATES];
+	int estimates_head;
+	int estimates_count;
 	MinstrelDstInfo() {
 		eth = EtherAddress();
 		rates = Vector<int>();
@@ -70,6 +92,9 @@ public:
 		max_tp_rate2 = 0;
 		max_prob_rate = 0;
 		ht = false;
+		hist_airtime = 0;
+		estimates_head = 0;
+		estimates_count = 0;
 	}
 	MinstrelDstInfo(EtherAddress neighbor, Vector<int> supported, bool ht_rates) {
 		eth = neighbor;
@@ -98,6 +123,9 @@ public:
 		max_tp_rate2 = 0;
 		max_prob_rate = 0;
 		ht = ht_rates;
+		hist_airtime = 0;
+		estimates_head = 0;
+		estimates_count = 0;
 	}
 	int rate_index(int rate) {
 		int ndx = -1;
@@ -109,6 +137,27 @@ public:
 		}
 		return (ndx == rates.size()) ? -1 : ndx;
 	}
+	// frames to a neighbor are reported in the order they were sent, when
+	// feedback is lost the oldest estimates are overwritten
+	void push_estimate(uint32_t usecs) {
+		int tail = (estimates_head + estimates_count) % MINSTREL_ESTIMATES;
+		estimates[tail] = usecs;
+		if (estimates_count < MINSTREL_ESTIMATES) {
+			estimates_count++;
+		} else {
+			estimates_head = (estimates_head + 1) % MINSTREL_ESTIMATES;
+		}
+	}
+	// 0 if no estimate is left
+	uint32_t pop_estimate() {
+		if (!estimates_count) {
+			return 0;
+		}
+		uint32_t usecs = estimates[estimates_head];
+		estimates_head = (estimates_head + 1) % MINSTREL_ESTIMATES;
+		estimates_count--;
+		return usecs;
+	}
 	void add_result(int rate, int tries, int success, uint32_t pkt_length) {
 		int ndx = rate_index(rate);
 		if (ndx >= 0) {
@@ -121,7 +170,7 @@ public:
 	String unparse() {
 		StringAccum sa;
 		int tp, prob, eprob, rate;
-		char buffer[4096];
+		char buffer[256];
 		sa << eth << "\n";
 		sa << "rate    throughput    ewma prob    this prob    this success (attempts)    success    attempts    this success_bytes    this attempts_bytes        success_bytes    attempts_bytes\n";
 		for (int i = 0; i < rates.size(); i++) {
@@ -133,7 +182,7 @@ public:
 			} else {
 				rate = rates[i] / 2;
 			}
-			sprintf(buffer, "%2d%s    %2u.%1u    %3u.%1u    %3u.%1u    %3u (%3u)    %8llu    %8llu    %8llu    %8llu    %8llu    %8llu\n",
+			snprintf(buffer, sizeof(buffer), "%2d%s    %2u.%1u    %3u.%1u    %3u.%1u    %3u (%3u)    %8llu    %8llu    %8llu    %8llu    %8llu    %8llu\n",
 					rate,
 					(rates[i] % 1 && !ht) ? ".5" : "  ",
 					tp / 10, tp % 10,
@@ -166,6 +215,8 @@ public:
 		   << sample_count
 		   << " total "
 		   << packet_count
+		   << "\n"
+		   << "Airtime: " << hist_airtime << " usec"
 		   << "\n\n";
 		return sa.take_string();
 	}
@@ -200,6 +251,9 @@ class Minstrel : public Element { public:
 
 	void assign_rate(Packet *);
 	void process_feedback(Packet *);
+	uint32_t feedback_usecs_wifi_packet(MinstrelDstInfo *, Packet *);
+
+	void set_eqm(EmpowerQOSManager *eqm) { _eqm = eqm; }
 
 	inline uint32_t estimate_usecs_wifi_packet(Packet *p) {
 		struct click_wifi *w = (struct click_wifi *) p->data();
@@ -212,7 +266,19 @@ class Minstrel : public Element { public:
 			}
 			return calc_usecs_wifi_packet(p->length(), rate, 0);
 		} else {
-			return calc_usecs_wifi_packet(p->length(), 1, 0);
+			// same rate selected by assign_rate, unsolicited retries are charged up front
+			uint32_t usecs;
+			TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
+			if (!tx_policy || tx_policy->_ht_mcs.size() == 0) {
+				Vector<int> &rates = _tx_policies->lookup(dst)->_mcs;
+				usecs = calc_usecs_wifi_packet(p->length(), (rates.size()) ? rates[0] : 2, 0);
+			} else {
+				usecs = calc_usecs_wifi_packet_ht(p->length(), tx_policy->_ht_mcs[0], 0);
+			}
+			if (tx_policy && tx_policy->_tx_mcast == TX_MCAST_UR && tx_policy->_ur_mcast_count > 1) {
+				usecs *= tx_policy->_ur_mcast_count;
+			}
+			return usecs;
 		}
 	}
 
@@ -232,13 +298,23 @@ class Minstrel : public Element { public:
 		return nfo;
 	}
 
+	String snapshot_rates(uint32_t, uint32_t);
+	void restore_rate(snapshot_rate_record *);
+
 private:
 
+	// tries per stage of the retry chain set by assign_rate
+	enum { STAGE_TRIES = 4 };
+
 	MinstrelNeighborTable _neighbors;
+	EmpowerQOSManager * _eqm;
 	TransmissionPolicies * _tx_policies;
 	Timer _timer;
 	TTime _transm_time;
 
+	Packet * _ur_packet;
+	int _ur_left;
+
 	unsigned _lookaround_rate;
 	unsigned _offset;
 	bool _active;
@@ -246,8 +322,13 @@ private:
 	unsigned _ewma_level;
 	bool _debug;
 
+	void ur_schedule(Packet *);
+	Packet * ur_repeat();
+	uint32_t rate_usecs(MinstrelDstInfo *, int);
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
+	static int snapshot_handler(int, String &, Element *, const Handler *, ErrorHandler *);
 
 };
 
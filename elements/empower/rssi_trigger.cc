@@ -22,10 +22,10 @@
 CLICK_DECLS
 
 RssiTrigger::RssiTrigger(EtherAddress eth, uint32_t trigger_id,
-		empower_trigger_relation rel, int val, bool dispatched, uint16_t period,
-		EmpowerLVAPManager * el, EmpowerRXStats * ers) :
+		empower_trigger_relation rel, int val, int estimator, bool dispatched,
+		uint16_t period, EmpowerLVAPManager * el, EmpowerRXStats * ers) :
 		Trigger(trigger_id, period, el, ers), _eth(eth), _rel(rel), _val(val),
-		_dispatched(dispatched) {
+		_estimator(estimator), _dispatched(dispatched) {
 
 }
 
@@ -56,6 +56,7 @@ String RssiTrigger::unparse() {
 		break;
 	}
 	sa << " val " << _val;
+	sa << " estimator " << rssi_estimator_name(_estimator);
 	if (_dispatched) {
 		sa << " dispatched";
 	}
@@ -63,22 +64,23 @@ String RssiTrigger::unparse() {
 }
 
 bool RssiTrigger::matches(const DstInfo* nfo) {
+	int rssi = nfo->estimate(_estimator);
 	bool match = false;
 	switch (_rel) {
 	case EQ:
-		match = (nfo->_sma_rssi->avg() == _val);
+		match = (rssi == _val);
 		break;
 	case GT:
-		match = (nfo->_sma_rssi->avg() > _val);
+		match = (rssi > _val);
 		break;
 	case LT:
-		match = (nfo->_sma_rssi->avg() < _val);
+		match = (rssi < _val);
 		break;
 	case GE:
-		match = (nfo->_sma_rssi->avg() >= _val);
+		match = (rssi >= _val);
 		break;
 	case LE:
-		match = (nfo->_sma_rssi->avg() <= _val);
+		match = (rssi <= _val);
 		break;
 	}
 	return match;
@@ -15,9 +15,10 @@ public:
 	EtherAddress _eth;
 	empower_trigger_relation _rel;
 	int _val;
+	int _estimator;
 	bool _dispatched;
 
-	RssiTrigger(EtherAddress, uint32_t, empower_trigger_relation, int, bool, uint16_t, EmpowerLVAPManager *, EmpowerRXStats *);
+	RssiTrigger(EtherAddress, uint32_t, empower_trigger_relation, int, int, bool, uint16_t, EmpowerLVAPManager *, EmpowerRXStats *);
 	~RssiTrigger();
 
 	String unparse();
@@ -25,7 +26,7 @@ public:
 	bool matches(const DstInfo* nfo);
 
 	inline bool operator==(const RssiTrigger &b) {
-		return (_eth == b._eth) && (_rel == b._rel) && (_val == b._val);
+		return (_eth == b._eth) && (_rel == b._rel) && (_val == b._val) && (_estimator == b._estimator);
 	}
 
 };
@@ -0,0 +1,132 @@
+#ifndef CLICK_EMPOWER_RSSIESTIMATOR_HH
+#define CLICK_EMPOWER_RSSIESTIMATOR_HH
+#include <click/glue.hh>
+#include <click/string.hh>
+CLICK_DECLS
+
+/*
+ * RSSI estimators a trigger can be evaluated against. SMA is the
+ * historical moving average of the per period averages kept by DstInfo,
+ * the others are updated on every frame, in O(1) and without allocating.
+ */
+enum empower_rssi_estimator {
+	EMPOWER_RSSI_SMA = 0x0,
+	EMPOWER_RSSI_EWMA = 0x1,
+	EMPOWER_RSSI_WSMA = 0x2,
+	EMPOWER_RSSI_KALMAN = 0x3,
+	EMPOWER_RSSI_MAX = 0x4,
+};
+
+static inline const char *rssi_estimator_name(int estimator) {
+	switch (estimator) {
+	case EMPOWER_RSSI_SMA:
+		return "SMA";
+	case EMPOWER_RSSI_EWMA:
+		return "EWMA";
+	case EMPOWER_RSSI_WSMA:
+		return "WSMA";
+	case EMPOWER_RSSI_KALMAN:
+		return "KALMAN";
+	default:
+		return "UNKNOWN";
+	}
+}
+
+static inline int rssi_estimator_parse(const String &s) {
+	for (int i = 0; i < EMPOWER_RSSI_MAX; i++) {
+		if (s.equals(rssi_estimator_name(i), -1)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Exponentially weighted moving average, alpha is the weight of a new sample.
+class EwmaEstimator {
+public:
+	EwmaEstimator() : _avg(0), _init(false) {
+	}
+	inline void add(int rssi, float alpha) {
+		if (!_init) {
+			_avg = rssi;
+			_init = true;
+		} else {
+			_avg += alpha * (rssi - _avg);
+		}
+	}
+	inline int estimate() const {
+		return _avg;
+	}
+private:
+	float _avg;
+	bool _init;
+};
+
+// Moving average of the last WSMA_MAX frames at most.
+class WsmaEstimator {
+public:
+	enum { WSMA_MAX = 32 };
+	WsmaEstimator() : _total(0), _head(0), _size(0) {
+	}
+	inline void add(int rssi, unsigned window) {
+		if (window < 1 || window > WSMA_MAX) {
+			window = WSMA_MAX;
+		}
+		// the window may have shrunk since the last frame
+		while (_size >= window) {
+			_total -= _window[(_head + WSMA_MAX - _size) % WSMA_MAX];
+			_size--;
+		}
+		_window[_head] = rssi;
+		_head = (_head + 1) % WSMA_MAX;
+		_size++;
+		_total += rssi;
+	}
+	inline int estimate() const {
+		return _size ? _total / (int) _size : 0;
+	}
+private:
+	int16_t _window[WSMA_MAX];
+	int _total;
+	unsigned _head;
+	unsigned _size;
+};
+
+// Scalar Kalman filter for a constant signal, q and r are the process
+// and measurement noise variances.
+class KalmanEstimator {
+public:
+	KalmanEstimator() : _x(0), _p(0), _init(false) {
+	}
+	inline void add(int rssi, float q, float r) {
+		if (!_init) {
+			_x = rssi;
+			_p = r;
+			_init = true;
+			return;
+		}
+		_p += q;
+		float k = _p / (_p + r);
+		_x += k * (rssi - _x);
+		_p *= 1 - k;
+	}
+	inline int estimate() const {
+		return _x;
+	}
+private:
+	float _x;
+	float _p;
+	bool _init;
+};
+
+// Per frame estimators to update and their parameters.
+struct RssiEstimators {
+	uint32_t mask; // bit i set if estimator i is in use
+	float alpha;
+	unsigned window;
+	float q;
+	float r;
+};
+
+CLICK_ENDDECLS
+#endif /* CLICK_EMPOWER_RSSIESTIMATOR_HH */
@@ -20,6 +20,7 @@ public:
 	uint32_t _sent;
 	int16_t _limit;
 	FramesList _frames;
+	FramesList _pending; // filled by the data path under summary_lock
 
 	SummaryTrigger(int, EtherAddress, uint32_t, int16_t, uint16_t, EmpowerLVAPManager *, EmpowerRXStats *);
 	~SummaryTrigger();
@@ -48,6 +48,7 @@ public:
 	int _max_amsdu_len;
 	CBytes _tx;
 	CBytes _rx;
+	CBytes _ur;
 
 	TxPolicyInfo() {
 		_mcs = Vector<int>();
@@ -85,6 +86,13 @@ public:
 		(*_rx.get_pointer(len))++;
 	}
 
+	void update_ur(uint16_t len) {
+		if (_ur.find(len) == _ur.end()) {
+			_ur.set(len, 0);
+		}
+		(*_ur.get_pointer(len))++;
+	}
+
 	String unparse() {
 		StringAccum sa;
 		sa << "mcs [";
@@ -65,6 +65,12 @@ TCPFragmenter::push(int, Packet *p)
 	(!mtu || mtu > p->anno_u16(_mtu_anno)))
 	mtu = p->anno_u16(_mtu_anno);
 
+    _count++;
+    if (!mtu) {
+        output(0).push(p);
+        return;
+    }
+
     int32_t hlen;
     int32_t tcp_len;
     {
@@ -76,32 +82,40 @@ TCPFragmenter::push(int, Packet *p)
 
     int max_tcp_len = mtu - hlen;
 
-    _count++;
-    if (!mtu || max_tcp_len <= 0 || tcp_len < max_tcp_len) {
+    if (max_tcp_len <= 0 || tcp_len < max_tcp_len) {
         output(0).push(p);
         return;
     }
 
+    // offset of the TCP payload in the packet data
+    int data_off = p->transport_header_offset() + hlen - p->network_header_length();
+
     _fragmented_count++;
     for (int offset = 0; offset < tcp_len; offset += max_tcp_len) {
-        Packet *p_clone;
-        if (offset + max_tcp_len < tcp_len)
-            p_clone = p->clone();
-        else {
-            p_clone = p;
+        int this_len = tcp_len - offset > max_tcp_len ? max_tcp_len : tcp_len - offset;
+        WritablePacket *q;
+        if (offset + this_len < tcp_len) {
+            // copy the headers and this fragment's payload only, rather
+            // than the whole packet
+            if (!(q = Packet::make(p->headroom(), p->data(), data_off + this_len, 0)))
+                break;
+            memcpy(q->data() + data_off, p->data() + data_off + offset, this_len);
+            q->copy_annotations(p);
+            if (p->has_mac_header())
+                q->set_mac_header(q->data() + p->mac_header_offset());
+            q->set_network_header(q->data() + p->network_header_offset(), p->network_header_length());
+        } else {
+            // uniqueify() frees p when it fails
+            Packet *t = p;
             p = 0;
+            if (!(q = t->uniqueify()))
+                break;
+            if (offset != 0)
+                memcpy(q->data() + data_off, q->data() + data_off + offset, this_len);
+            q->take(tcp_len - this_len);
         }
-        if (!p_clone)
-            break;
-        WritablePacket *q = p_clone->uniqueify();
-        p_clone = 0;
         click_ip *ip = q->ip_header();
         click_tcp *tcp = q->tcp_header();
-        uint8_t *tcp_data = ((uint8_t *)tcp) + (tcp->th_off<<2);
-        int this_len = tcp_len - offset > max_tcp_len ? max_tcp_len : tcp_len - offset;
-        if (offset != 0)
-            memcpy(tcp_data, tcp_data + offset, this_len);
-        q->take(tcp_len - this_len);
         ip->ip_len = htons(q->end_data() - q->network_header());
         ip->ip_sum = 0;
 #if HAVE_FAST_CHECKSUM
@@ -110,8 +124,9 @@ TCPFragmenter::push(int, Packet *p)
         ip->ip_sum = click_in_cksum((unsigned char *)ip, q->network_header_length());
 #endif
 
-        if ((tcp->th_flags & TH_FIN) && offset + mtu < tcp_len)
-            tcp->th_flags ^= TH_FIN;
+        // FIN and PUSH belong to the last fragment only
+        if (offset + this_len < tcp_len)
+            tcp->th_flags &= ~(TH_FIN | TH_PUSH);
 
         tcp->th_seq = htonl(ntohl(tcp->th_seq) + offset);
         tcp->th_sum = 0;
@@ -123,6 +138,8 @@ TCPFragmenter::push(int, Packet *p)
         _fragments++;
         output(0).push(q);
     }
+    if (p)
+        p->kill();
 }
 
 void
@@ -28,7 +28,21 @@ Unsigned. If MTU is non-zero, then fragment every packet larger than MTU.
 Two Byte Annotation. If specified and annotation is non zero, then
 fragment every packet larger than the annotation's value.
 
-=a IPFragmenter, TCPIPEncap
+Each fragment but the last is built from a copy of the headers and its own
+payload; the input packet becomes the last fragment. Packets are parsed
+only when their MTU is nonzero, so with MTU_ANNO alone, packets without
+the annotation, TCP or not, pass through untouched.
+
+=e
+
+Split the super-packets that KernelTap hands over with VNET_HDR:
+
+  KernelTap(10.0.0.1/24, VNET_HDR true)
+    -> MarkIPHeader(14)
+    -> TCPFragmenter(MTU_ANNO GSO_MTU)
+    -> ...
+
+=a IPFragmenter, TCPIPEncap, KernelTap
 */
 
 class TCPFragmenter : public Element { public:
@@ -0,0 +1,138 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * idleselect.{cc,hh} -- test element that selects on many idle sockets
+ * Roberto Riggio
+ *
+ * Copyright (c) 2017 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "idleselect.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+CLICK_DECLS
+
+IdleSelect::IdleSelect()
+    : _n(0), _edge(false), _send_fd(-1), _selected(0), _received(0)
+{
+}
+
+int
+IdleSelect::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    return Args(conf, this, errh)
+	.read_mp("N", _n)
+	.read("EDGE", _edge)
+	.complete();
+}
+
+int
+IdleSelect::initialize(ErrorHandler *errh)
+{
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (uint32_t i = 0; i < _n; i++) {
+	int fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+	    return errh->error("socket: %s", strerror(errno));
+	_fds.push_back(fd);
+	if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0)
+	    return errh->error("bind: %s", strerror(errno));
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (add_select(fd, SELECT_READ | (_edge ? SELECT_EDGE : 0)) < 0)
+	    return errh->error("add_select(%d) failed", fd);
+    }
+
+    if ((_send_fd = socket(PF_INET, SOCK_DGRAM, 0)) < 0)
+	return errh->error("socket: %s", strerror(errno));
+    return 0;
+}
+
+void
+IdleSelect::cleanup(CleanupStage)
+{
+    for (int i = 0; i < _fds.size(); i++) {
+	remove_select(_fds[i], SELECT_READ);
+	close(_fds[i]);
+    }
+    _fds.clear();
+    if (_send_fd >= 0)
+	close(_send_fd);
+    _send_fd = -1;
+}
+
+void
+IdleSelect::selected(int fd, int)
+{
+    char buf[64];
+    _selected++;
+    while (recv(fd, buf, sizeof(buf), 0) >= 0)
+	_received++;
+}
+
+enum { h_fds, h_selected, h_received };
+
+String
+IdleSelect::read_handler(Element *e, void *thunk)
+{
+    IdleSelect *is = static_cast<IdleSelect *>(e);
+    switch ((intptr_t) thunk) {
+    case h_fds:
+	return String(is->_fds.size());
+    case h_selected:
+	return String(is->_selected);
+    case h_received:
+	return String(is->_received);
+    default:
+	return String();
+    }
+}
+
+int
+IdleSelect::poke_handler(const String &str, Element *e, void *, ErrorHandler *errh)
+{
+    IdleSelect *is = static_cast<IdleSelect *>(e);
+    uint32_t i;
+    if (!IntArg().parse(str, i) || i >= (uint32_t) is->_fds.size())
+	return errh->error("bad socket index");
+
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    if (getsockname(is->_fds[i], (struct sockaddr *) &sin, &len) < 0
+	|| sendto(is->_send_fd, "", 1, 0, (struct sockaddr *) &sin, len) < 0)
+	return errh->error("poke: %s", strerror(errno));
+    return 0;
+}
+
+void
+IdleSelect::add_handlers()
+{
+    add_read_handler("fds", read_handler, h_fds);
+    add_read_handler("selected", read_handler, h_selected);
+    add_read_handler("received", read_handler, h_received);
+    add_write_handler("poke", poke_handler, 0);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(IdleSelect)
+ELEMENT_REQUIRES(userlevel)
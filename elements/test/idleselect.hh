@@ -0,0 +1,96 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_IDLESELECT_HH
+#define CLICK_IDLESELECT_HH
+#include <click/element.hh>
+#include <click/vector.hh>
+CLICK_DECLS
+
+/*
+=c
+
+IdleSelect(N [, I<keywords> EDGE])
+
+=s test
+
+selects on many idle file descriptors
+
+=d
+
+IdleSelect opens N UDP sockets bound to the loopback address and selects for
+readability on all of them.  Nothing is ever sent to the sockets unless the
+C<poke> handler is written, so they stay idle: this is useful for measuring
+the cost idle file descriptors add to Click's select loop.
+
+Keyword arguments are:
+
+=over 8
+
+=item EDGE
+
+Boolean.  If true, registers the sockets with SELECT_EDGE.  IdleSelect reads
+a socket until it would block on every selected() call, so this is safe.
+Default is false.
+
+=back
+
+=h fds read-only
+
+Returns the number of sockets.
+
+=h selected read-only
+
+Returns the number of selected() calls so far.
+
+=h received read-only
+
+Returns the number of datagrams received so far.
+
+=h poke write-only
+
+Write a socket index to send that socket a datagram.
+
+=e
+
+With an active task, Click checks its file descriptors every couple of task
+runs, so the following configuration shows the per-iteration cost of 1000
+idle file descriptors; run it with C<click -t> and compare the run time with
+that of N 0, or between builds configured with --enable-select=poll and
+--enable-select=epoll.
+
+  IdleSelect(1000);
+  NullTask(LIMIT 10000000, STOP true);
+
+=a
+
+NullTask
+*/
+
+class IdleSelect : public Element { public:
+
+    IdleSelect() CLICK_COLD;
+
+    const char *class_name() const	{ return "IdleSelect"; }
+
+    int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+    int initialize(ErrorHandler *) CLICK_COLD;
+    void cleanup(CleanupStage) CLICK_COLD;
+    void add_handlers() CLICK_COLD;
+
+    void selected(int fd, int mask);
+
+  private:
+
+    uint32_t _n;
+    bool _edge;
+    Vector<int> _fds;
+    int _send_fd;
+    uint32_t _selected;
+    uint32_t _received;
+
+    static String read_handler(Element *, void *) CLICK_COLD;
+    static int poke_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
+
+};
+
+CLICK_ENDDECLS
+#endif
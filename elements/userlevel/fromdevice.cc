@@ -53,16 +53,23 @@
 # include <linux/if_packet.h>
 # include <net/ethernet.h>
 #endif
+#if FROMDEVICE_ALLOW_MMAP
+# include <sys/mman.h>
+#endif
 
 CLICK_DECLS
 
 FromDevice::FromDevice()
     :
-#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP
+#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_MMAP
       _task(this),
 #endif
 #if FROMDEVICE_ALLOW_PCAP
       _pcap(0), _pcap_complaints(0),
+#endif
+#if FROMDEVICE_ALLOW_MMAP
+      _ring(0), _blocks(0), _block_idx(0), _block_left(0), _block_next(0),
+      _ring_timer(this),
 #endif
       _datalink(-1), _count(0), _promisc(0), _snaplen(0)
 {
@@ -85,6 +92,11 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
     _headroom += (4 - (_headroom + 2) % 4) % 4; // default 4/2 alignment
     _force_ip = false;
     _burst = 1;
+#if FROMDEVICE_ALLOW_MMAP
+    _ring_blocks = 64;
+    _ring_block_size = 65536;
+    _ring_timeout = 1;
+#endif
     String bpf_filter, capture, encap_type;
     bool has_encap;
     if (Args(conf, this, errh)
@@ -102,6 +114,11 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("ENCAP", WordArg(), encap_type).read_status(has_encap)
 	.read("BURST", _burst)
 	.read("TIMESTAMP", timestamp)
+#if FROMDEVICE_ALLOW_MMAP
+	.read("RING_BLOCKS", _ring_blocks)
+	.read("RING_BLOCK_SIZE", _ring_block_size)
+	.read("RING_TIMEOUT", _ring_timeout)
+#endif
 	.complete() < 0)
 	return -1;
     if (_snaplen > 65535 || _snaplen < 14)
@@ -111,6 +128,14 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
     if (_burst <= 0)
 	return errh->error("BURST out of range");
     _protocol = htons(_protocol);
+#if FROMDEVICE_ALLOW_MMAP
+    if (_ring_blocks == 0)
+	return errh->error("RING_BLOCKS out of range");
+    if (_ring_block_size == 0 || _ring_block_size % getpagesize() != 0)
+	return errh->error("RING_BLOCK_SIZE must be a multiple of the page size");
+    if (_ring_block_size < TPACKET_ALIGN(TPACKET3_HDRLEN) + _headroom + _snaplen + 64)
+	return errh->error("RING_BLOCK_SIZE too small for SNAPLEN");
+#endif
 
 #if FROMDEVICE_ALLOW_PCAP
     _bpf_filter = bpf_filter;
@@ -141,6 +166,10 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
     else if (capture == "PCAP")
 	_method = method_pcap;
 #endif
+#if FROMDEVICE_ALLOW_MMAP
+    else if (capture == "MMAP")
+	_method = method_mmap;
+#endif
 #if FROMDEVICE_ALLOW_NETMAP
     else if (capture == "NETMAP")
 	_method = method_netmap;
@@ -230,6 +259,148 @@ FromDevice::set_promiscuous(int fd, String ifname, bool promisc)
 }
 #endif /* FROMDEVICE_ALLOW_LINUX */
 
+#if FROMDEVICE_ALLOW_MMAP
+int
+FromDevice::open_ring(ErrorHandler *errh)
+{
+    int version = TPACKET_V3;
+    if (setsockopt(_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+	return errh->error("%s: PACKET_VERSION: %s", _ifname.c_str(), strerror(errno));
+
+    // leave HEADROOM bytes in front of each packet for pushed headers
+    unsigned reserve = _headroom;
+    if (setsockopt(_fd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve)) < 0)
+	return errh->error("%s: PACKET_RESERVE: %s", _ifname.c_str(), strerror(errno));
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = _ring_block_size;
+    req.tp_block_nr = _ring_blocks;
+    req.tp_frame_size = TPACKET_ALIGN(TPACKET3_HDRLEN + _headroom + _snaplen);
+    req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+    req.tp_retire_blk_tov = _ring_timeout;
+    if (setsockopt(_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+	return errh->error("%s: PACKET_RX_RING: %s", _ifname.c_str(), strerror(errno));
+
+    size_t size = (size_t) _ring_blocks * _ring_block_size;
+    void *ring = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (ring == MAP_FAILED)
+	return errh->error("%s: mmap: %s", _ifname.c_str(), strerror(errno));
+    _ring = (unsigned char *) ring;
+
+    _blocks = new MmapBlock[_ring_blocks];
+    for (unsigned i = 0; i < _ring_blocks; i++) {
+	_blocks[i].refs = 0;
+	_blocks[i].returned = true;
+	_blocks[i].desc = (struct tpacket_block_desc *) (_ring + (size_t) i * _ring_block_size);
+    }
+    _block_idx = 0;
+    _block_left = 0;
+    return 0;
+}
+
+void
+FromDevice::close_ring()
+{
+    if (!_ring)
+	return;
+    // packets still pointing into the ring keep it mapped
+    for (unsigned i = 0; i < _ring_blocks; i++) {
+	unsigned reader = (i == _block_idx && _block_left ? 1 : 0);
+	if (_blocks[i].refs > reader) {
+	    click_chatter("%p{element}: ring still in use, not unmapped", this);
+	    _ring = 0;
+	    _blocks = 0;
+	    return;
+	}
+    }
+    munmap(_ring, (size_t) _ring_blocks * _ring_block_size);
+    delete[] _blocks;
+    _ring = 0;
+    _blocks = 0;
+}
+
+void
+FromDevice::mmap_destructor(unsigned char *, size_t, void *arg)
+{
+    MmapBlock *b = (MmapBlock *) arg;
+    if (b->refs.dec_and_test()) {
+	// done with the block before the kernel may write it again
+	click_fence();
+	b->desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	click_fence();
+	b->returned = true;
+    }
+}
+
+int
+FromDevice::mmap_dispatch()
+{
+    int n = 0;
+    while (n < _burst) {
+	MmapBlock *b = &_blocks[_block_idx];
+	if (!_block_left) {
+	    // a block read on the previous lap and still pinned by packets
+	    // is marked TP_STATUS_USER too
+	    if (!b->returned)
+		break;
+	    click_fence();
+	    if (!(b->desc->hdr.bh1.block_status & TP_STATUS_USER))
+		break;
+	    click_fence();
+	    b->returned = false;
+	    _block_left = b->desc->hdr.bh1.num_pkts;
+	    _block_next = (struct tpacket3_hdr *) ((unsigned char *) b->desc + b->desc->hdr.bh1.offset_to_first_pkt);
+	    b->refs = 1;
+	}
+
+	if (_block_left) {
+	    struct tpacket3_hdr *h = _block_next;
+	    _block_next = (struct tpacket3_hdr *) ((unsigned char *) h + h->tp_next_offset);
+	    --_block_left;
+
+	    struct sockaddr_ll *sa = (struct sockaddr_ll *) ((unsigned char *) h + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+	    if ((sa->sll_pkttype != PACKET_OUTGOING || _outbound)
+		&& (_protocol == 0 || _protocol == sa->sll_protocol)) {
+		uint32_t len = h->tp_snaplen;
+		if (len > (uint32_t) _snaplen)
+		    len = _snaplen;
+		++b->refs;
+		WritablePacket *p = Packet::make((unsigned char *) h + h->tp_mac, len, mmap_destructor, b,
+						 h->tp_mac - TPACKET3_HDRLEN, 0);
+		if (p) {
+		    SET_EXTRA_LENGTH_ANNO(p, h->tp_len - len);
+		    p->set_packet_type_anno((Packet::PacketType) sa->sll_pkttype);
+		    if (_timestamp)
+			p->timestamp_anno() = Timestamp::make_nsec(h->tp_sec, h->tp_nsec);
+		    p->set_mac_header(p->data());
+		    ++n;
+		    if (!_force_ip || fake_pcap_force_ip(p, _datalink))
+			output(0).push(p);
+		    else
+			checked_output_push(1, p);
+		} else
+		    --b->refs;
+	    }
+	}
+
+	if (!_block_left) {
+	    // drop the reference taken while reading the block
+	    mmap_destructor(0, 0, b);
+	    _block_idx = (_block_idx + 1) % _ring_blocks;
+	}
+    }
+    return n;
+}
+
+void
+FromDevice::run_timer(Timer *)
+{
+    add_select(_fd, SELECT_READ);
+    _task.reschedule();
+}
+#endif /* FROMDEVICE_ALLOW_MMAP */
+
 #if FROMDEVICE_ALLOW_PCAP
 const char*
 FromDevice::fetch_pcap_error(pcap_t* pcap, const char *ebuf)
@@ -409,6 +580,29 @@ FromDevice::initialize(ErrorHandler *errh)
     }
 #endif
 
+#if FROMDEVICE_ALLOW_MMAP
+    if (_method == method_mmap) {
+	_fd = open_packet_socket(_ifname, errh);
+	if (_fd < 0)
+	    return -1;
+
+	int promisc_ok = set_promiscuous(_fd, _ifname, _promisc);
+	if (promisc_ok < 0) {
+	    if (_promisc)
+		errh->warning("cannot set promiscuous mode");
+	    _was_promisc = -1;
+	} else
+	    _was_promisc = promisc_ok;
+
+	if (open_ring(errh) < 0)
+	    return -1;
+
+	_datalink = FAKE_DLT_EN10MB;
+	ScheduleInfo::initialize_task(this, &_task, false, errh);
+	_ring_timer.initialize(this);
+    }
+#endif
+
 #if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP
     if (_method == method_pcap || _method == method_netmap)
 	ScheduleInfo::initialize_task(this, &_task, false, errh);
@@ -435,9 +629,12 @@ FromDevice::cleanup(CleanupStage stage)
 	_netmap.close(_fd);
 #endif
 #if FROMDEVICE_ALLOW_LINUX
-    if (_fd >= 0 && _method == method_linux) {
+    if (_fd >= 0 && (_method == method_linux || _method == method_mmap)) {
 	if (_was_promisc >= 0)
 	    set_promiscuous(_fd, _ifname, _was_promisc);
+# if FROMDEVICE_ALLOW_MMAP
+	close_ring();
+# endif
 	close(_fd);
     }
 #endif
@@ -529,6 +726,22 @@ FromDevice::selected(int, int)
 	    ErrorHandler::default_handler()->error("%p{element}: %s", this, pcap_geterr(_pcap));
     }
 #endif
+#if FROMDEVICE_ALLOW_MMAP
+    if (_method == method_mmap) {
+	// Read and push() at most one burst of packets.
+	int r = mmap_dispatch();
+	if (r > 0) {
+	    _count += r;
+	    _task.reschedule();
+	} else {
+	    // The kernel reports the socket readable while the last block
+	    // it filled is not back, which happens when packets still
+	    // point into it. Poll again once a block may have retired.
+	    remove_select(_fd, SELECT_READ);
+	    _ring_timer.schedule_after_msec(_ring_timeout);
+	}
+    }
+#endif
 #if FROMDEVICE_ALLOW_LINUX
     int nlinux = 0;
     while (_method == method_linux && nlinux < _burst) {
@@ -562,12 +775,16 @@ FromDevice::selected(int, int)
 #endif
 }
 
-#if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP
+#if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_MMAP
 bool
 FromDevice::run_task(Task *)
 {
     // Read and push() at most one burst of packets.
     int r = 0;
+# if FROMDEVICE_ALLOW_MMAP
+    if (_method == method_mmap)
+	r = mmap_dispatch();
+# endif
 # if FROMDEVICE_ALLOW_NETMAP
     if (_method == method_netmap) {
 	// Read and push() at most one burst of packets.
@@ -613,6 +830,14 @@ FromDevice::kernel_drops(bool& known, int& max_drops) const
             known = true, max_drops = stats.tp_drops;
     }
 #endif
+#if FROMDEVICE_ALLOW_MMAP
+    if (_method == method_mmap) {
+        struct tpacket_stats_v3 stats;
+        socklen_t statsize = sizeof(stats);
+        if (getsockopt(_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &statsize) >= 0)
+            known = true, max_drops = stats.tp_drops;
+    }
+#endif
 }
 
 String
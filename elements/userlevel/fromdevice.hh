@@ -5,6 +5,9 @@
 
 #ifdef __linux__
 # define FROMDEVICE_ALLOW_LINUX 1
+# define FROMDEVICE_ALLOW_MMAP 1
+struct tpacket_block_desc;
+struct tpacket3_hdr;
 #endif
 
 #if HAVE_PCAP
@@ -23,8 +26,14 @@ int pcap_setnonblock(pcap_t *p, int nonblock, char *errbuf);
 # include "elements/userlevel/netmapinfo.hh"
 #endif
 
-#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP
+#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_MMAP
 # include <click/task.hh>
+#endif
+#if FROMDEVICE_ALLOW_MMAP
+# include <click/atomic.hh>
+# include <click/timer.hh>
+#endif
+#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP
 extern "C" {
 void FromDevice_get_packet(u_char*, const struct pcap_pkthdr*, const u_char*);
 }
@@ -95,8 +104,14 @@ but the IP header annotation has been set appropriately.) Default is false.
 =item METHOD
 
 Word.  Defines the capture method FromDevice will use to read packets from the
-device.  Linux targets generally support PCAP and LINUX; other targets support
-only PCAP.  Defaults to PCAP.
+device.  Linux targets generally support PCAP, LINUX and MMAP; other targets
+support only PCAP.  Defaults to PCAP.
+
+MMAP reads packets from a TPACKET_V3 receive ring shared with the kernel.
+Packets are not copied: they point into the ring, and a block of the ring
+goes back to the kernel once every packet in it has been freed. Timestamps
+come from the ring headers. Packets held for long, for instance in a Queue,
+keep their block from being reused, so the ring should be sized for them.
 
 =item BPF_FILTER
 
@@ -133,6 +148,21 @@ Integer. Maximum number of packets to read per scheduling. Defaults to 1.
 
 Boolean. If false, then do not timestamp packets. Defaults to true.
 
+=item RING_BLOCKS
+
+Integer. Number of blocks in the receive ring. Only affects METHOD MMAP.
+Defaults to 64.
+
+=item RING_BLOCK_SIZE
+
+Integer. Size of a ring block in bytes, a multiple of the page size.
+Only affects METHOD MMAP. Defaults to 65536.
+
+=item RING_TIMEOUT
+
+Integer. Milliseconds after which the kernel hands over a block that is
+not full. Only affects METHOD MMAP. Defaults to 1.
+
 =back
 
 =e
@@ -197,7 +227,7 @@ class FromDevice : public Element { public:
 #endif
 
 #if FROMDEVICE_ALLOW_LINUX
-    int linux_fd() const		{ return _method == method_linux ? _fd : -1; }
+    int linux_fd() const		{ return _method == method_linux || _method == method_mmap ? _fd : -1; }
     static int open_packet_socket(String, ErrorHandler *);
     static int set_promiscuous(int, String, bool);
 #endif
@@ -206,9 +236,12 @@ class FromDevice : public Element { public:
     const NetmapInfo *netmap() const { return _method == method_netmap ? &_netmap : 0; }
 #endif
 
-#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP
+#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_MMAP
     bool run_task(Task *task);
 #endif
+#if FROMDEVICE_ALLOW_MMAP
+    void run_timer(Timer *timer);
+#endif
 
     void kernel_drops(bool& known, int& max_drops) const;
 
@@ -217,7 +250,7 @@ class FromDevice : public Element { public:
 #if FROMDEVICE_ALLOW_LINUX || FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP
     int _fd;
 #endif
-#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP
+#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_MMAP
     Task _task;
 #endif
 #if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP
@@ -235,6 +268,29 @@ class FromDevice : public Element { public:
     friend void FromDevice_get_packet(u_char*, const struct pcap_pkthdr*,
                                       const u_char*);
 #endif
+#if FROMDEVICE_ALLOW_MMAP
+    // A ring block is handed back to the kernel when refs drops to zero:
+    // one reference for each packet pointing into it and one while it is
+    // being read. returned is set once the kernel owns the block again.
+    struct MmapBlock {
+	atomic_uint32_t refs;
+	volatile bool returned;
+	struct tpacket_block_desc *desc;
+    };
+    unsigned char *_ring;
+    MmapBlock *_blocks;
+    unsigned _ring_blocks;
+    unsigned _ring_block_size;
+    unsigned _ring_timeout;
+    unsigned _block_idx;
+    uint32_t _block_left;
+    struct tpacket3_hdr *_block_next;
+    Timer _ring_timer;
+    int open_ring(ErrorHandler *errh);
+    void close_ring();
+    int mmap_dispatch();
+    static void mmap_destructor(unsigned char *, size_t, void *);
+#endif
 
     bool _force_ip;
 #if FROMDEVICE_ALLOW_PCAP && TIMESTAMP_NANOSEC && defined(PCAP_TSTAMP_PRECISION_NANO)
@@ -259,7 +315,7 @@ class FromDevice : public Element { public:
     int _snaplen;
     uint16_t _protocol;
     unsigned _headroom;
-    enum { method_default, method_netmap, method_pcap, method_linux };
+    enum { method_default, method_netmap, method_pcap, method_linux, method_mmap };
     int _method;
 #if FROMDEVICE_ALLOW_PCAP
     String _bpf_filter;
@@ -25,7 +25,11 @@
 #include <click/args.hh>
 #include <click/straccum.hh>
 #include <click/glue.hh>
+#include <click/packet_anno.hh>
+#include <click/master.hh>
+#include <click/routerthread.hh>
 #include <clicknet/ether.h>
+#include <clicknet/tcp.h>
 #include <click/standard/scheduleinfo.hh>
 #include <unistd.h>
 #include <fcntl.h>
@@ -51,6 +55,11 @@
 # include <net/if_tun.h>
 #elif HAVE_LINUX_IF_TUN_H
 # include <linux/if_tun.h>
+# include <click/cxxprotect.h>
+CLICK_CXX_PROTECT
+# include <linux/virtio_net.h>
+CLICK_CXX_UNPROTECT
+# include <click/cxxunprotect.h>
 #endif
 #if HAVE_NET_IF_TAP_H
 # include <net/if_tap.h>
@@ -68,9 +77,9 @@
 CLICK_DECLS
 
 KernelTun::KernelTun()
-    : _fd(-1), _tap(false), _task(this), _ignore_q_errs(false),
-      _printed_write_err(false), _printed_read_err(false),
-      _selected_calls(0), _packets(0)
+    : _fd(-1), _nqueues(1), _vnet_hdr(false), _tap(false), _task(this),
+      _ignore_q_errs(false), _printed_write_err(false),
+      _printed_read_err(false)
 {
 }
 
@@ -108,6 +117,8 @@ KernelTun::configure(Vector<String> &conf, ErrorHandler *errh)
 #if KERNELTUN_LINUX
 	.read("DEV_NAME", Args::deprecated, _dev_name)
 	.read("DEVNAME", _dev_name)
+	.read("QUEUES", _nqueues)
+	.read("VNET_HDR", _vnet_hdr)
 #endif
 	.complete() < 0)
 	return -1;
@@ -116,6 +127,8 @@ KernelTun::configure(Vector<String> &conf, ErrorHandler *errh)
 	return errh->error("bad GATEWAY");
     if (_burst < 1)
 	return errh->error("BURST must be >= 1");
+    if (_nqueues < 1)
+	return errh->error("QUEUES must be >= 1");
     if (_mtu_out < (int) sizeof(click_ip))
 	return errh->error("MTU must be greater than %d", sizeof(click_ip));
     if (_headroom > 8192)
@@ -125,8 +138,12 @@ KernelTun::configure(Vector<String> &conf, ErrorHandler *errh)
 }
 
 #if KERNELTUN_LINUX
+/*
+ * Open a queue of the universal device. With QUEUES > 1 the first call
+ * creates the device and the following ones attach to it by name.
+ */
 int
-KernelTun::try_linux_universal()
+KernelTun::open_linux_universal()
 {
     int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
     if (fd < 0)
@@ -135,16 +152,40 @@ KernelTun::try_linux_universal()
     struct ifreq ifr;
     memset(&ifr, 0, sizeof(ifr));
     ifr.ifr_flags = (_tap ? IFF_TAP : IFF_TUN);
+    if (_nqueues > 1)
+	ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    if (_vnet_hdr)
+	ifr.ifr_flags |= IFF_VNET_HDR;
     if (_dev_name)
 	// Setting ifr_name allows us to select an arbitrary interface name.
 	strncpy(ifr.ifr_name, _dev_name.c_str(), sizeof(ifr.ifr_name));
     int err = ioctl(fd, TUNSETIFF, (void *)&ifr);
     if (err < 0) {
+	err = -errno;
 	close(fd);
-	return -errno;
+	return err;
     }
 
     _dev_name = ifr.ifr_name;
+    return fd;
+}
+
+int
+KernelTun::try_linux_universal()
+{
+    int fd = open_linux_universal();
+    if (fd < 0)
+	return fd;
+
+    // Only TCP/IPv4 super-packets: TCPFragmenter does not handle IPv6
+    // and does not move CWR to the first segment, so the kernel keeps
+    // segmenting those itself.
+    if (_vnet_hdr && ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4) < 0) {
+	int err = -errno;
+	close(fd);
+	return err;
+    }
+
     _fd = fd;
     _type = LINUX_UNIVERSAL;
     return 0;
@@ -455,73 +496,180 @@ KernelTun::setup_tun(ErrorHandler *errh)
     else /* _type == LINUX_ETHERTAP */
 	_mtu_in = _mtu_out + 16;
 
+#if KERNELTUN_LINUX
+    // super-packets are larger than the MTU
+    if (_vnet_hdr)
+	_mtu_in = (_tap ? 18 : 4) + sizeof(struct virtio_net_hdr) + MAX_GSO_LENGTH;
+#endif
+
     return 0;
 }
 
+int
+KernelTun::add_queue(int fd, ErrorHandler *errh)
+{
+    TunQueue q;
+    memset(&q, 0, sizeof(q));
+    q.fd = fd;
+    q.thread = (home_thread()->thread_id() + _queues.size()) % master()->nthreads();
+    if (_vnet_hdr && !(q.buf = new unsigned char[_mtu_in])) {
+	close(fd);
+	return errh->error("out of memory");
+    }
+    _queues.push_back(q);
+    return master()->thread(q.thread)->select_set().add_select(fd, this, SELECT_READ);
+}
+
 int
 KernelTun::initialize(ErrorHandler *errh)
 {
     if (alloc_tun(errh) < 0)
 	return -1;
+    if ((_nqueues > 1 || _vnet_hdr) && _type != LINUX_UNIVERSAL)
+	return errh->error("QUEUES and VNET_HDR require /dev/net/tun");
     if (setup_tun(errh) < 0)
 	return -1;
+    if (add_queue(_fd, errh) < 0)
+	return -1;
+#if KERNELTUN_LINUX
+    for (unsigned i = 1; i < _nqueues; i++) {
+	int fd = open_linux_universal();
+	if (fd < 0)
+	    return errh->error("%s: queue %u: %s", _dev_name.c_str(), i, strerror(-fd));
+	if (add_queue(fd, errh) < 0)
+	    return -1;
+    }
+#endif
     if (input_is_pull(0)) {
 	ScheduleInfo::join_scheduler(this, &_task, errh);
 	_signal = Notifier::upstream_empty_signal(this, 0, &_task);
     }
     if (_adjust_headroom) {
+	// the 10-byte virtio-net header shifts the packet by 2 mod 4
+	unsigned vnet = (_vnet_hdr ? 2 : 0);
 	if (_tap && _type == LINUX_UNIVERSAL)
-	    _headroom += (4 - (_headroom + 2) % 4) % 4; // default 4/2 alignment
+	    _headroom += (4 - (_headroom + 2 + vnet) % 4) % 4; // default 4/2 alignment
 	else
-	    _headroom += (4 - _headroom % 4) % 4; // default 4/0 alignment
+	    _headroom += (4 - (_headroom + vnet) % 4) % 4; // default 4/0 alignment
     }
-    add_select(_fd, SELECT_READ);
     return 0;
 }
 
 void
 KernelTun::cleanup(CleanupStage)
 {
-    if (_fd >= 0) {
-	if (_type != LINUX_UNIVERSAL && _type != NETBSD_TAP)
-	    updown(0, ~0, ErrorHandler::default_handler());
+    if (_fd >= 0 && _type != LINUX_UNIVERSAL && _type != NETBSD_TAP)
+	updown(0, ~0, ErrorHandler::default_handler());
+    if (_fd >= 0 && !_queues.size())
 	close(_fd);
-	remove_select(_fd, SELECT_READ);
+    for (TunQueue *q = _queues.begin(); q != _queues.end(); ++q) {
+	close(q->fd);
+	master()->thread(q->thread)->select_set().remove_select(q->fd, this, SELECT_READ);
+	delete[] q->buf;
     }
+    _queues.clear();
+    _fd = -1;
 }
 
 void
 KernelTun::selected(int fd, int)
 {
     Timestamp now = Timestamp::now();
-    if (fd != _fd)
+    TunQueue *q = _queues.begin();
+    while (q != _queues.end() && q->fd != fd)
+	++q;
+    if (q == _queues.end())
 	return;
-    ++_selected_calls;
+    ++q->selected_calls;
     unsigned n = _burst;
-    while (n > 0 && one_selected(now))
+    while (n > 0 && one_selected(*q, now))
 	--n;
 }
 
+#if KERNELTUN_LINUX
+/*
+ * Strip the virtio-net header. Partial checksums are completed here;
+ * super-packets keep theirs, as TCPFragmenter recomputes it for every
+ * segment, and get their segments' IP length in GSO_MTU_ANNO.
+ */
 bool
-KernelTun::one_selected(const Timestamp &now)
+KernelTun::vnet_pull(WritablePacket *p)
 {
-    WritablePacket *p = Packet::make(_headroom, 0, _mtu_in, 0);
-    if (!p) {
-	click_chatter("out of memory!");
+    struct virtio_net_hdr vh;
+    if (p->length() < sizeof(vh))
 	return false;
+    memcpy(&vh, p->data(), sizeof(vh));
+    p->pull(sizeof(vh));
+
+    if ((vh.gso_type & ~VIRTIO_NET_HDR_GSO_ECN) == VIRTIO_NET_HDR_GSO_TCPV4
+	&& vh.gso_size && vh.csum_start + sizeof(click_tcp) <= p->length()) {
+	// csum_start is the TCP header offset
+	const click_tcp *th = reinterpret_cast<const click_tcp *>(p->data() + vh.csum_start);
+	unsigned l3 = 0;
+	if (_tap)
+	    l3 = (((const click_ether *) p->data())->ether_type == htons(ETHERTYPE_8021Q) ? 18 : 14);
+	unsigned mtu = vh.csum_start - l3 + (th->th_off << 2) + vh.gso_size;
+	if (vh.csum_start > l3 && p->length() > l3 + mtu) {
+	    SET_GSO_MTU_ANNO(p, mtu);
+	    return true;
+	}
+    }
+
+    if (vh.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+	// the checksum field holds the pseudo-header sum
+	unsigned off = vh.csum_start + vh.csum_offset;
+	if (vh.csum_start >= p->length() || off + 2 > p->length())
+	    return false;
+	uint16_t sum = click_in_cksum(p->data() + vh.csum_start, p->length() - vh.csum_start);
+	if (sum == 0)	// zero means no checksum to UDP
+	    sum = 0xFFFF;
+	memcpy(p->data() + off, &sum, 2);
+    }
+    return true;
+}
+#endif
+
+bool
+KernelTun::one_selected(TunQueue &q, const Timestamp &now)
+{
+    WritablePacket *p;
+    int cc;
+
+    if (q.buf) {
+	// Read into the queue's buffer and copy out what arrived, so that
+	// small packets do not pin a super-packet sized buffer.
+	cc = read(q.fd, q.buf, _mtu_in);
+	p = 0;
+	if (cc > 0 && !(p = Packet::make(_headroom, q.buf, cc, 0))) {
+	    click_chatter("out of memory!");
+	    return false;
+	}
+    } else {
+	p = Packet::make(_headroom, 0, _mtu_in, 0);
+	if (!p) {
+	    click_chatter("out of memory!");
+	    return false;
+	}
+	cc = read(q.fd, p->data(), _mtu_in);
+	if (cc > 0)
+	    p->take(_mtu_in - cc);
     }
 
-    int cc = read(_fd, p->data(), _mtu_in);
     if (cc > 0) {
-	++_packets;
-	p->take(_mtu_in - cc);
+	++q.packets;
 	bool ok = false;
 
 	if (_tap) {
-	    if (_type == LINUX_UNIVERSAL)
+	    if (_type == LINUX_UNIVERSAL) {
 		// 2-byte padding, 2-byte Ethernet type, then Ethernet header
 		p->pull(4);
-	    else if (_type == LINUX_ETHERTAP)
+#if KERNELTUN_LINUX
+		if (_vnet_hdr && !vnet_pull(p)) {
+		    checked_output_push(1, p);
+		    return true;
+		}
+#endif
+	    } else if (_type == LINUX_ETHERTAP)
 		// 2-byte padding, then Ethernet header
 		p->pull(2);
 	    ok = true;
@@ -529,6 +677,10 @@ KernelTun::one_selected(const Timestamp &now)
 	    // 2-byte padding followed by an Ethernet type
 	    uint16_t etype = *(uint16_t *)(p->data() + 2);
 	    p->pull(4);
+#if KERNELTUN_LINUX
+	    if (_vnet_hdr && !vnet_pull(p))
+		etype = 0;
+#endif
 	    if (etype != htons(ETHERTYPE_IP) && etype != htons(ETHERTYPE_IP6))
 		checked_output_push(1, p->clone());
 	    else
@@ -561,7 +713,8 @@ KernelTun::one_selected(const Timestamp &now)
 	    checked_output_push(1, p);
 	return true;
     } else {
-	p->kill();
+	if (p)
+	    p->kill();
 	if (errno != EAGAIN && errno != EWOULDBLOCK
 	    && (!_ignore_q_errs || !_printed_read_err || errno != ENOBUFS)) {
 	    _printed_read_err = true;
@@ -623,10 +776,26 @@ KernelTun::push(int, Packet *p)
     }
 
     WritablePacket *q;
+    int ip_v = (iph ? iph->ip_v : 0);	// iph is stale once pushed
+#if KERNELTUN_LINUX
+    // no offloads: zeroed virtio-net header between padding and packet
+    if (_vnet_hdr) {
+	if ((q = p->push(sizeof(struct virtio_net_hdr))))
+	    memset(q->data(), 0, sizeof(struct virtio_net_hdr));
+	else {
+	    click_chatter("%s(%s): out of memory", class_name(), _dev_name.c_str());
+	    return;
+	}
+	p = q;
+    }
+    int vnet = (_vnet_hdr ? sizeof(struct virtio_net_hdr) : 0);
+#else
+    int vnet = 0;
+#endif
     if (_tap) {
 	if (_type == LINUX_UNIVERSAL) {
 	    // 2-byte padding, 2-byte Ethernet type, then Ethernet header
-	    uint16_t ethertype = ((const click_ether *) p->data())->ether_type;
+	    uint16_t ethertype = ((const click_ether *) (p->data() + vnet))->ether_type;
 	    if ((q = p->push(4)))
 		((uint16_t *) q->data())[1] = ethertype;
 	    p = q;
@@ -638,17 +807,17 @@ KernelTun::push(int, Packet *p)
 	}
     } else if (_type == LINUX_UNIVERSAL) {
 	// 2-byte padding followed by an Ethernet type
-	uint32_t ethertype = (iph->ip_v == 4 ? htonl(ETHERTYPE_IP) : htonl(ETHERTYPE_IP6));
+	uint32_t ethertype = (ip_v == 4 ? htonl(ETHERTYPE_IP) : htonl(ETHERTYPE_IP6));
 	if ((q = p->push(4)))
 	    *(uint32_t *)(q->data()) = ethertype;
 	p = q;
     } else if (_type == BSD_TUN) {
-	uint32_t af = (iph->ip_v == 4 ? htonl(AF_INET) : htonl(AF_INET6));
+	uint32_t af = (ip_v == 4 ? htonl(AF_INET) : htonl(AF_INET6));
 	if ((q = p->push(4)))
 	    *(uint32_t *)(q->data()) = af;
 	p = q;
     } else if (_type == LINUX_ETHERTAP) {
-	uint16_t ethertype = (iph->ip_v == 4 ? htons(ETHERTYPE_IP) : htons(ETHERTYPE_IP6));
+	uint16_t ethertype = (ip_v == 4 ? htons(ETHERTYPE_IP) : htons(ETHERTYPE_IP6));
 	if ((q = p->push(16))) {
 	    /* ethertap driver is very picky about what address we use
 	     * here. e.g. if we have the wrong address, linux might ignore
@@ -663,7 +832,12 @@ KernelTun::push(int, Packet *p)
     }
 
     if (p) {
-	int w = write(_fd, p->data(), p->length());
+	// the queue this thread reads, as assigned by add_queue(), or any
+	// if there are more threads than queues
+	unsigned nthreads = master()->nthreads();
+	unsigned i = (click_current_cpu_id() + nthreads - home_thread()->thread_id()) % nthreads;
+	int fd = _queues[i % _queues.size()].fd;
+	int w = write(fd, p->data(), p->length());
 	if (w != (int) p->length() && (errno != ENOBUFS || !_ignore_q_errs || !_printed_write_err)) {
 	    _printed_write_err = true;
 	    click_chatter("%s(%s): write failed: %s", class_name(), _dev_name.c_str(), strerror(errno));
@@ -679,8 +853,18 @@ KernelTun::add_handlers()
     if (input_is_pull(0))
 	add_task_handlers(&_task);
     add_data_handlers("dev_name", Handler::OP_READ, &_dev_name);
-    add_data_handlers("selected_calls", Handler::OP_READ, &_selected_calls);
-    add_data_handlers("packets", Handler::OP_READ, &_packets);
+    add_read_handler("selected_calls", read_handler, h_selected_calls);
+    add_read_handler("packets", read_handler, h_packets);
+}
+
+String
+KernelTun::read_handler(Element *e, void *thunk)
+{
+    KernelTun *kt = static_cast<KernelTun *>(e);
+    click_uint_large_t n = 0;
+    for (TunQueue *q = kt->_queues.begin(); q != kt->_queues.end(); ++q)
+	n += ((intptr_t) thunk == h_selected_calls ? q->selected_calls : q->packets);
+    return String(n);
 }
 
 CLICK_ENDDECLS
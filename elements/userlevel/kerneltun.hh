@@ -10,7 +10,7 @@ CLICK_DECLS
 /*
 =c
 
-KernelTun(ADDR/MASK [, GATEWAY, I<keywords> HEADROOM, ETHER, MTU, IGNORE_QUEUE_OVERFLOWS])
+KernelTun(ADDR/MASK [, GATEWAY, I<keywords> HEADROOM, ETHER, MTU, IGNORE_QUEUE_OVERFLOWS, QUEUES, VNET_HDR])
 
 =s comm
 
@@ -73,6 +73,24 @@ String. If specified, try to alloc a tun device with name DEVNAME.
 Otherwise, we'll just take the first virtual device we find. This option
 only works with the Linux Universal TUN/TAP driver.
 
+=item QUEUES
+
+Integer. The number of queues to open on a multiqueue device. Each queue
+has its own file descriptor, and queue I is read by Click thread I (modulo
+the number of threads), so packets are emitted from several threads at
+once when QUEUES is greater than 1. Packets are written on the queue of
+the thread pushing them. Default is 1. Linux Universal TUN/TAP driver only.
+
+=item VNET_HDR
+
+Boolean. If true, exchange packets with a virtio-net header and let the
+kernel hand over TCP/IPv4 super-packets of up to 64KB whose checksums are
+not yet computed. KernelTun completes partial checksums; a super-packet
+is emitted whole with its GSO_MTU annotation set to the IP length of the
+segments it stands for, so that a downstream TCPFragmenter(MTU_ANNO
+GSO_MTU) can split it where needed. Default is false. Linux Universal
+TUN/TAP driver only.
+
 =back
 
 =n
@@ -100,9 +118,21 @@ and C<ping> should print Click's responses.
 This element differs from KernelTap in that it produces and expects IP
 packets, not IP-in-Ethernet packets.
 
+=h dev_name read-only
+
+The name of the device.
+
+=h selected_calls read-only
+
+Number of times a queue was found readable.
+
+=h packets read-only
+
+Number of packets read from the device.
+
 =a
 
-FromDevice.u, ToDevice.u, KernelTap, ifconfig(8) */
+FromDevice.u, ToDevice.u, KernelTap, TCPFragmenter, ifconfig(8) */
 
 class KernelTun : public Element { public:
 
@@ -129,11 +159,22 @@ class KernelTun : public Element { public:
 
   private:
 
-    enum { DEFAULT_MTU = 1500 };
+    enum { DEFAULT_MTU = 1500, MAX_GSO_LENGTH = 65535 };
     enum Type { LINUX_UNIVERSAL, LINUX_ETHERTAP, BSD_TUN, BSD_TAP, OSX_TUN,
 		NETBSD_TUN, NETBSD_TAP };
 
-    int _fd;
+    struct TunQueue {
+	int fd;
+	int thread;
+	unsigned char *buf;	// read buffer, VNET_HDR only
+	click_uint_large_t selected_calls;
+	click_uint_large_t packets;
+    };
+
+    int _fd;			// first queue
+    Vector<TunQueue> _queues;
+    unsigned _nqueues;
+    bool _vnet_hdr;
     int _mtu_in;
     int _mtu_out;
     Type _type;
@@ -153,17 +194,21 @@ class KernelTun : public Element { public:
     bool _printed_read_err;
     bool _adjust_headroom;
 
-    click_uint_large_t _selected_calls;
-    click_uint_large_t _packets;
+    enum { h_selected_calls, h_packets };
 
 #if HAVE_LINUX_IF_TUN_H
+    int open_linux_universal();
     int try_linux_universal();
+    bool vnet_pull(WritablePacket *);
 #endif
     int try_tun(const String &, ErrorHandler *);
     int alloc_tun(ErrorHandler *);
     int setup_tun(ErrorHandler *);
     int updown(IPAddress, IPAddress, ErrorHandler *);
-    bool one_selected(const Timestamp &now);
+    int add_queue(int fd, ErrorHandler *);
+    bool one_selected(TunQueue &q, const Timestamp &now);
+
+    static String read_handler(Element *, void *) CLICK_COLD;
 
     friend class KernelTap;
 
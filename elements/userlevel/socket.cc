@@ -28,9 +28,11 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <fcntl.h>
+#include <new>
 #include <click/timer.hh>
 #include <click/handlercall.hh>
 #include "socket.hh"
@@ -43,7 +45,9 @@ CLICK_DECLS
 
 Socket::Socket()
   : _task(this), _timer(this),
-    _fd(-1), _active(-1), _rq(0), _wq(0),
+    _fd(-1), _active(-1), _rbuf(0), _rcap(0), _rlen(0), _max_message(0), _wq(0), _wq_tail(0),
+    _wq_bytes(0), _wq_capacity(65536), _writes(0), _framing(0),
+    _framing_thunk(0), _length_offset(0), _length_bytes(4), _length_adjust(0),
     _local_port(0), _local_pathname(""),
     _timestamp(true), _sndbuf(-1), _rcvbuf(-1),
     _snaplen(2048), _headroom(Packet::default_headroom), _nodelay(1),
@@ -55,6 +59,14 @@ Socket::~Socket()
 {
 }
 
+void *
+Socket::cast(const char *n)
+{
+  if (strcmp(n, Notifier::FULL_NOTIFIER) == 0 && ninputs() && input_is_push(0))
+    return static_cast<Notifier *>(&_full_note);
+  return Element::cast(n);
+}
+
 void Socket::run_timer(Timer *) {
 
   ErrorHandler *errh = new ErrorHandler();
@@ -79,10 +91,18 @@ Socket::configure(Vector<String> &conf, ErrorHandler *errh)
   socktype = socktype.upper();
 
   String reconnect_call;
+  String framing = "NONE";
+  uint32_t max_message = 65535;
   // remove keyword arguments
   Element *allow = 0, *deny = 0;
   if (args.read("VERBOSE", _verbose)
       .read("SNAPLEN", _snaplen)
+      .read("WRITE_QUEUE", _wq_capacity)
+      .read("FRAMING", WordArg(), framing)
+      .read("MAX_MESSAGE", max_message)
+      .read("LENGTH_OFFSET", _length_offset)
+      .read("LENGTH_BYTES", _length_bytes)
+      .read("LENGTH_ADJUST", _length_adjust)
       .read("HEADROOM", _headroom)
       .read("TIMESTAMP", _timestamp)
       .read("RCVBUF", _rcvbuf)
@@ -99,6 +119,27 @@ Socket::configure(Vector<String> &conf, ErrorHandler *errh)
   if (reconnect_call)
     _reconnect_call_h = new HandlerCall(reconnect_call);
 
+  if (_snaplen <= 0)
+    return errh->error("SNAPLEN must be positive");
+  if (_wq_capacity == 0)
+    return errh->error("WRITE_QUEUE must be positive");
+
+  _max_message = _snaplen;
+  framing = framing.upper();
+  if (framing == "LENGTH") {
+    if (_length_bytes != 1 && _length_bytes != 2 && _length_bytes != 4)
+      return errh->error("LENGTH_BYTES must be 1, 2, or 4");
+    set_framing(length_framing, this);
+    // the receive buffer grows up to MAX_MESSAGE, or the longest length
+    // the field encodes if that is shorter
+    int64_t m = (int64_t) (0xFFFFFFFFU >> (32 - 8 * _length_bytes)) + _length_adjust;
+    if (m > max_message)
+      m = max_message;
+    if (m > _max_message)
+      _max_message = m > 0x7FFFFFFF ? 0x7FFFFFFF : m;
+  } else if (framing != "NONE")
+    return errh->error("unknown FRAMING `%s'", framing.c_str());
+
   if (allow && !(_allow = (IPRouteTable *)allow->cast("IPRouteTable")))
     return errh->error("%s is not an IPRouteTable", allow->name().c_str());
 
@@ -139,6 +180,9 @@ Socket::configure(Vector<String> &conf, ErrorHandler *errh)
   else
     return errh->error("unknown socket type `%s'", socktype.c_str());
 
+  if (_framing && _socktype != SOCK_STREAM)
+    return errh->error("FRAMING requires a stream socket");
+
   return 0;
 }
 
@@ -168,6 +212,19 @@ Socket::initialize(ErrorHandler *errh)
   _timer.initialize(this);
   _timer.reschedule_after_sec(2);
 
+  // receive buffer, write queue notifier and task, kept across reconnects
+  if (!_rbuf) {
+    if (!(_rbuf = new unsigned char[_snaplen]))
+      return errh->error("out of memory");
+    _rcap = _snaplen;
+  }
+  if (!_full_note.initialized()) {
+    _full_note.initialize(Notifier::FULL_NOTIFIER, router());
+    _full_note.set_active(true, false);
+  }
+  if (ninputs() && input_is_push(0) && !_task.initialized())
+    ScheduleInfo::initialize_task(this, &_task, false, errh);
+
   // initialize callback
   if (_reconnect_call_h && (_reconnect_call_h->initialize_write(this, errh) < 0))
     return initialize_socket_error(errh, "callback");
@@ -277,7 +334,8 @@ Socket::initialize(ErrorHandler *errh)
     add_select(_fd, SELECT_READ);
 
   if (ninputs() && input_is_pull(0)) {
-    ScheduleInfo::join_scheduler(this, &_task, errh);
+    if (!_task.initialized())
+      ScheduleInfo::join_scheduler(this, &_task, errh);
     _signal = Notifier::upstream_empty_signal(this, 0, &_task);
     add_select(_fd, SELECT_WRITE);
   }
@@ -295,10 +353,10 @@ Socket::cleanup(CleanupStage)
     close(_active);
     _active = -1;
   }
-  if (_rq)
-    _rq->kill();
-  if (_wq)
-    _wq->kill();
+  clear_queue();
+  delete[] _rbuf;
+  _rbuf = 0;
+  _rcap = 0;
   if (_fd >= 0) {
     // shut down the listening socket in case we forked
 #ifdef SHUT_RDWR
@@ -336,12 +394,268 @@ Socket::close_active(void)
       click_chatter("%s: closed connection %d", declaration().c_str(), _active);
     _active = -1;
   }
+  // whatever was pending belongs to the old connection
+  _rlen = 0;
+  clear_queue();
+}
+
+int
+Socket::length_framing(const unsigned char *data, int length, void *thunk)
+{
+  Socket *s = static_cast<Socket *>(thunk);
+  int header = s->_length_offset + s->_length_bytes;
+  if (length < header)
+    return 0;
+  uint32_t v = 0;
+  for (uint32_t i = 0; i < s->_length_bytes; i++)
+    v = (v << 8) | data[s->_length_offset + i];
+  int64_t m = (int64_t) v + s->_length_adjust;
+  // a message holds at least its length field
+  if (m < header || m > 0x7FFFFFFF)
+    return -1;
+  return m;
+}
+
+void
+Socket::emit(const unsigned char *data, int len, int extra)
+{
+  WritablePacket *p = Packet::make(_headroom, data, len, 0);
+  if (!p) {
+    click_chatter("%s: out of memory", declaration().c_str());
+    return;
+  }
+  if (extra)
+    SET_EXTRA_LENGTH_ANNO(p, extra);
+
+  // set timestamp
+  if (_timestamp)
+    p->timestamp_anno().assign_now();
+
+  output(0).push(p);
 }
 
 void
-Socket::selected(int fd, int)
+Socket::receive()
 {
+  union { struct sockaddr_in in; struct sockaddr_un un; } from;
+  struct iovec iov;
+  struct msghdr msg;
   int len;
+
+  // with framing, append to the bytes of an incomplete message
+  iov.iov_base = _rbuf + _rlen;
+  iov.iov_len = _rcap - _rlen;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (_socktype != SOCK_STREAM && !_client) {
+    // datagram server, find out who we are talking to
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+  }
+  len = recvmsg(_active, &msg, _socktype == SOCK_STREAM ? 0 : MSG_TRUNC);
+
+  if (len > 0 && msg.msg_name) {
+    if (_family == AF_INET && !allowed(IPAddress(from.in.sin_addr))) {
+      if (_verbose)
+	click_chatter("%s: dropped datagram from %s:%d", declaration().c_str(),
+		      IPAddress(from.in.sin_addr).unparse().c_str(), ntohs(from.in.sin_port));
+      return;
+    }
+    memcpy(&_remote, &from, msg.msg_namelen);
+    _remote_len = msg.msg_namelen;
+  }
+
+  // connection terminated or fatal error
+  if (len == 0 || (len < 0 && errno != EAGAIN)) {
+    if (len < 0 && _verbose)
+      click_chatter("%s: %s", declaration().c_str(), strerror(errno));
+    close_active();
+    return;
+  } else if (len < 0)
+    return;
+
+  if (!_framing) {
+    // truncate packet to max length
+    if (len > _snaplen)
+      emit(_rbuf, _snaplen, len - _snaplen);
+    else
+      emit(_rbuf, len, 0);
+    return;
+  }
+
+  // emit every complete message
+  _rlen += len;
+  int off = 0;
+  int m = 0;
+  while (off < _rlen) {
+    m = _framing(_rbuf + off, _rlen - off, _framing_thunk);
+    if (m < 0) {
+      click_chatter("%s: bad message framing, closing connection", declaration().c_str());
+      close_active();
+      return;
+    } else if (m > _max_message) {
+      click_chatter("%s: %d byte message longer than %d, closing connection", declaration().c_str(), m, _max_message);
+      close_active();
+      return;
+    } else if (m == 0 || m > _rlen - off)
+      break;
+    emit(_rbuf + off, m, 0);
+    // downstream may have dropped the connection
+    if (_active < 0)
+      return;
+    off += m;
+    m = 0;
+  }
+  if (off) {
+    memmove(_rbuf, _rbuf + off, _rlen - off);
+    _rlen -= off;
+  }
+  if (m > _rcap) {
+    // the next message does not fit, make room for all of it
+    unsigned char *rbuf = new (std::nothrow) unsigned char[m];
+    if (!rbuf) {
+      click_chatter("%s: out of memory for a %d byte message, closing connection", declaration().c_str(), m);
+      close_active();
+      return;
+    }
+    memcpy(rbuf, _rbuf, _rlen);
+    delete[] _rbuf;
+    _rbuf = rbuf;
+    _rcap = m;
+  } else if (_rlen == _rcap) {
+    click_chatter("%s: message longer than SNAPLEN, closing connection", declaration().c_str());
+    close_active();
+  }
+}
+
+/*
+ * Append p to the write queue, from any thread. Returns true if the queue
+ * is over WRITE_QUEUE.
+ */
+bool
+Socket::enqueue(Packet *p)
+{
+  p->set_next(0);
+  _wq_lock.acquire();
+  if (_wq)
+    _wq_tail->set_next(p);
+  else
+    _wq = p;
+  _wq_tail = p;
+  _wq_bytes += p->length();
+  bool full = _wq_bytes >= _wq_capacity;
+  if (full)
+    _full_note.sleep();
+  _wq_lock.release();
+  return full;
+}
+
+void
+Socket::clear_queue()
+{
+  _wq_lock.acquire();
+  Packet *q = _wq;
+  _wq = _wq_tail = 0;
+  _wq_bytes = 0;
+  if (_full_note.initialized())
+    _full_note.wake();
+  _wq_lock.release();
+  while (Packet *p = q) {
+    q = p->next();
+    p->kill();
+  }
+}
+
+/*
+ * Write the queue of a stream socket, gathering up to WRITEV_MAX packets
+ * per writev(). Returns 0 once the queue is empty, -1 if the socket
+ * would block, the connection was closed, or another thread is writing.
+ *
+ * The writer detaches the queue under _wq_lock and writes it unlocked, so
+ * other threads keep enqueueing meanwhile. _flush_lock keeps a single
+ * writer, and what it could not write goes back ahead of the queue.
+ */
+int
+Socket::flush()
+{
+  if (!_flush_lock.attempt())
+    return -1;
+
+  Packet *q = 0, *q_tail = 0;
+  int err = 0;
+  while (1) {
+    if (!q) {
+      _wq_lock.acquire();
+      q = _wq;
+      q_tail = _wq_tail;
+      _wq = _wq_tail = 0;
+      _wq_lock.release();
+      if (!q)
+	break;
+    }
+
+    struct iovec iov[WRITEV_MAX];
+    int n = 0;
+    for (Packet *p = q; p && n < WRITEV_MAX; p = p->next(), n++) {
+      iov[n].iov_base = const_cast<unsigned char *>(p->data());
+      iov[n].iov_len = p->length();
+    }
+
+    ssize_t len = writev(_active, iov, n);
+    _writes++;
+    if (len < 0) {
+      // interrupted by signal, try again immediately
+      if (errno == EINTR)
+	continue;
+      err = -1;
+      // out of memory or would block
+      if (errno == ENOBUFS || errno == EAGAIN)
+	break;
+      // connection probably terminated or other fatal error
+      if (_verbose)
+	click_chatter("%s: %s", declaration().c_str(), strerror(errno));
+      while (Packet *p = q) {
+	q = p->next();
+	p->kill();
+      }
+      close_active();
+      break;
+    }
+
+    // release what was written, keep the rest of a partial packet
+    size_t written = len;
+    while (q && (size_t) len >= q->length()) {
+      Packet *p = q;
+      len -= p->length();
+      q = p->next();
+      p->kill();
+    }
+    if (q && len)
+      q->pull(len);
+    _wq_lock.acquire();
+    _wq_bytes -= written < _wq_bytes ? written : _wq_bytes;
+    if (_wq_bytes <= _wq_capacity / 2)
+      _full_note.wake();
+    _wq_lock.release();
+  }
+
+  if (q) {
+    // what was queued meanwhile goes after the rest of the detached queue
+    _wq_lock.acquire();
+    q_tail->set_next(_wq);
+    if (!_wq)
+      _wq_tail = q_tail;
+    _wq = q;
+    _wq_lock.release();
+  }
+  _flush_lock.release();
+  return err;
+}
+
+void
+Socket::selected(int fd, int mask)
+{
   union { struct sockaddr_in in; struct sockaddr_un un; } from;
   socklen_t from_len = sizeof(from);
   bool allow;
@@ -382,60 +696,11 @@ Socket::selected(int fd, int)
     }
 
     // read data from socket
-    if (!_rq)
-      _rq = Packet::make(_headroom, 0, _snaplen, 0);
-    if (_rq) {
-      if (_socktype == SOCK_STREAM)
-	len = read(_active, _rq->data(), _rq->length());
-      else if (_client)
-	len = recv(_active, _rq->data(), _rq->length(), MSG_TRUNC);
-      else {
-	// datagram server, find out who we are talking to
-	len = recvfrom(_active, _rq->data(), _rq->length(), MSG_TRUNC, (struct sockaddr *)&from, &from_len);
-
-	if (_family == AF_INET && !allowed(IPAddress(from.in.sin_addr))) {
-	  if (_verbose)
-	    click_chatter("%s: dropped datagram from %s:%d", declaration().c_str(),
-			  IPAddress(from.in.sin_addr).unparse().c_str(), ntohs(from.in.sin_port));
-	  len = -1;
-	  errno = EAGAIN;
-	} else if (len > 0) {
-	  memcpy(&_remote, &from, from_len);
-	  _remote_len = from_len;
-	}
-      }
-
-      // this segment OK
-      if (len > 0) {
-	if (len > _snaplen) {
-	  // truncate packet to max length (should never happen)
-	  assert(_rq->length() == (uint32_t)_snaplen);
-	  SET_EXTRA_LENGTH_ANNO(_rq, len - _snaplen);
-	} else {
-	  // trim packet to actual length
-	  _rq->take(_snaplen - len);
-	}
-
-	// set timestamp
-	if (_timestamp)
-	  _rq->timestamp_anno().assign_now();
-
-	// push packet
-	output(0).push(_rq);
-	_rq = 0;
-      }
-
-      // connection terminated or fatal error
-      else if (len == 0 || errno != EAGAIN) {
-	if (errno != EAGAIN && _verbose)
-	  click_chatter("%s: %s", declaration().c_str(), strerror(errno));
-	close_active();
-	return;
-      }
-    }
+    if (_active >= 0 && (mask & SELECT_READ))
+      receive();
   }
 
-  if (ninputs() && input_is_pull(0))
+  if (ninputs() && (input_is_pull(0) || _wq))
     run_task(0);
 }
 
@@ -492,44 +757,86 @@ Socket::push(int, Packet *p)
   fd_set fds;
   int err;
 
-  if (_active >= 0) {
-    // block
-    do {
+  if (_active < 0) {
+    p->kill();
+    return;
+  }
+
+  if (_socktype == SOCK_STREAM) {
+    // the task writes a burst of pushed packets at once
+    if (!enqueue(p)) {
+      _task.reschedule();
+      return;
+    }
+    // queue full, block
+    while (_active >= 0 && _wq_bytes >= _wq_capacity && flush() < 0) {
+      if (_active < 0)
+	break;
       FD_ZERO(&fds);
       FD_SET(_active, &fds);
-      err = select(_active + 1, NULL, &fds, NULL, NULL);
-    } while (err < 0 && errno == EINTR);
-
-    if (err >= 0) {
-      // write
-      do {
-	err = write_packet(p);
-      } while (err < 0 && (errno == ENOBUFS || errno == EAGAIN));
+      if (select(_active + 1, NULL, &fds, NULL, NULL) < 0 && errno != EINTR)
+	close_active();
     }
+    return;
+  }
 
-    if (err < 0) {
-      if (_verbose)
-	click_chatter("%s: %s, dropping packet", declaration().c_str(), strerror(err));
-      p->kill();
-    }
-  } else
+  // block
+  do {
+    FD_ZERO(&fds);
+    FD_SET(_active, &fds);
+    err = select(_active + 1, NULL, &fds, NULL, NULL);
+  } while (err < 0 && errno == EINTR);
+
+  if (err >= 0) {
+    // write
+    do {
+      err = write_packet(p);
+    } while (err < 0 && (errno == ENOBUFS || errno == EAGAIN));
+  }
+
+  if (err < 0) {
+    if (_verbose)
+      click_chatter("%s: %s, dropping packet", declaration().c_str(), strerror(err));
     p->kill();
+  }
 }
 
 bool
 Socket::run_task(Task *)
 {
-  assert(ninputs() && input_is_pull(0));
   bool any = false;
 
-  if (_active >= 0) {
+  if (_active >= 0 && _socktype == SOCK_STREAM) {
+    // queue as much as we can, then write it at once
+    if (ninputs() && input_is_pull(0))
+      while (_wq_bytes < _wq_capacity) {
+	Packet *p = input(0).pull();
+	if (!p)
+	  break;
+	enqueue(p);
+	any = true;
+      }
+
+    if (flush() < 0) {
+      // write the rest when socket becomes available
+      if (_active >= 0)
+	add_select(_active, SELECT_WRITE);
+    } else if (ninputs() && input_is_pull(0) && _signal)
+      // more pending
+      // (can't use fast_reschedule() cause selected() calls this)
+      _task.reschedule();
+    else
+      // wrote all we could and no more pending
+      remove_select(_active, SELECT_WRITE);
+
+  } else if (_active >= 0 && ninputs() && input_is_pull(0)) {
     Packet *p = 0;
     int err = 0;
 
     // write as much as we can
     do {
       p = _wq ? _wq : input(0).pull();
-      _wq = 0;
+      _wq = _wq_tail = 0;
       if (p) {
 	any = true;
 	err = write_packet(p);
@@ -538,7 +845,7 @@ Socket::run_task(Task *)
 
     if (err < 0) {
       // queue packet for writing when socket becomes available
-      _wq = p;
+      _wq = _wq_tail = p;
       p = 0;
       add_select(_active, SELECT_WRITE);
     } else if (_signal)
@@ -554,10 +861,21 @@ Socket::run_task(Task *)
   return any;
 }
 
+String
+Socket::read_handler(Element *e, void *thunk)
+{
+  Socket *s = static_cast<Socket *>(e);
+  if (thunk)
+    return String(s->_writes);
+  return String(s->_wq_bytes);
+}
+
 void
 Socket::add_handlers()
 {
   add_task_handlers(&_task);
+  add_read_handler("queued", read_handler, 0);
+  add_read_handler("writes", read_handler, 1);
 }
 
 CLICK_ENDDECLS
@@ -6,6 +6,7 @@
 #include <click/task.hh>
 #include <click/timer.hh>
 #include <click/notifier.hh>
+#include <click/sync.hh>
 #include "../ip/iproutetable.hh"
 #include <sys/un.h>
 #include <click/handlercall.hh>
@@ -61,6 +62,19 @@ otherwise, the socket will pull packets as it can accept them. For
 best performance, place a Notifier element (such as NotifierQueue)
 upstream of a "pull" Socket.
 
+On stream sockets, packets to send are queued and written together with
+a single writev(2), so a burst of small messages costs one system call.
+At most WRITE_QUEUE bytes are queued: above that a pushed packet blocks
+until the queue drains, and a "pull" Socket stops pulling. Socket is a
+full notifier, so upstream push elements that honor full signals stop
+pushing while the queue is above WRITE_QUEUE, and resume once it drains
+to half of it.
+
+Received data is read with recvmsg(2) into a buffer of SNAPLEN bytes
+that is reused across reads; each packet is a copy of what arrived. With
+FRAMING, a stream is split at message boundaries instead, and each packet
+holds exactly one message.
+
 Keyword arguments are:
 
 =over 8
@@ -68,7 +82,45 @@ Keyword arguments are:
 =item SNAPLEN
 
 Unsigned integer. Maximum length of packets that can be
-received. Default is 2048 bytes.
+received. With FRAMING LENGTH, the receive buffer grows for longer
+messages, up to MAX_MESSAGE. With a framing function installed by
+another element, a message longer than SNAPLEN closes the connection.
+Default is 2048 bytes.
+
+=item WRITE_QUEUE
+
+Unsigned integer. Maximum number of bytes queued for writing on a stream
+socket. Default is 65536.
+
+=item FRAMING
+
+Either NONE or LENGTH. With LENGTH, each message of a stream starts
+with its length, an unsigned big-endian integer of LENGTH_BYTES bytes at
+offset LENGTH_OFFSET, to which LENGTH_ADJUST is added. Default is NONE,
+which emits data as it arrives. Elements can also install their own
+framing function with set_framing().
+
+=item MAX_MESSAGE
+
+Unsigned integer. Longest message accepted with FRAMING LENGTH, so a
+corrupt length field cannot make the receive buffer grow without bound.
+A longer message closes the connection. Default is 65535 bytes, or
+SNAPLEN if that is larger.
+
+=item LENGTH_OFFSET
+
+Unsigned integer. Offset of the length field for FRAMING LENGTH. Default
+is 0.
+
+=item LENGTH_BYTES
+
+1, 2, or 4. Size of the length field for FRAMING LENGTH. Default is 4.
+
+=item LENGTH_ADJUST
+
+Integer. Added to the length field to get the whole message length, for
+instance the header size if the field does not count the header. Default
+is 0.
 
 =item NODELAY
 
@@ -145,6 +197,14 @@ Integer. Per-packet headroom. Defaults to 28.
 
 =back
 
+=h queued read-only
+
+Number of bytes queued for writing.
+
+=h writes read-only
+
+Number of write system calls made.
+
 =e
 
   // A server socket
@@ -162,6 +222,11 @@ Integer. Per-packet headroom. Defaults to 28.
   // A bi-directional client socket bound to a particular local port
   ... -> Socket(TCP, 1.2.3.4, 80, 0.0.0.0, 54321) -> ...
 
+  // A client socket reading messages prefixed by a 32-bit length
+  // that counts the whole message and starts at byte 2
+  ... -> Socket(TCP, 1.2.3.4, 4433, CLIENT true, FRAMING LENGTH,
+                LENGTH_OFFSET 2) -> ...
+
   // A localhost server socket
   allow :: RadixIPLookup(127.0.0.1 0);
   deny :: RadixIPLookup(0.0.0.0/0	0);
@@ -181,6 +246,7 @@ class Socket : public Element { public:
   const char *processing() const	{ return "a/h"; }
   const char *flow_code() const		{ return "x/y"; }
   const char *flags() const		{ return "S3"; }
+  void *cast(const char *);
 
   virtual int configure(Vector<String> &conf, ErrorHandler *) CLICK_COLD;
   virtual int initialize(ErrorHandler *) CLICK_COLD;
@@ -196,6 +262,18 @@ class Socket : public Element { public:
   void close_active(void);
   int write_packet(Packet*);
 
+  /** @brief Framing function for stream sockets.
+   * @param data bytes received and not yet emitted
+   * @param length number of bytes at @a data
+   * @param thunk user data passed to set_framing()
+   * @return the length of the first message at @a data, 0 if more bytes
+   * are needed to tell, or a negative number if the stream is corrupt */
+  typedef int (*FramingCallback)(const unsigned char *data, int length, void *thunk);
+  void set_framing(FramingCallback f, void *thunk) {
+    _framing = f;
+    _framing_thunk = thunk;
+  }
+
 protected:
   Task _task;
   Timer _timer;
@@ -214,8 +292,23 @@ private:
   socklen_t _remote_len;
 
   NotifierSignal _signal;	// packet is available to pull()
-  WritablePacket *_rq;		// queue to receive pulled packets
-  Packet *_wq;			// queue to store pulled packet for when sendto() blocks
+  unsigned char *_rbuf;		// receive buffer, _rcap bytes
+  int _rcap;			// _snaplen, or the longest message framed so far
+  int _rlen;			// bytes in _rbuf not yet emitted (framing only)
+  int _max_message;		// longest message _rbuf may grow to
+  Packet *_wq;			// packets waiting to be written, linked by next()
+  Packet *_wq_tail;
+  uint32_t _wq_bytes;		// bytes in _wq and being written by flush()
+  SimpleSpinlock _wq_lock;	// _wq, _wq_tail and _wq_bytes, pushed from any thread
+  SimpleSpinlock _flush_lock;	// held by the thread writing the queue
+  uint32_t _wq_capacity;	// maximum bytes in _wq
+  uint32_t _writes;		// write system calls
+  ActiveNotifier _full_note;	// asleep while _wq is over capacity
+  FramingCallback _framing;	// splits streams into messages
+  void *_framing_thunk;
+  uint32_t _length_offset;	// FRAMING LENGTH parameters
+  uint32_t _length_bytes;
+  int _length_adjust;
 
   int _family;			// AF_INET or AF_UNIX
   int _socktype;		// SOCK_STREAM or SOCK_DGRAM
@@ -240,6 +333,14 @@ private:
   IPRouteTable *_deny;		// lookup table of bad hosts
 
   int initialize_socket_error(ErrorHandler *, const char *);
+  enum { WRITEV_MAX = 256 };	// packets per writev()
+  void emit(const unsigned char *, int, int);
+  bool enqueue(Packet *);
+  int flush();
+  void clear_queue();
+  void receive();
+  static int length_framing(const unsigned char *, int, void *);
+  static String read_handler(Element *, void *) CLICK_COLD;
 
   HandlerCall *_reconnect_call_h;
 
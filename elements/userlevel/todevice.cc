@@ -61,7 +61,11 @@
 CLICK_DECLS
 
 ToDevice::ToDevice()
-    : _task(this), _timer(&_task), _q(0), _pulls(0)
+    : _task(this), _timer(&_task), _q(0),
+#if TODEVICE_ALLOW_LINUX
+      _batch(0), _nbatch(0), _msgs(0), _iov(0),
+#endif
+      _backoff(0), _pulls(0)
 {
 #if TODEVICE_ALLOW_PCAP
     _pcap = 0;
@@ -75,6 +79,11 @@ ToDevice::ToDevice()
 
 ToDevice::~ToDevice()
 {
+#if TODEVICE_ALLOW_LINUX
+    delete[] _batch;
+    delete[] _msgs;
+    delete[] _iov;
+#endif
 }
 
 int
@@ -233,6 +242,16 @@ ToDevice::initialize(ErrorHandler *errh)
 	    _my_fd = true;
 	}
 	_method = method_linux;
+	if (_burst > 1) {
+	    _batch = new Packet *[_burst];
+	    _msgs = new struct mmsghdr[_burst];
+	    _iov = new struct iovec[_burst];
+	    memset(_msgs, 0, sizeof(struct mmsghdr) * _burst);
+	    for (int i = 0; i < _burst; i++) {
+		_msgs[i].msg_hdr.msg_iov = &_iov[i];
+		_msgs[i].msg_hdr.msg_iovlen = 1;
+	    }
+	}
     }
 #endif
 
@@ -261,6 +280,11 @@ ToDevice::initialize(ErrorHandler *errh)
 void
 ToDevice::cleanup(CleanupStage)
 {
+#if TODEVICE_ALLOW_LINUX
+    for (int i = 0; i < _nbatch; i++)
+	_batch[i]->kill();
+    _nbatch = 0;
+#endif
 #if TODEVICE_ALLOW_PCAP
     if (_pcap && _my_pcap)
 	pcap_close(_pcap);
@@ -339,9 +363,85 @@ ToDevice::send_packet(Packet *p)
 	return errno ? -errno : -EINVAL;
 }
 
+void
+ToDevice::backoff()
+{
+    if (!_backoff) {
+	_backoff = 1;
+	add_select(_fd, SELECT_WRITE);
+    } else {
+	_timer.schedule_after(Timestamp::make_usec(_backoff));
+	if (_backoff < 256)
+	    _backoff *= 2;
+	if (_debug) {
+	    Timestamp now = Timestamp::now();
+	    click_chatter("%p{element} backing off for %d at %p{timestamp}\n", this, _backoff, &now);
+	}
+    }
+}
+
+#if TODEVICE_ALLOW_LINUX
+bool
+ToDevice::run_batch()
+{
+    // top up the packets left over by a partial send
+    while (_nbatch < _burst) {
+	++_pulls;
+	Packet *p = input(0).pull();
+	if (!p)
+	    break;
+	_batch[_nbatch++] = p;
+    }
+    if (!_nbatch) {
+	if (_signal)
+	    _task.fast_reschedule();
+	return false;
+    }
+
+    for (int i = 0; i < _nbatch; i++) {
+	_iov[i].iov_base = (void *) _batch[i]->data();
+	_iov[i].iov_len = _batch[i]->length();
+    }
+
+    // sendmmsg() fails only if the first packet could not be sent, an
+    // error on a later one is reported by the next call
+    int r = sendmmsg(_fd, _msgs, _nbatch, 0);
+    int err = (r < 0 ? errno : 0);
+    int sent = (r > 0 ? r : 0);
+
+    if (sent) {
+	_backoff = 0;
+	for (int i = 0; i < sent; i++)
+	    checked_output_push(0, _batch[i]);
+	_nbatch -= sent;
+	memmove(_batch, _batch + sent, _nbatch * sizeof(Packet *));
+    }
+
+    if (err == ENOBUFS || err == EAGAIN) {
+	backoff();
+	return false;
+    } else if (err) {
+	click_chatter("ToDevice(%s): %s", _ifname.c_str(), strerror(err));
+	Packet *p = _batch[0];
+	--_nbatch;
+	memmove(_batch, _batch + 1, _nbatch * sizeof(Packet *));
+	checked_output_push(1, p);
+    }
+
+    if (_nbatch || _signal)
+	_task.fast_reschedule();
+    return sent > 0;
+}
+#endif
+
 bool
 ToDevice::run_task(Task *)
 {
+#if TODEVICE_ALLOW_LINUX
+    if (_batch)
+	return run_batch();
+#endif
+
     Packet *p = _q;
     _q = 0;
     int count = 0, r = 0;
@@ -364,19 +464,7 @@ ToDevice::run_task(Task *)
     if (r == -ENOBUFS || r == -EAGAIN) {
 	assert(!_q);
 	_q = p;
-
-	if (!_backoff) {
-	    _backoff = 1;
-	    add_select(_fd, SELECT_WRITE);
-	} else {
-	    _timer.schedule_after(Timestamp::make_usec(_backoff));
-	    if (_backoff < 256)
-		_backoff *= 2;
-	    if (_debug) {
-		Timestamp now = Timestamp::now();
-		click_chatter("%p{element} backing off for %d at %p{timestamp}\n", this, _backoff, &now);
-	    }
-	}
+	backoff();
 	return count > 0;
     } else if (r < 0) {
 	click_chatter("ToDevice(%s): %s", _ifname.c_str(), strerror(-r));
@@ -408,6 +496,10 @@ ToDevice::read_param(Element *e, void *thunk)
     case h_pulls:
 	return String(td->_pulls);
     case h_q:
+#if TODEVICE_ALLOW_LINUX
+	if (td->_nbatch)
+	    return String(true);
+#endif
 	return String((bool) td->_q);
     default:
 	return String();
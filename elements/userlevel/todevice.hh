@@ -29,6 +29,9 @@ CLICK_DECLS
  * =item BURST
  *
  * Integer. Maximum number of packets to pull per scheduling. Defaults to 1.
+ * With METHOD LINUX and a BURST greater than 1, the packets pulled are
+ * sent with a single sendmmsg() call. Packets the kernel could not take
+ * yet are kept and sent first once the device has room again.
  *
  * =item METHOD
  *
@@ -67,6 +70,8 @@ CLICK_DECLS
 
 #if defined(__linux__)
 # define TODEVICE_ALLOW_LINUX 1
+struct mmsghdr;
+struct iovec;
 #endif
 #if HAVE_PCAP && (HAVE_PCAP_INJECT || HAVE_PCAP_SENDPACKET)
 extern "C" {
@@ -126,6 +131,14 @@ class ToDevice : public Element { public:
 
     Packet *_q;
     int _burst;
+#if TODEVICE_ALLOW_LINUX
+    // packets pulled for sendmmsg() and not sent yet
+    Packet **_batch;
+    int _nbatch;
+    struct mmsghdr *_msgs;
+    struct iovec *_iov;
+    bool run_batch();
+#endif
 
     bool _debug;
 #if TODEVICE_ALLOW_PCAP
@@ -140,6 +153,7 @@ class ToDevice : public Element { public:
     enum { h_debug, h_signal, h_pulls, h_q };
     FromDevice *find_fromdevice() const;
     int send_packet(Packet *p);
+    void backoff();
     static int write_param(const String &in_s, Element *e, void *vparam, ErrorHandler *errh) CLICK_COLD;
     static String read_param(Element *e, void *thunk) CLICK_COLD;
 
@@ -40,7 +40,7 @@ class Element { public:
     virtual bool run_task(Task *task);  // return true iff did useful work
     virtual void run_timer(Timer *timer);
 #if CLICK_USERLEVEL
-    enum { SELECT_READ = 1, SELECT_WRITE = 2 };
+    enum { SELECT_READ = 1, SELECT_WRITE = 2, SELECT_EDGE = 4 };
     virtual void selected(int fd, int mask);
     virtual void selected(int fd);
 #endif
@@ -251,6 +251,16 @@ class Element { public:
 
     };
 
+#if CLICK_STATS >= 2
+    // STATISTICS
+    unsigned xfer_calls() const                 { return _xfer_calls; }
+    click_cycles_t xfer_own_cycles() const      { return _xfer_own_cycles; }
+    unsigned task_calls() const                 { return _task_calls; }
+    click_cycles_t task_own_cycles() const      { return _task_own_cycles; }
+    unsigned timer_calls() const                { return _timer_calls; }
+    click_cycles_t timer_own_cycles() const     { return _timer_own_cycles; }
+#endif
+
     // DEPRECATED
     /** @cond never */
     String id() const CLICK_DEPRECATED;
@@ -134,4 +134,20 @@
 # endif
 #endif
 
+// bytes 44-45
+#define GSO_MTU_ANNO_OFFSET		44
+#define GSO_MTU_ANNO_SIZE		2
+#define GSO_MTU_ANNO(p)			((p)->anno_u16(GSO_MTU_ANNO_OFFSET))
+#define SET_GSO_MTU_ANNO(p, v)		((p)->set_anno_u16(GSO_MTU_ANNO_OFFSET, (v)))
+
+// bytes 44-47, received 802.11 frames: EmpowerRXStats header parse
+#define EMPOWER_WIFI_HDR_ANNO_OFFSET	44
+#define EMPOWER_WIFI_HDR_ANNO_SIZE	4
+
+// bytes 44-47, 802.11 frames to transmit: airtime charged at dequeue
+#define AIRTIME_ANNO_OFFSET		44
+#define AIRTIME_ANNO_SIZE		4
+#define AIRTIME_ANNO(p)			((p)->anno_u32(AIRTIME_ANNO_OFFSET))
+#define SET_AIRTIME_ANNO(p, v)		((p)->set_anno_u32(AIRTIME_ANNO_OFFSET, (v)))
+
 #endif
@@ -323,6 +323,15 @@ struct click_wifi_ht_info {
 #define WIFI_WME_APSD_MASK         	0x80
 #define WIFI_WME_APSD_SHIFT        	7
 
+/* WME Information Element, sent by stations */
+#define WIFI_WME_INFO_SUBTYPE			0
+
+/* WME QoS Info of a station, ACs it uses U-APSD for */
+#define WIFI_WME_QOSINFO_UAPSD_VO	0x01
+#define WIFI_WME_QOSINFO_UAPSD_VI	0x02
+#define WIFI_WME_QOSINFO_UAPSD_BK	0x04
+#define WIFI_WME_QOSINFO_UAPSD_BE	0x08
+
 struct edca_ac_param {
 	uint8_t   		aci;
 	uint8_t   		ecw;
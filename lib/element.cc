@@ -1714,7 +1714,8 @@ Element::selected(int fd)
 /** @brief Register interest in @a mask events on file descriptor @a fd.
  *
  * @param fd the file descriptor
- * @param mask relevant events: bitwise-or of one or more of SELECT_READ, SELECT_WRITE
+ * @param mask relevant events: bitwise-or of one or more of SELECT_READ,
+ * SELECT_WRITE, optionally with SELECT_EDGE
  *
  * Click will register interest in readability and/or writability on file
  * descriptor @a fd.  When @a fd is ready, Click will call this element's
@@ -1732,6 +1733,13 @@ Element::selected(int fd)
  * Otherwise, Click will constantly poll your element's selected(@a fd, @a
  * mask) method.
  *
+ * Or-ing SELECT_EDGE into @a mask asks for edge-triggered notification of
+ * the events added: where the underlying mechanism supports it (epoll,
+ * kqueue), selected() is called when @a fd becomes ready rather than as
+ * long as it stays ready.  Only elements that read or write @a fd until it
+ * returns EAGAIN on every selected() call may do so; other mechanisms
+ * ignore the flag, which is always safe for such elements.
+ *
  * @sa remove_select, selected
  */
 int
@@ -118,6 +118,7 @@ static const StaticNameDB::Entry annotation_entries[] = {
     { "FIX_IP_SRC", MKAI(FIX_IP_SRC) },
     { "FWD_RATE", MKAI(FWD_RATE) },
     { "GRID_ROUTE_CB", MKAI(GRID_ROUTE_CB) },
+    { "GSO_MTU", MKAI(GSO_MTU) },
     { "ICMP_PARAMPROB", MKAI(ICMP_PARAMPROB) },
     { "IPREASSEMBLER", MKAI(IPREASSEMBLER) },
 #ifdef IPSEC_SA_DATA_REFERENCE_ANNO_OFFSET
@@ -33,10 +33,14 @@
 #  define EV_SET_UDATA_CAST	/* nothing */
 # endif
 #endif
+#if HAVE_ALLOW_EPOLL
+# include <sys/epoll.h>
+#endif
 CLICK_DECLS
 
 namespace {
-enum { SELECT_READ = Element::SELECT_READ, SELECT_WRITE = Element::SELECT_WRITE };
+enum { SELECT_READ = Element::SELECT_READ, SELECT_WRITE = Element::SELECT_WRITE,
+       SELECT_EDGE = Element::SELECT_EDGE };
 #if !HAVE_ALLOW_POLL
 enum { POLLIN = Element::SELECT_READ, POLLOUT = Element::SELECT_WRITE };
 #endif
@@ -58,6 +62,15 @@ SelectSet::SelectSet()
 # endif
 #endif
 
+#if HAVE_ALLOW_EPOLL
+# if HAVE_ALLOW_KQUEUE
+    if (_kqueue >= 0)
+	_epoll = -1;
+    else
+# endif
+	_epoll = epoll_create1(EPOLL_CLOEXEC);
+#endif
+
 #if !HAVE_ALLOW_POLL
     FD_ZERO(&_read_select_fd_set);
     FD_ZERO(&_write_select_fd_set);
@@ -85,6 +98,10 @@ SelectSet::~SelectSet()
 #if HAVE_ALLOW_KQUEUE
     if (_kqueue >= 0)
 	close(_kqueue);
+#endif
+#if HAVE_ALLOW_EPOLL
+    if (_epoll >= 0)
+	close(_epoll);
 #endif
     if (_wake_pipe[0] >= 0) {
 	close(_wake_pipe[0]);
@@ -100,7 +117,7 @@ SelectSet::initialize()
 	fcntl(_wake_pipe[1], F_SETFL, O_NONBLOCK);
 	fcntl(_wake_pipe[0], F_SETFD, FD_CLOEXEC);
 	fcntl(_wake_pipe[1], F_SETFD, FD_CLOEXEC);
-	register_select(_wake_pipe[0], true, false);
+	register_select(_wake_pipe[0], true, false, false);
     }
     assert(_wake_pipe[0] >= 0);
 }
@@ -126,7 +143,7 @@ SelectSet::kill_router(Router *router)
 }
 
 void
-SelectSet::register_select(int fd, bool add_read, bool add_write)
+SelectSet::register_select(int fd, bool add_read, bool add_write, bool edge)
 {
     // add the pollfd
     if (fd >= _selinfo.size())
@@ -138,24 +155,30 @@ SelectSet::register_select(int fd, bool add_read, bool add_write)
 	_pollfds.back().events = 0;
     }
     int pi = _selinfo[fd].pollfd;
+#if HAVE_ALLOW_EPOLL
+    int old_events = _pollfds[pi].events;
+#endif
 
     // add the elements
     if (add_read)
 	_pollfds[pi].events |= POLLIN;
     if (add_write)
 	_pollfds[pi].events |= POLLOUT;
+    if (edge)
+	_selinfo[fd].edge |= (add_read ? POLLIN : 0) | (add_write ? POLLOUT : 0);
 
 #if HAVE_ALLOW_KQUEUE
     if (_kqueue >= 0) {
 	// Add events to the kqueue
 	struct kevent kev[2];
 	int nkev = 0;
+	int flags = EV_ADD | (edge ? EV_CLEAR : 0);
 	if (add_read) {
-	    EV_SET(&kev[nkev], fd, EVFILT_READ, EV_ADD, 0, 0, EV_SET_UDATA_CAST ((intptr_t) 0));
+	    EV_SET(&kev[nkev], fd, EVFILT_READ, flags, 0, 0, EV_SET_UDATA_CAST ((intptr_t) 0));
 	    nkev++;
 	}
 	if (add_write) {
-	    EV_SET(&kev[nkev], fd, EVFILT_WRITE, EV_ADD, 0, 0, EV_SET_UDATA_CAST ((intptr_t) 0));
+	    EV_SET(&kev[nkev], fd, EVFILT_WRITE, flags, 0, 0, EV_SET_UDATA_CAST ((intptr_t) 0));
 	    nkev++;
 	}
 	int r = kevent(_kqueue, &kev[0], nkev, 0, 0, 0);
@@ -167,6 +190,10 @@ SelectSet::register_select(int fd, bool add_read, bool add_write)
 	}
     }
 #endif
+#if HAVE_ALLOW_EPOLL
+    if (_epoll >= 0)
+	update_epoll(fd, old_events, _pollfds[pi].events);
+#endif
 
 #if !HAVE_ALLOW_POLL
     // Add 'mask' to the fd_sets
@@ -201,7 +228,7 @@ SelectSet::add_select(int fd, Element *element, int mask)
 	return -1;
     if (mask == 0)
 	return 0;
-    assert(element && (mask & ~(SELECT_READ | SELECT_WRITE)) == 0);
+    assert(element && (mask & ~(SELECT_READ | SELECT_WRITE | SELECT_EDGE)) == 0);
     lock();
 
     // check whether to add readability, writability, or both; it is an error
@@ -228,7 +255,7 @@ SelectSet::add_select(int fd, Element *element, int mask)
     }
 
     // add the pollfd
-    register_select(fd, add_read, add_write);
+    register_select(fd, add_read, add_write, mask & SELECT_EDGE);
 
     // add the elements
     if (add_read)
@@ -252,7 +279,11 @@ SelectSet::remove_pollfd(int pi, int event)
 
     // remove event
     int fd = _pollfds[pi].fd;
+#if HAVE_ALLOW_EPOLL
+    int old_events = _pollfds[pi].events;
+#endif
     _pollfds[pi].events &= ~event;
+    _selinfo[fd].edge &= ~event;
     if (event == POLLIN)
 	_selinfo[fd].read = 0;
     else
@@ -268,6 +299,11 @@ SelectSet::remove_pollfd(int pi, int event)
 	    click_chatter("SelectSet::remove_pollfd(fd %d): kevent: %s", _pollfds[pi].fd, strerror(errno));
     }
 #endif
+#if HAVE_ALLOW_EPOLL
+    // remove event from epoll
+    if (_epoll >= 0)
+	update_epoll(fd, old_events, _pollfds[pi].events);
+#endif
 #if !HAVE_ALLOW_POLL
     // remove event from select list
     if (fd < FD_SETSIZE) {
@@ -302,7 +338,7 @@ SelectSet::remove_select(int fd, Element *element, int mask)
 {
     if (fd < 0)
 	return -1;
-    assert(element && (mask & ~(SELECT_READ | SELECT_WRITE)) == 0);
+    assert(element && (mask & ~(SELECT_READ | SELECT_WRITE | SELECT_EDGE)) == 0);
     lock();
 
     bool remove_read = false, remove_write = false;
@@ -424,6 +460,106 @@ SelectSet::run_selects_kqueue(RouterThread *thread)
 }
 #endif /* HAVE_ALLOW_KQUEUE */
 
+#if HAVE_ALLOW_EPOLL
+void
+SelectSet::update_epoll(int fd, int old_events, int events)
+{
+    // epoll keeps one registration per fd, covering both directions; it
+    // is edge-triggered only if every registered direction asked for it
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (events & POLLIN)
+	ev.events |= EPOLLIN;
+    if (events & POLLOUT)
+	ev.events |= EPOLLOUT;
+    if (events && (_selinfo[fd].edge & events) == events)
+	ev.events |= EPOLLET;
+
+    int op = !old_events ? EPOLL_CTL_ADD : (events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL);
+    int r = epoll_ctl(_epoll, op, fd, &ev);
+    // A closed fd leaves the epoll set by itself, and its number may have
+    // been reused since.
+    if (r < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+	r = epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+    else if (r < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+	r = epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
+    if (r < 0 && op == EPOLL_CTL_DEL) {
+	if (errno != ENOENT && errno != EBADF)
+	    click_chatter("SelectSet::remove_pollfd(fd %d): epoll_ctl: %s", fd, strerror(errno));
+    } else if (r < 0) {
+	// Not all file descriptors are epollable, regular files for
+	// instance.  So if we encounter a problem, fall back to select() or
+	// poll(), which keep working off _pollfds.
+	close(_epoll);
+	_epoll = -1;
+    }
+}
+
+void
+SelectSet::run_selects_epoll(RouterThread *thread)
+{
+# if HAVE_MULTITHREAD
+    click_fence();
+    _select_lock.release();
+# endif
+
+    // Decide how long to wait.
+    Timestamp t;
+    int delay_type = thread->timer_set().next_timer_delay(thread->active(), t);
+    thread->set_thread_state_for_blocking(delay_type);
+
+    // The cost of epoll_wait() depends on the ready fds only, so idle fds
+    // cost nothing however often we are called.
+    struct epoll_event ev[256];
+    int n = -1;
+# if HAVE_EPOLL_PWAIT2
+    // A millisecond timeout rounds a sub-millisecond timer delay down to
+    // zero, which would spin until the timer fires.
+    static bool have_pwait2 = true;
+    if (have_pwait2) {
+	struct timespec wait, *wait_ptr = &wait;
+	if (delay_type == 0)
+	    wait.tv_sec = wait.tv_nsec = 0;
+	else if (delay_type > 0)
+	    wait = t.timespec();
+	else
+	    wait_ptr = 0;
+	n = epoll_pwait2(_epoll, &ev[0], 256, wait_ptr, 0);
+	if (n < 0 && errno == ENOSYS)
+	    have_pwait2 = false;
+    }
+    if (!have_pwait2)
+# endif
+    {
+	int timeout;
+	if (delay_type == 0)
+	    timeout = 0;
+	else if (delay_type > 0)
+	    timeout = (t.sec() >= INT_MAX / 1000 ? INT_MAX - 1000 : t.msecval());
+	else
+	    timeout = -1;
+	n = epoll_wait(_epoll, &ev[0], 256, timeout);
+    }
+    int was_errno = errno;
+
+    if (post_select(thread, true))
+	return;
+
+    thread->set_thread_state(RouterThread::S_RUNSELECT);
+    if (n < 0 && was_errno != EINTR)
+	perror("epoll_wait");
+    else
+	// Each fd is reported once, so there is nothing to merge.
+	// call_selected() skips fds whose elements went away meanwhile.
+	for (int i = 0; i < n; ++i) {
+	    int mask = (ev[i].events & ~EPOLLOUT ? Element::SELECT_READ : 0)
+		+ (ev[i].events & ~EPOLLIN ? Element::SELECT_WRITE : 0);
+	    call_selected(ev[i].data.fd, mask);
+	}
+}
+#endif /* HAVE_ALLOW_EPOLL */
+
 #if HAVE_ALLOW_POLL
 void
 SelectSet::run_selects_poll(RouterThread *thread)
@@ -577,6 +713,12 @@ SelectSet::run_selects(RouterThread *thread)
 	    break;
 	}
 #endif
+#if HAVE_ALLOW_EPOLL
+	if (_epoll >= 0) {
+	    run_selects_epoll(thread);
+	    break;
+	}
+#endif
 #if HAVE_ALLOW_POLL
 	run_selects_poll(thread);
 #else